@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "deadline/deadline.h"
+#include "peer/peer.h"
+#include "torrent/torrent_data.h"
+#include "net_utils/net_utils.h"
+#include "message_ring/message_ring.h"
+
+#define BENCH_CLOCK_CALLS 1000000
+#define BENCH_CLOCK_MESSAGES 160000
+
+/* clock reads are counted by wrapping the libc functions, see the bench rule in the Makefile */
+static _Atomic uint64_t bench_clock_reads = 0;
+
+int __real_clock_gettime(clockid_t clock_id, struct timespec * tp);
+int __wrap_clock_gettime(clockid_t clock_id, struct timespec * tp) {
+    bench_clock_reads++;
+    return __real_clock_gettime(clock_id, tp);
+}
+
+int __real_gettimeofday(struct timeval * tv, void * tz);
+int __wrap_gettimeofday(struct timeval * tv, void * tz) {
+    bench_clock_reads++;
+    return __real_gettimeofday(tv, tz);
+}
+
+static int64_t bench_clock_call(clockid_t clock_id) {
+    struct timespec ts;
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_CLOCK_CALLS; i++) {
+        clock_gettime(clock_id, &ts);
+    }
+    return bench_now_ns() - start;
+}
+
+struct BenchClockLoop {
+    int cached; // 1 to call now_update each round like the reactors do, 0 for every now_cached to read the clock
+    int batch; // messages handled per round
+    double reads_per_message;
+};
+
+/**
+ * @brief run a connected peer the way a reactor does, batch HAVE messages arriving between each run
+ */
+static void * bench_clock_loop(void * args) {
+    struct BenchClockLoop * loop = (struct BenchClockLoop *) args;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    size_t chunk_size = 16384;
+    int piece_count = 64;
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_bench_clock", chunk_size * piece_count);
+    torrent_data_set_piece_size(td, chunk_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_data_size(td, chunk_size * piece_count);
+
+    struct TorrentData * metadata = torrent_data_new("/tmp/");
+    struct MessageRing * metadata_queue = message_ring_new(64);
+    struct MessageRing * data_queue = message_ring_new(64);
+
+    struct Peer * p = peer_new(2130706433, 5000);
+    p->socket = buffered_socket_new((struct sockaddr *) &p->addr);
+    buffered_socket_set_socket_fd(p->socket, fds[0]);
+    p->status = PEER_HANDSHAKE_COMPLETE;
+
+    _Atomic int cancel_flag = 0;
+    int8_t info_hash[20] = {0};
+    struct PEER_MSG_HAVE * msgs = malloc(sizeof(struct PEER_MSG_HAVE) * loop->batch);
+    uint8_t sink[4096];
+
+    uint64_t reads = 0;
+    for (int round = 0; round < BENCH_CLOCK_MESSAGES / loop->batch; round++) {
+        for (int i = 0; i < loop->batch; i++) {
+            msgs[i].length = net_utils.htonl((uint32_t) sizeof(struct PEER_MSG_HAVE) - sizeof(uint32_t));
+            msgs[i].msg_id = MSG_HAVE;
+            msgs[i].piece_id = net_utils.htonl((uint32_t) ((round * loop->batch + i) % piece_count));
+        }
+        write(fds[1], msgs, sizeof(struct PEER_MSG_HAVE) * loop->batch);
+
+        uint64_t start_reads = bench_clock_reads;
+        p->socket->readable = 1;
+        if (loop->cached == 1) {
+            now_update();
+        }
+        peer_run(p, info_hash, metadata, td, metadata_queue, data_queue, &cancel_flag);
+        reads += bench_clock_reads - start_reads;
+
+        // throw away whatever the peer sent back
+        while (recv(fds[1], sink, sizeof(sink), MSG_DONTWAIT) > 0);
+    }
+    loop->reads_per_message = (double) reads / BENCH_CLOCK_MESSAGES;
+
+    free(msgs);
+    peer_free(p);
+    torrent_data_free(td);
+    torrent_data_free(metadata);
+    message_ring_free(metadata_queue);
+    message_ring_free(data_queue);
+    close(fds[1]);
+    unlink("/tmp/uvgtorrent_bench_clock");
+    return NULL;
+}
+
+/**
+ * @brief the cost of reading each clock, and how many times the clock is read per message a peer handles. "uncached"
+ *        runs the peer on a thread that never calls now_update, so every now_cached reads the clock the way every
+ *        now() used to
+ */
+static void bench_clock() {
+    printf("clock read cost, %i calls\n", BENCH_CLOCK_CALLS);
+    printf("%26s %10s\n", "clock", "ns/call");
+
+    struct timeval tv;
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_CLOCK_CALLS; i++) {
+        gettimeofday(&tv, NULL);
+    }
+    printf("%26s %10.1f\n", "gettimeofday", (double) (bench_now_ns() - start) / BENCH_CLOCK_CALLS);
+    printf("%26s %10.1f\n", "CLOCK_MONOTONIC", (double) bench_clock_call(CLOCK_MONOTONIC) / BENCH_CLOCK_CALLS);
+    printf("%26s %10.1f\n", "CLOCK_MONOTONIC_COARSE", (double) bench_clock_call(CLOCK_MONOTONIC_COARSE) / BENCH_CLOCK_CALLS);
+
+    now_update();
+    start = bench_now_ns();
+    int64_t sum = 0;
+    for (int i = 0; i < BENCH_CLOCK_CALLS; i++) {
+        sum += now_cached();
+    }
+    printf("%26s %10.1f\n", "now_cached", (double) (bench_now_ns() - start) / BENCH_CLOCK_CALLS);
+    (void) sum;
+
+    printf("clock reads per peer message, %i HAVE messages\n", BENCH_CLOCK_MESSAGES);
+    printf("%16s %12s %12s\n", "messages/run", "uncached", "cached");
+    int batches[3] = {1, 16, 256};
+    for (int i = 0; i < 3; i++) {
+        struct BenchClockLoop uncached = {.cached = 0, .batch = batches[i]};
+        struct BenchClockLoop cached = {.cached = 1, .batch = batches[i]};
+
+        // a fresh thread each, so the uncached one has never called now_update
+        pthread_t thread;
+        pthread_create(&thread, NULL, &bench_clock_loop, &uncached);
+        pthread_join(thread, NULL);
+        pthread_create(&thread, NULL, &bench_clock_loop, &cached);
+        pthread_join(thread, NULL);
+
+        printf("%16i %12.2f %12.2f\n", batches[i], uncached.reads_per_message, cached.reads_per_message);
+    }
+}
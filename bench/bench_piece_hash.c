@@ -0,0 +1,73 @@
+#include <string.h>
+#include <unistd.h>
+#include "torrent/torrent_data.h"
+#include "sha1/sha1.h"
+
+#define BENCH_PIECE_HASH_ROUNDS 5
+
+/**
+ * @brief time how long completing a piece takes, for piece sizes from 256 KiB to 16 MiB.
+ *
+ *        "full hash" is one SHA-1 pass over the whole piece, which is what completing a piece used to cost on top of
+ *        writing it's last chunk. "last chunk" is the time torrent_data_write_chunk takes for the chunk that completes
+ *        the piece, with chunks arriving in order. mapped storage is used so disk writes stay out of the numbers.
+ */
+static void bench_piece_hash() {
+    size_t chunk_size = 16384;
+
+    printf("piece completion latency, %i rounds\n", BENCH_PIECE_HASH_ROUNDS);
+    printf("%12s %16s %16s\n", "piece size", "full hash (us)", "last chunk (us)");
+
+    for (size_t piece_size = 256 * 1024; piece_size <= 16 * 1024 * 1024; piece_size *= 4) {
+        uint8_t * data = malloc(piece_size);
+        for (size_t i = 0; i < piece_size; i++) {
+            data[i] = (uint8_t) (i * 31);
+        }
+
+        int64_t full_ns = 0;
+        int64_t last_chunk_ns = 0;
+
+        for (int round = 0; round < BENCH_PIECE_HASH_ROUNDS; round++) {
+            char hash[20];
+            SHA1_CTX sha;
+
+            int64_t start = bench_now_ns();
+            SHA1Init(&sha);
+            SHA1Update(&sha, data, piece_size);
+            SHA1Final((unsigned char *) &hash, &sha);
+            full_ns += bench_now_ns() - start;
+
+            unlink("/tmp/uvgtorrent_bench");
+            struct TorrentData * td = torrent_data_new("/tmp/");
+            torrent_data_set_storage(td, TORRENT_DATA_STORAGE_MMAP);
+            torrent_data_add_file(td, "uvgtorrent_bench", piece_size);
+            torrent_data_set_piece_size(td, piece_size);
+            torrent_data_set_chunk_size(td, chunk_size);
+            torrent_data_set_sha1_hashes(td, (char *) &hash, sizeof(hash));
+            torrent_data_set_data_size(td, piece_size);
+
+            int chunk_count = (int) (piece_size / chunk_size);
+            for (int i = 0; i < chunk_count - 1; i++) {
+                torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size);
+            }
+
+            start = bench_now_ns();
+            int result = torrent_data_write_chunk(td, chunk_count - 1, data + ((chunk_count - 1) * chunk_size), chunk_size);
+            last_chunk_ns += bench_now_ns() - start;
+
+            if (result != EXIT_SUCCESS) {
+                printf("piece failed to validate\n");
+            }
+
+            torrent_data_free(td);
+        }
+
+        printf("%9zu KiB %16.1f %16.1f\n", piece_size / 1024,
+               (double) full_ns / BENCH_PIECE_HASH_ROUNDS / 1000,
+               (double) last_chunk_ns / BENCH_PIECE_HASH_ROUNDS / 1000);
+
+        free(data);
+    }
+
+    unlink("/tmp/uvgtorrent_bench");
+}
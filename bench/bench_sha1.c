@@ -0,0 +1,60 @@
+#include "sha1/sha1.h"
+
+#define BENCH_SHA1_SIZE (64 * 1024 * 1024)
+#define BENCH_SHA1_LANES 8
+
+/**
+ * @brief SHA-1 throughput of every implementation the cpu supports.
+ *
+ *        "single" hashes one 64 MiB buffer with SHA1Update. "multi" hashes 8 buffers of 8 MiB at once with
+ *        SHA1MultiUpdate, the way whole pieces are verified in batches, and reports the combined throughput.
+ */
+static void bench_sha1() {
+    unsigned char * data = malloc(BENCH_SHA1_SIZE);
+    for (size_t i = 0; i < BENCH_SHA1_SIZE; i++) {
+        data[i] = (unsigned char) (i * 31);
+    }
+
+    printf("sha1 throughput\n");
+    printf("%12s %14s %14s\n", "impl", "single (GB/s)", "multi (GB/s)");
+
+    for (int impl = SHA1_IMPL_AUTO; impl <= SHA1_IMPL_AVX2; impl++) {
+        if (SHA1UseImplementation(impl) == EXIT_FAILURE) {
+            printf("%12s %14s %14s\n", SHA1ImplementationName(impl), "-", "-");
+            continue;
+        }
+
+        SHA1_CTX ctx;
+        unsigned char digest[20];
+
+        int64_t start = bench_now_ns();
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, data, BENCH_SHA1_SIZE);
+        SHA1Final(digest, &ctx);
+        int64_t single_ns = bench_now_ns() - start;
+
+        SHA1_CTX contexts[BENCH_SHA1_LANES];
+        SHA1_CTX * context_ptrs[BENCH_SHA1_LANES];
+        const unsigned char * lanes[BENCH_SHA1_LANES];
+        for (int i = 0; i < BENCH_SHA1_LANES; i++) {
+            context_ptrs[i] = &contexts[i];
+            lanes[i] = data + (i * (BENCH_SHA1_SIZE / BENCH_SHA1_LANES));
+        }
+
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_SHA1_LANES; i++) {
+            SHA1Init(&contexts[i]);
+        }
+        SHA1MultiUpdate(context_ptrs, lanes, BENCH_SHA1_SIZE / BENCH_SHA1_LANES, BENCH_SHA1_LANES);
+        for (int i = 0; i < BENCH_SHA1_LANES; i++) {
+            SHA1Final(digest, &contexts[i]);
+        }
+        int64_t multi_ns = bench_now_ns() - start;
+
+        printf("%12s %14.2f %14.2f\n", SHA1ImplementationName(impl),
+               (double) BENCH_SHA1_SIZE / single_ns, (double) BENCH_SHA1_SIZE / multi_ns);
+    }
+
+    SHA1UseImplementation(SHA1_IMPL_AUTO);
+    free(data);
+}
@@ -0,0 +1,155 @@
+#include <sched.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include "thread_pool/thread_pool.h"
+#include "thread_pool/queue.h"
+
+#define BENCH_THREAD_POOL_JOBS 200000
+#define BENCH_THREAD_POOL_CHILDREN 100 // jobs each spawning job adds from inside the pool
+
+/**
+ * the thread pool as it was before work stealing: one mutex protected queue that mallocs a node per job, and a
+ * semaphore posted for every job. kept here to compare against
+ */
+struct BenchLockedPool {
+    _Atomic int cancel_flag;
+    int thread_count;
+    sem_t job_semaphore;
+    struct Queue * job_queue;
+    pthread_t threads[64];
+};
+
+static void * bench_locked_pool_handle(void * args) {
+    struct BenchLockedPool * tp = (struct BenchLockedPool *) args;
+    while (tp->cancel_flag != 1) {
+        sem_wait(&tp->job_semaphore);
+        if (queue_get_count(tp->job_queue) > 0) {
+            struct Job * j = (struct Job *) queue_pop(tp->job_queue);
+            if (j) {
+                job_execute(j, &tp->cancel_flag);
+                job_free(j);
+            }
+        }
+    }
+    return NULL;
+}
+
+static struct BenchLockedPool * bench_locked_pool = NULL;
+static struct ThreadPool * bench_pool = NULL;
+
+static void bench_add_job(struct Job * j) {
+    if (bench_locked_pool != NULL) {
+        queue_push(bench_locked_pool->job_queue, j);
+        sem_post(&bench_locked_pool->job_semaphore);
+    } else {
+        // the injection queue is bounded, wait for the workers to catch up
+        while (thread_pool_add_job(bench_pool, j) == EXIT_FAILURE) {
+            sched_yield();
+        }
+    }
+}
+
+static int bench_thread_pool_count(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+    struct JobArg counter_arg = va_arg(args, struct JobArg);
+    va_end(args);
+
+    atomic_fetch_add((_Atomic int *) counter_arg.arg, 1);
+    return EXIT_SUCCESS;
+}
+
+static int bench_thread_pool_spawn(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+    struct JobArg counter_arg = va_arg(args, struct JobArg);
+    va_end(args);
+
+    for (int i = 0; i < BENCH_THREAD_POOL_CHILDREN; i++) {
+        bench_add_job(job_new(&bench_thread_pool_count, 1, &counter_arg));
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief run one round of jobs, returns the time it took in nanoseconds
+ * @param spawn 0 to add every job from this thread, 1 to add jobs that each add BENCH_THREAD_POOL_CHILDREN more
+ */
+static int64_t bench_thread_pool_round(int locked, int threads, int spawn) {
+    _Atomic int counter = 0;
+    struct JobArg counter_arg = {.arg = (void *) &counter, .mutex = NULL};
+
+    if (locked == 1) {
+        bench_locked_pool = malloc(sizeof(struct BenchLockedPool));
+        bench_locked_pool->cancel_flag = 0;
+        bench_locked_pool->thread_count = threads;
+        sem_init(&bench_locked_pool->job_semaphore, 0, 0);
+        bench_locked_pool->job_queue = queue_new();
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&bench_locked_pool->threads[i], NULL, &bench_locked_pool_handle, bench_locked_pool);
+        }
+    } else {
+        bench_pool = thread_pool_new(threads);
+    }
+
+    int64_t start = bench_now_ns();
+    if (spawn == 1) {
+        for (int i = 0; i < BENCH_THREAD_POOL_JOBS / BENCH_THREAD_POOL_CHILDREN; i++) {
+            bench_add_job(job_new(&bench_thread_pool_spawn, 1, &counter_arg));
+        }
+    } else {
+        for (int i = 0; i < BENCH_THREAD_POOL_JOBS; i++) {
+            bench_add_job(job_new(&bench_thread_pool_count, 1, &counter_arg));
+        }
+    }
+    while (counter < BENCH_THREAD_POOL_JOBS) {
+        sched_yield();
+    }
+    int64_t elapsed_ns = bench_now_ns() - start;
+
+    if (locked == 1) {
+        bench_locked_pool->cancel_flag = 1;
+        for (int i = 0; i < threads; i++) {
+            sem_post(&bench_locked_pool->job_semaphore);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(bench_locked_pool->threads[i], NULL);
+        }
+        while (queue_get_count(bench_locked_pool->job_queue) > 0) {
+            job_free(queue_pop(bench_locked_pool->job_queue));
+        }
+        queue_free(bench_locked_pool->job_queue);
+        sem_destroy(&bench_locked_pool->job_semaphore);
+        free(bench_locked_pool);
+        bench_locked_pool = NULL;
+    } else {
+        bench_pool = thread_pool_free(bench_pool);
+    }
+
+    return elapsed_ns;
+}
+
+/**
+ * @brief jobs per second through the thread pool, against the mutex and semaphore pool it replaced.
+ *
+ *        every job only bumps a counter, so the numbers are the cost of scheduling. "submit" adds every job from the
+ *        benchmark thread. "spawn" adds jobs that each add BENCH_THREAD_POOL_CHILDREN more from inside the pool, which
+ *        is where the per worker deques and stealing come in.
+ */
+static void bench_thread_pool() {
+    printf("thread pool throughput, %i jobs\n", BENCH_THREAD_POOL_JOBS);
+    printf("%8s %18s %18s %18s %18s\n", "threads", "submit locked", "submit stealing", "spawn locked", "spawn stealing");
+
+    int thread_counts[] = {1, 4, 16, 64};
+    for (int i = 0; i < 4; i++) {
+        int threads = thread_counts[i];
+        printf("%8i", threads);
+        for (int spawn = 0; spawn <= 1; spawn++) {
+            for (int locked = 1; locked >= 0; locked--) {
+                int64_t elapsed_ns = bench_thread_pool_round(locked, threads, spawn);
+                printf(" %12.2f Mjob/s", (double) BENCH_THREAD_POOL_JOBS / ((double) elapsed_ns / 1000));
+            }
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * @file bench/main.c
+ *
+ * @brief runs the benchmarks. build and run them with make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "log.h"
+
+/**
+ * @brief current time in nanoseconds, for timing benchmarks
+ */
+static int64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* include here your files that contain benchmarks */
+#include "bench_clock.c"
+#include "bench_piece_hash.c"
+#include "bench_sha1.c"
+#include "bench_thread_pool.c"
+
+int main(void) {
+    log_set_level(LOG_ERROR);
+
+    bench_sha1();
+    bench_piece_hash();
+    bench_thread_pool();
+    bench_clock();
+
+    return EXIT_SUCCESS;
+}
@@ -23,6 +23,7 @@
 #include "../messages/messages.h"
 #include "args.h"
 #include "../colors.h"
+#include "../piece_picker/piece_picker.h"
 
 
 /*
@@ -33,6 +34,14 @@ static void set_default_options(options_t *options) {
     memset(options->path, '\0', sizeof(options->path));
     options->port = 5000;
     options->debug = 0;
+    options->max_open_files = 0;
+    options->mmap_storage = 0;
+    options->piece_memory = 0;
+    options->piece_picker = PIECE_PICKER_SEQUENTIAL;
+    options->stream_window = 0;
+    options->stream_piece_ms = 0;
+    options->http_port = 0;
+    options->http_remote = 0;
 }
 
 
@@ -59,6 +68,55 @@ switch_options(int arg, options_t *options) {
 
         case 'd':
             options->debug = 1;
+            break;
+
+        case 'f':
+            options->max_open_files = atoi(optarg);
+            break;
+
+        case 's':
+            if (strcmp(optarg, "mmap") == 0) {
+                options->mmap_storage = 1;
+            } else if (strcmp(optarg, "file") == 0) {
+                options->mmap_storage = 0;
+            } else {
+                help();
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'b':
+            options->piece_memory = atoi(optarg);
+            break;
+
+        case 'k':
+            if (strcmp(optarg, "sequential") == 0) {
+                options->piece_picker = PIECE_PICKER_SEQUENTIAL;
+            } else if (strcmp(optarg, "window") == 0) {
+                options->piece_picker = PIECE_PICKER_SEQUENTIAL_WINDOW;
+            } else if (strcmp(optarg, "rarest") == 0) {
+                options->piece_picker = PIECE_PICKER_RAREST_FIRST;
+            } else {
+                help();
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'w':
+            options->stream_window = atoi(optarg);
+            break;
+
+        case 'e':
+            options->stream_piece_ms = atoi(optarg);
+            break;
+
+        case 't':
+            options->http_port = (uint16_t) atoi(optarg);
+            break;
+
+        case 'r':
+            options->http_remote = 1;
+            break;
     }
 }
 
@@ -80,13 +138,22 @@ options_parser(int argc, char *argv[], options_t *options) {
                     {"path",       required_argument, NULL, 'p'},
                     {"port",       required_argument, 0,    'o'},
                     {"debug",      no_argument,       0,    'd'},
+                    {"max_open_files", required_argument, 0, 'f'},
+                    {"storage",    required_argument, 0,    's'},
+                    {"piece_memory", required_argument, 0,  'b'},
+                    {"picker",     required_argument, 0,    'k'},
+                    {"stream",     required_argument, 0,    'w'},
+                    {"stream_deadline", required_argument, 0, 'e'},
+                    {"http_port",  required_argument, 0,    't'},
+                    {"http_remote", no_argument,      0,    'r'},
+                    {0,            0,                 0,    0}
 
             };
 
     while (true) {
 
         int option_index = 0;
-        arg = getopt_long(argc, argv, "hm:p:o:d", long_options, &option_index);
+        arg = getopt_long(argc, argv, "hm:p:o:df:s:b:k:w:e:t:r", long_options, &option_index);
 
         /* End of the options? */
         if (arg == -1) break;
@@ -34,6 +34,14 @@ struct options {
     char path[MAX_ARG_LENGTH];
     uint16_t port;
     int debug;
+    int max_open_files; // 0 keeps the torrent_data default
+    int mmap_storage; // store torrent data in mapped files instead of assembling pieces in memory
+    int piece_memory; // megabytes for buffering in flight pieces, 0 keeps the torrent_data default
+    int piece_picker; // enum PiecePickerPolicy used to pick pieces to request
+    int stream_window; // pieces past the read cursor with deadlines, 0 when not streaming
+    int stream_piece_ms; // time between the deadlines of consecutive pieces, 0 keeps the torrent_data default
+    uint16_t http_port; // port to serve the torrents files over http on, 0 to not serve them
+    int http_remote; // serve http on every interface instead of only loopback
 };
 
 
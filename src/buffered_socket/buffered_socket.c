@@ -3,9 +3,12 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <poll.h>
 #include <inttypes.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include "buffered_socket.h"
 #include "../log.h"
@@ -21,16 +24,23 @@ struct BufferedSocket * buffered_socket_new(struct sockaddr * addr) {
 
     buffered_socket->socket = -1;
     buffered_socket->opt = 0;
+    buffered_socket->registered = 0;
+    buffered_socket->readable = 0;
+    buffered_socket->writable = 0;
+    buffered_socket->hungup = 0;
     buffered_socket->write_buffer_head = NULL;
     buffered_socket->write_buffer_tail = NULL;
+    buffered_socket->sending_tag = 0;
     buffered_socket->read_buffer = NULL;
+    buffered_socket->read_buffer_offset = 0;
     buffered_socket->read_buffer_size = 0;
+    buffered_socket->read_buffer_capacity = 0;
     buffered_socket->addr = addr;
 
     buffered_socket->download_rate = 0.00;
-    buffered_socket->last_download_rate_update = now();
+    buffered_socket->last_download_rate_update = now_cached();
     buffered_socket->upload_rate = 0.00;
-    buffered_socket->last_upload_rate_update = now();
+    buffered_socket->last_upload_rate_update = now_cached();
 
     return buffered_socket;
 
@@ -81,16 +91,7 @@ int buffered_socket_connect(struct BufferedSocket * buffered_socket) {
 int buffered_socket_can_write(struct BufferedSocket * buffered_socket) {
     if(buffered_socket != NULL) {
         if (buffered_socket->socket != -1) {
-            struct pollfd poll_set[1];
-            memset(poll_set, 0x00, sizeof(poll_set));
-            poll_set[0].fd = buffered_socket->socket;
-            poll_set[0].events = POLLOUT;
-
-            poll(poll_set, 1, 0);
-
-            if (poll_set[0].revents & POLLOUT) {
-                return 1;
-            }
+            return buffered_socket->writable;
         }
     }
 
@@ -109,17 +110,7 @@ int buffered_socket_can_network_write(struct BufferedSocket * buffered_socket) {
 int buffered_socket_can_network_read(struct BufferedSocket * buffered_socket) {
     if(buffered_socket != NULL) {
         if (buffered_socket->socket != -1) {
-            struct pollfd poll_set[1];
-            memset(poll_set, 0x00, sizeof(poll_set));
-            poll_set[0].fd = buffered_socket->socket;
-            poll_set[0].events = POLLIN;
-
-            poll(poll_set, 1, 0);
-            if(poll_set[0].revents & POLLIN) {
-                return 1;
-            } else {
-                return 0;
-            }
+            return buffered_socket->readable;
         }
     }
     return 0;
@@ -139,46 +130,97 @@ int buffered_socket_can_read(struct BufferedSocket * buffered_socket) {
 int buffered_socket_has_hungup(struct BufferedSocket * buffered_socket) {
     if(buffered_socket != NULL) {
         if (buffered_socket->socket != -1) {
-            struct pollfd poll_set[1];
-            memset(poll_set, 0x00, sizeof(poll_set));
-            poll_set[0].fd = buffered_socket->socket;
-            poll_set[0].events = POLLIN | POLLOUT;
-            poll(poll_set, 1, 0);
-
-            if (poll_set[0].revents & POLLHUP) {
-                return 1;
-            }
+            return buffered_socket->hungup;
         }
     }
 
     return 0;
 }
 
-size_t buffered_socket_write(struct BufferedSocket * buffered_socket, void * data, size_t data_size) {
-    if(buffered_socket == NULL) {
-        throw("writing a null buffered socket");
-    } else if(buffered_socket->socket == -1) {
-        throw("writing a disconnected buffered socket");
+/* private functions */
+static void buffered_socket_append_write_buffer(struct BufferedSocket * buffered_socket, struct BufferedSocketWriteBuffer * write_buffer) {
+    if(buffered_socket->write_buffer_tail == NULL) {
+        buffered_socket->write_buffer_head = write_buffer;
+        buffered_socket->write_buffer_tail = write_buffer;
+    } else {
+        buffered_socket->write_buffer_tail->next = write_buffer;
+        buffered_socket->write_buffer_tail = write_buffer;
+    }
+}
+
+static void buffered_socket_free_write_buffer(struct BufferedSocketWriteBuffer * write_buffer) {
+    if(write_buffer->fd != -1) {
+        close(write_buffer->fd);
+    }
+    free(write_buffer->data);
+    free(write_buffer);
+}
+
+static int buffered_socket_reserve_read_buffer(struct BufferedSocket * buffered_socket) {
+    size_t used = buffered_socket->read_buffer_offset + buffered_socket->read_buffer_size;
+    if(buffered_socket->read_buffer_capacity - used >= BUFFERED_SOCKET_READ_MIN_FREE) {
+        return EXIT_SUCCESS;
+    }
+
+    // move the unread tail back to the start of the buffer. this is at most one partial message
+    if(buffered_socket->read_buffer_offset > 0) {
+        memmove(buffered_socket->read_buffer,
+                buffered_socket->read_buffer + buffered_socket->read_buffer_offset,
+                buffered_socket->read_buffer_size);
+        buffered_socket->read_buffer_offset = 0;
+    }
+
+    if(buffered_socket->read_buffer_capacity - buffered_socket->read_buffer_size >= BUFFERED_SOCKET_READ_MIN_FREE) {
+        return EXIT_SUCCESS;
     }
 
+    // a peer sending faster than we consume doesn't get to grow the buffer forever, what room is left still gets used
+    if(buffered_socket->read_buffer_capacity >= BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY) {
+        return EXIT_SUCCESS;
+    }
+
+    size_t new_capacity = buffered_socket->read_buffer_capacity == 0 ? BUFFERED_SOCKET_READ_BUFFER_CAPACITY : buffered_socket->read_buffer_capacity * 2;
+    if(new_capacity > BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY) {
+        new_capacity = BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY;
+    }
+    uint8_t * new_read_buffer = realloc(buffered_socket->read_buffer, new_capacity);
+    if(new_read_buffer == NULL) {
+        throw("failed to grow read buffer");
+    }
+    buffered_socket->read_buffer = new_read_buffer;
+    buffered_socket->read_buffer_capacity = new_capacity;
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief queue a copy of data in a new write buffer with room for data_capacity bytes
+ * @return data_size on success, -1 on failure
+ */
+static size_t buffered_socket_queue_data(struct BufferedSocket * buffered_socket, void * data, size_t data_size,
+                                         size_t data_capacity, uint64_t tag) {
     struct BufferedSocketWriteBuffer * write_buffer = malloc(sizeof(struct BufferedSocketWriteBuffer));
     if (write_buffer == NULL) {
         throw("failed to write to socket write buffer");
     }
-    write_buffer->data = malloc(data_size);
-    memset(write_buffer->data, 0x00, data_size);
+
+    write_buffer->data = malloc(data_capacity);
+    if (write_buffer->data == NULL) {
+        free(write_buffer);
+        throw("failed to write to socket write buffer");
+    }
     memcpy(write_buffer->data, data, data_size);
     write_buffer->data_size = data_size;
+    write_buffer->data_capacity = data_capacity;
     write_buffer->data_sent = 0;
+    write_buffer->fd = -1;
+    write_buffer->file_offset = 0;
+    write_buffer->tag = tag;
     write_buffer->next = NULL;
 
-    if(buffered_socket->write_buffer_tail == NULL) {
-        buffered_socket->write_buffer_head = write_buffer;
-        buffered_socket->write_buffer_tail = write_buffer;
-    } else {
-        buffered_socket->write_buffer_tail->next = write_buffer;
-        buffered_socket->write_buffer_tail = write_buffer;
-    }
+    buffered_socket_append_write_buffer(buffered_socket, write_buffer);
 
     return data_size;
 
@@ -186,6 +228,121 @@ size_t buffered_socket_write(struct BufferedSocket * buffered_socket, void * dat
     return -1;
 }
 
+size_t buffered_socket_write(struct BufferedSocket * buffered_socket, void * data, size_t data_size) {
+    if(buffered_socket == NULL) {
+        throw("writing a null buffered socket");
+    } else if(buffered_socket->socket == -1) {
+        throw("writing a disconnected buffered socket");
+    }
+
+    // small messages are appended to the tail buffer if it has room left
+    struct BufferedSocketWriteBuffer * tail = buffered_socket->write_buffer_tail;
+    if(tail != NULL && tail->fd == -1 && tail->tag == 0 && data_size <= BUFFERED_SOCKET_COALESCE_SIZE && tail->data_capacity - tail->data_size >= data_size) {
+        memcpy(tail->data + tail->data_size, data, data_size);
+        tail->data_size += data_size;
+        return data_size;
+    }
+
+    // give small messages a buffer that following small messages can be appended to
+    size_t data_capacity = data_size;
+    if(data_capacity <= BUFFERED_SOCKET_COALESCE_SIZE) {
+        data_capacity = BUFFERED_SOCKET_WRITE_BUFFER_CAPACITY;
+    }
+
+    return buffered_socket_queue_data(buffered_socket, data, data_size, data_capacity, 0);
+
+    error:
+    return -1;
+}
+
+size_t buffered_socket_write_tagged(struct BufferedSocket * buffered_socket, void * data, size_t data_size, uint64_t tag) {
+    if(buffered_socket == NULL) {
+        throw("writing a null buffered socket");
+    } else if(buffered_socket->socket == -1) {
+        throw("writing a disconnected buffered socket");
+    }
+
+    // tagged messages get a buffer of their own, so they can be dropped without touching anything else
+    return buffered_socket_queue_data(buffered_socket, data, data_size, data_size, tag);
+
+    error:
+    return -1;
+}
+
+size_t buffered_socket_write_file(struct BufferedSocket * buffered_socket, int fd, off_t offset, size_t length, uint64_t tag) {
+    struct BufferedSocketWriteBuffer * write_buffer = NULL;
+
+    if(buffered_socket == NULL) {
+        throw("writing a null buffered socket");
+    } else if(buffered_socket->socket == -1) {
+        throw("writing a disconnected buffered socket");
+    }
+
+    write_buffer = malloc(sizeof(struct BufferedSocketWriteBuffer));
+    if (write_buffer == NULL) {
+        throw("failed to write file to socket write buffer");
+    }
+
+    // the caller may close fd before this buffer is sent
+    write_buffer->fd = dup(fd);
+    if (write_buffer->fd == -1) {
+        throw("failed to dup file descriptor %s", clean_errno());
+    }
+
+    write_buffer->data = NULL;
+    write_buffer->data_size = length;
+    write_buffer->data_capacity = 0;
+    write_buffer->data_sent = 0;
+    write_buffer->file_offset = offset;
+    write_buffer->tag = tag;
+    write_buffer->next = NULL;
+
+    buffered_socket_append_write_buffer(buffered_socket, write_buffer);
+
+    return length;
+
+    error:
+    if (write_buffer != NULL) {
+        free(write_buffer);
+    }
+    return -1;
+}
+
+size_t buffered_socket_cancel(struct BufferedSocket * buffered_socket, uint64_t tag) {
+    if(buffered_socket == NULL || tag == 0) {
+        return 0;
+    }
+
+    // a message that started going out has to be sent whole, or the stream is corrupted
+    if(buffered_socket->sending_tag == tag) {
+        return 0;
+    }
+
+    size_t dropped = 0;
+    struct BufferedSocketWriteBuffer * prev = NULL;
+    struct BufferedSocketWriteBuffer * current = buffered_socket->write_buffer_head;
+    while(current != NULL) {
+        struct BufferedSocketWriteBuffer * next = current->next;
+        if(current->tag == tag) {
+            if(prev == NULL) {
+                buffered_socket->write_buffer_head = next;
+            } else {
+                prev->next = next;
+            }
+            if(buffered_socket->write_buffer_tail == current) {
+                buffered_socket->write_buffer_tail = prev;
+            }
+            dropped += current->data_size;
+            buffered_socket_free_write_buffer(current);
+        } else {
+            prev = current;
+        }
+        current = next;
+    }
+
+    return dropped;
+}
+
 size_t buffered_socket_network_write(struct BufferedSocket * buffered_socket) {
     if(buffered_socket == NULL) {
         throw("network_writing a null buffered socket");
@@ -200,37 +357,78 @@ size_t buffered_socket_network_write(struct BufferedSocket * buffered_socket) {
     uint64_t last_update = buffered_socket->last_upload_rate_update;
     size_t total_bytes_sent = 0;
 
-    // write anything we need to write
+    // write anything we need to write, as many buffers per syscall as we can
     while(buffered_socket->write_buffer_head != NULL) {
-        size_t bytes_to_send = buffered_socket->write_buffer_head->data_size - buffered_socket->write_buffer_head->data_sent;
+        ssize_t result;
+
+        struct BufferedSocketWriteBuffer * head = buffered_socket->write_buffer_head;
+        if(head->fd != -1) {
+            // file buffers go straight from the page cache to the socket
+            off_t file_offset = head->file_offset + head->data_sent;
+            result = sendfile(buffered_socket->socket, head->fd, &file_offset, head->data_size - head->data_sent);
+        } else {
+            // in memory buffers are gathered until the next file buffer
+            struct iovec iov[BUFFERED_SOCKET_MAX_IOVECS];
+            int iov_count = 0;
+
+            struct BufferedSocketWriteBuffer * current = head;
+            while(current != NULL && current->fd == -1 && iov_count < BUFFERED_SOCKET_MAX_IOVECS) {
+                iov[iov_count].iov_base = current->data + current->data_sent;
+                iov[iov_count].iov_len = current->data_size - current->data_sent;
+                iov_count++;
+                current = current->next;
+            }
+
+            result = writev(buffered_socket->socket, iov, iov_count);
+        }
 
-        int result = write(buffered_socket->socket, buffered_socket->write_buffer_head->data + buffered_socket->write_buffer_head->data_sent, bytes_to_send);
         if(result == -1) {
             if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for the reactor to tell us the socket is writable again
+                buffered_socket->writable = 0;
                 break;
             } else {
                 throw("failed network write %s", clean_errno());
             }
         } else if(result == 0) {
+            if(head->fd != -1) {
+                // the file is shorter than the range that was queued, the rest of it will never arrive
+                throw("file ended %zu bytes before it's queued range was sent", head->data_size - head->data_sent);
+            }
             return 0;
-        } else if(result < bytes_to_send) {
-            buffered_socket->write_buffer_head->data_sent += result;
-            total_bytes_sent += result;
-            break;
         }
 
         total_bytes_sent += result;
 
-        struct BufferedSocketWriteBuffer * next = buffered_socket->write_buffer_head->next;
-        free(buffered_socket->write_buffer_head->data);
-        free(buffered_socket->write_buffer_head);
-        buffered_socket->write_buffer_head = NULL;
-        buffered_socket->write_buffer_head = next;
+        // release every buffer that was fully sent, and remember how far we got into the last one
+        size_t bytes_left = (size_t) result;
+        while(bytes_left > 0) {
+            head = buffered_socket->write_buffer_head;
+            if(head->tag != 0) {
+                buffered_socket->sending_tag = head->tag;
+            }
+
+            size_t head_remaining = head->data_size - head->data_sent;
+            if(bytes_left < head_remaining) {
+                head->data_sent += bytes_left;
+                break;
+            }
+
+            bytes_left -= head_remaining;
+            buffered_socket->write_buffer_head = head->next;
+            if(head->tag != 0 && (head->next == NULL || head->next->tag != head->tag)) {
+                // that was the last buffer of the message
+                buffered_socket->sending_tag = 0;
+            }
+            buffered_socket_free_write_buffer(head);
+        }
     }
 
-    buffered_socket->write_buffer_tail = NULL;
+    if(buffered_socket->write_buffer_head == NULL) {
+        buffered_socket->write_buffer_tail = NULL;
+    }
 
-    buffered_socket->last_upload_rate_update = now();
+    buffered_socket->last_upload_rate_update = now_cached();
     uint64_t milliseconds_elapsed = ((buffered_socket->last_upload_rate_update - last_update));
     if(milliseconds_elapsed > 0) {
         buffered_socket->upload_rate = (float) total_bytes_sent / ((float) milliseconds_elapsed / 1000);
@@ -244,6 +442,21 @@ size_t buffered_socket_network_write(struct BufferedSocket * buffered_socket) {
     return -1;
 }
 
+int buffered_socket_get_rtt(struct BufferedSocket * buffered_socket) {
+    if(buffered_socket == NULL || buffered_socket->socket == -1) {
+        return 0;
+    }
+
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if(getsockopt(buffered_socket->socket, IPPROTO_TCP, TCP_INFO, &info, &info_len) == -1) {
+        errno = 0;
+        return 0;
+    }
+
+    return (int) (info.tcpi_rtt / 1000);
+}
+
 size_t buffered_socket_network_read(struct BufferedSocket * buffered_socket) {
     if(buffered_socket == NULL) {
         throw("network_reading a null buffered socket");
@@ -251,22 +464,35 @@ size_t buffered_socket_network_read(struct BufferedSocket * buffered_socket) {
         throw("network_reading a disconnected buffered socket");
     }
 
-    /* read whatever we can */
-    uint8_t buffer[65535]; // absolute tcp limit
-    memset(&buffer, 0x00, sizeof(buffer));
+    if(buffered_socket_reserve_read_buffer(buffered_socket) == EXIT_FAILURE) {
+        goto error;
+    }
 
     uint64_t last_update = buffered_socket->last_download_rate_update;
 
-    int read_size = read(buffered_socket->socket, &buffer, sizeof(buffer));
+    /* read whatever fits straight into the free end of the read buffer */
+    size_t used = buffered_socket->read_buffer_offset + buffered_socket->read_buffer_size;
+    if(used == buffered_socket->read_buffer_capacity) {
+        // full, leave the rest in the kernel until messages are consumed. readable stays set to come back for it
+        return 0;
+    }
+    int read_size = read(buffered_socket->socket, buffered_socket->read_buffer + used, buffered_socket->read_buffer_capacity - used);
     if(read_size == -1) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            // drained, wait for the reactor to tell us there's more to read
+            buffered_socket->readable = 0;
+        }
         buffered_socket->download_rate = 0.00;
         goto error;
     } else if (read_size == 0) {
+        // orderly shutdown from the other side
+        buffered_socket->readable = 0;
+        buffered_socket->hungup = 1;
         buffered_socket->download_rate = 0.00;
         return 0;
     }
 
-    buffered_socket->last_download_rate_update = now();
+    buffered_socket->last_download_rate_update = now_cached();
     uint64_t milliseconds_elapsed = (buffered_socket->last_download_rate_update - last_update);
     if(milliseconds_elapsed > 0) {
         buffered_socket->download_rate = (float) read_size / ((float) milliseconds_elapsed / 1000);
@@ -274,16 +500,7 @@ size_t buffered_socket_network_read(struct BufferedSocket * buffered_socket) {
         buffered_socket->download_rate = 0.00;
     }
 
-    if(buffered_socket->read_buffer_size == 0) {
-        buffered_socket->read_buffer = malloc(read_size);
-        memcpy(buffered_socket->read_buffer, &buffer, read_size);
-        buffered_socket->read_buffer_size = read_size;
-    } else {
-        size_t new_buffer_size = buffered_socket->read_buffer_size + read_size;
-        buffered_socket->read_buffer = realloc(buffered_socket->read_buffer, new_buffer_size);
-        memcpy(buffered_socket->read_buffer + buffered_socket->read_buffer_size, &buffer, read_size);
-        buffered_socket->read_buffer_size = new_buffer_size;
-    }
+    buffered_socket->read_buffer_size += read_size;
 
     return 1;
     error:
@@ -301,24 +518,13 @@ size_t buffered_socket_read(struct BufferedSocket * buffered_socket, void * data
         return 0; // we dont have enough data in memory, treat like timeout
     }
 
-    memcpy(data, buffered_socket->read_buffer, data_length);
+    memcpy(data, buffered_socket->read_buffer + buffered_socket->read_buffer_offset, data_length);
+    buffered_socket->read_buffer_offset += data_length;
+    buffered_socket->read_buffer_size -= data_length;
 
-    size_t new_buffer_size = buffered_socket->read_buffer_size - data_length;
-    if(new_buffer_size == 0) {
-        free(buffered_socket->read_buffer);
-        buffered_socket->read_buffer = NULL;
-        buffered_socket->read_buffer_size = 0;
-    } else {
-        void * new_read_buffer = malloc(new_buffer_size);
-        if(new_read_buffer == NULL) {
-            throw("failed to malloc new read buffer");
-        }
-        memcpy(new_read_buffer, buffered_socket->read_buffer + data_length, new_buffer_size);
-        free(buffered_socket->read_buffer);
-        buffered_socket->read_buffer = NULL;
-
-        buffered_socket->read_buffer = new_read_buffer;
-        buffered_socket->read_buffer_size = new_buffer_size;
+    if(buffered_socket->read_buffer_size == 0) {
+        // everything consumed, start from the front of the buffer again
+        buffered_socket->read_buffer_offset = 0;
     }
 
     return data_length;
@@ -344,8 +550,7 @@ struct BufferedSocket * buffered_socket_free(struct BufferedSocket * buffered_so
             struct BufferedSocketWriteBuffer * current = buffered_socket->write_buffer_head;
             while(current != NULL) {
                 struct BufferedSocketWriteBuffer * next = current->next;
-                free(current->data);
-                free(current);
+                buffered_socket_free_write_buffer(current);
                 current = NULL;
                 current = next;
             }
@@ -15,6 +15,26 @@
  *        buffered_socket_network_write call will return -1 in case of error and the amount of data written in case
  *        of success.
  *
+ *        the write buffer is a list of buffers flushed with writev, so one network write sends as much of the list as
+ *        the socket accepts. small messages (requests, haves, keepalives...) don't get a buffer each, they're appended
+ *        to the tail buffer while it has room.
+ *
+ *        buffered_socket_write_file queues a range of a file instead of a copy of it. when it reaches the front of the
+ *        write buffer the range is sent with sendfile, straight from the page cache to the socket.
+ *
+ *        buffers can be tagged with the message they're part of, e.g. the header and file ranges of a piece message.
+ *        buffered_socket_cancel drops every buffer of a message as long as none of it has been sent yet.
+ *
+ *  @note the buffered_socket doesn't poll it's own file descriptor. readiness is reported by whoever watches the socket
+ *        (see reactor/reactor.h) by setting readable, writable and hungup. network reads and writes clear readable and
+ *        writable again once the socket would block, which is what edge triggered epoll expects.
+ *
+ *  @note the read buffer is a single growable slab. unread data lives between read_buffer_offset and
+ *        read_buffer_offset + read_buffer_size. network reads go straight into the free space at the end of the slab,
+ *        buffered_socket_read consumes by advancing read_buffer_offset. the unread tail is only moved back to the start
+ *        of the slab when there isn't enough free space left for the next network read, and the slab only grows when
+ *        even that isn't enough.
+ *
  *  @note in situations where you make multiple reads to handle a single message you will need to deal with cases
  *        where the first read succedes and the second fails. you can see an example of this in peer/peer.h in the function
  *        peer_read_message. one iteration may successfully read msg_length and the next may read msg_id. the function
@@ -57,10 +77,23 @@
 #ifndef UVGTORRENT_C_BUFFERED_SOCKET_H
 #define UVGTORRENT_C_BUFFERED_SOCKET_H
 
+#define BUFFERED_SOCKET_READ_BUFFER_CAPACITY (32 * 1024) // initial read buffer size, fits two full PIECE messages
+#define BUFFERED_SOCKET_READ_MIN_FREE (16 * 1024) // make at least this much room before every network read
+#define BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY (2 * 1024 * 1024) // the read buffer never grows past this, it holds the largest message a peer may send with room to spare
+#define BUFFERED_SOCKET_WRITE_BUFFER_CAPACITY 4096 // size of the shared buffers small messages are coalesced into
+#define BUFFERED_SOCKET_COALESCE_SIZE 512 // messages up to this size are appended to a shared write buffer
+#define BUFFERED_SOCKET_MAX_IOVECS 64 // write buffers handed to a single writev call
+
 struct BufferedSocketWriteBuffer {
-    void * data;
+    uint8_t * data;
     size_t data_sent;
     size_t data_size;
+    size_t data_capacity; // small messages are appended while data_size leaves room
+
+    /* file buffers send data_size bytes from fd instead of data */
+    int fd; // -1 for in memory buffers
+    off_t file_offset;
+    uint64_t tag; // 0, or the message this buffer is part of. tagged buffers are never appended to
     struct BufferedSocketWriteBuffer * next;
 };
 
@@ -70,13 +103,22 @@ struct BufferedSocket {
     int socket;
     struct sockaddr * addr;
 
+    /* readiness, set by the reactor watching this socket */
+    int registered; // has this socket been added to a reactor's epoll set?
+    int readable;
+    int writable;
+    int hungup;
+
     /* write buffer */
     struct BufferedSocketWriteBuffer * write_buffer_head; // for sending in fifo order
     struct BufferedSocketWriteBuffer * write_buffer_tail; // for appending in fifo order
+    uint64_t sending_tag; // tag of the message partly sent, it's buffers can't be cancelled anymore. 0 if none
 
     /* read buffer */
-    void * read_buffer;
-    size_t read_buffer_size;
+    uint8_t * read_buffer;
+    size_t read_buffer_offset; // start of unread data
+    size_t read_buffer_size; // amount of unread data
+    size_t read_buffer_capacity;
 
     /* rate measures */
     float download_rate; // bytes per second
@@ -104,10 +146,54 @@ extern int buffered_socket_can_read(struct BufferedSocket * buffered_socket);
 
 extern size_t buffered_socket_write(struct BufferedSocket * buffered_socket, void * data, size_t data_length);
 
+/**
+ * @brief queue data in a buffer of it's own, tagged so it can be dropped again with buffered_socket_cancel
+ * @param buffered_socket
+ * @param data
+ * @param data_length
+ * @param tag non zero id of the message the data is part of
+ * @return data_length on success, -1 on failure
+ */
+extern size_t buffered_socket_write_tagged(struct BufferedSocket * buffered_socket, void * data, size_t data_length, uint64_t tag);
+
+/**
+ * @brief queue length bytes of the file fd, starting at offset, to be sent with sendfile
+ * @note fd is dup'd, the caller keeps ownership of fd. the file contents are read when the data is actually sent
+ * @param buffered_socket
+ * @param fd
+ * @param offset
+ * @param length
+ * @param tag id of the message the data is part of, 0 if it can't be cancelled
+ * @return length on success, -1 on failure
+ */
+extern size_t buffered_socket_write_file(struct BufferedSocket * buffered_socket, int fd, off_t offset, size_t length, uint64_t tag);
+
+/**
+ * @brief drop every queued buffer with the given tag, unless part of the message was already sent. buffers of the
+ *        message that were sent are freed, so that's tracked by sending_tag rather than the buffers still queued
+ * @param buffered_socket
+ * @param tag
+ * @return number of bytes dropped, 0 if there was nothing to drop or it was too late
+ */
+extern size_t buffered_socket_cancel(struct BufferedSocket * buffered_socket, uint64_t tag);
+
 extern size_t buffered_socket_network_write(struct BufferedSocket * buffered_socket);
 
+/**
+ * @brief read whatever the socket has into the read buffer, growing it up to BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY
+ * @param buffered_socket
+ * @return 1 on success. 0 if the other side hung up, or if the read buffer is full, in which case readable stays set
+ *         so reading carries on once some of it was consumed. -1 on failure, readable is cleared on EAGAIN
+ */
 extern size_t buffered_socket_network_read(struct BufferedSocket * buffered_socket);
 
+/**
+ * @brief get the smoothed round trip time the kernel measured for the connection
+ * @param buffered_socket
+ * @return milliseconds, 0 if it isn't known
+ */
+extern int buffered_socket_get_rtt(struct BufferedSocket * buffered_socket);
+
 extern size_t buffered_socket_read(struct BufferedSocket * buffered_socket, void * data, size_t data_length);
 
 extern void buffered_socket_close(struct BufferedSocket * buffered_socket);
@@ -2,14 +2,31 @@
 #include <sys/time.h>
 #include <time.h>
 #include <inttypes.h>
+#include "deadline.h"
 #include "../log.h"
 
+static __thread int64_t deadline_cached_time = 0;
+static __thread int deadline_cached = 0; // has this thread called now_update?
+
 int64_t now() {
-    struct timeval tv;
-    int rc = gettimeofday(&tv, NULL);
+    struct timespec ts;
+    int rc = clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
     if (rc != 0) {
         return -1;
     }
-    int64_t current_time = ((int64_t) tv.tv_sec) * 1000 + (((int64_t) tv.tv_usec) / 1000);
+    int64_t current_time = ((int64_t) ts.tv_sec) * 1000 + (((int64_t) ts.tv_nsec) / 1000000);
     return current_time;
 }
+
+int64_t now_update() {
+    deadline_cached_time = now();
+    deadline_cached = 1;
+    return deadline_cached_time;
+}
+
+int64_t now_cached() {
+    if (deadline_cached == 0) {
+        return now();
+    }
+    return deadline_cached_time;
+}
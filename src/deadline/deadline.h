@@ -1,3 +1,16 @@
+/**
+ * @file deadline/deadline.h
+ *
+ * @brief the clock every deadline and rate is measured with. times are milliseconds from CLOCK_MONOTONIC_COARSE, which
+ *        never jumps when the wall clock is changed and is read from the vDSO without a syscall. it only moves once per
+ *        kernel tick, a few milliseconds, which is plenty for deadlines measured in seconds.
+ *
+ *        threads running an event loop read the clock once per loop with now_update, and everything they run during
+ *        that loop takes the time from now_cached instead of reading the clock again. threads that never call
+ *        now_update get a fresh reading from now_cached every time.
+ *
+ * @see deadline/timer_wheel.h
+ */
 #ifndef UVGTORRENT_C_DEADLINE_H
 #define UVGTORRENT_C_DEADLINE_H
 
@@ -8,9 +21,26 @@
 /**
 * extern int64_t now()
 *
-* NOTES   : returns current time as milliseconds. useful for checking deadlines
+* NOTES   : reads the clock. returns milliseconds since some point in the past. useful for checking deadlines
 * RETURN  : int64_t
 */
 extern int64_t now();
 
-#endif // UVGTORRENT_C_DEADLINE_H
\ No newline at end of file
+/**
+* extern int64_t now_update()
+*
+* NOTES   : reads the clock and caches the time for this thread, call once at the start of each loop of an event loop
+* RETURN  : int64_t the time now_cached returns until the next update
+*/
+extern int64_t now_update();
+
+/**
+* extern int64_t now_cached()
+*
+* NOTES   : the time of the last now_update on this thread, or now() if this thread never called it. use it on hot
+*           paths, anything waiting on the clock to move needs now()
+* RETURN  : int64_t
+*/
+extern int64_t now_cached();
+
+#endif // UVGTORRENT_C_DEADLINE_H
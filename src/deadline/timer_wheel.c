@@ -0,0 +1,217 @@
+#include "timer_wheel.h"
+#include "../log.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVEL_SHIFT(level) (TIMER_WHEEL_SLOT_BITS * (level))
+
+/* PRIVATE FUNCTIONS */
+static void timer_list_init(struct Timer * head) {
+    head->prev = head;
+    head->next = head;
+}
+
+static void timer_list_append(struct Timer * head, struct Timer * timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void timer_list_unlink(struct Timer * timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * @brief move every timer in from onto the empty list to
+ */
+static void timer_list_splice(struct Timer * from, struct Timer * to) {
+    if (from->next == from) {
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    timer_list_init(from);
+}
+
+static int64_t timer_wheel_tick_time(struct TimerWheel * w, uint64_t tick) {
+    return w->start + (int64_t) tick * TIMER_WHEEL_TICK_MS;
+}
+
+/**
+ * @brief link the timer into the slot it's deadline falls in
+ */
+static void timer_wheel_insert(struct TimerWheel * w, struct Timer * timer) {
+    // round up, timers never fire before their deadline
+    uint64_t expires = w->tick;
+    if (timer->deadline > w->start) {
+        expires = (uint64_t) ((timer->deadline - w->start + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS);
+        if (expires < w->tick) {
+            expires = w->tick;
+        }
+    }
+
+    uint64_t delta = expires - w->tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS && delta >= ((uint64_t) 1 << TIMER_WHEEL_LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+    if (level == TIMER_WHEEL_LEVELS) {
+        // out of range, park it in the furthest slot until it gets closer
+        level = TIMER_WHEEL_LEVELS - 1;
+        expires = w->tick + ((uint64_t) 1 << TIMER_WHEEL_LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    timer->expires = expires;
+    timer_list_append(&w->slots[level][(expires >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_MASK], timer);
+}
+
+/**
+ * @brief move the timers of a slot down to the levels below, now that they're in range
+ */
+static void timer_wheel_cascade(struct TimerWheel * w, int level, int slot) {
+    struct Timer timers;
+    timer_list_init(&timers);
+    timer_list_splice(&w->slots[level][slot], &timers);
+
+    while (timers.next != &timers) {
+        struct Timer * timer = timers.next;
+        timer_list_unlink(timer);
+        timer_wheel_insert(w, timer);
+    }
+}
+
+/* TIMER */
+void timer_init(struct Timer * timer, TimerCallback callback, void * arg) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->deadline = 0;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+int timer_is_scheduled(struct Timer * timer) {
+    return timer->prev != NULL;
+}
+
+/* TIMER WHEEL */
+struct TimerWheel * timer_wheel_new(int64_t current_time) {
+    struct TimerWheel * w = malloc(sizeof(struct TimerWheel));
+    if (w == NULL) {
+        throw("timer wheel failed to malloc");
+    }
+
+    w->start = current_time;
+    w->tick = 0;
+    w->count = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_list_init(&w->slots[level][slot]);
+        }
+    }
+
+    return w;
+    error:
+    return NULL;
+}
+
+void timer_wheel_schedule(struct TimerWheel * w, struct Timer * timer, int64_t deadline) {
+    if (timer_is_scheduled(timer)) {
+        timer_list_unlink(timer);
+        w->count--;
+    }
+
+    timer->deadline = deadline;
+    timer_wheel_insert(w, timer);
+    w->count++;
+}
+
+void timer_wheel_cancel(struct TimerWheel * w, struct Timer * timer) {
+    if (timer_is_scheduled(timer)) {
+        timer_list_unlink(timer);
+        w->count--;
+    }
+}
+
+int timer_wheel_advance(struct TimerWheel * w, int64_t current_time, void * context) {
+    int fired = 0;
+
+    while (timer_wheel_tick_time(w, w->tick) <= current_time) {
+        if (w->count == 0) {
+            // nothing to run, skip straight to the first tick after current_time
+            w->tick = (uint64_t) ((current_time - w->start) / TIMER_WHEEL_TICK_MS) + 1;
+            break;
+        }
+
+        // each time a level wraps around, the next slot of the level above comes into range
+        int slot = (int) (w->tick & TIMER_WHEEL_MASK);
+        for (int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++) {
+            slot = (int) ((w->tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_MASK);
+            timer_wheel_cascade(w, level, slot);
+        }
+
+        // take the due timers out first, so callbacks can schedule and cancel timers freely
+        struct Timer due;
+        timer_list_init(&due);
+        timer_list_splice(&w->slots[0][w->tick & TIMER_WHEEL_MASK], &due);
+        w->tick++;
+
+        while (due.next != &due) {
+            struct Timer * timer = due.next;
+            timer_list_unlink(timer);
+            w->count--;
+            fired++;
+            timer->callback(timer->arg, context);
+        }
+    }
+
+    return fired;
+}
+
+int64_t timer_wheel_next_deadline(struct TimerWheel * w) {
+    if (w->count == 0) {
+        return 0;
+    }
+
+    // the first level holds the timers due in the next TIMER_WHEEL_SLOTS ticks
+    uint64_t next = UINT64_MAX;
+    for (uint64_t tick = w->tick; tick < w->tick + TIMER_WHEEL_SLOTS; tick++) {
+        if (w->slots[0][tick & TIMER_WHEEL_MASK].next != &w->slots[0][tick & TIMER_WHEEL_MASK]) {
+            next = tick;
+            break;
+        }
+    }
+
+    // in the levels above, the first slot in use holds the earliest timers of the level. cascading them down doesn't
+    // have to happen on time, so look for the earliest of them rather than waking up when the slot comes up
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t width = (uint64_t) 1 << TIMER_WHEEL_LEVEL_SHIFT(level);
+        uint64_t tick = (w->tick + width - 1) & ~(width - 1);
+        for (int i = 0; i < TIMER_WHEEL_SLOTS && tick < next; i++, tick += width) {
+            struct Timer * slot = &w->slots[level][(tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_MASK];
+            if (slot->next != slot) {
+                for (struct Timer * timer = slot->next; timer != slot; timer = timer->next) {
+                    next = timer->expires < next ? timer->expires : next;
+                }
+                break;
+            }
+        }
+    }
+
+    return timer_wheel_tick_time(w, next);
+}
+
+struct TimerWheel * timer_wheel_free(struct TimerWheel * w) {
+    if (w != NULL) {
+        free(w);
+        w = NULL;
+    }
+    return w;
+}
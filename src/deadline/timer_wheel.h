@@ -0,0 +1,117 @@
+/**
+ * @file deadline/timer_wheel.h
+ *
+ * @brief hierarchical hashed timer wheel. instead of polling now() against every deadline it owns, a thread schedules
+ *        a struct Timer for each deadline and advances the wheel with the current time, which runs the callbacks of the
+ *        timers that came due.
+ *
+ *        - time is cut into ticks of TIMER_WHEEL_TICK_MS. the first level has a slot for each of the next
+ *          TIMER_WHEEL_SLOTS ticks, each level above has slots TIMER_WHEEL_SLOTS times as wide
+ *        - scheduling and cancelling a timer is O(1), it's linked into / out of the list of a single slot
+ *        - when the first level wraps around, the next slot of the level above is cascaded down into it
+ *        - timers never fire early, and at most one tick late. deadlines past the top level are parked in it's last
+ *          slot and cascaded down again until they're in range
+ *
+ *        times are milliseconds from now(), see deadline/deadline.h
+ *
+ * @warning a wheel and it's timers belong to a single thread, nothing is locked
+ *
+ * @see reactor/reactor.h
+ * @see http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+ */
+#ifndef UVGTORRENT_C_TIMER_WHEEL_H
+#define UVGTORRENT_C_TIMER_WHEEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_LEVELS 4 // covers 10ms * 64^4, about 46 hours
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/**
+ * @brief called when a timer comes due. the timer isn't scheduled anymore, so it can be scheduled again from here
+ * @param arg given to timer_init
+ * @param context given to timer_wheel_advance
+ */
+typedef void (*TimerCallback)(void * arg, void * context);
+
+struct Timer {
+    struct Timer * prev; // NULL while the timer isn't scheduled
+    struct Timer * next;
+    int64_t deadline;
+    uint64_t expires; // tick the timer is due on
+    TimerCallback callback;
+    void * arg;
+};
+
+struct TimerWheel {
+    int64_t start; // time of tick 0
+    uint64_t tick; // next tick to run
+    int count; // scheduled timers
+    struct Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list heads, timers link into them in a circle
+};
+
+/**
+ * @brief set up a timer, before it's first scheduled
+ * @param timer
+ * @param callback
+ * @param arg passed to the callback
+ */
+extern void timer_init(struct Timer * timer, TimerCallback callback, void * arg);
+
+/**
+ * @brief is the timer waiting to fire?
+ * @param timer
+ * @return 1 if it's scheduled, 0 otherwise
+ */
+extern int timer_is_scheduled(struct Timer * timer);
+
+/**
+ * @brief mallocs a new TimerWheel
+ * @param current_time now()
+ * @return struct TimerWheel * on success, NULL on failure
+ */
+extern struct TimerWheel * timer_wheel_new(int64_t current_time);
+
+/**
+ * @brief schedule the timer to fire at deadline, moving it if it's already scheduled
+ * @param w
+ * @param timer
+ * @param deadline time to fire at. deadlines in the past fire on the next advance
+ */
+extern void timer_wheel_schedule(struct TimerWheel * w, struct Timer * timer, int64_t deadline);
+
+/**
+ * @brief stop the timer from firing. does nothing if it isn't scheduled
+ * @param w
+ * @param timer
+ */
+extern void timer_wheel_cancel(struct TimerWheel * w, struct Timer * timer);
+
+/**
+ * @brief run the callbacks of every timer due by current_time
+ * @param w
+ * @param current_time now()
+ * @param context passed to the callbacks
+ * @return number of timers that fired
+ */
+extern int timer_wheel_advance(struct TimerWheel * w, int64_t current_time, void * context);
+
+/**
+ * @brief when timer_wheel_advance next has something to do, so the owning thread knows how long it can sleep
+ * @note walks the timers in the earliest slot in use of each level above the first
+ * @param w
+ * @return time of the next tick with work to do, 0 if nothing is scheduled
+ */
+extern int64_t timer_wheel_next_deadline(struct TimerWheel * w);
+
+/**
+ * @brief free the given wheel. timers still scheduled are forgotten, not freed
+ * @param w
+ * @return w after freeing, NULL on success
+ */
+extern struct TimerWheel * timer_wheel_free(struct TimerWheel * w);
+
+#endif //UVGTORRENT_C_TIMER_WHEEL_H
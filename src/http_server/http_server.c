@@ -0,0 +1,639 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include "http_server.h"
+#include "../log.h"
+#include "../net_utils/net_utils.h"
+#include "../thread_pool/job.h"
+#include "../deadline/deadline.h"
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+struct HttpServer * http_server_new(struct TorrentData * td, uint16_t port, int remote) {
+    struct HttpServer * s = malloc(sizeof(struct HttpServer));
+    if (s == NULL) {
+        throw("http server failed to malloc");
+    }
+
+    s->port = port;
+    s->sockfd = -1;
+    s->epoll_fd = -1;
+    s->torrent_data = td;
+    s->client_count = 0;
+
+    s->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->sockfd == -1) {
+        throw("http server failed to create socket %s", clean_errno());
+    }
+
+    int enable = 1;
+    if (setsockopt(s->sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) {
+        throw("http server SO_REUSEADDR failed %s", clean_errno());
+    }
+
+    struct sockaddr_in servaddr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = net_utils.htonl(remote == 1 ? INADDR_ANY : INADDR_LOOPBACK),
+            .sin_port = net_utils.htons(port)
+    };
+    if (bind(s->sockfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) != 0) {
+        throw("http server failed to bind to port %i %s", port, clean_errno());
+    }
+
+    if (listen(s->sockfd, HTTP_SERVER_MAX_CLIENTS) != 0) {
+        throw("http server failed to listen %s", clean_errno());
+    }
+
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epoll_fd == -1) {
+        throw("http server failed to create epoll instance %s", clean_errno());
+    }
+
+    // the listening socket is registered with a NULL pointer so it can be told apart from clients
+    struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.ptr = NULL
+    };
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->sockfd, &ev) == -1) {
+        throw("http server failed to register socket %s", clean_errno());
+    }
+
+    if (remote == 1) {
+        log_info("serving torrent files on port %i of every interface, e.g. http://127.0.0.1:%i/", port, port);
+    } else {
+        log_info("serving torrent files on http://127.0.0.1:%i/", port);
+    }
+
+    return s;
+    error:
+    return http_server_free(s);
+}
+
+int http_server_parse_range(const char * value, uint64_t size, uint64_t * begin, uint64_t * end) {
+    while (*value == ' ') {
+        value++;
+    }
+    if (strncasecmp(value, "bytes=", 6) != 0) {
+        return EXIT_FAILURE;
+    }
+    value += 6;
+
+    char * next = NULL;
+    if (*value == '-') {
+        // the last n bytes of the file
+        uint64_t suffix = strtoull(value + 1, &next, 10);
+        if (next == value + 1 || suffix == 0 || size == 0) {
+            return EXIT_FAILURE;
+        }
+        *begin = size - MIN(suffix, size);
+        *end = size;
+    } else {
+        uint64_t first = strtoull(value, &next, 10);
+        if (next == value || *next != '-' || first >= size) {
+            return EXIT_FAILURE;
+        }
+        value = next + 1;
+
+        uint64_t last = size - 1;
+        if (*value >= '0' && *value <= '9') {
+            last = strtoull(value, &next, 10);
+            if (last < first) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            next = (char *) value;
+        }
+        *begin = first;
+        *end = MIN(last + 1, size);
+    }
+
+    // multiple ranges aren't supported
+    while (*next == ' ') {
+        next++;
+    }
+    if (*next != '\0' && *next != '\r' && *next != '\n') {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* private functions */
+
+/**
+ * @brief start a response with the given status. headers and a body are added to the returned stream
+ * @return stream writing to c->response, NULL on failure
+ */
+static FILE * http_server_begin_response(struct HttpClient * c, int status, const char * reason) {
+    if (c->response != NULL) {
+        free(c->response);
+        c->response = NULL;
+    }
+    c->response_len = 0;
+    c->response_sent = 0;
+
+    FILE * response = open_memstream(&c->response, &c->response_len);
+    if (response == NULL) {
+        return NULL;
+    }
+
+    fprintf(response, "HTTP/1.1 %i %s\r\n", status, reason);
+    fprintf(response, "Server: uvgTorrent\r\n");
+    fprintf(response, "Connection: %s\r\n", c->keep_alive == 1 ? "keep-alive" : "close");
+    return response;
+}
+
+/**
+ * @brief respond with a short plain text body
+ */
+static int http_server_respond_error(struct HttpClient * c, int status, const char * reason, const char * extra_headers) {
+    FILE * response = http_server_begin_response(c, status, reason);
+    if (response == NULL) {
+        throw("http server failed to build response");
+    }
+
+    fprintf(response, "Content-Type: text/plain\r\n");
+    fprintf(response, "Content-Length: %zu\r\n", strlen(reason) + 1);
+    fprintf(response, "%s\r\n", extra_headers != NULL ? extra_headers : "");
+    fprintf(response, "%s\n", reason);
+    fclose(response);
+
+    c->offset = 0;
+    c->end = 0;
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief the path of a file in the torrent, without the folder it's saved to
+ */
+static const char * http_server_file_name(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    size_t root_len = strlen(td->root_path);
+    if (strncmp(file->file_path, td->root_path, root_len) == 0) {
+        return file->file_path + root_len;
+    }
+    return file->file_path;
+}
+
+static int http_server_respond_index(struct HttpServer * s, struct HttpClient * c, int head) {
+    char * body = NULL;
+    size_t body_len = 0;
+
+    FILE * page = open_memstream(&body, &body_len);
+    if (page == NULL) {
+        throw("http server failed to build index");
+    }
+
+    fprintf(page, "<!DOCTYPE html>\n<html><body><ul>\n");
+    int file_id = 0;
+    struct TorrentDataFileInfo * file = s->torrent_data->files;
+    while (file != NULL) {
+        const char * name = http_server_file_name(s->torrent_data, file);
+        const char * base_name = strrchr(name, '/');
+        base_name = base_name != NULL ? base_name + 1 : name;
+
+        fprintf(page, "<li><a href=\"/%i/%s\">%s</a> %zu bytes</li>\n", file_id, base_name, name, file->file_size);
+
+        file = file->next;
+        file_id++;
+    }
+    fprintf(page, "</ul></body></html>\n");
+    fclose(page);
+
+    FILE * response = http_server_begin_response(c, 200, "OK");
+    if (response == NULL) {
+        throw("http server failed to build response");
+    }
+    fprintf(response, "Content-Type: text/html; charset=utf-8\r\n");
+    fprintf(response, "Content-Length: %zu\r\n\r\n", body_len);
+    if (head == 0) {
+        fwrite(body, 1, body_len, response);
+    }
+    fclose(response);
+    free(body);
+
+    c->offset = 0;
+    c->end = 0;
+    return EXIT_SUCCESS;
+    error:
+    if (body != NULL) {
+        free(body);
+    }
+    return EXIT_FAILURE;
+}
+
+static int http_server_respond_file(struct HttpServer * s, struct HttpClient * c, struct TorrentDataFileInfo * file,
+                                    const char * range, int head) {
+    uint64_t begin = 0;
+    uint64_t end = file->file_size;
+    int status = 200;
+
+    if (range != NULL) {
+        if (http_server_parse_range(range, file->file_size, &begin, &end) == EXIT_FAILURE) {
+            char content_range[64];
+            snprintf(content_range, sizeof(content_range), "Content-Range: bytes */%zu\r\n", file->file_size);
+            return http_server_respond_error(c, 416, "Range Not Satisfiable", content_range);
+        }
+        status = 206;
+    }
+
+    FILE * response = http_server_begin_response(c, status, status == 206 ? "Partial Content" : "OK");
+    if (response == NULL) {
+        throw("http server failed to build response");
+    }
+    fprintf(response, "Content-Type: application/octet-stream\r\n");
+    fprintf(response, "Accept-Ranges: bytes\r\n");
+    fprintf(response, "Content-Length: %" PRIu64 "\r\n", end - begin);
+    if (status == 206) {
+        fprintf(response, "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%zu\r\n", begin, end - 1, file->file_size);
+    }
+    fprintf(response, "\r\n");
+    fclose(response);
+
+    c->offset = file->file_offset + begin;
+    c->end = head == 0 ? file->file_offset + end : c->offset;
+
+    // the reader just moved here, start downloading from here
+    if (c->offset < c->end) {
+        torrent_data_set_stream_position(s->torrent_data, c->offset);
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+int http_server_handle_request(struct HttpServer * s, struct HttpClient * c) {
+    char method[8];
+    char target[1024];
+    char version[16];
+    if (sscanf(c->request, "%7s %1023s %15s", method, target, version) != 3) {
+        c->keep_alive = 0;
+        return http_server_respond_error(c, 400, "Bad Request", NULL);
+    }
+
+    c->keep_alive = strcmp(version, "HTTP/1.1") == 0 ? 1 : 0;
+
+    // headers we care about
+    const char * range = NULL;
+    char * line = strstr(c->request, "\r\n");
+    while (line != NULL && strncmp(line, "\r\n\r\n", 4) != 0) {
+        line += 2;
+        if (strncasecmp(line, "Range:", 6) == 0) {
+            range = line + 6;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char * value = line + 11;
+            while (*value == ' ') {
+                value++;
+            }
+            if (strncasecmp(value, "close", 5) == 0) {
+                c->keep_alive = 0;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                c->keep_alive = 1;
+            }
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    int head = strcmp(method, "HEAD") == 0 ? 1 : 0;
+    const char * range_value = range != NULL ? range : "";
+    log_info("http %s %s%.*s", method, target, (int) strcspn(range_value, "\r\n"), range_value);
+
+    if (head == 0 && strcmp(method, "GET") != 0) {
+        return http_server_respond_error(c, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+    }
+
+    if (s->torrent_data->initialized == 0) {
+        // we don't know what files there are until we have the metadata
+        return http_server_respond_error(c, 503, "Service Unavailable", "Retry-After: 5\r\n");
+    }
+
+    if (strcmp(target, "/") == 0) {
+        return http_server_respond_index(s, c, head);
+    }
+
+    char * next = NULL;
+    long file_id = strtol(&target[1], &next, 10);
+    if (target[0] == '/' && next != &target[1] && (*next == '\0' || *next == '/') && file_id >= 0) {
+        struct TorrentDataFileInfo * file = s->torrent_data->files;
+        while (file != NULL && file_id > 0) {
+            file = file->next;
+            file_id--;
+        }
+        if (file != NULL) {
+            return http_server_respond_file(s, c, file, range, head);
+        }
+    }
+
+    return http_server_respond_error(c, 404, "Not Found", NULL);
+}
+
+static void http_server_close_client(struct HttpServer * s, int index) {
+    struct HttpClient * c = s->clients[index];
+
+    close(c->fd);
+    if (c->response != NULL) {
+        free(c->response);
+    }
+    free(c);
+
+    s->client_count--;
+    s->clients[index] = s->clients[s->client_count];
+    s->clients[s->client_count] = NULL;
+}
+
+static int http_server_watch_client(struct HttpServer * s, struct HttpClient * c, uint32_t events) {
+    struct epoll_event ev = {
+            .events = events | EPOLLRDHUP,
+            .data.ptr = (void *) c
+    };
+    return epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void http_server_accept(struct HttpServer * s) {
+    int fd = accept4(s->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+        errno = 0;
+        return;
+    }
+
+    if (s->client_count == HTTP_SERVER_MAX_CLIENTS) {
+        log_warn("http server has too many clients, dropping connection");
+        close(fd);
+        return;
+    }
+
+    struct HttpClient * c = malloc(sizeof(struct HttpClient));
+    if (c == NULL) {
+        log_error("http server failed to malloc client");
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->state = HTTP_CLIENT_READING;
+    c->request_len = 0;
+    c->request[0] = '\0';
+    c->response = NULL;
+    c->response_len = 0;
+    c->response_sent = 0;
+    c->offset = 0;
+    c->end = 0;
+    c->keep_alive = 0;
+    c->wait_deadline = 0;
+
+    struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLRDHUP,
+            .data.ptr = (void *) c
+    };
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        log_error("http server failed to register client %s", clean_errno());
+        close(fd);
+        free(c);
+        return;
+    }
+
+    s->clients[s->client_count] = c;
+    s->client_count++;
+}
+
+/**
+ * @brief send as much of the body as the socket takes, up to HTTP_SERVER_SEND_SIZE
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the connection should be closed
+ */
+static int http_server_send_body(struct HttpServer * s, struct HttpClient * c) {
+    struct TorrentData * td = s->torrent_data;
+    uint64_t round_end = MIN(c->end, c->offset + HTTP_SERVER_SEND_SIZE);
+
+    while (c->offset < round_end) {
+        int piece_id = (int) (c->offset / td->piece_size);
+        if (torrent_data_is_piece_complete(td, piece_id) != 1) {
+            // pull the piece forward and wait for it
+            torrent_data_set_stream_position(td, c->offset);
+            c->state = HTTP_CLIENT_WAITING;
+            c->wait_deadline = now() + HTTP_SERVER_WAIT_MS;
+            return http_server_watch_client(s, c, 0);
+        }
+
+        uint64_t piece_end = ((uint64_t) piece_id + 1) * td->piece_size;
+        size_t length = (size_t) (MIN(piece_end, round_end) - c->offset);
+
+        struct TorrentDataFileSegment segments[HTTP_SERVER_SEGMENTS];
+        int segment_count = 0;
+        if (torrent_data_get_file_segments(td, c->offset, length, segments, HTTP_SERVER_SEGMENTS, &segment_count) == EXIT_FAILURE) {
+            throw("http server failed to find data at %" PRIu64, c->offset);
+        }
+
+        int blocked = 0;
+        for (int i = 0; i < segment_count && blocked == 0; i++) {
+            off_t file_offset = (off_t) segments[i].file_offset;
+            ssize_t sent = sendfile(c->fd, segments[i].fd, &file_offset, segments[i].length);
+            if (sent == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    torrent_data_release_file_segments(td, segments, segment_count);
+                    throw("http server failed to send %s", clean_errno());
+                }
+                errno = 0;
+                sent = 0;
+            }
+            c->offset += sent;
+            blocked = (size_t) sent < segments[i].length ? 1 : 0;
+        }
+        torrent_data_release_file_segments(td, segments, segment_count);
+
+        if (blocked == 1) {
+            // wait until the socket is writable again
+            return EXIT_SUCCESS;
+        }
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief make progress on whatever the client is doing
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the connection should be closed
+ */
+static int http_server_run_client(struct HttpServer * s, struct HttpClient * c) {
+    while (1) {
+        switch (c->state) {
+            case HTTP_CLIENT_READING: {
+                char * request_end = strstr(c->request, "\r\n\r\n");
+                if (request_end == NULL) {
+                    if (c->request_len == HTTP_SERVER_REQUEST_SIZE) {
+                        c->keep_alive = 0;
+                        c->request_len = 0;
+                        if (http_server_respond_error(c, 431, "Request Header Fields Too Large", NULL) == EXIT_FAILURE) {
+                            return EXIT_FAILURE;
+                        }
+                        c->state = HTTP_CLIENT_SENDING;
+                        if (http_server_watch_client(s, c, EPOLLOUT) == EXIT_FAILURE) {
+                            return EXIT_FAILURE;
+                        }
+                        continue;
+                    }
+
+                    ssize_t received = recv(c->fd, &c->request[c->request_len], HTTP_SERVER_REQUEST_SIZE - c->request_len, 0);
+                    if (received == 0) {
+                        return EXIT_FAILURE;
+                    }
+                    if (received == -1) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            errno = 0;
+                            return EXIT_SUCCESS;
+                        }
+                        return EXIT_FAILURE;
+                    }
+                    c->request_len += received;
+                    c->request[c->request_len] = '\0';
+                    continue;
+                }
+
+                if (http_server_handle_request(s, c) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+
+                // keep anything pipelined after this request for the next one
+                size_t request_size = (request_end + 4) - c->request;
+                memmove(c->request, request_end + 4, c->request_len - request_size + 1);
+                c->request_len -= request_size;
+
+                c->state = HTTP_CLIENT_SENDING;
+                if (http_server_watch_client(s, c, EPOLLOUT) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+
+            case HTTP_CLIENT_SENDING:
+                if (c->response_sent < c->response_len) {
+                    ssize_t sent = send(c->fd, &c->response[c->response_sent], c->response_len - c->response_sent, MSG_NOSIGNAL);
+                    if (sent == -1) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            errno = 0;
+                            return EXIT_SUCCESS;
+                        }
+                        return EXIT_FAILURE;
+                    }
+                    c->response_sent += sent;
+                    continue;
+                }
+
+                if (c->offset < c->end) {
+                    if (http_server_send_body(s, c) == EXIT_FAILURE) {
+                        return EXIT_FAILURE;
+                    }
+                    // come back when the socket is writable, the piece arrives, or after the other clients had a go
+                    if (c->offset < c->end) {
+                        return EXIT_SUCCESS;
+                    }
+                }
+
+                if (c->keep_alive == 0) {
+                    return EXIT_FAILURE;
+                }
+                c->state = HTTP_CLIENT_READING;
+                if (http_server_watch_client(s, c, EPOLLIN) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+
+            case HTTP_CLIENT_WAITING:
+                if (torrent_data_is_piece_complete(s->torrent_data, (int) (c->offset / s->torrent_data->piece_size)) != 1) {
+                    if (now() > c->wait_deadline) {
+                        log_warn("http client gave up waiting for data at %" PRIu64, c->offset);
+                        return EXIT_FAILURE;
+                    }
+                    return EXIT_SUCCESS;
+                }
+                c->state = HTTP_CLIENT_SENDING;
+                if (http_server_watch_client(s, c, EPOLLOUT) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+                continue;
+        }
+    }
+}
+
+int http_server_run(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+
+    struct JobArg s_job_arg = va_arg(args, struct JobArg);
+    struct HttpServer * s = (struct HttpServer *) s_job_arg.arg;
+
+    va_end(args);
+
+    struct epoll_event events[HTTP_SERVER_MAX_CLIENTS + 1];
+
+    while (*cancel_flag != 1) {
+        int event_count = epoll_wait(s->epoll_fd, events, HTTP_SERVER_MAX_CLIENTS + 1, HTTP_SERVER_POLL_MS);
+        if (event_count == -1) {
+            if (errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            throw("http server failed to wait for events %s", clean_errno());
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].data.ptr == NULL) {
+                http_server_accept(s);
+                continue;
+            }
+
+            // hang ups of waiting clients are handled below, with everyone else
+            struct HttpClient * c = (struct HttpClient *) events[i].data.ptr;
+            if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                c->keep_alive = 0;
+                if (c->state == HTTP_CLIENT_WAITING) {
+                    c->wait_deadline = 0;
+                }
+            }
+        }
+
+        // run every client, clients sending a body stop after HTTP_SERVER_SEND_SIZE so everyone gets a turn
+        for (int i = s->client_count - 1; i >= 0; i--) {
+            struct HttpClient * c = s->clients[i];
+            if (http_server_run_client(s, c) == EXIT_FAILURE) {
+                http_server_close_client(s, i);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+struct HttpServer * http_server_free(struct HttpServer * s) {
+    if (s != NULL) {
+        while (s->client_count > 0) {
+            http_server_close_client(s, s->client_count - 1);
+        }
+        if (s->epoll_fd != -1) {
+            close(s->epoll_fd);
+            s->epoll_fd = -1;
+        }
+        if (s->sockfd != -1) {
+            close(s->sockfd);
+            s->sockfd = -1;
+        }
+        free(s);
+        s = NULL;
+    }
+    return s;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file http_server/http_server.h
+ *
+ * @brief the http_server struct serves the files of a torrent over HTTP/1.1 while it downloads, so a media player can
+ *        play them straight away. GET and HEAD are supported, with single byte Range requests for seeking.
+ *
+ *          - /          lists the files in the torrent, linking to each of them
+ *          - /<n>       the n-th file in the torrent. anything after a further / is ignored, so links can end with the
+ *                       file name for players that go by the extension, e.g. /0/movie.mkv
+ *
+ *        e.g. curl -r 0-1023 http://127.0.0.1:8080/0 or mpv http://127.0.0.1:8080/0
+ *
+ *        the server runs every client from a single thread, as a long lived job on the torrents thread pool. sockets
+ *        are non blocking and registered with epoll, the same as the peers in a reactor. completed data is sent
+ *        straight from the torrents files with sendfile, using the open file cache in torrent_data.
+ *
+ *        when a client reaches a piece that isn't complete yet it waits for it, long polling every HTTP_SERVER_POLL_MS
+ *        for up to HTTP_SERVER_WAIT_MS. the byte the client is at becomes the stream position in torrent_data, moving
+ *        the piece picker's cursor and the streaming window to it, so the pieces the client waits on are requested
+ *        next. this also happens when a request starts, which is how a player seeking moves the download along.
+ *
+ * @note responses are only ever built from verified pieces, see torrent_data_is_piece_complete
+ *
+ * @see torrent/torrent_data.h
+ * @see reactor/reactor.h
+ * @see https://datatracker.ietf.org/doc/html/rfc7233
+ */
+#ifndef UVGTORRENT_C_HTTP_SERVER_H
+#define UVGTORRENT_C_HTTP_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "../torrent/torrent_data.h"
+
+#define HTTP_SERVER_MAX_CLIENTS 16
+#define HTTP_SERVER_REQUEST_SIZE 4096 // requests with bigger headers than this are refused
+#define HTTP_SERVER_SEND_SIZE (256 * 1024) // most sent to one client at a time, so a fast client can't starve the rest
+#define HTTP_SERVER_SEGMENTS 8 // most files one sendfile round may span
+#define HTTP_SERVER_POLL_MS 100 // how often clients waiting on a piece check if it arrived
+#define HTTP_SERVER_WAIT_MS (2 * 60 * 1000) // clients waiting on a piece for longer than this are dropped
+
+enum HttpClientState {
+    HTTP_CLIENT_READING, // waiting for a complete request
+    HTTP_CLIENT_SENDING, // sending the response header, then the body
+    HTTP_CLIENT_WAITING, // the next byte of the body is in a piece that isn't complete yet
+};
+
+struct HttpClient {
+    int fd;
+    enum HttpClientState state;
+
+    char request[HTTP_SERVER_REQUEST_SIZE + 1]; // null terminated
+    size_t request_len;
+
+    char * response; // header, plus the body when it isn't torrent data
+    size_t response_len;
+    size_t response_sent;
+
+    uint64_t offset; // torrent offset of the next byte of the body to send
+    uint64_t end; // torrent offset one past the last byte of the body
+    int keep_alive;
+    int64_t wait_deadline; // when a waiting client gives up
+};
+
+struct HttpServer {
+    uint16_t port;
+    int sockfd;
+    int epoll_fd;
+    struct TorrentData * torrent_data;
+
+    /* clients owned by the server thread */
+    struct HttpClient * clients[HTTP_SERVER_MAX_CLIENTS];
+    int client_count;
+};
+
+/**
+ * @brief create a new http server listening on port
+ * @param td torrent data to serve the files of
+ * @param port
+ * @param remote 0 to only listen on loopback, 1 to listen on every interface. there's no authentication, anyone who
+ *        can reach the port can read the files
+ * @return struct HttpServer *. NULL on failure
+ */
+extern struct HttpServer * http_server_new(struct TorrentData * td, uint16_t port, int remote);
+
+/**
+ * @brief parse the value of a Range header
+ * @param value e.g. bytes=0-499, bytes=500- or bytes=-500. only a single range is supported
+ * @param size size of the file the range is in
+ * @param begin first byte of the range
+ * @param end one past the last byte of the range
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the range can't be satisfied
+ */
+extern int http_server_parse_range(const char * value, uint64_t size, uint64_t * begin, uint64_t * end);
+
+/**
+ * @brief build the response to the complete request in c->request. sets up the header in c->response and the range
+ *        of torrent data to send after it
+ * @param s
+ * @param c
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the connection should be closed
+ */
+extern int http_server_handle_request(struct HttpServer * s, struct HttpClient * c);
+
+/**
+ * @brief server main loop. runs until cancel_flag is set
+ * @param cancel_flag
+ * @param ... JobArg containing the struct HttpServer *
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int http_server_run(_Atomic int * cancel_flag, ...);
+
+/**
+ * @brief free the given http server, closing any connected clients
+ * @note the server thread must have exited before calling this
+ * @param s
+ * @return s after freeing, NULL on success
+ */
+extern struct HttpServer * http_server_free(struct HttpServer * s);
+
+#endif //UVGTORRENT_C_HTTP_SERVER_H
@@ -14,13 +14,20 @@
  *
  *       torrent/torrent_data.h: provides a shared interface to encapsulate torrent data for access by peers and the main thread
  *                               peers can claim chunks of a given piece of data, with the claims expiring after a deadline
+ *                               a piece picker decides which pieces peers claim next, in order or rarest first
+ *                               while streaming, the pieces just past the read cursor get deadlines and go to the fastest peers
  *                               peers can read completed chunks for sharing with other peers
  *                               the main thread can write chunks into the data
- *                               the main thread can read completed pieces for validation
+ *                               hashers validate completed pieces and write them to disk off the main thread
  *                               the main thread can get information needed for writing to file, such as relative position of the piece in the torrent and length
  *
+ *       torrent/torrent_resume.h: saves which pieces are on disk so a restarted download picks up where it left off
+ *
  *       tracker/tracker.h:  returns available peers to the main thread via queue
  *
+ *       http_server/http_server.h: serves the torrents files over http while they download, waiting on and
+ *                                  moving the download to the pieces clients are reading
+ *
  *       peer/peer.h: establishes and manages the state of a connection with a given peer
  *                    will use torrent_data.h to determine if there is torrent metadata or torrent data that needs requesting
  *                    upon receiving data peer will return this data to the main thread via queue
@@ -41,6 +48,8 @@
 #include <sys/select.h>
 #include <unistd.h>
 #include <sys/sysinfo.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include "args/args.h"
 #include "colors.h"
@@ -51,10 +60,20 @@
 #include "thread_pool/thread_pool.h"
 #include "hash_map/hash_map.h"
 #include "ipify/ipify.h"
+#include "http_server/http_server.h"
+#include "message_ring/message_ring.h"
+#include "deadline/deadline.h"
+
+#define MAIN_DATA_QUEUE_SIZE 2048 // most chunks waiting for the main thread, 32 MiB of 16 KiB chunks
+#define MAIN_METADATA_QUEUE_SIZE 64
+#define MAIN_DRAIN_BATCH 64 // most messages of each kind handled per loop
+#define MAIN_MAX_WAIT_MS 1000 // longest the main loop sleeps, in case a tracker job finished without telling us
 
 volatile sig_atomic_t running = 1;
+int main_wake_fd = -1; // written to by everything that has work for the main loop
 struct ThreadPool *tp = NULL;
 struct Torrent *t = NULL;
+struct HttpServer *http_server = NULL;
 int has_closed = 0;
 /**
  * @brief handle sigint
@@ -66,6 +85,9 @@ void SIGINT_handle(int signum) {
         has_closed = 1;
     }
     running = 0;
+    if (main_wake_fd != -1) {
+        eventfd_write(main_wake_fd, 1);
+    }
 }
 
 /**
@@ -84,6 +106,41 @@ int stdin_available() {
     return (FD_ISSET(0, &fds));
 }
 
+/**
+ * @brief sleep until something has work for the main loop: a message or peer in one of it's queues, a verified piece,
+ *        user input, a signal, or the next deadline from torrent_get_next_deadline
+ * @param epoll_fd epoll instance watching main_wake_fd and stdin
+ * @param metadata_queue
+ * @param data_queue
+ * @param peer_queue
+ */
+void wait_for_work(int epoll_fd, struct MessageRing * metadata_queue, struct MessageRing * data_queue, struct Queue * peer_queue) {
+    // anything arriving from here on writes to main_wake_fd again
+    eventfd_t wakeups;
+    eventfd_read(main_wake_fd, &wakeups);
+
+    if (running == 0 ||
+        message_ring_prepare_wait(metadata_queue) == 1 ||
+        message_ring_prepare_wait(data_queue) == 1 ||
+        queue_get_count(peer_queue) > 0 ||
+        queue_get_count(t->torrent_data->verified_queue) > 0) {
+        return;
+    }
+
+    int timeout_ms = MAIN_MAX_WAIT_MS;
+    int64_t deadline = torrent_get_next_deadline(t);
+    if (deadline > 0) {
+        // deadlines count as passed once now() is beyond them
+        int64_t remaining_ms = deadline - now() + 1;
+        if (remaining_ms < timeout_ms) {
+            timeout_ms = remaining_ms > 0 ? (int) remaining_ms : 0;
+        }
+    }
+
+    struct epoll_event events[2];
+    epoll_wait(epoll_fd, events, 2, timeout_ms);
+}
+
 /**
  * @brief start a thread listening to peers connecting to us
  * @param t
@@ -115,7 +172,42 @@ int listen_for_peers(struct Torrent * t, struct ThreadPool * tp, struct Queue *
     return EXIT_FAILURE;
 }
 
+/**
+ * @brief start a thread serving the torrents files over http
+ * @param s
+ * @param tp
+ * @return
+ */
+int serve_http(struct HttpServer * s, struct ThreadPool * tp) {
+    struct JobArg args[1] = {
+            {
+                    .arg = (void *) s,
+                    .mutex = NULL
+            }
+    };
+    struct Job * j = job_new(
+            &http_server_run,
+            sizeof(args) / sizeof(struct JobArg),
+            args
+    );
+    if (!j) {
+        throw("job failed to init");
+    }
+    return thread_pool_add_job(tp, j);
+    error:
+    return EXIT_FAILURE;
+}
+
 int main(int argc, char *argv[]) {
+    int epoll_fd = -1;
+
+    /* set up the eventfd that wakes the main loop, before any signal can need it */
+    main_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (main_wake_fd == -1) {
+        log_error("failed to create main loop eventfd");
+        exit(EXIT_FAILURE);
+    }
+
     /* set up sigint handler */
     struct sigaction a;
     a.sa_handler = SIGINT_handle;
@@ -165,27 +257,89 @@ int main(int argc, char *argv[]) {
     if (!t) {
         throw("torrent failed to initialize");
     }
+    if (options.max_open_files > 0) {
+        torrent_data_set_max_open_files(t->torrent_data, options.max_open_files);
+    }
+    if (options.mmap_storage == 1) {
+        torrent_data_set_storage(t->torrent_data, TORRENT_DATA_STORAGE_MMAP);
+    }
+    if (options.piece_memory > 0) {
+        torrent_data_set_piece_memory(t->torrent_data, (size_t) options.piece_memory * 1024 * 1024);
+    }
+    torrent_data_set_piece_picker(t->torrent_data, (enum PiecePickerPolicy) options.piece_picker, 0);
+    if (options.stream_window > 0) {
+        torrent_data_set_stream(t->torrent_data, options.stream_window, options.stream_piece_ms);
+    }
+
+    /* skip fetching the metadata if we already have it */
+    if (torrent_load_cached_metadata(t) == EXIT_FAILURE) {
+        log_warn("failed to use cached metadata");
+    }
 
     /* initialize queue for receiving peers */
     struct Queue * peer_queue = queue_new();
 
     /* initialize queue for receiving metadata chunks */
-    struct Queue * metadata_queue = queue_new();
+    struct MessageRing * metadata_queue = message_ring_new(MAIN_METADATA_QUEUE_SIZE);
+
+    /* initialize queue for receiving file chunks, peers hold off requesting more while it's congested */
+    struct MessageRing * data_queue = message_ring_new(MAIN_DATA_QUEUE_SIZE);
+
+    void * messages[MAIN_DRAIN_BATCH];
 
-    /* initialize queue for receiving file chunks */
-    struct Queue * data_queue = queue_new();
+    /* the main loop sleeps in epoll until one of the queues, stdin or a signal wakes it */
+    queue_set_wake_fd(peer_queue, main_wake_fd);
+    queue_set_wake_fd(t->torrent_data->verified_queue, main_wake_fd);
+    message_ring_set_wake_fd(metadata_queue, main_wake_fd);
+    message_ring_set_wake_fd(data_queue, main_wake_fd);
 
-    /* initialize thread pool */
-    tp = thread_pool_new(10);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        throw("failed to create main loop epoll");
+    }
+    struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.fd = main_wake_fd
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, main_wake_fd, &event) == -1) {
+        throw("failed to watch main loop eventfd");
+    }
+    // stdin may be a file or /dev/null, which epoll can't watch. q + enter is then picked up on the next wake
+    event.data.fd = STDIN_FILENO;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event);
+
+    /* initialize thread pool, reactors, hashers and the http server each hold a thread for as long as we run */
+    tp = thread_pool_new(11 + TORRENT_VERIFIER_COUNT);
     if (!tp) {
         throw("thread pool failed to init");
     }
 
+    /* start the reactors that run our peers */
+    if (torrent_start_reactors(t, tp, metadata_queue, data_queue) == EXIT_FAILURE) {
+        throw("failed to start peer reactors");
+    }
+
+    /* start the hashers that verify completed pieces */
+    if (torrent_start_verifiers(t, tp) == EXIT_FAILURE) {
+        throw("failed to start piece verifiers");
+    }
+
     /* listen for connecting peers */
     if (listen_for_peers(t, tp, peer_queue) == EXIT_FAILURE) {
         throw("failed to listen for peers");
     }
 
+    /* serve the files to players while they download */
+    if (options.http_port > 0) {
+        http_server = http_server_new(t->torrent_data, options.http_port, options.http_remote);
+        if (http_server == NULL) {
+            throw("failed to start http server");
+        }
+        if (serve_http(http_server, tp) == EXIT_FAILURE) {
+            throw("failed to serve http");
+        }
+    }
+
     /* if we're in debug mode, initialize a peer on localhost.
      *
      * this allows us to simulate 2 sides of a peer connection
@@ -203,6 +357,9 @@ int main(int argc, char *argv[]) {
     while (running) {
         /* STATE MANAGEMENT */
 
+        // everything below takes the time from now_cached, one clock read per loop
+        now_update();
+
         // run any trackers that have actions to perform
         if (options.debug == 0) {
             torrent_run_trackers(t, tp, peer_queue);
@@ -214,77 +371,122 @@ int main(int argc, char *argv[]) {
             torrent_add_peer(t, tp, p);
         }
 
-        // run any peers that have actions to perform
+        // peers are ran by the reactors, we only decide who gets to upload
         torrent_assign_upload_slots(t);
-        torrent_run_peers(t, tp, metadata_queue, data_queue);
+
+        // keep the streaming window in front of the reader, fed by the fastest peers
+        torrent_rate_peers(t);
+        torrent_data_update_stream(t->torrent_data);
 
         // update metadata with chunks from peers
         torrent_data_release_expired_claims(t->torrent_metadata);
-        if (queue_get_count(metadata_queue) > 0) {
-            struct PEER_MSG_EXTENSION * metadata_msg = (struct PEER_MSG_EXTENSION *) queue_pop(metadata_queue);
-            torrent_process_metadata_piece(t, metadata_msg);
-            free(metadata_msg);
+        size_t message_count = message_ring_pop_batch(metadata_queue, messages, MAIN_DRAIN_BATCH);
+        for (size_t i = 0; i < message_count; i++) {
+            torrent_process_metadata_piece(t, (struct PEER_MSG_EXTENSION *) messages[i]);
+            free(messages[i]);
         }
 
         // update files with chunks from peers
         torrent_data_release_expired_claims(t->torrent_data);
-        if (queue_get_count(data_queue) > 0) {
-            struct PEER_MSG_PIECE * data_msg = (struct PEER_MSG_PIECE *) queue_pop(data_queue);
-            torrent_process_data_chunk(t, data_msg);
-            free(data_msg);
+        int congested = message_ring_is_congested(data_queue);
+        message_count = message_ring_pop_batch(data_queue, messages, MAIN_DRAIN_BATCH);
+        for (size_t i = 0; i < message_count; i++) {
+            torrent_process_data_chunk(t, (struct PEER_MSG_PIECE *) messages[i]);
+            free(messages[i]);
         }
 
+        // peers stopped requesting or reading while we were behind, let them carry on straight away
+        int caught_up = message_ring_reset_full(metadata_queue) | message_ring_reset_full(data_queue);
+        if (caught_up == 1 || (congested == 1 && message_ring_is_congested(data_queue) == 0)) {
+            torrent_wake_reactors(t);
+        }
+
+        // tell peers about pieces the hashers verified
+        torrent_process_verified_pieces(t);
+
+        // remember what we have in case we're restarted
+        torrent_save_resume(t, 0);
+
         // display some kind of progress
         if (stdin_available()) {
             if (running == 1) {
-                char c = getchar();
-                if (c == 'q') {
+                char line[64];
+                if (fgets(line, sizeof(line), stdin) == NULL) {
+                    // stdin closed, stop it waking us
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    line[0] = '\0';
+                }
+
+                if (line[0] == 'q') {
                     running = 0;
+                } else if (line[0] == 's') {
+                    // s <byte offset> moves the stream cursor
+                    torrent_data_set_stream_position(t->torrent_data, strtoull(&line[1], NULL, 10));
                 }
             }
         }
+
+        // nothing left to do, sleep until there is
+        wait_for_work(epoll_fd, metadata_queue, data_queue, peer_queue);
     }
 
     thread_pool_free(tp);
+    http_server_free(http_server);
+
+    // nothing writes to the files anymore, so the saved mtimes will match on the next start
+    torrent_save_resume(t, 1);
 
     while(queue_get_count(peer_queue) > 0) {
         struct Peer * p = (struct Peer *) queue_pop(peer_queue);
         peer_free(p);
     }
 
-    while(queue_get_count(metadata_queue) > 0) {
-        struct PEER_MSG_EXTENSION * metadata_msg = (struct PEER_MSG_EXTENSION *) queue_pop(metadata_queue);
-        free(metadata_msg);
+    void * msg = NULL;
+    while((msg = message_ring_pop(metadata_queue)) != NULL) {
+        free(msg);
     }
 
-    while(queue_get_count(data_queue) > 0) {
-        struct PEER_MSG_PIECE * data_msg = (struct PEER_MSG_PIECE *) queue_pop(data_queue);
-        free(data_msg);
+    while((msg = message_ring_pop(data_queue)) != NULL) {
+        free(msg);
     }
 
     queue_free(peer_queue);
-    queue_free(metadata_queue);
-    queue_free(data_queue);
+    message_ring_free(metadata_queue);
+    message_ring_free(data_queue);
 
     torrent_free(t);
 
+    close(epoll_fd);
+    close(main_wake_fd);
+
     return EXIT_SUCCESS;
 
     error:
     thread_pool_free(tp);
+    http_server_free(http_server);
 
     while(queue_get_count(peer_queue) > 0) {
         struct Peer * p = (struct Peer *) queue_pop(peer_queue);
         peer_free(p);
     }
 
-    while(queue_get_count(metadata_queue) > 0) {
-        struct PEER_EXTENSION * metadata_msg = queue_pop(metadata_queue);
-        free(metadata_msg);
+    while(metadata_queue != NULL && (msg = message_ring_pop(metadata_queue)) != NULL) {
+        free(msg);
+    }
+
+    while(data_queue != NULL && (msg = message_ring_pop(data_queue)) != NULL) {
+        free(msg);
     }
 
     queue_free(peer_queue);
+    message_ring_free(metadata_queue);
+    message_ring_free(data_queue);
 
     torrent_free(t);
+
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    close(main_wake_fd);
     return EXIT_FAILURE;
 }
@@ -0,0 +1,211 @@
+#include "message_ring.h"
+#include "../log.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+
+/* PRIVATE FUNCTIONS */
+static void message_ring_futex_wait(_Atomic uint32_t * addr, uint32_t value, int timeout_ms) {
+    struct timespec timeout = {
+            .tv_sec = timeout_ms / 1000,
+            .tv_nsec = (timeout_ms % 1000) * 1000000
+    };
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, value, &timeout, NULL, 0);
+}
+
+static void message_ring_futex_wake(_Atomic uint32_t * addr, int count) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * @brief only the first producer to see the consumer waiting wakes it
+ */
+static void message_ring_wake_consumer(struct MessageRing * r) {
+    int waiting = 1;
+    if (atomic_load(&r->consumer_waiting) == 1 && atomic_compare_exchange_strong(&r->consumer_waiting, &waiting, 0)) {
+        if (r->wake_fd != -1) {
+            eventfd_write(r->wake_fd, 1);
+        } else {
+            atomic_fetch_add(&r->message_seq, 1);
+            message_ring_futex_wake(&r->message_seq, 1);
+        }
+    }
+}
+
+/**
+ * @brief claim a slot and publish the message to it
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the ring is full
+ */
+static int message_ring_try_push(struct MessageRing * r, void * message) {
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    struct MessageRingSlot * slot = NULL;
+
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the consumer hasn't taken the message from the previous lap yet
+            return EXIT_FAILURE;
+        } else {
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->message = message;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    return EXIT_SUCCESS;
+}
+
+/* MESSAGE RING */
+struct MessageRing * message_ring_new(size_t capacity) {
+    struct MessageRing * r = NULL;
+
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    r = aligned_alloc(_Alignof(struct MessageRing), sizeof(struct MessageRing));
+    if (!r) {
+        throw("message ring failed to malloc");
+    }
+    r->mask = size - 1;
+    r->congested = (size_t) (size * MESSAGE_RING_CONGESTED);
+    r->slots = malloc(sizeof(struct MessageRingSlot) * size);
+    if (!r->slots) {
+        throw("message ring slots failed to malloc");
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&r->slots[i].sequence, i);
+        r->slots[i].message = NULL;
+    }
+    atomic_init(&r->enqueue_pos, 0);
+    atomic_init(&r->full, 0);
+    atomic_init(&r->dequeue_pos, 0);
+    atomic_init(&r->message_seq, 0);
+    atomic_init(&r->consumer_waiting, 0);
+    r->wake_fd = -1;
+
+    return r;
+    error:
+    return message_ring_free(r);
+}
+
+int message_ring_push(struct MessageRing * r, void * message) {
+    if (message_ring_try_push(r, message) == EXIT_FAILURE) {
+        // mark it before looking for the consumer, so it either sees the mark or is woken
+        atomic_store(&r->full, 1);
+        message_ring_wake_consumer(r);
+        return EXIT_FAILURE;
+    }
+
+    message_ring_wake_consumer(r);
+
+    return EXIT_SUCCESS;
+}
+
+void * message_ring_pop(struct MessageRing * r) {
+    void * message = NULL;
+    if (message_ring_pop_batch(r, &message, 1) == 0) {
+        return NULL;
+    }
+    return message;
+}
+
+size_t message_ring_pop_batch(struct MessageRing * r, void ** messages, size_t max_messages) {
+    size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    size_t count = 0;
+
+    while (count < max_messages) {
+        struct MessageRingSlot * slot = &r->slots[pos & r->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (sequence != pos + 1) {
+            // nothing published to the slot yet
+            break;
+        }
+
+        messages[count] = slot->message;
+        count++;
+        // free for the producers of the next lap
+        atomic_store_explicit(&slot->sequence, pos + r->mask + 1, memory_order_release);
+        pos++;
+    }
+
+    if (count > 0) {
+        atomic_store(&r->dequeue_pos, pos);
+    }
+
+    return count;
+}
+
+int message_ring_wait(struct MessageRing * r, int timeout_ms) {
+    if (message_ring_get_count(r) > 0) {
+        return 1;
+    }
+
+    // announce we're waiting before looking again, so a message pushed in between always wakes us
+    uint32_t message_seq = atomic_load(&r->message_seq);
+    atomic_store(&r->consumer_waiting, 1);
+    if (message_ring_get_count(r) == 0) {
+        message_ring_futex_wait(&r->message_seq, message_seq, timeout_ms);
+    }
+    atomic_store(&r->consumer_waiting, 0);
+
+    return message_ring_get_count(r) > 0;
+}
+
+void message_ring_set_wake_fd(struct MessageRing * r, int wake_fd) {
+    r->wake_fd = wake_fd;
+}
+
+int message_ring_prepare_wait(struct MessageRing * r) {
+    // announce we're waiting before looking, so a message pushed in between always writes to the eventfd
+    atomic_store(&r->consumer_waiting, 1);
+    if (message_ring_get_count(r) > 0 || atomic_load(&r->full) == 1) {
+        atomic_store(&r->consumer_waiting, 0);
+        return 1;
+    }
+    return 0;
+}
+
+int message_ring_reset_full(struct MessageRing * r) {
+    if (atomic_load(&r->full) == 0 || message_ring_is_congested(r) == 1) {
+        return 0;
+    }
+    return atomic_exchange(&r->full, 0);
+}
+
+size_t message_ring_get_count(struct MessageRing * r) {
+    size_t dequeue_pos = atomic_load(&r->dequeue_pos);
+    size_t enqueue_pos = atomic_load(&r->enqueue_pos);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+int message_ring_is_congested(struct MessageRing * r) {
+    return message_ring_get_count(r) >= r->congested;
+}
+
+struct MessageRing * message_ring_free(struct MessageRing * r) {
+    if (r) {
+        if (r->slots) {
+            free(r->slots);
+            r->slots = NULL;
+        }
+        free(r);
+        r = NULL;
+    }
+
+    return r;
+}
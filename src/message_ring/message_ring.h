@@ -0,0 +1,135 @@
+/**
+ * @file message_ring/message_ring.h
+ *
+ * @brief bounded lock free multi producer single consumer ring, used to hand messages from the peer reactors to the main
+ *        thread. the reactors push PIECE and ut_metadata messages as they arrive, the main thread takes them in batches.
+ *
+ *        - slots are allocated up front, pushing never mallocs or takes a lock. each slot carries a sequence number
+ *          saying whether it's free or holds a message for the current lap of the ring
+ *        - the consumer can block in message_ring_wait until a message arrives, producers only make a syscall to wake
+ *          it when it's actually waiting. a consumer waiting on more than the ring instead sets a wake eventfd and
+ *          calls message_ring_prepare_wait before blocking in epoll, see main.c
+ *        - once MESSAGE_RING_CONGESTED of the ring is in use it counts as congested, and peers stop sending new
+ *          requests until the main thread catches up. see peer_should_send_msg_request
+ *        - pushing to a full ring fails straight away, a reactor can't afford to sleep. the producer holds on to the
+ *          message, and the ring remembers it was full until the consumer has caught up. see message_ring_reset_full
+ *
+ * @warning message_ring_pop, message_ring_pop_batch and message_ring_wait may only be called by the consuming thread
+ *
+ * @see http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+#ifndef UVGTORRENT_C_MESSAGE_RING_H
+#define UVGTORRENT_C_MESSAGE_RING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define MESSAGE_RING_CONGESTED 0.75 // share of the ring in use at which it counts as congested
+
+struct MessageRingSlot {
+    _Atomic size_t sequence;
+    void * message;
+};
+
+struct MessageRing {
+    size_t mask; // capacity - 1, capacity is a power of 2
+    size_t congested; // slots in use at which the ring is congested
+    struct MessageRingSlot * slots;
+
+    /* producers and the consumer each get their own cache line */
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Atomic int full; // a push failed since message_ring_reset_full last found the ring caught up
+
+    _Alignas(64) _Atomic size_t dequeue_pos;
+    _Atomic uint32_t message_seq; // futex word the consumer sleeps on
+    _Atomic int consumer_waiting;
+    int wake_fd; // eventfd written to instead of the futex when set, -1 for none
+};
+
+/**
+ * @brief mallocs a new MessageRing
+ * @param capacity most messages the ring holds, rounded up to a power of 2
+ * @return struct MessageRing * on success, NULL on failure
+ */
+extern struct MessageRing * message_ring_new(size_t capacity);
+
+/**
+ * @brief add a message to the ring, waking the consumer if it's waiting. never blocks
+ * @note a failed push marks the ring full and wakes the consumer, so it gets to message_ring_reset_full
+ * @param r
+ * @param message
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the ring is full. the caller still owns message on failure
+ */
+extern int message_ring_push(struct MessageRing * r, void * message);
+
+/**
+ * @brief take the oldest message from the ring
+ * @param r
+ * @return the message, NULL if the ring is empty
+ */
+extern void * message_ring_pop(struct MessageRing * r);
+
+/**
+ * @brief take up to max_messages of the oldest messages from the ring
+ * @param r
+ * @param messages set to the messages taken, oldest first
+ * @param max_messages
+ * @return number of messages taken
+ */
+extern size_t message_ring_pop_batch(struct MessageRing * r, void ** messages, size_t max_messages);
+
+/**
+ * @brief block until the ring has a message in it
+ * @param r
+ * @param timeout_ms longest to wait
+ * @return 1 if there's a message, 0 if the wait timed out
+ */
+extern int message_ring_wait(struct MessageRing * r, int timeout_ms);
+
+/**
+ * @brief have producers wake the consumer by writing to an eventfd, rather than the futex message_ring_wait sleeps on
+ * @note set it before any producers start
+ * @param r
+ * @param wake_fd eventfd, -1 to go back to the futex
+ */
+extern void message_ring_set_wake_fd(struct MessageRing * r, int wake_fd);
+
+/**
+ * @brief announce the consumer is about to block on the wake eventfd, so the next push writes to it
+ * @param r
+ * @return 1 if there's already a message in the ring or a push failed, and the consumer shouldn't block. 0 otherwise
+ */
+extern int message_ring_prepare_wait(struct MessageRing * r);
+
+/**
+ * @brief once the ring is no longer congested, clear the mark left by failed pushes. the consumer then lets the
+ *        producers know there's room again
+ * @param r
+ * @return 1 if a push failed since the last reset and the ring has room now, 0 otherwise
+ */
+extern int message_ring_reset_full(struct MessageRing * r);
+
+/**
+ * @brief number of messages in the ring
+ * @note only a snapshot while producers are pushing
+ * @param r
+ * @return
+ */
+extern size_t message_ring_get_count(struct MessageRing * r);
+
+/**
+ * @brief is enough of the ring in use that producers should slow down?
+ * @param r
+ * @return 1 if congested, 0 otherwise
+ */
+extern int message_ring_is_congested(struct MessageRing * r);
+
+/**
+ * @brief free the given ring. messages still in it are not freed
+ * @param r
+ * @return r after freeing, NULL on success
+ */
+extern struct MessageRing * message_ring_free(struct MessageRing * r);
+
+#endif //UVGTORRENT_C_MESSAGE_RING_H
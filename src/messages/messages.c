@@ -46,5 +46,26 @@ options() {
                     "\t\tfolder to save the torrent to\n\n");
     fprintf(stdout, GRAY "\t-o|--port\n" NO_COLOR
                     "\t\tport to listen for peers on\n\n");
+    fprintf(stdout, GRAY "\t-f|--max_open_files\n" NO_COLOR
+                    "\t\tmost files to keep open at once, for torrents with a lot of files\n\n");
+    fprintf(stdout, GRAY "\t-s|--storage\n" NO_COLOR
+                    "\t\thow to store torrent data, file (default) or mmap\n\n");
+    fprintf(stdout, GRAY "\t-b|--piece_memory\n" NO_COLOR
+                    "\t\thard limit in megabytes on memory for pieces being downloaded with file storage,\n"
+                    "\t\tpartial pieces past it are spilled to disk\n\n");
+    fprintf(stdout, GRAY "\t-k|--picker\n" NO_COLOR
+                    "\t\thow to pick pieces to download, sequential (default), window (in order near the start,\n"
+                    "\t\trarest first after that) or rarest\n\n");
+    fprintf(stdout, GRAY "\t-w|--stream\n" NO_COLOR
+                    "\t\tstream the torrent, giving the given number of pieces past the read cursor deadlines.\n"
+                    "\t\tmove the cursor by typing s <byte offset> + enter\n\n");
+    fprintf(stdout, GRAY "\t-e|--stream_deadline\n" NO_COLOR
+                    "\t\tmilliseconds between the deadlines of consecutive pieces while streaming, 1000 by default\n\n");
+    fprintf(stdout, GRAY "\t-t|--http_port\n" NO_COLOR
+                    "\t\tserve the torrents files over http on the given port while they download, with range\n"
+                    "\t\trequests for seeking. e.g. curl http://127.0.0.1:<port>/0 for the first file\n\n");
+    fprintf(stdout, GRAY "\t-r|--http_remote\n" NO_COLOR
+                    "\t\tlet other machines on the network reach the http server, which has no authentication.\n"
+                    "\t\tby default it only listens on 127.0.0.1\n\n");
 
 }
@@ -3,7 +3,6 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
-#include <stdarg.h>
 #include "../thread_pool/thread_pool.h"
 #include "../net_utils/net_utils.h"
 #include "../bitfield/bitfield.h"
@@ -13,14 +12,13 @@ void peer_reset(struct Peer * p) {
     p->ut_metadata = 0;
     p->ut_metadata_size = 0;
 
-    p->running = 0;
     p->am_choking = 1;
     p->am_interested = 0;
     p->peer_choking = 1;
     p->peer_interested = 0;
 
     p->status = PEER_UNCONNECTED;
-    p->reconnect_deadline = now();
+    p->reconnect_deadline = now_cached();
 
     p->network_ordered_msg_length = 0;
     p->network_ordered_msg_length_loaded = 0;
@@ -31,6 +29,16 @@ void peer_reset(struct Peer * p) {
 
     p->msg_bitfield_sent = 0;
     p->pending_request_count = 0;
+    p->cancel_epoch = 0;
+    p->request_depth = ATOMIC_VAR_INIT(PEER_REQUEST_DEPTH);
+    p->rtt_ms = ATOMIC_VAR_INIT(0);
+    p->request_rate = 0.00;
+    p->request_bytes = 0;
+    p->request_rate_updated = now_cached();
+
+    p->downloaded = ATOMIC_VAR_INIT(0);
+    p->download_rate = 0.00;
+    p->fast = ATOMIC_VAR_INIT(1);
 }
 
 struct Peer *peer_new(int32_t ip, uint16_t port) {
@@ -50,7 +58,12 @@ struct Peer *peer_new(int32_t ip, uint16_t port) {
 
     p->progress_queue = queue_new();
     p->peer_bitfield = NULL;
+    p->peer_bitfield_counted = NULL;
+    p->requested = NULL;
     p->ut_metadata_requested = NULL;
+    p->held_message = NULL;
+    p->held_queue = NULL;
+    timer_init(&p->timer, NULL, NULL);
 
     char *str_ip = inet_ntoa(p->addr.sin_addr);
     p->str_ip = strndup(str_ip, strlen(str_ip));
@@ -65,6 +78,31 @@ struct Peer *peer_new(int32_t ip, uint16_t port) {
     return peer_free(p);
 }
 
+int64_t peer_get_timeout(struct Peer * p) {
+    int64_t deadline;
+    if (p->socket == NULL) {
+        if (p->status != PEER_UNCONNECTED) {
+            return -1;
+        }
+        deadline = (int64_t) p->reconnect_deadline;
+    } else if (p->status == PEER_HANDSHAKE_COMPLETE) {
+        int64_t quiet_ms = PEER_TIMEOUT_MS < PEER_KEEPALIVE_MS ? PEER_TIMEOUT_MS : PEER_KEEPALIVE_MS;
+        deadline = (int64_t) p->socket->last_download_rate_update + quiet_ms;
+    } else {
+        deadline = (int64_t) p->socket->last_download_rate_update + PEER_HANDSHAKE_TIMEOUT_MS;
+    }
+
+    if (p->socket != NULL && buffered_socket_can_network_read(p->socket) == 1 && p->held_message == NULL) {
+        // the read buffer filled up before the socket was drained, carry on once messages were consumed. peers holding
+        // a message are woken by the torrent once the main thread caught up instead
+        return 0;
+    }
+
+    // the should functions only act once the deadline has passed
+    int64_t timeout = deadline - now_cached() + 1;
+    return timeout > 0 ? timeout : 0;
+}
+
 int peer_should_handle_network_buffers(struct Peer * p) {
     if(p->socket == NULL || p->socket->socket == -1) {
         return 0;
@@ -90,15 +128,20 @@ int peer_handle_network_buffers(struct Peer * p) {
             }
         }
     }
-    if(buffered_socket_can_network_read(p->socket)) {
+    // the socket is edge triggered, keep reading until the kernel buffer is drained
+    while(buffered_socket_can_network_read(p->socket)) {
         int result = buffered_socket_network_read(p->socket);
         if(result == -1) {
             if (errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK && errno != EALREADY) {
                 goto error;
             }
+        } else if(result == 0) {
+            // peer closed the connection, or the read buffer is full. messages already buffered still get handled,
+            // the hangup is picked up the next time network buffers are handled
+            break;
         }
     }
-    
+
     errno = 0;
     return EXIT_SUCCESS;
     error:
@@ -110,37 +153,14 @@ int peer_handle_network_buffers(struct Peer * p) {
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCDFAInspection"
-int peer_run(_Atomic int *cancel_flag, ...) {
-    va_list args;
-    va_start(args, cancel_flag);
-
-    struct JobArg p_job_arg = va_arg(args, struct JobArg);
-    struct Peer *p = (struct Peer *) p_job_arg.arg;
-
-    struct JobArg info_hash_job_arg = va_arg(args, struct JobArg);
-    int8_t(*info_hash)[20] = (int8_t (*)[20]) info_hash_job_arg.arg;
-    int8_t info_hash_hex[20];
-    memcpy(&info_hash_hex, info_hash, sizeof(info_hash_hex));
-
-    struct JobArg metadata_job_arg = va_arg(args, struct JobArg);
-    struct TorrentData * torrent_metadata = (struct TorrentData *) metadata_job_arg.arg;
-
-    struct JobArg data_job_arg = va_arg(args, struct JobArg);
-    struct TorrentData * torrent_data = (struct TorrentData *) data_job_arg.arg;
-
-    struct JobArg metadata_queue_job_arg = va_arg(args, struct JobArg);
-    struct Queue * metadata_queue = (struct Queue *) metadata_queue_job_arg.arg;
-
-    struct JobArg data_queue_job_arg = va_arg(args, struct JobArg);
-    struct Queue * data_queue = (struct Queue *) data_queue_job_arg.arg;
-
+int peer_run(struct Peer * p, int8_t info_hash_hex[20], struct TorrentData * torrent_metadata, struct TorrentData * torrent_data,
+             struct MessageRing * metadata_queue, struct MessageRing * data_queue, _Atomic int * cancel_flag) {
     /* connect */
     if (peer_should_connect(p) == 1) {
         if (peer_connect(p) == EXIT_FAILURE) {
             peer_disconnect(p, __FILE__, __LINE__);
             goto error;
         }
-        sched_yield();
     }
 
     /* handle network, write buffered messages to peer
@@ -157,7 +177,6 @@ int peer_run(_Atomic int *cancel_flag, ...) {
             peer_disconnect(p, __FILE__, __LINE__);
             goto error;
         }
-        sched_yield();
     }
 
     if (peer_should_handle_handshake(p) == 1) {
@@ -167,6 +186,83 @@ int peer_run(_Atomic int *cancel_flag, ...) {
         }
     }
 
+    /* hand over the message the main thread had no room for last time, before reading any more */
+    if (peer_should_push_held_message(p) == 1) {
+        peer_push_held_message(p);
+    }
+
+    /* read incoming messages. peers only run when there's something to do, so handle
+     * everything that's buffered instead of one message per run */
+    while (peer_should_read_message(p) == 1) {
+        void *msg_buffer = peer_read_message(p, cancel_flag);
+        if (msg_buffer == NULL) {
+            break;
+        }
+
+        uint32_t msg_length;
+        uint8_t msg_id;
+        size_t buffer_size;
+
+        get_msg_length(msg_buffer, (uint32_t * ) & msg_length);
+        get_msg_id(msg_buffer, (uint8_t * ) & msg_id);
+        get_msg_buffer_size(msg_buffer, (size_t * ) & buffer_size);
+
+        switch (msg_id) {
+            case MSG_CHOKE:
+                peer_handle_msg_choke(p, msg_buffer);
+                break;
+
+            case MSG_UNCHOKE:
+                peer_handle_msg_unchoke(p, msg_buffer);
+            break;
+
+            case MSG_INTERESTED:
+                peer_handle_msg_interested(p, msg_buffer);
+            break;
+
+            case MSG_NOT_INTERESTED:
+                peer_handle_msg_not_interested(p, msg_buffer);
+            break;
+
+            case MSG_HAVE:
+                peer_handle_msg_have(p, msg_buffer, torrent_data);
+            break;
+
+            case MSG_BITFIELD:
+                peer_handle_msg_bitfield(p, msg_buffer, torrent_data);
+            break;
+
+            case MSG_REQUEST:
+                peer_handle_msg_request(p, msg_buffer, torrent_data);
+            break;
+
+            case MSG_PIECE:
+                peer_handle_msg_piece(p, msg_buffer, torrent_data, data_queue);
+            break;
+
+            case MSG_CANCEL:
+                peer_handle_msg_cancel(p, msg_buffer, torrent_data);
+            break;
+
+            case MSG_PORT:
+                peer_handle_msg_port(p, msg_buffer);
+            break;
+
+            case MSG_EXTENSION:
+                peer_handle_msg_extension(p, msg_buffer, torrent_metadata, metadata_queue);
+            break;
+
+            default:
+                log_error("got unknown msg id %i :: %s:%i", msg_id, p->str_ip, p->port);
+                free(msg_buffer);
+        }
+
+        if (p->socket == NULL) {
+            // handling the message disconnected the peer
+            goto error;
+        }
+    }
+
     /* write messages to buffered tcp socket */
     if(peer_should_send_msg_have(p) == 1) {
         peer_send_msg_have(p, torrent_data);
@@ -181,7 +277,15 @@ int peer_run(_Atomic int *cancel_flag, ...) {
         peer_send_ut_metadata_request(p, torrent_metadata);
     }
 
-    if (peer_should_send_msg_request(p, torrent_data) == 1) {
+    if (peer_should_send_msg_cancel(p, torrent_data) == 1) {
+        peer_send_msg_cancel(p, torrent_data);
+    }
+
+    if (p->status == PEER_HANDSHAKE_COMPLETE) {
+        peer_update_request_depth(p, torrent_data);
+    }
+
+    if (peer_should_send_msg_request(p, torrent_data, data_queue) == 1) {
         peer_send_msg_request(p, torrent_data);
     }
 
@@ -193,70 +297,6 @@ int peer_run(_Atomic int *cancel_flag, ...) {
         }
     }
 
-    /* read incoming messages */
-    if (peer_should_read_message(p) == 1) {
-        void *msg_buffer = peer_read_message(p, cancel_flag);
-        if (msg_buffer != NULL) {
-            uint32_t msg_length;
-            uint8_t msg_id;
-            size_t buffer_size;
-
-            get_msg_length(msg_buffer, (uint32_t * ) & msg_length);
-            get_msg_id(msg_buffer, (uint8_t * ) & msg_id);
-            get_msg_buffer_size(msg_buffer, (size_t * ) & buffer_size);
-
-            switch (msg_id) {
-                case MSG_CHOKE:
-                    peer_handle_msg_choke(p, msg_buffer);
-                    break;
-
-                case MSG_UNCHOKE:
-                    peer_handle_msg_unchoke(p, msg_buffer);
-                break;
-
-                case MSG_INTERESTED:
-                    peer_handle_msg_interested(p, msg_buffer);
-                break;
-
-                case MSG_NOT_INTERESTED:
-                    peer_handle_msg_not_interested(p, msg_buffer);
-                break;
-
-                case MSG_HAVE:
-                    peer_handle_msg_have(p, msg_buffer, torrent_data);
-                break;
-
-                case MSG_BITFIELD:
-                    peer_handle_msg_bitfield(p, msg_buffer, torrent_data);
-                break;
-
-                case MSG_REQUEST:
-                    peer_handle_msg_request(p, msg_buffer, torrent_data);
-                break;
-
-                case MSG_PIECE:
-                    peer_handle_msg_piece(p, msg_buffer, data_queue);
-                break;
-
-                case MSG_CANCEL:
-                    peer_handle_msg_cancel(p, msg_buffer);
-                break;
-
-                case MSG_PORT:
-                    peer_handle_msg_port(p, msg_buffer);
-                break;
-
-                case MSG_EXTENSION:
-                    peer_handle_msg_extension(p, msg_buffer, torrent_metadata, metadata_queue);
-                break;
-
-                default:
-                    log_error("got unknown msg id %i :: %s:%i", msg_id, p->str_ip, p->port);
-                    free(msg_buffer);
-            }
-        }
-    }
-
     if(peer_should_send_keepalive(p) == 1) {
         peer_send_keepalive(p);
     }
@@ -273,10 +313,8 @@ int peer_run(_Atomic int *cancel_flag, ...) {
         }
     }
 
-    p->running = 0;
     return EXIT_SUCCESS;
     error:
-    p->running = 0;
     return EXIT_FAILURE;
 }
 #pragma clang diagnostic pop
@@ -9,11 +9,9 @@
  *       pattern of first calling a "peer_should_take_action()" function to see if the current state calls for an associated
  *       action, and then calling "peer_take_action()" if the should function returned 1.
  *
- *       the peer struct also provides a "peer_should_run()" function for torrent/torrent.h to use to determine if
- *       a peer_run job needs to be scheduled.
- *
- * @note it's important any time you exit the peer_run function to set p->running = 0; so that the peer
- *       can be scheduled again as needed.
+ * @note peers are owned and ran by a reactor (see reactor/reactor.h). peer_run is called when the peers socket
+ *       becomes ready, when it's timer fires or when the reactor ticks, and is never called for the same peer from two
+ *       threads.
  *
  * @note check out peer_should_handle_network_buffers & peer_handle_network_buffers. if these functions aren't part of
  *       peer_should_run and peer_run the peer won't do anything as it wont see any data in it's buffered_sockets buffers
@@ -26,12 +24,28 @@
 #include <netinet/ip.h>
 #include <stdint.h>
 #include "../thread_pool/queue.h"
+#include "../message_ring/message_ring.h"
 #include "../torrent/torrent_data.h"
 #include "../buffered_socket/buffered_socket.h"
+#include "../deadline/timer_wheel.h"
 
 #define METADATA_PIECE_SIZE 262144
 #define METADATA_CHUNK_SIZE 16384
 #define UT_METADATA_ID 3
+#define PEER_MAX_MSG_LENGTH (1024 * 1024) // longer messages are refused, fits the bitfield of 8 million pieces. has to fit in BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY
+
+/* request pipeline, see peer_request_depth */
+#define PEER_REQUEST_DEPTH 10 // requests kept outstanding until the peers rate is known
+#define PEER_REQUEST_DEPTH_MIN 4
+#define PEER_REQUEST_DEPTH_MAX 256
+#define PEER_REQUEST_QUEUE_MS 1000 // data requested on top of what fits in one round trip, in milliseconds of download time
+#define PEER_REQUEST_DEPTH_INTERVAL_MS 1000 // how often the rate is measured and the depth adapted
+
+/* time based work, see peer_get_timeout */
+#define PEER_RECONNECT_MS (30 * 1000) // wait after a disconnect before connecting again
+#define PEER_HANDSHAKE_TIMEOUT_MS (10 * 1000) // connections that haven't finished the handshake by then are dropped
+#define PEER_KEEPALIVE_MS (2 * 60 * 1000) // send a keepalive once nothing was received for this long
+#define PEER_TIMEOUT_MS ((2 * 60 * 1000) - 500) // drop handshaken connections once nothing was received for this long
 
 enum PeerStatus {
     PEER_UNCONNECTED,
@@ -53,16 +67,17 @@ struct Peer {
     struct Bitfield * ut_metadata_requested;
     int ut_metadata_size;
 
-    int running;
     int am_choking;
     int am_interested;
     int peer_choking;
     int peer_interested;
     struct Bitfield * peer_bitfield;
+    struct TorrentData * peer_bitfield_counted; // torrent_data the pieces in peer_bitfield are counted in, NULL until they are
     struct Queue * progress_queue; // queue storing piece_ids that have been completed
 
     enum PeerStatus status;
     uint64_t reconnect_deadline; // when we should next attempt reconnection
+    struct Timer timer; // runs the peer when it's next due to reconnect, time out or send a keepalive. owned by the reactor
 
     /* msg reading stuff */
     // keeps the state of the current message being received so the peer can handle partial reads
@@ -70,6 +85,8 @@ struct Peer {
     int network_ordered_msg_length_loaded;
     uint8_t msg_id;
     int msg_id_loaded;
+    void * held_message; // message a full queue to the main thread had no room for, no more are read until it's handed over
+    struct MessageRing * held_queue; // queue held_message goes to
 
     /* upload stuff */
     _Atomic int uploader;
@@ -77,6 +94,18 @@ struct Peer {
     /* msg sending stuff */
     int msg_bitfield_sent; // have i sent the bitfield?
     int pending_request_count; // number of pending piece messages we're waiting for
+    struct Bitfield * requested; // chunks requested from the peer that haven't arrived yet
+    _Atomic int request_depth; // most requests kept outstanding, adapted to the peers rate and round trip time
+    _Atomic int rtt_ms; // round trip time of the connection, 0 until it's known
+    float request_rate; // bytes per second of chunks received, smoothed
+    uint64_t request_bytes; // bytes of chunks received since request_rate was last updated
+    int64_t request_rate_updated;
+    int cancel_epoch; // torrent_data cancel_epoch when requested was last checked for chunks someone else delivered
+
+    /* download speed */
+    _Atomic uint64_t downloaded; // bytes of chunks received since the torrent last measured the peer
+    float download_rate; // bytes per second of chunks received, measured by the torrent
+    _Atomic int fast; // set by the torrent for the fastest peers, only they're given pieces in the streaming window
 };
 
 #include "peer_connect.h"
@@ -104,12 +133,27 @@ extern int peer_should_handle_network_buffers(struct Peer * p);
 extern int peer_handle_network_buffers(struct Peer * p);
 
 /**
- * @brief peer main loop
+ * @brief run the peer state machine once. handles network buffers, handshakes, all buffered messages and
+ *        any messages the current state calls for sending
+ * @param p
+ * @param info_hash_hex
+ * @param torrent_metadata
+ * @param torrent_data
+ * @param metadata_queue queue to return metadata chunks to the main thread
+ * @param data_queue queue to return data chunks to the main thread
  * @param cancel_flag
- * @param ...
- * @return
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int peer_run(struct Peer * p, int8_t info_hash_hex[20], struct TorrentData * torrent_metadata, struct TorrentData * torrent_data,
+                    struct MessageRing * metadata_queue, struct MessageRing * data_queue, _Atomic int * cancel_flag);
+
+/**
+ * @brief how long until the peer next has time based work to do: reconnecting, timing out or sending a keepalive. the
+ *        reactor runs the peer again by then, even if it's socket stays quiet
+ * @param p
+ * @return milliseconds, -1 if there's nothing to wait for
  */
-extern int peer_run(_Atomic int * cancel_flag, ...);
+extern int64_t peer_get_timeout(struct Peer * p);
 
 /**
  * @brief free the given peer struct
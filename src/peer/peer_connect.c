@@ -11,7 +11,7 @@ void peer_set_socket(struct Peer *p, struct BufferedSocket * socket) {
 }
 
 int peer_should_connect(struct Peer *p) {
-    return (p->status == PEER_UNCONNECTED && p->reconnect_deadline < now());
+    return (p->status == PEER_UNCONNECTED && (int64_t) p->reconnect_deadline < now_cached());
 }
 
 int peer_connect(struct Peer *p) {
@@ -19,7 +19,7 @@ int peer_connect(struct Peer *p) {
 
     p->socket = buffered_socket_new((struct sockaddr *) &p->addr);
 
-    if(buffered_socket_connect(p->socket) == -1) {
+    if(buffered_socket_connect(p->socket) == EXIT_FAILURE) {
         goto error;
     }
 
@@ -30,7 +30,7 @@ int peer_connect(struct Peer *p) {
     error:
 
     p->status = PEER_UNCONNECTED;
-    buffered_socket_free(p->socket);
+    p->socket = buffered_socket_free(p->socket);
     return EXIT_FAILURE;
 }
 
@@ -40,13 +40,34 @@ void peer_disconnect(struct Peer *p, char * file, int line) {
         p->socket = NULL;
     }
 
+    // the peer doesn't have anything for us anymore, it sends a new bitfield if it reconnects
+    if (p->peer_bitfield != NULL) {
+        if (p->peer_bitfield_counted != NULL) {
+            torrent_data_remove_peer_pieces(p->peer_bitfield_counted, p->peer_bitfield);
+            p->peer_bitfield_counted = NULL;
+        }
+        p->peer_bitfield = bitfield_free(p->peer_bitfield);
+    }
+
+    // the main thread never gets it, the chunk is requested again once it's claim expires
+    if (p->held_message != NULL) {
+        free(p->held_message);
+        p->held_message = NULL;
+        p->held_queue = NULL;
+    }
+
+    // whatever we asked for isn't coming
+    if (p->requested != NULL) {
+        p->requested = bitfield_free(p->requested);
+    }
+
     if(p->status >= PEER_HANDSHAKE_COMPLETE) {
         log_warn(RED"peer disconnected %s:%d %s :: %s:%i"NO_COLOR, file, line, clean_errno(), p->str_ip, p->port);
     }
 
     peer_reset(p);
 
-    p->reconnect_deadline = now() + (30 * 1000);
+    p->reconnect_deadline = now_cached() + PEER_RECONNECT_MS;
 }
 
 int peer_should_send_handshake(struct Peer *p) {
@@ -4,10 +4,42 @@
 #include "../bencode/bencode.h"
 #include "../deadline/deadline.h"
 
-#define REQUEST_MSG_QUEUE_LENGTH 10
+#define MAX_REQUEST_LENGTH (128 * 1024) // largest block we're willing to send for a single request
+#define MAX_REQUEST_SEGMENTS 16 // most files a single requested block may span
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+/**
+ * @brief tag the write buffers of a piece message are queued with, so a cancel can find them
+ */
+static uint64_t peer_block_tag(uint32_t network_ordered_index, uint32_t network_ordered_begin) {
+    // + 1 keeps the tag of block 0 of piece 0 from being 0, which can't be cancelled
+    return (((uint64_t) net_utils.ntohl(network_ordered_index) << 32) | net_utils.ntohl(network_ordered_begin)) + 1;
+}
 
 int peer_should_read_message(struct Peer *p) {
-    return (p->status == PEER_HANDSHAKE_COMPLETE) && (buffered_socket_can_read(p->socket));
+    return (p->status == PEER_HANDSHAKE_COMPLETE) && (buffered_socket_can_read(p->socket)) && (p->held_message == NULL);
+}
+
+void peer_queue_message(struct Peer * p, struct MessageRing * queue, void * msg_buffer) {
+    if (message_ring_push(queue, msg_buffer) == EXIT_FAILURE) {
+        // the main thread is behind, don't read anything more until it took this one
+        p->held_message = msg_buffer;
+        p->held_queue = queue;
+    }
+}
+
+int peer_should_push_held_message(struct Peer * p) {
+    return p->held_message != NULL;
+}
+
+int peer_push_held_message(struct Peer * p) {
+    if (message_ring_push(p->held_queue, p->held_message) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    p->held_message = NULL;
+    p->held_queue = NULL;
+    return EXIT_SUCCESS;
 }
 
 void *peer_read_message(struct Peer *p, _Atomic int *cancel_flag) {
@@ -53,6 +85,11 @@ void *peer_read_message(struct Peer *p, _Atomic int *cancel_flag) {
     uint32_t msg_length = net_utils.ntohl(p->network_ordered_msg_length);
     if(msg_length == 0) {
         return NULL;
+    } else if(msg_length > PEER_MAX_MSG_LENGTH) {
+        // it could never fit in the read buffer
+        log_error("got msg of %" PRIu32 " bytes, more than %i :: %s:%i", msg_length, PEER_MAX_MSG_LENGTH, p->str_ip, p->port);
+        peer_disconnect(p, __FILE__, __LINE__);
+        return NULL;
     }
 
     size_t buffer_size = sizeof(msg_length) + msg_length;
@@ -120,7 +157,7 @@ int peer_should_send_keepalive(struct Peer *p) {
     if(p->socket == NULL) {
         return 0;
     }
-    return (p->status == PEER_HANDSHAKE_COMPLETE && p->socket->last_download_rate_update < now() - ((60 * 1000) * 2)); // send keepalive every 2 minutes
+    return (p->status == PEER_HANDSHAKE_COMPLETE && now_cached() - (int64_t) p->socket->last_download_rate_update > PEER_KEEPALIVE_MS);
 }
 
 int peer_send_keepalive(struct Peer *p) {
@@ -137,22 +174,36 @@ int peer_send_keepalive(struct Peer *p) {
 }
 
 int peer_should_timeout(struct Peer *p) {
-    // disconnect users with no new messages for 2.5 seconds
     if(p->socket == NULL) {
         return 0;
     }
 
     if(p->status == PEER_HANDSHAKE_COMPLETE) {
-        // timeout a handshaken connection if we've had no communication for 2.5 minutes
-        return (p->socket->last_download_rate_update < now() - ((60 * 1000) * 2) + 500);
+        // timeout a handshaken connection if we've had no communication for a while
+        return (now_cached() - (int64_t) p->socket->last_download_rate_update > PEER_TIMEOUT_MS);
     } else if (p->status < PEER_HANDSHAKE_COMPLETE) {
-        // time out a handshaking connection after 5 seconds
-        return (p->socket->last_download_rate_update < now() - (10 * 1000));
+        // time out a handshaking connection that's taking too long
+        return (now_cached() - (int64_t) p->socket->last_download_rate_update > PEER_HANDSHAKE_TIMEOUT_MS);
     }
 
     return 0;
 }
 
+/**
+ * @brief count the pieces of the peer in the piece picker, once torrent_data knows how many pieces there are
+ * @param p
+ * @param torrent_data
+ */
+static void peer_count_pieces(struct Peer *p, struct TorrentData * torrent_data) {
+    if (p->peer_bitfield == NULL || p->peer_bitfield_counted != NULL) {
+        return;
+    }
+
+    if (torrent_data_add_peer_pieces(torrent_data, p->peer_bitfield) == EXIT_SUCCESS) {
+        p->peer_bitfield_counted = torrent_data;
+    }
+}
+
 void peer_update_interested(struct Peer *p, struct TorrentData * torrent_data) {
     if(p->peer_bitfield == NULL) {
         return;
@@ -163,7 +214,7 @@ void peer_update_interested(struct Peer *p, struct TorrentData * torrent_data) {
         int have = 0;
         if(torrent_data_is_complete(torrent_data) == 1) {
             have = 1;
-        } else if (torrent_data->needed == 1) {
+        } else if (torrent_data->ready == 1) {
             have = torrent_data_is_piece_complete(torrent_data, i);
         }
 
@@ -316,14 +367,20 @@ int peer_handle_msg_have(struct Peer *p, void * msg_buffer, struct TorrentData *
         p->peer_bitfield = bitfield_new(torrent_data->piece_count, 0, 0x00);
     }
 
-    bitfield_set_bit(p->peer_bitfield, net_utils.ntohl(msg_have->piece_id), 1);
+    int piece_id = net_utils.ntohl(msg_have->piece_id);
+    if (p->peer_bitfield_counted != NULL && piece_id < p->peer_bitfield->bit_count && bitfield_get_bit(p->peer_bitfield, piece_id) == 0) {
+        torrent_data_add_peer_piece(torrent_data, piece_id);
+    }
+    bitfield_set_bit(p->peer_bitfield, piece_id, 1);
     free(msg_buffer);
 
+    peer_count_pieces(p, torrent_data);
+
     peer_update_interested(p, torrent_data);
 }
 
 int peer_should_send_msg_bitfield(struct Peer *p, struct TorrentData * torrent_data) {
-    return (p->status == PEER_HANDSHAKE_COMPLETE && p->msg_bitfield_sent == 0 && torrent_data->needed == 1);
+    return (p->status == PEER_HANDSHAKE_COMPLETE && p->msg_bitfield_sent == 0 && torrent_data->ready == 1);
 }
 
 int peer_send_msg_bitfield(struct Peer *p, struct TorrentData * torrent_data) {
@@ -386,7 +443,7 @@ int peer_handle_msg_bitfield(struct Peer *p, void * msg_buffer, struct TorrentDa
     get_msg_buffer_size(msg_buffer, (size_t * ) & buffer_size);
     size_t bitfield_size = (buffer_size - sizeof(struct PEER_MSG_BITFIELD));
     int chunk_count = bitfield_size * BITS_PER_INT;
-    if(torrent_data->needed == 1) {
+    if(torrent_data->ready == 1) {
         // if we already have torrent metadata loaded and we know how large our bitfield should be, use that size
         chunk_count = torrent_data->piece_count;
 
@@ -400,9 +457,15 @@ int peer_handle_msg_bitfield(struct Peer *p, void * msg_buffer, struct TorrentDa
     if (p->peer_bitfield == NULL) {
         p->peer_bitfield = bitfield_new(chunk_count, 0, 0x00);
     }
-    memcpy(&p->peer_bitfield->bytes, &bitfield_msg->bitfield, bitfield_size);
+    if (p->peer_bitfield_counted != NULL) {
+        torrent_data_remove_peer_pieces(p->peer_bitfield_counted, p->peer_bitfield);
+        p->peer_bitfield_counted = NULL;
+    }
+    memcpy(&p->peer_bitfield->bytes, &bitfield_msg->bitfield, MIN(bitfield_size, p->peer_bitfield->bytes_count));
     free(msg_buffer);
 
+    peer_count_pieces(p, torrent_data);
+
     peer_update_interested(p, torrent_data);
 
     return EXIT_SUCCESS;
@@ -411,37 +474,65 @@ int peer_handle_msg_bitfield(struct Peer *p, void * msg_buffer, struct TorrentDa
 }
 
 
-int peer_should_send_msg_request(struct Peer *p, struct TorrentData * torrent_data) {
-    return(p->status == PEER_HANDSHAKE_COMPLETE && torrent_data->needed == 1 && p->pending_request_count < REQUEST_MSG_QUEUE_LENGTH && p->peer_choking == 0 && p->am_interested == 1);
+int peer_request_depth(float rate, int rtt_ms, size_t chunk_size) {
+    double in_flight = (double) rate * (rtt_ms + PEER_REQUEST_QUEUE_MS) / 1000;
+    int depth = (int) (in_flight / chunk_size) + 1;
+    if (depth < PEER_REQUEST_DEPTH_MIN) {
+        return PEER_REQUEST_DEPTH_MIN;
+    } else if (depth > PEER_REQUEST_DEPTH_MAX) {
+        return PEER_REQUEST_DEPTH_MAX;
+    }
+    return depth;
+}
+
+void peer_update_request_depth(struct Peer *p, struct TorrentData * torrent_data) {
+    int64_t elapsed_ms = now_cached() - p->request_rate_updated;
+    if (elapsed_ms < PEER_REQUEST_DEPTH_INTERVAL_MS) {
+        return;
+    }
+    p->request_rate_updated = now_cached();
+
+    // nothing arrived because nothing was asked for, the last measurement still stands
+    if (p->request_bytes == 0 && p->pending_request_count == 0) {
+        return;
+    }
+
+    float rate = (float) p->request_bytes / ((float) elapsed_ms / 1000);
+    p->request_rate = p->request_rate == 0.00 ? rate : (p->request_rate + rate) / 2;
+    p->request_bytes = 0;
+
+    int rtt_ms = buffered_socket_get_rtt(p->socket);
+    if (rtt_ms > 0) {
+        p->rtt_ms = rtt_ms;
+    }
+
+    p->request_depth = peer_request_depth(p->request_rate, p->rtt_ms, torrent_data->chunk_size);
+}
+
+int peer_should_send_msg_request(struct Peer *p, struct TorrentData * torrent_data, struct MessageRing * data_queue) {
+    return(p->status == PEER_HANDSHAKE_COMPLETE && torrent_data->needed == 1 && p->pending_request_count < p->request_depth && p->peer_choking == 0 && p->am_interested == 1
+           && message_ring_is_congested(data_queue) == 0);
 }
 
 int peer_send_msg_request(struct Peer *p, struct TorrentData * torrent_data) {
-    // build bitfield of chunks we're interested in
-    struct Bitfield * interested = bitfield_new(torrent_data->chunk_count, 0, 0xFF);
+    // the bitfield may have arrived before we knew how many pieces there are
+    peer_count_pieces(p, torrent_data);
 
-    for(int i = 0; i < torrent_data->piece_count; i++) {
-        int interested_in_piece = bitfield_get_bit(p->peer_bitfield, i);
-        int chunks_per_piece = torrent_data->piece_size / torrent_data->chunk_size;
-        int uints_per_piece = chunks_per_piece / BITS_PER_INT;
-        for (int x = 0; x < uints_per_piece; x++) {
-            if((i*uints_per_piece)+x < interested->bytes_count) {
-                if (interested_in_piece == 0) {
-                    interested->bytes[(i*uints_per_piece)+x] = 0x00;
-                } else if (interested_in_piece == 1) {
-                    interested->bytes[(i*uints_per_piece)+x] = 0xFF;
-                }
-            }
+    if (p->requested == NULL) {
+        p->requested = bitfield_new(torrent_data->chunk_count, 0, 0x00);
+        if (p->requested == NULL) {
+            goto error;
         }
     }
 
-    if (p->pending_request_count < REQUEST_MSG_QUEUE_LENGTH) {
-        int needed_chunks = REQUEST_MSG_QUEUE_LENGTH - p->pending_request_count;
+    if (p->pending_request_count < p->request_depth) {
+        int needed_chunks = p->request_depth - p->pending_request_count;
         int chunks_to_request[needed_chunks];
         for (int i = 0; i < needed_chunks; i++) {
             chunks_to_request[i] = -1;
         }
 
-        if(torrent_data_claim_chunk(torrent_data, interested, 10, needed_chunks, &chunks_to_request[0]) == EXIT_SUCCESS) {
+        if(torrent_data_claim_piece_chunks(torrent_data, p->peer_bitfield, p->requested, p->fast, 10, needed_chunks, &chunks_to_request[0]) == EXIT_SUCCESS) {
             for (int i = 0; i < needed_chunks; i++) {
                 int chunk_id = chunks_to_request[i];
                 if(chunk_id == -1) {
@@ -465,18 +556,16 @@ int peer_send_msg_request(struct Peer *p, struct TorrentData * torrent_data) {
 
                 if (buffered_socket_write(p->socket, &msg_request, sizeof(struct PEER_MSG_REQUEST)) !=
                     sizeof(struct PEER_MSG_REQUEST)) {
-
-                    bitfield_free(interested);
                     goto error;
                 }
 
                 // increment pending_request_msgs
                 p->pending_request_count++;
+                bitfield_set_bit(p->requested, chunk_id, 1);
             }
         }
     }
 
-    bitfield_free(interested);
     return EXIT_SUCCESS;
 
     error:
@@ -489,58 +578,167 @@ int peer_handle_msg_request(struct Peer *p, void * msg_buffer, struct TorrentDat
     struct PEER_MSG_REQUEST * request = msg_buffer;
 
     uint32_t piece_id = net_utils.ntohl(request->index);
+    uint32_t chunk_begin = net_utils.ntohl(request->begin);
+    uint32_t chunk_size = net_utils.ntohl(request->chunk_length);
+
+    // only serve data we have on disk
+    if (torrent_data->initialized == 0 || piece_id >= torrent_data->piece_count) {
+        throw("got request for unknown piece %" PRIu32 " :: %s:%i", piece_id, p->str_ip, p->port);
+    }
+    if (torrent_data_is_piece_complete(torrent_data, piece_id) == 0) {
+        throw("got request for incomplete piece %" PRIu32 " :: %s:%i", piece_id, p->str_ip, p->port);
+    }
 
     struct PieceInfo piece_info;
     torrent_data_get_piece_info(torrent_data, piece_id, &piece_info);
 
-    uint64_t chunk_offset = piece_info.piece_offset + net_utils.ntohl(request->begin);
-    uint32_t chunk_size = net_utils.ntohl(request->chunk_length);
+    if (chunk_size == 0 || chunk_size > MAX_REQUEST_LENGTH || (uint64_t) chunk_begin + chunk_size > piece_info.piece_size) {
+        throw("got invalid request %" PRIu32 " %" PRIu32 " %" PRIu32 " :: %s:%i", piece_id, chunk_begin, chunk_size, p->str_ip, p->port);
+    }
+
+    uint64_t chunk_offset = piece_info.piece_offset + chunk_begin;
 
-    // prepare piece response
-    size_t piece_msg_size = sizeof(struct PEER_MSG_PIECE) + chunk_size;
-    struct PEER_MSG_PIECE * piece_msg = malloc(piece_msg_size);
-    piece_msg->length = net_utils.htonl(piece_msg_size - sizeof(uint32_t));
-    piece_msg->msg_id = MSG_PIECE;
-    piece_msg->index = request->index;
-    piece_msg->begin = request->begin;
-    memset(piece_msg->block, 0x00, chunk_size);
+    struct TorrentDataFileSegment segments[MAX_REQUEST_SEGMENTS];
+    int segment_count = 0;
+    if (torrent_data_get_file_segments(torrent_data, chunk_offset, chunk_size, segments, MAX_REQUEST_SEGMENTS, &segment_count) == EXIT_FAILURE) {
+        throw("failed to find files for request :: %s:%i", p->str_ip, p->port);
+    }
 
-    // read torrent data into response
-    torrent_data_read_data(torrent_data, &piece_msg->block, chunk_offset, chunk_size);
+    // the piece header is buffered, the block itself is sent straight from the files
+    struct PEER_MSG_PIECE piece_msg;
+    piece_msg.length = net_utils.htonl(sizeof(struct PEER_MSG_PIECE) + chunk_size - sizeof(uint32_t));
+    piece_msg.msg_id = MSG_PIECE;
+    piece_msg.index = request->index;
+    piece_msg.begin = request->begin;
 
-    // send response
-    if (buffered_socket_write(p->socket, piece_msg, piece_msg_size) != piece_msg_size) {
+    uint64_t tag = peer_block_tag(request->index, request->begin);
+    if (buffered_socket_write_tagged(p->socket, &piece_msg, sizeof(struct PEER_MSG_PIECE), tag) != sizeof(struct PEER_MSG_PIECE)) {
+        torrent_data_release_file_segments(torrent_data, segments, segment_count);
         throw("failed to write piece msg :: %s:%i", p->str_ip, p->port);
     }
 
-    free(piece_msg);
+    // the socket dup's the fds, so the files can be unpinned as soon as they're queued
+    for (int i = 0; i < segment_count; i++) {
+        if (buffered_socket_write_file(p->socket, segments[i].fd, segments[i].file_offset, segments[i].length, tag) != segments[i].length) {
+            torrent_data_release_file_segments(torrent_data, segments, segment_count);
+            // the header is already queued, the stream can't be recovered
+            peer_disconnect(p, __FILE__, __LINE__);
+            throw("failed to write piece data :: %s:%i", p->str_ip, p->port);
+        }
+    }
+    torrent_data_release_file_segments(torrent_data, segments, segment_count);
+
+    torrent_data->uploaded += chunk_size;
+
     free(msg_buffer);
 
     return EXIT_SUCCESS;
 
     error:
 
-    free(piece_msg);
     free(msg_buffer);
 
     return EXIT_SUCCESS;
 }
 
-int peer_handle_msg_piece(struct Peer *p, void * msg_buffer, struct Queue * data_queue) {
-    queue_push(data_queue, msg_buffer);
+int peer_handle_msg_piece(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data, struct MessageRing * data_queue) {
+    struct PEER_MSG_PIECE * msg_piece = (struct PEER_MSG_PIECE *) msg_buffer;
+
+    size_t buffer_size;
+    get_msg_buffer_size(msg_buffer, (size_t * ) & buffer_size);
+    p->downloaded += buffer_size - sizeof(struct PEER_MSG_PIECE);
+    p->request_bytes += buffer_size - sizeof(struct PEER_MSG_PIECE);
+
+    int pending = 1;
+    if (p->requested != NULL && torrent_data->initialized == 1) {
+        uint64_t chunk_offset = ((uint64_t) net_utils.ntohl(msg_piece->index) * torrent_data->piece_size) + net_utils.ntohl(msg_piece->begin);
+        int chunk_id = (int) (chunk_offset / torrent_data->chunk_size);
+        // blocks of cancelled requests may still arrive, they no longer count against the pending requests
+        pending = chunk_id < p->requested->bit_count ? bitfield_get_bit(p->requested, chunk_id) : 0;
+        if (pending == 1) {
+            bitfield_set_bit(p->requested, chunk_id, 0);
+        }
+    }
+
+    peer_queue_message(p, data_queue, msg_buffer);
     // log_info("got piece :: %s:%i", p->str_ip, p->port);
-    p->pending_request_count--;
+    if (pending == 1) {
+        p->pending_request_count--;
+    }
 }
 
-int peer_handle_msg_cancel(struct Peer *p, void * msg_buffer) {
+int peer_should_send_msg_cancel(struct Peer *p, struct TorrentData * torrent_data) {
+    return (p->status == PEER_HANDSHAKE_COMPLETE && p->requested != NULL && torrent_data->duplicating == 1 && p->cancel_epoch != torrent_data->cancel_epoch);
+}
+
+int peer_send_msg_cancel(struct Peer *p, struct TorrentData * torrent_data) {
+    p->cancel_epoch = torrent_data->cancel_epoch;
+
+    for (size_t byte = 0; byte < p->requested->bytes_count && p->pending_request_count > 0; byte++) {
+        if (p->requested->bytes[byte] == 0) {
+            continue;
+        }
+
+        for (int chunk_id = byte * BITS_PER_INT; chunk_id < (byte + 1) * BITS_PER_INT && chunk_id < p->requested->bit_count; chunk_id++) {
+            if (bitfield_get_bit(p->requested, chunk_id) == 0 || torrent_data_is_chunk_complete(torrent_data, chunk_id) == 0) {
+                continue;
+            }
+
+            struct ChunkInfo chunk_info;
+            torrent_data_get_chunk_info(torrent_data, chunk_id, &chunk_info);
+
+            struct PieceInfo piece_info;
+            torrent_data_get_piece_info(torrent_data, chunk_info.piece_id, &piece_info);
+
+            // a cancel looks just like the request it cancels
+            struct PEER_MSG_REQUEST msg_cancel = {
+                    .length=net_utils.htonl((uint32_t) sizeof(struct PEER_MSG_REQUEST) - sizeof(uint32_t)),
+                    .msg_id=MSG_CANCEL,
+                    .index=net_utils.htonl(piece_info.piece_id),
+                    .begin=net_utils.htonl(chunk_info.chunk_offset - piece_info.piece_offset),
+                    .chunk_length=net_utils.htonl(chunk_info.chunk_size)
+            };
+
+            if (buffered_socket_write(p->socket, &msg_cancel, sizeof(struct PEER_MSG_REQUEST)) != sizeof(struct PEER_MSG_REQUEST)) {
+                throw("failed to write cancel msg :: %s:%i", p->str_ip, p->port);
+            }
+            log_debug("cancelled chunk %i / %i :: %s:%i", chunk_id, torrent_data->chunk_count, p->str_ip, p->port);
+
+            bitfield_set_bit(p->requested, chunk_id, 0);
+            p->pending_request_count--;
+        }
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+int peer_handle_msg_cancel(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data) {
+    struct PEER_MSG_REQUEST * cancel = msg_buffer;
+
+    size_t buffer_size;
+    get_msg_buffer_size(msg_buffer, &buffer_size);
+    if (buffer_size < sizeof(struct PEER_MSG_REQUEST)) {
+        free(msg_buffer);
+        return EXIT_FAILURE;
+    }
+
+    size_t dropped = buffered_socket_cancel(p->socket, peer_block_tag(cancel->index, cancel->begin));
+    if (dropped > 0) {
+        // the header is dropped along with the block
+        torrent_data->uploaded -= dropped - sizeof(struct PEER_MSG_PIECE);
+    }
+
     free(msg_buffer);
+    return EXIT_SUCCESS;
 }
 
 int peer_handle_msg_port(struct Peer *p, void * msg_buffer) {
     free(msg_buffer);
 }
 
-int peer_handle_msg_extension(struct Peer * p, void * msg_buffer, struct TorrentData * torrent_metadata, struct Queue * metadata_queue) {
+int peer_handle_msg_extension(struct Peer * p, void * msg_buffer, struct TorrentData * torrent_metadata, struct MessageRing * metadata_queue) {
     uint32_t msg_length;
     uint8_t msg_id;
     size_t buffer_size;
@@ -86,6 +86,23 @@ struct PEER_MSG_EXTENSION {
  */
 extern int peer_should_read_message(struct Peer * p);
 
+/**
+ * @brief hand a message over to the main thread. if the queue is full the peer holds on to it and stops reading
+ *        messages, the data stays in the socket until the main thread has caught up and the torrent wakes the reactors
+ * @param p
+ * @param queue
+ * @param msg_buffer owned by the queue or the peer afterwards
+ */
+extern void peer_queue_message(struct Peer * p, struct MessageRing * queue, void * msg_buffer);
+
+/**
+ * @brief try handing over the message a full queue had no room for again
+ * @param p
+ * @return peer_push_held_message returns EXIT_SUCCESS once it's handed over, EXIT_FAILURE while the queue is still full
+ */
+extern int peer_should_push_held_message(struct Peer * p);
+extern int peer_push_held_message(struct Peer * p);
+
 /**
  * @brief attempt to read a message from the peer. will either return NULL
  *        or will allocate memory to use as a buffer if we are dealing with a valid message
@@ -156,14 +173,56 @@ extern int peer_should_send_msg_bitfield(struct Peer *p, struct TorrentData * to
 extern int peer_send_msg_bitfield(struct Peer *p, struct TorrentData * torrent_data);
 extern int peer_handle_msg_bitfield(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data);
 
-extern int peer_should_send_msg_request(struct Peer *p, struct TorrentData * torrent_data);
+/**
+ * @brief number of requests to keep outstanding to a peer: enough to cover the data it sends in one round trip plus
+ *        PEER_REQUEST_QUEUE_MS, between PEER_REQUEST_DEPTH_MIN and PEER_REQUEST_DEPTH_MAX. the idea is libtorrent's
+ *        request queue time, a fast peer on a long link is never left idle waiting for our next request
+ * @param rate bytes per second received from the peer
+ * @param rtt_ms round trip time, 0 if it isn't known
+ * @param chunk_size bytes per request
+ * @return request depth
+ */
+extern int peer_request_depth(float rate, int rtt_ms, size_t chunk_size);
+
+/**
+ * @brief measure the rate chunks arrive at and adapt the peers request depth to it
+ * @note runs every PEER_REQUEST_DEPTH_INTERVAL_MS
+ * @param p
+ * @param torrent_data
+ */
+extern void peer_update_request_depth(struct Peer *p, struct TorrentData * torrent_data);
+
+/**
+ * @brief should the peer request more chunks? not while data_queue is congested, the main thread has to catch up with
+ *        the chunks that already arrived first
+ * @param p
+ * @param torrent_data
+ * @param data_queue
+ * @return 1 if it should, 0 otherwise
+ */
+extern int peer_should_send_msg_request(struct Peer *p, struct TorrentData * torrent_data, struct MessageRing * data_queue);
 extern int peer_send_msg_request(struct Peer *p, struct TorrentData * torrent_data);
 extern int peer_handle_msg_request(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data);
 
-extern int peer_handle_msg_piece(struct Peer *p, void * msg_buffer, struct Queue * data_queue);
-extern int peer_handle_msg_cancel(struct Peer *p, void * msg_buffer);
+extern int peer_handle_msg_piece(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data, struct MessageRing * data_queue);
+
+/**
+ * @brief cancel requests for chunks that arrived from another peer first, see endgame in torrent/torrent_data.h
+ * @param p
+ * @param torrent_data
+ */
+extern int peer_should_send_msg_cancel(struct Peer *p, struct TorrentData * torrent_data);
+extern int peer_send_msg_cancel(struct Peer *p, struct TorrentData * torrent_data);
+
+/**
+ * @brief drop the piece message for a cancelled request, if it hasn't started going out yet
+ * @param p
+ * @param msg_buffer
+ * @param torrent_data
+ */
+extern int peer_handle_msg_cancel(struct Peer *p, void * msg_buffer, struct TorrentData * torrent_data);
 extern int peer_handle_msg_port(struct Peer *p, void * msg_buffer);
-extern int peer_handle_msg_extension(struct Peer * p, void * msg_buffer, struct TorrentData * torrent_metadata, struct Queue * metadata_queue);
+extern int peer_handle_msg_extension(struct Peer * p, void * msg_buffer, struct TorrentData * torrent_metadata, struct MessageRing * metadata_queue);
 
 
 #endif //UVGTORRENT_C_PEER_MESSAGES_H
@@ -98,8 +98,8 @@ int peer_handle_ut_metadata_request(struct Peer * p, uint64_t chunk_id, struct T
     return EXIT_FAILURE;
 }
 
-int peer_handle_ut_metadata_data(struct Peer * p, void * msg_buffer, struct Queue * metadata_queue) {
-    queue_push(metadata_queue, msg_buffer);
+int peer_handle_ut_metadata_data(struct Peer * p, void * msg_buffer, struct MessageRing * metadata_queue) {
+    peer_queue_message(p, metadata_queue, msg_buffer);
 }
 
 int peer_handle_ut_metadata_reject(struct Peer * p) {
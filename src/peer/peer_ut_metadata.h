@@ -9,7 +9,7 @@
 extern int peer_supports_ut_metadata(struct Peer * p);
 extern int peer_handle_ut_metadata_handshake(struct Peer * p, void * msg_buffer);
 extern int peer_handle_ut_metadata_request(struct Peer * p, uint64_t chunk_id, struct TorrentData * torrent_metadata);
-extern int peer_handle_ut_metadata_data(struct Peer * p, void * msg_buffer, struct Queue * metadata_queue);
+extern int peer_handle_ut_metadata_data(struct Peer * p, void * msg_buffer, struct MessageRing * metadata_queue);
 extern int peer_handle_ut_metadata_reject(struct Peer * p);
 
 /**
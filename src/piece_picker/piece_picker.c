@@ -0,0 +1,287 @@
+#include "../log.h"
+#include "piece_picker.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+struct PiecePicker * piece_picker_new(int piece_count, enum PiecePickerPolicy policy, int window) {
+    struct PiecePicker * pp = malloc(sizeof(struct PiecePicker));
+    if (pp == NULL) {
+        throw("piece picker failed to malloc");
+    }
+
+    pthread_mutex_init(&pp->mutex, NULL);
+
+    pp->policy = policy;
+    pp->window = window > 0 ? window : PIECE_PICKER_WINDOW;
+    pp->cursor = 0;
+    pp->piece_count = piece_count;
+    pp->first_open = 0;
+    pp->open_count = 0;
+    pp->availability = NULL;
+    pp->open = NULL;
+    pp->bucket_prev = NULL;
+    pp->bucket_next = NULL;
+
+    for (int i = 0; i < PIECE_PICKER_BUCKETS; i++) {
+        pp->buckets[i] = -1;
+        pp->bucket_tails[i] = -1;
+    }
+
+    pp->availability = calloc(piece_count, sizeof(int));
+    pp->open = calloc(piece_count, sizeof(uint8_t));
+    pp->bucket_prev = malloc(sizeof(int) * piece_count);
+    pp->bucket_next = malloc(sizeof(int) * piece_count);
+    if (pp->availability == NULL || pp->open == NULL || pp->bucket_prev == NULL || pp->bucket_next == NULL) {
+        throw("piece picker failed to malloc pieces");
+    }
+
+    for (int i = 0; i < piece_count; i++) {
+        piece_picker_set_open(pp, i, 1);
+    }
+
+    return pp;
+    error:
+    return piece_picker_free(pp);
+}
+
+static int piece_picker_bucket(struct PiecePicker * pp, int piece_id) {
+    return MIN(pp->availability[piece_id], PIECE_PICKER_BUCKETS - 1);
+}
+
+static void piece_picker_bucket_remove(struct PiecePicker * pp, int piece_id) {
+    int bucket = piece_picker_bucket(pp, piece_id);
+    int prev = pp->bucket_prev[piece_id];
+    int next = pp->bucket_next[piece_id];
+    if (prev != -1) {
+        pp->bucket_next[prev] = next;
+    } else {
+        pp->buckets[bucket] = next;
+    }
+    if (next != -1) {
+        pp->bucket_prev[next] = prev;
+    } else {
+        pp->bucket_tails[bucket] = prev;
+    }
+}
+
+static void piece_picker_bucket_push(struct PiecePicker * pp, int piece_id) {
+    int bucket = piece_picker_bucket(pp, piece_id);
+    pp->bucket_prev[piece_id] = pp->bucket_tails[bucket];
+    pp->bucket_next[piece_id] = -1;
+    if (pp->bucket_tails[bucket] != -1) {
+        pp->bucket_next[pp->bucket_tails[bucket]] = piece_id;
+    } else {
+        pp->buckets[bucket] = piece_id;
+    }
+    pp->bucket_tails[bucket] = piece_id;
+}
+
+/**
+ * @brief change the availability of a piece, moving it to it's new bucket if it's open
+ * @note call it holding the picker lock
+ */
+static void piece_picker_update_availability(struct PiecePicker * pp, int piece_id, int delta) {
+    if (pp->availability[piece_id] + delta < 0) {
+        log_warn("piece picker availability of piece %i dropped below 0", piece_id);
+        return;
+    }
+
+    if (pp->open[piece_id] == 1) {
+        piece_picker_bucket_remove(pp, piece_id);
+    }
+    pp->availability[piece_id] += delta;
+    if (pp->open[piece_id] == 1) {
+        piece_picker_bucket_push(pp, piece_id);
+    }
+}
+
+void piece_picker_set_policy(struct PiecePicker * pp, enum PiecePickerPolicy policy, int window) {
+    pthread_mutex_lock(&pp->mutex);
+    pp->policy = policy;
+    pp->window = window > 0 ? window : PIECE_PICKER_WINDOW;
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void piece_picker_set_cursor(struct PiecePicker * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+    pp->cursor = piece_id;
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void piece_picker_add_peer(struct PiecePicker * pp, struct Bitfield * pieces) {
+    int bit_count = MIN((int) pieces->bit_count, pp->piece_count);
+
+    pthread_mutex_lock(&pp->mutex);
+    for (int i = 0; i < bit_count; i++) {
+        if (bitfield_get_bit(pieces, i) == 1) {
+            piece_picker_update_availability(pp, i, 1);
+        }
+    }
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void piece_picker_remove_peer(struct PiecePicker * pp, struct Bitfield * pieces) {
+    int bit_count = MIN((int) pieces->bit_count, pp->piece_count);
+
+    pthread_mutex_lock(&pp->mutex);
+    for (int i = 0; i < bit_count; i++) {
+        if (bitfield_get_bit(pieces, i) == 1) {
+            piece_picker_update_availability(pp, i, -1);
+        }
+    }
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void piece_picker_add_piece(struct PiecePicker * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+    piece_picker_update_availability(pp, piece_id, 1);
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+int piece_picker_get_availability(struct PiecePicker * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+    int availability = pp->availability[piece_id];
+    pthread_mutex_unlock(&pp->mutex);
+
+    return availability;
+}
+
+void piece_picker_set_open(struct PiecePicker * pp, int piece_id, int open) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+    if (pp->open[piece_id] != open) {
+        pp->open[piece_id] = open;
+        if (open == 1) {
+            piece_picker_bucket_push(pp, piece_id);
+            pp->first_open = MIN(pp->first_open, piece_id);
+            pp->open_count++;
+        } else {
+            piece_picker_bucket_remove(pp, piece_id);
+            pp->open_count--;
+        }
+    }
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+static int piece_picker_peer_has(struct Bitfield * peer_pieces, int piece_id) {
+    return piece_id < peer_pieces->bit_count && bitfield_get_bit(peer_pieces, piece_id) == 1;
+}
+
+/**
+ * @brief find the first open piece the peer has between begin and end
+ * @return piece id, -1 if there is none
+ */
+static int piece_picker_pick_in_order(struct PiecePicker * pp, struct Bitfield * peer_pieces, int begin, int end) {
+    for (int i = MAX(begin, pp->first_open); i < end; i++) {
+        if (pp->open[i] == 1 && piece_picker_peer_has(peer_pieces, i) == 1) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief find the least available open piece the peer has, outside of skip_begin - skip_end. pieces no one is counted
+ *        as having go last
+ * @return piece id, -1 if there is none
+ */
+static int piece_picker_pick_rarest(struct PiecePicker * pp, struct Bitfield * peer_pieces, int skip_begin, int skip_end) {
+    for (int bucket = 1; bucket <= PIECE_PICKER_BUCKETS; bucket++) {
+        int piece_id = pp->buckets[bucket % PIECE_PICKER_BUCKETS];
+        while (piece_id != -1) {
+            if ((piece_id < skip_begin || piece_id >= skip_end) && piece_picker_peer_has(peer_pieces, piece_id) == 1) {
+                return piece_id;
+            }
+            piece_id = pp->bucket_next[piece_id];
+        }
+    }
+    return -1;
+}
+
+int piece_picker_pick(struct PiecePicker * pp, struct Bitfield * peer_pieces, int in_window) {
+    int piece_id = -1;
+
+    pthread_mutex_lock(&pp->mutex);
+
+    while (pp->first_open < pp->piece_count && pp->open[pp->first_open] == 0) {
+        pp->first_open++;
+    }
+
+    int window_begin = MAX(pp->cursor, pp->first_open);
+    int window_end = MIN(window_begin + pp->window, pp->piece_count);
+
+    if (pp->open_count > 0) {
+        switch (pp->policy) {
+            case PIECE_PICKER_SEQUENTIAL:
+                piece_id = piece_picker_pick_in_order(pp, peer_pieces, in_window == 1 ? pp->cursor : window_end, pp->piece_count);
+                if (piece_id == -1) {
+                    piece_id = piece_picker_pick_in_order(pp, peer_pieces, 0, pp->cursor);
+                }
+                break;
+
+            case PIECE_PICKER_SEQUENTIAL_WINDOW:
+                if (in_window == 1) {
+                    piece_id = piece_picker_pick_in_order(pp, peer_pieces, window_begin, window_end);
+                }
+                if (piece_id == -1) {
+                    piece_id = piece_picker_pick_rarest(pp, peer_pieces, window_begin, window_end);
+                }
+                break;
+
+            case PIECE_PICKER_RAREST_FIRST:
+                if (in_window == 1) {
+                    piece_id = piece_picker_pick_rarest(pp, peer_pieces, 0, 0);
+                } else {
+                    piece_id = piece_picker_pick_rarest(pp, peer_pieces, window_begin, window_end);
+                }
+                break;
+        }
+    }
+
+    pthread_mutex_unlock(&pp->mutex);
+
+    return piece_id;
+}
+
+struct PiecePicker * piece_picker_free(struct PiecePicker * pp) {
+    if (pp != NULL) {
+        if (pp->availability != NULL) {
+            free(pp->availability);
+            pp->availability = NULL;
+        }
+        if (pp->open != NULL) {
+            free(pp->open);
+            pp->open = NULL;
+        }
+        if (pp->bucket_prev != NULL) {
+            free(pp->bucket_prev);
+            pp->bucket_prev = NULL;
+        }
+        if (pp->bucket_next != NULL) {
+            free(pp->bucket_next);
+            pp->bucket_next = NULL;
+        }
+        pthread_mutex_destroy(&pp->mutex);
+        free(pp);
+        pp = NULL;
+    }
+    return pp;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file piece_picker/piece_picker.h
+ *
+ * @brief the piece_picker struct decides which piece a peer should request chunks of next. it keeps a count of how
+ *        many connected peers have each piece, updated from their bitfield and have messages, and tracks which pieces
+ *        are open: not yet complete and with chunks no one has claimed.
+ *
+ *        open pieces are kept in buckets by availability, one doubly linked list per availability count, so the rarest
+ *        open piece is found without scanning every piece. a peer announcing or dropping a piece just moves it to the
+ *        next bucket up or down.
+ *
+ *        pieces are picked using one of these policies:
+ *          - PIECE_PICKER_SEQUENTIAL picks the first open piece from the cursor onwards, then wraps around to the first
+ *            open piece. this is what streaming wants.
+ *          - PIECE_PICKER_SEQUENTIAL_WINDOW picks in order inside a window of pieces starting at the cursor, and
+ *            rarest first past it. the window keeps playback fed while the rest of the torrent stays healthy in the swarm.
+ *          - PIECE_PICKER_RAREST_FIRST picks the open piece held by the fewest peers. pieces no connected peer is
+ *            counted as having are picked last.
+ *
+ *        the cursor only ever points at where the pieces should start coming in, it isn't moved by picking. the window
+ *        starts at the first open piece from the cursor onwards. peers can be kept out of the window, so that while
+ *        streaming the pieces needed soonest only go to the fastest peers, see piece_picker_pick.
+ *
+ * @note all functions are thread safe. the picker lock is never held while taking another lock, so it can be used
+ *       while holding the torrent_data claimed / completed locks.
+ *
+ * @see torrent/torrent_data.h
+ * @see https://www.bittorrent.org/bittorrentecon.pdf
+ */
+#ifndef UVGTORRENT_C_PIECE_PICKER_H
+#define UVGTORRENT_C_PIECE_PICKER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "../bitfield/bitfield.h"
+
+#define PIECE_PICKER_WINDOW 16 // default number of pieces picked in order with PIECE_PICKER_SEQUENTIAL_WINDOW
+#define PIECE_PICKER_BUCKETS 64 // pieces held by more peers than this share the last bucket
+
+enum PiecePickerPolicy {
+    PIECE_PICKER_SEQUENTIAL, // first open piece from the cursor
+    PIECE_PICKER_SEQUENTIAL_WINDOW, // in order inside the window past the cursor, rarest first after that
+    PIECE_PICKER_RAREST_FIRST, // least available piece first
+};
+
+struct PiecePicker {
+    pthread_mutex_t mutex;
+
+    enum PiecePickerPolicy policy;
+    int window; // number of pieces picked in order with PIECE_PICKER_SEQUENTIAL_WINDOW
+    int cursor; // piece the sequential policies start picking from
+
+    int piece_count;
+    int * availability; // number of peers that have each piece
+    uint8_t * open; // 1 for pieces that still have unclaimed chunks to request
+    int first_open; // no piece before this one is open
+    int open_count;
+
+    /* open pieces, one list per availability count. indexed by piece id, -1 terminated */
+    int buckets[PIECE_PICKER_BUCKETS]; // head of the list for each availability count
+    int bucket_tails[PIECE_PICKER_BUCKETS];
+    int * bucket_prev;
+    int * bucket_next;
+};
+
+/**
+ * @brief create a new piece picker. every piece starts out open, with no peers having it
+ * @param piece_count number of pieces in the torrent
+ * @param policy
+ * @param window pieces picked in order with PIECE_PICKER_SEQUENTIAL_WINDOW, 0 for PIECE_PICKER_WINDOW
+ * @return struct PiecePicker *. NULL on failure
+ */
+extern struct PiecePicker * piece_picker_new(int piece_count, enum PiecePickerPolicy policy, int window);
+
+/**
+ * @brief change how pieces are picked
+ * @param pp
+ * @param policy
+ * @param window pieces picked in order with PIECE_PICKER_SEQUENTIAL_WINDOW, 0 for PIECE_PICKER_WINDOW
+ */
+extern void piece_picker_set_policy(struct PiecePicker * pp, enum PiecePickerPolicy policy, int window);
+
+/**
+ * @brief move the piece the sequential policies start picking from
+ * @param pp
+ * @param piece_id
+ */
+extern void piece_picker_set_cursor(struct PiecePicker * pp, int piece_id);
+
+/**
+ * @brief count the pieces of a peer that just told us what it has
+ * @note every piece added has to be removed with piece_picker_remove_peer once the peer goes away
+ * @param pp
+ * @param pieces bitfield indexed by piece id, bits past the piece count are ignored
+ */
+extern void piece_picker_add_peer(struct PiecePicker * pp, struct Bitfield * pieces);
+
+/**
+ * @brief stop counting the pieces of a peer
+ * @param pp
+ * @param pieces the same bits passed to piece_picker_add_peer, plus any added with piece_picker_add_piece
+ */
+extern void piece_picker_remove_peer(struct PiecePicker * pp, struct Bitfield * pieces);
+
+/**
+ * @brief count a single piece a peer just got
+ * @param pp
+ * @param piece_id
+ */
+extern void piece_picker_add_piece(struct PiecePicker * pp, int piece_id);
+
+/**
+ * @brief get the number of peers that have a piece
+ * @param pp
+ * @param piece_id
+ * @return availability, -1 for an unknown piece
+ */
+extern int piece_picker_get_availability(struct PiecePicker * pp, int piece_id);
+
+/**
+ * @brief mark whether a piece has chunks left to request. closed pieces are never picked
+ * @param pp
+ * @param piece_id
+ * @param open 1 or 0
+ */
+extern void piece_picker_set_open(struct PiecePicker * pp, int piece_id, int open);
+
+/**
+ * @brief pick the next piece to request chunks of from a peer
+ * @note the piece stays open, close it with piece_picker_set_open once all of it's chunks are claimed
+ * @param pp
+ * @param peer_pieces bitfield of the pieces the peer has, indexed by piece id
+ * @param in_window 1 if the peer may be given pieces inside the window, 0 to only pick from outside of it
+ * @return piece id, -1 if the peer has no open pieces
+ */
+extern int piece_picker_pick(struct PiecePicker * pp, struct Bitfield * peer_pieces, int in_window);
+
+/**
+ * @brief free the given piece picker
+ * @param pp
+ * @return pp after freeing, NULL on success
+ */
+extern struct PiecePicker * piece_picker_free(struct PiecePicker * pp);
+
+#endif //UVGTORRENT_C_PIECE_PICKER_H
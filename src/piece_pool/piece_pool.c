@@ -0,0 +1,218 @@
+#include "../log.h"
+#include "piece_pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+struct PiecePool * piece_pool_new(int piece_count, size_t buffer_size, size_t memory_budget) {
+    struct PiecePool * pp = malloc(sizeof(struct PiecePool));
+    if (pp == NULL) {
+        throw("piece pool failed to malloc");
+    }
+
+    pthread_mutex_init(&pp->mutex, NULL);
+
+    pp->buffer_size = buffer_size;
+    pp->buffer_count = 0;
+    if (buffer_size > 0) {
+        pp->buffer_count = memory_budget / buffer_size;
+    }
+    if (pp->buffer_count > piece_count && piece_count > 0) {
+        pp->buffer_count = piece_count;
+    }
+    pp->allocated_count = 0;
+    pp->free_count = 0;
+    pp->piece_count = piece_count;
+    pp->in_flight = 0;
+    pp->pieces = NULL;
+    pp->lru_prev = NULL;
+    pp->lru_next = NULL;
+    pp->lru_head = -1;
+    pp->lru_tail = -1;
+
+    pp->free_buffers = NULL;
+    if (pp->buffer_count > 0) {
+        pp->free_buffers = malloc(sizeof(uint8_t *) * pp->buffer_count);
+        if (pp->free_buffers == NULL) {
+            throw("piece pool failed to malloc free buffers");
+        }
+    }
+
+    pp->pieces = calloc(piece_count, sizeof(uint8_t *));
+    if (pp->pieces == NULL) {
+        throw("piece pool failed to malloc piece table");
+    }
+
+    pp->lru_prev = malloc(sizeof(int) * piece_count);
+    pp->lru_next = malloc(sizeof(int) * piece_count);
+    if (pp->lru_prev == NULL || pp->lru_next == NULL) {
+        throw("piece pool failed to malloc lru");
+    }
+
+    return pp;
+    error:
+    return piece_pool_free(pp);
+}
+
+static void piece_pool_lru_remove(struct PiecePool * pp, int piece_id) {
+    int prev = pp->lru_prev[piece_id];
+    int next = pp->lru_next[piece_id];
+    if (prev != -1) {
+        pp->lru_next[prev] = next;
+    } else {
+        pp->lru_head = next;
+    }
+    if (next != -1) {
+        pp->lru_prev[next] = prev;
+    } else {
+        pp->lru_tail = prev;
+    }
+}
+
+static void piece_pool_lru_push(struct PiecePool * pp, int piece_id) {
+    pp->lru_prev[piece_id] = -1;
+    pp->lru_next[piece_id] = pp->lru_head;
+    if (pp->lru_head != -1) {
+        pp->lru_prev[pp->lru_head] = piece_id;
+    }
+    pp->lru_head = piece_id;
+    if (pp->lru_tail == -1) {
+        pp->lru_tail = piece_id;
+    }
+}
+
+uint8_t * piece_pool_get(struct PiecePool * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+    uint8_t * buffer = pp->pieces[piece_id];
+    pthread_mutex_unlock(&pp->mutex);
+
+    return buffer;
+}
+
+uint8_t * piece_pool_acquire(struct PiecePool * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+
+    uint8_t * buffer = pp->pieces[piece_id];
+    if (buffer != NULL) {
+        if (pp->lru_prev[piece_id] == PIECE_POOL_PINNED) {
+            pthread_mutex_unlock(&pp->mutex);
+            return buffer;
+        }
+
+        // most recently used goes to the front
+        piece_pool_lru_remove(pp, piece_id);
+        piece_pool_lru_push(pp, piece_id);
+    } else {
+        if (pp->free_count > 0) {
+            pp->free_count--;
+            buffer = pp->free_buffers[pp->free_count];
+        } else if (pp->allocated_count < pp->buffer_count) {
+            buffer = malloc(pp->buffer_size);
+            if (buffer == NULL) {
+                log_error("piece pool failed to malloc buffer");
+            } else {
+                pp->allocated_count++;
+            }
+        }
+
+        if (buffer != NULL) {
+            pp->pieces[piece_id] = buffer;
+            pp->in_flight++;
+            piece_pool_lru_push(pp, piece_id);
+        }
+    }
+
+    pthread_mutex_unlock(&pp->mutex);
+
+    return buffer;
+}
+
+int piece_pool_least_recently_used(struct PiecePool * pp) {
+    pthread_mutex_lock(&pp->mutex);
+    int piece_id = pp->lru_tail;
+    pthread_mutex_unlock(&pp->mutex);
+
+    return piece_id;
+}
+
+void piece_pool_pin(struct PiecePool * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+
+    if (pp->pieces[piece_id] != NULL && pp->lru_prev[piece_id] != PIECE_POOL_PINNED) {
+        piece_pool_lru_remove(pp, piece_id);
+        pp->lru_prev[piece_id] = PIECE_POOL_PINNED;
+        pp->lru_next[piece_id] = PIECE_POOL_PINNED;
+    }
+
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void piece_pool_release(struct PiecePool * pp, int piece_id) {
+    if (piece_id < 0 || piece_id >= pp->piece_count) {
+        return;
+    }
+
+    pthread_mutex_lock(&pp->mutex);
+
+    uint8_t * buffer = pp->pieces[piece_id];
+    if (buffer != NULL) {
+        pp->pieces[piece_id] = NULL;
+        if (pp->lru_prev[piece_id] != PIECE_POOL_PINNED) {
+            piece_pool_lru_remove(pp, piece_id);
+        }
+        pp->free_buffers[pp->free_count] = buffer;
+        pp->free_count++;
+        pp->in_flight--;
+    }
+
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+struct PiecePool * piece_pool_free(struct PiecePool * pp) {
+    if (pp != NULL) {
+        if (pp->pieces != NULL) {
+            for (int i = 0; i < pp->piece_count; i++) {
+                if (pp->pieces[i] != NULL) {
+                    free(pp->pieces[i]);
+                }
+            }
+            free(pp->pieces);
+            pp->pieces = NULL;
+        }
+
+        if (pp->free_buffers != NULL) {
+            for (int i = 0; i < pp->free_count; i++) {
+                free(pp->free_buffers[i]);
+            }
+            free(pp->free_buffers);
+            pp->free_buffers = NULL;
+        }
+
+        if (pp->lru_prev != NULL) {
+            free(pp->lru_prev);
+            pp->lru_prev = NULL;
+        }
+
+        if (pp->lru_next != NULL) {
+            free(pp->lru_next);
+            pp->lru_next = NULL;
+        }
+
+        pthread_mutex_destroy(&pp->mutex);
+        free(pp);
+        pp = NULL;
+    }
+
+    return pp;
+}
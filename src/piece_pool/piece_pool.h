@@ -0,0 +1,104 @@
+/**
+ * @file piece_pool/piece_pool.h
+ *
+ * @brief the piece_pool struct holds the buffers of pieces that are being downloaded. pieces are looked up directly by
+ *        piece id, and buffers come from a fixed pool of reusable piece sized buffers. the number of buffers is
+ *        derived from a memory budget, buffers are only malloced the first time they're needed, and are handed back to
+ *        the pool instead of being freed once a piece is written out.
+ *
+ *        pieces holding a buffer are kept in least recently used order. when every buffer is in use torrent_data spills
+ *        the least recently used piece to disk to make room, see piece_pool_least_recently_used. the budget is a hard
+ *        limit, with a budget smaller than a piece no buffers are used at all.
+ *
+ * @note all functions are thread safe. the pool lock is never held while taking another lock, so it can be used while
+ *       holding the torrent_data claimed / completed locks.
+ *
+ * @see torrent/torrent_data.h
+ */
+#ifndef UVGTORRENT_C_PIECE_POOL_H
+#define UVGTORRENT_C_PIECE_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define PIECE_POOL_PINNED -2 // lru_prev / lru_next of a pinned piece
+
+struct PiecePool {
+    pthread_mutex_t mutex;
+
+    size_t buffer_size; // bytes in every buffer, the torrents piece size
+    int buffer_count; // max number of buffers, derived from the memory budget
+    int allocated_count; // buffers malloced so far
+
+    uint8_t ** free_buffers; // stack of buffers that aren't holding a piece
+    int free_count;
+
+    uint8_t ** pieces; // buffer for each piece id, NULL while the piece isn't in flight
+    int piece_count;
+    int in_flight;
+
+    /* pieces holding a buffer, most recently used first. indexed by piece id, -1 terminated. pinned pieces are left out */
+    int * lru_prev;
+    int * lru_next;
+    int lru_head;
+    int lru_tail;
+};
+
+/**
+ * @brief create a new piece pool
+ * @param piece_count number of pieces in the torrent
+ * @param buffer_size size of a piece
+ * @param memory_budget max bytes used for buffers
+ * @return struct PiecePool *. NULL on failure
+ */
+extern struct PiecePool * piece_pool_new(int piece_count, size_t buffer_size, size_t memory_budget);
+
+/**
+ * @brief get the buffer of a piece that is in flight
+ * @param pp
+ * @param piece_id
+ * @return the pieces buffer, NULL if the piece isn't in flight
+ */
+extern uint8_t * piece_pool_get(struct PiecePool * pp, int piece_id);
+
+/**
+ * @brief get the buffer of a piece, taking one from the pool if the piece isn't in flight yet
+ * @note buffers are reused, their contents are undefined until every chunk of the piece has been written.
+ *       the piece becomes the most recently used one
+ * @param pp
+ * @param piece_id
+ * @return the pieces buffer, NULL if every buffer is in use
+ */
+extern uint8_t * piece_pool_acquire(struct PiecePool * pp, int piece_id);
+
+/**
+ * @brief get the piece that has gone the longest without being acquired
+ * @param pp
+ * @return piece id, -1 if no piece is holding a buffer
+ */
+extern int piece_pool_least_recently_used(struct PiecePool * pp);
+
+/**
+ * @brief take a piece out of the least recently used order, so it's never picked to be spilled
+ * @note used while a piece is being verified. the piece stays pinned until it's released
+ * @param pp
+ * @param piece_id
+ */
+extern void piece_pool_pin(struct PiecePool * pp, int piece_id);
+
+/**
+ * @brief hand the buffer of a piece back to the pool
+ * @param pp
+ * @param piece_id
+ */
+extern void piece_pool_release(struct PiecePool * pp, int piece_id);
+
+/**
+ * @brief free the given piece pool and all of it's buffers
+ * @param pp
+ * @return pp after freeing, NULL on success
+ */
+extern struct PiecePool * piece_pool_free(struct PiecePool * pp);
+
+#endif //UVGTORRENT_C_PIECE_POOL_H
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+#include "../log.h"
+#include "../thread_pool/job.h"
+#include "../deadline/deadline.h"
+
+struct Reactor * reactor_new(int8_t info_hash_hex[20], struct TorrentData * torrent_metadata, struct TorrentData * torrent_data,
+                             struct MessageRing * metadata_queue, struct MessageRing * data_queue) {
+    struct Reactor * r = malloc(sizeof(struct Reactor));
+    if (r == NULL) {
+        throw("reactor failed to malloc");
+    }
+
+    r->epoll_fd = -1;
+    r->wake_fd = -1;
+    r->incoming_peers = NULL;
+    r->timers = NULL;
+    r->cancel_flag = NULL;
+    r->peers = NULL;
+    r->peer_count = 0;
+    r->peer_capacity = 0;
+
+    memcpy(&r->info_hash_hex, info_hash_hex, sizeof(r->info_hash_hex));
+    r->torrent_metadata = torrent_metadata;
+    r->torrent_data = torrent_data;
+    r->metadata_queue = metadata_queue;
+    r->data_queue = data_queue;
+
+    r->incoming_peers = queue_new();
+    if (r->incoming_peers == NULL) {
+        throw("reactor failed to init incoming peers queue");
+    }
+
+    r->timers = timer_wheel_new(now());
+    if (r->timers == NULL) {
+        throw("reactor failed to init timer wheel");
+    }
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd == -1) {
+        throw("reactor failed to create epoll instance %s", clean_errno());
+    }
+
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wake_fd == -1) {
+        throw("reactor failed to create eventfd %s", clean_errno());
+    }
+
+    // the wake fd is registered with a NULL pointer so it can be told apart from peers
+    struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.ptr = NULL
+    };
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &ev) == -1) {
+        throw("reactor failed to register eventfd %s", clean_errno());
+    }
+
+    return r;
+    error:
+    return reactor_free(r);
+}
+
+int reactor_add_peer(struct Reactor * r, struct Peer * p) {
+    if (queue_push(r->incoming_peers, (void *) p) == EXIT_FAILURE) {
+        throw("reactor failed to queue peer :: %s:%i", p->str_ip, p->port);
+    }
+    reactor_wake(r);
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+void reactor_wake(struct Reactor * r) {
+    uint64_t one = 1;
+    // EAGAIN means the counter is already non zero, and a wake is already pending
+    if (write(r->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        log_error("reactor failed to wake %s", clean_errno());
+    }
+    errno = 0;
+}
+
+/* private functions */
+static void reactor_run_peer(struct Reactor * r, struct Peer * p);
+
+static void reactor_peer_timer(void * arg, void * context) {
+    reactor_run_peer((struct Reactor *) context, (struct Peer *) arg);
+}
+
+static void reactor_tick(struct Reactor * r) {
+    for (int i = 0; i < r->peer_count; i++) {
+        reactor_run_peer(r, r->peers[i]);
+    }
+    timer_wheel_schedule(r->timers, &r->tick_timer, now_cached() + REACTOR_TICK_MS);
+}
+
+static void reactor_tick_timer(void * arg, void * context) {
+    reactor_tick((struct Reactor *) context);
+}
+
+static int reactor_adopt_peers(struct Reactor * r) {
+    while (queue_get_count(r->incoming_peers) > 0) {
+        struct Peer * p = (struct Peer *) queue_pop(r->incoming_peers);
+
+        if (r->peer_count == r->peer_capacity) {
+            int new_capacity = r->peer_capacity == 0 ? 64 : r->peer_capacity * 2;
+            struct Peer ** peers = realloc(r->peers, sizeof(struct Peer *) * new_capacity);
+            if (peers == NULL) {
+                throw("reactor failed to grow peer list");
+            }
+            r->peers = peers;
+            r->peer_capacity = new_capacity;
+        }
+
+        r->peers[r->peer_count] = p;
+        r->peer_count++;
+        timer_init(&p->timer, &reactor_peer_timer, (void *) p);
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+static void reactor_register_socket(struct Reactor * r, struct Peer * p) {
+    if (p->socket == NULL || p->socket->socket == -1 || p->socket->registered == 1) {
+        return;
+    }
+
+    struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = (void *) p
+    };
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, p->socket->socket, &ev) == -1) {
+        log_error("reactor failed to register socket %s :: %s:%i", clean_errno(), p->str_ip, p->port);
+        peer_disconnect(p, __FILE__, __LINE__);
+        return;
+    }
+
+    p->socket->registered = 1;
+}
+
+static void reactor_run_peer(struct Reactor * r, struct Peer * p) {
+    peer_run(p, r->info_hash_hex, r->torrent_metadata, r->torrent_data, r->metadata_queue, r->data_queue, r->cancel_flag);
+
+    // connecting replaces the peers socket, make sure the new one is being watched
+    reactor_register_socket(r, p);
+
+    // run it again when it's next due to reconnect, time out or send a keepalive
+    int64_t timeout = peer_get_timeout(p);
+    if (timeout == -1) {
+        timer_wheel_cancel(r->timers, &p->timer);
+    } else {
+        timer_wheel_schedule(r->timers, &p->timer, now_cached() + timeout);
+    }
+}
+
+int reactor_run(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+
+    struct JobArg r_job_arg = va_arg(args, struct JobArg);
+    struct Reactor * r = (struct Reactor *) r_job_arg.arg;
+
+    va_end(args);
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    r->cancel_flag = cancel_flag;
+    timer_init(&r->tick_timer, &reactor_tick_timer, NULL);
+    // tick straight away
+    timer_wheel_schedule(r->timers, &r->tick_timer, now_update());
+
+    while (*cancel_flag != 1) {
+        // the tick timer is always scheduled, so there's always a deadline. the coarse clock can lag behind by a
+        // kernel tick, sleep a wheel tick longer so the timers are due by the time we wake up
+        int64_t timeout = timer_wheel_next_deadline(r->timers) - now() + TIMER_WHEEL_TICK_MS;
+        if (timeout < 0) {
+            timeout = 0;
+        }
+
+        int event_count = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, (int) timeout);
+        if (event_count == -1) {
+            if (errno == EINTR) {
+                errno = 0;
+                continue;
+            }
+            throw("reactor failed to wait for events %s", clean_errno());
+        }
+
+        // peers take the time from now_cached until the next wait, rather than each reading the clock
+        now_update();
+
+        int tick = 0;
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].data.ptr == NULL) {
+                uint64_t wakes;
+                if (read(r->wake_fd, &wakes, sizeof(wakes)) == -1) {
+                    errno = 0;
+                }
+                tick = 1;
+                continue;
+            }
+
+            struct Peer * p = (struct Peer *) events[i].data.ptr;
+            if (p->socket == NULL) {
+                continue;
+            }
+
+            uint32_t e = events[i].events;
+            if (e & EPOLLIN) {
+                p->socket->readable = 1;
+            }
+            if (e & EPOLLOUT) {
+                p->socket->writable = 1;
+            }
+            if (e & (EPOLLERR | EPOLLHUP)) {
+                p->socket->hungup = 1;
+            }
+
+            reactor_run_peer(r, p);
+        }
+
+        if (reactor_adopt_peers(r) == EXIT_FAILURE) {
+            goto error;
+        }
+
+        if (tick == 1) {
+            reactor_tick(r);
+        }
+
+        timer_wheel_advance(r->timers, now_cached(), (void *) r);
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+struct Reactor * reactor_free(struct Reactor * r) {
+    if (r != NULL) {
+        if (r->incoming_peers != NULL) {
+            // peers waiting to be adopted are still owned by the torrent
+            while (queue_get_count(r->incoming_peers) > 0) {
+                queue_pop(r->incoming_peers);
+            }
+            queue_free(r->incoming_peers);
+            r->incoming_peers = NULL;
+        }
+        r->timers = timer_wheel_free(r->timers);
+        if (r->peers != NULL) {
+            free(r->peers);
+            r->peers = NULL;
+        }
+        if (r->wake_fd != -1) {
+            close(r->wake_fd);
+            r->wake_fd = -1;
+        }
+        if (r->epoll_fd != -1) {
+            close(r->epoll_fd);
+            r->epoll_fd = -1;
+        }
+        free(r);
+        r = NULL;
+    }
+
+    return r;
+}
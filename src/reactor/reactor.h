@@ -0,0 +1,108 @@
+/**
+ * @file reactor/reactor.h
+ *
+ * @brief the reactor struct owns a set of peers and drives their state machines from a single thread. every peer socket
+ *        is registered with an edge-triggered epoll instance, so a peer only runs when its socket actually becomes
+ *        readable / writable / hung up, or when the reactor ticks.
+ *
+ *        each peer has a timer in the reactors timer wheel, set to when the peer next has time based work to do
+ *        (reconnecting, keepalives, timeouts, see peer_get_timeout). it's moved every time the peer runs, and when it
+ *        fires the peer is ran. epoll_wait sleeps until the wheel's next deadline.
+ *
+ *        the reactor also ticks every REACTOR_TICK_MS, or sooner when reactor_wake is called. a tick runs every peer
+ *        once so that work depending on state other threads change (completed pieces to announce, upload slot changes,
+ *        metadata becoming available, expired claims) still happens.
+ *
+ *        the reactor runs as a long lived job on the torrents thread pool. see reactor_run.
+ *
+ * @note peers are handed to a reactor with reactor_add_peer and are never run by any other thread afterwards. the
+ *       reactor does not own the peers memory, the torrent frees peers after the thread pool has been stopped.
+ *
+ * @note when a peer connects or disconnects it's buffered_socket is replaced. the reactor registers any socket that
+ *       isn't registered yet after running a peer. closing a socket removes it from the epoll set automatically.
+ *
+ * @see peer/peer.h
+ * @see buffered_socket/buffered_socket.h
+ */
+#ifndef UVGTORRENT_C_REACTOR_H
+#define UVGTORRENT_C_REACTOR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "../thread_pool/queue.h"
+#include "../message_ring/message_ring.h"
+#include "../torrent/torrent_data.h"
+#include "../peer/peer.h"
+#include "../deadline/timer_wheel.h"
+
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_TICK_MS 1000
+
+struct Reactor {
+    int epoll_fd;
+    int wake_fd; // eventfd used to interrupt epoll_wait and force a tick
+
+    struct Queue * incoming_peers; // peers handed over by other threads, waiting to be picked up by the reactor thread
+
+    /* owned by the reactor thread */
+    struct TimerWheel * timers; // the peers timers, and tick_timer
+    struct Timer tick_timer;
+    _Atomic int * cancel_flag; // of the running reactor job, for peers ran by their timers
+
+    /* peers owned by the reactor thread */
+    struct Peer ** peers;
+    int peer_count;
+    int peer_capacity;
+
+    /* shared torrent state passed to every peer */
+    int8_t info_hash_hex[20];
+    struct TorrentData * torrent_metadata;
+    struct TorrentData * torrent_data;
+    struct MessageRing * metadata_queue;
+    struct MessageRing * data_queue;
+};
+
+/**
+ * @brief create a new reactor
+ * @param info_hash_hex
+ * @param torrent_metadata
+ * @param torrent_data
+ * @param metadata_queue queue for peers to return metadata chunks to the main thread
+ * @param data_queue queue for peers to return data chunks to the main thread
+ * @return struct Reactor *. NULL on failure
+ */
+extern struct Reactor * reactor_new(int8_t info_hash_hex[20], struct TorrentData * torrent_metadata, struct TorrentData * torrent_data,
+                                    struct MessageRing * metadata_queue, struct MessageRing * data_queue);
+
+/**
+ * @brief hand a peer over to the reactor. safe to call from any thread
+ * @param r
+ * @param p
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int reactor_add_peer(struct Reactor * r, struct Peer * p);
+
+/**
+ * @brief interrupt the reactor and make it run all of it's peers. safe to call from any thread
+ * @note call this when shared state changed in a way peers should react to without waiting for the next tick
+ * @param r
+ */
+extern void reactor_wake(struct Reactor * r);
+
+/**
+ * @brief reactor main loop. runs until cancel_flag is set
+ * @param cancel_flag
+ * @param ... JobArg containing the struct Reactor *
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int reactor_run(_Atomic int * cancel_flag, ...);
+
+/**
+ * @brief free the given reactor
+ * @note the reactor thread must have exited before calling this. peers are not freed
+ * @param r
+ * @return r after freeing, NULL on success
+ */
+extern struct Reactor * reactor_free(struct Reactor * r);
+
+#endif //UVGTORRENT_C_REACTOR_H
@@ -23,6 +23,10 @@ A million repetitions of "a"
 #include <stdint.h>
 
 #include "sha1.h"
+#include "sha1_x86.h"
+
+#include <pthread.h>
+#include <stdlib.h>
 
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -176,6 +180,100 @@ void SHA1Transform(
 }
 
 
+/* Runtime dispatch. SHA1Update hashes whole blocks through sha1_blocks, SHA1MultiUpdate hands 8 messages at a time
+   to sha1_blocks_x8 when there is one. Both are picked from cpuid the first time they're needed. */
+
+static void sha1_portable_blocks(
+        uint32_t state[5],
+        const unsigned char *data,
+        size_t blocks
+)
+{
+    for (size_t i = 0; i < blocks; i++)
+    {
+        SHA1Transform(state, &data[i * 64]);
+    }
+}
+
+static void (*sha1_blocks)(uint32_t state[5], const unsigned char *data, size_t blocks) = sha1_portable_blocks;
+static void (*sha1_blocks_x8)(uint32_t * states[8], const unsigned char * data[8], size_t blocks) = NULL;
+static pthread_once_t sha1_dispatch_once = PTHREAD_ONCE_INIT;
+
+static void sha1_dispatch_select(
+        enum SHA1Implementation impl
+)
+{
+    sha1_blocks = sha1_portable_blocks;
+    sha1_blocks_x8 = NULL;
+#ifdef SHA1_X86
+    /* auto takes the best of both: SHA-NI for single streams, AVX2 lanes for batches, which come out ahead of
+       SHA-NI per stream */
+    if ((impl == SHA1_IMPL_AUTO || impl == SHA1_IMPL_SHANI) && sha1_x86_has_shani())
+        sha1_blocks = sha1_x86_shani_blocks;
+    if ((impl == SHA1_IMPL_AUTO || impl == SHA1_IMPL_AVX2) && sha1_x86_has_avx2())
+        sha1_blocks_x8 = sha1_x86_avx2_blocks_x8;
+#endif
+}
+
+static void sha1_dispatch_init(
+        void
+)
+{
+    sha1_dispatch_select(SHA1_IMPL_AUTO);
+}
+
+int SHA1ImplementationSupported(
+        enum SHA1Implementation impl
+)
+{
+    switch (impl)
+    {
+    case SHA1_IMPL_AUTO:
+    case SHA1_IMPL_PORTABLE:
+        return 1;
+#ifdef SHA1_X86
+    case SHA1_IMPL_SHANI:
+        return sha1_x86_has_shani();
+    case SHA1_IMPL_AVX2:
+        return sha1_x86_has_avx2();
+#endif
+    default:
+        return 0;
+    }
+}
+
+int SHA1UseImplementation(
+        enum SHA1Implementation impl
+)
+{
+    pthread_once(&sha1_dispatch_once, sha1_dispatch_init);
+    if (!SHA1ImplementationSupported(impl))
+        return EXIT_FAILURE;
+
+    sha1_dispatch_select(impl);
+    return EXIT_SUCCESS;
+}
+
+const char * SHA1ImplementationName(
+        enum SHA1Implementation impl
+)
+{
+    switch (impl)
+    {
+    case SHA1_IMPL_AUTO:
+        return "auto";
+    case SHA1_IMPL_PORTABLE:
+        return "portable";
+    case SHA1_IMPL_SHANI:
+        return "sha-ni";
+    case SHA1_IMPL_AVX2:
+        return "avx2 x8";
+    default:
+        return "unknown";
+    }
+}
+
+
 /* SHA1Init - Initialize new context */
 
 void SHA1Init(
@@ -204,6 +302,8 @@ void SHA1Update(
 
     uint32_t j;
 
+    pthread_once(&sha1_dispatch_once, sha1_dispatch_init);
+
     j = context->count[0];
     if ((context->count[0] += len << 3) < j)
         context->count[1]++;
@@ -212,11 +312,9 @@ void SHA1Update(
     if ((j + len) > 63)
     {
         memcpy(&context->buffer[j], data, (i = 64 - j));
-        SHA1Transform(context->state, context->buffer);
-        for (; i + 63 < len; i += 64)
-        {
-            SHA1Transform(context->state, &data[i]);
-        }
+        sha1_blocks(context->state, context->buffer, 1);
+        sha1_blocks(context->state, &data[i], (len - i) / 64);
+        i += ((len - i) / 64) * 64;
         j = 0;
     }
     else
@@ -225,6 +323,57 @@ void SHA1Update(
 }
 
 
+/* Run count messages of the same length through at once, 8 at a time on the AVX2 lanes when they can be used. */
+
+void SHA1MultiUpdate(
+        SHA1_CTX * contexts[],
+        const unsigned char * data[],
+        uint32_t len,
+        int count
+)
+{
+    int lane = 0;
+
+    pthread_once(&sha1_dispatch_once, sha1_dispatch_init);
+
+    if (sha1_blocks_x8 != NULL)
+    {
+        uint32_t blocks = len / 64;
+        uint32_t bytes = blocks * 64;
+
+        for (; blocks > 0 && lane + 8 <= count; lane += 8)
+        {
+            uint32_t * states[8];
+            int aligned = 1;
+            for (int i = 0; i < 8; i++)
+            {
+                states[i] = contexts[lane + i]->state;
+                /* the lanes can only start on a block boundary */
+                aligned &= ((contexts[lane + i]->count[0] >> 3) & 63) == 0;
+            }
+            if (!aligned)
+                break;
+
+            sha1_blocks_x8(states, &data[lane], blocks);
+            for (int i = 0; i < 8; i++)
+            {
+                SHA1_CTX * context = contexts[lane + i];
+                uint32_t j = context->count[0];
+                if ((context->count[0] += bytes << 3) < j)
+                    context->count[1]++;
+                context->count[1] += (bytes >> 29);
+                SHA1Update(context, data[lane + i] + bytes, len - bytes);
+            }
+        }
+    }
+
+    for (; lane < count; lane++)
+    {
+        SHA1Update(contexts[lane], data[lane], len);
+    }
+}
+
+
 /* Add padding and return the message digest. */
 
 void SHA1Final(
@@ -284,11 +433,9 @@ void SHA1(
         int len)
 {
     SHA1_CTX ctx;
-    unsigned int ii;
 
     SHA1Init(&ctx);
-    for (ii=0; ii<len; ii+=1)
-        SHA1Update(&ctx, (const unsigned char*)str + ii, 1);
+    SHA1Update(&ctx, (const unsigned char*)str, (uint32_t) len);
     SHA1Final((unsigned char *)hash_out, &ctx);
     hash_out[20] = '\0';
 }
@@ -15,6 +15,32 @@ typedef struct
     unsigned char buffer[64];
 } SHA1_CTX;
 
+/*
+   Block functions the hashing can run on. The fastest ones the cpu supports are picked the first time it's used:
+   SHA-NI hashes a single stream, AVX2 hashes 8 independent streams at once and is only used by SHA1MultiUpdate.
+ */
+enum SHA1Implementation
+{
+    SHA1_IMPL_AUTO,
+    SHA1_IMPL_PORTABLE,
+    SHA1_IMPL_SHANI,
+    SHA1_IMPL_AVX2
+};
+
+int SHA1ImplementationSupported(
+        enum SHA1Implementation impl
+);
+
+/* force an implementation, for benchmarks and tests, SHA1_IMPL_AUTO goes back to the default.
+   not thread safe, call it before hashing. returns EXIT_FAILURE if the cpu doesn't support it */
+int SHA1UseImplementation(
+        enum SHA1Implementation impl
+);
+
+const char * SHA1ImplementationName(
+        enum SHA1Implementation impl
+);
+
 void SHA1Transform(
         uint32_t state[5],
         const unsigned char buffer[64]
@@ -30,6 +56,14 @@ void SHA1Update(
         uint32_t len
 );
 
+/* SHA1Update on count contexts with len bytes each, hashing 8 at a time in parallel when the cpu allows it */
+void SHA1MultiUpdate(
+        SHA1_CTX * contexts[],
+        const unsigned char * data[],
+        uint32_t len,
+        int count
+);
+
 void SHA1Final(
         unsigned char digest[20],
         SHA1_CTX * context
@@ -0,0 +1,177 @@
+#include "sha1_x86.h"
+
+#ifdef SHA1_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+int sha1_x86_has_shani(void) {
+    unsigned int a, b, c, d;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d) == 0) {
+        return 0;
+    }
+    return (b & (1 << 29)) != 0 && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+}
+
+int sha1_x86_has_avx2(void) {
+    // __builtin_cpu_supports also checks the os saves the ymm registers
+    return __builtin_cpu_supports("avx2");
+}
+
+/* SHA extensions */
+
+/* 4 rounds, while expanding the message words 4 rounds ahead. M0 holds the words for these rounds */
+#define SHA1_NI_ROUNDS(EIN, EOUT, M0, M1, M2, M3, F) \
+    EIN = _mm_sha1nexte_epu32(EIN, M0); \
+    EOUT = abcd; \
+    M1 = _mm_sha1msg2_epu32(M1, M0); \
+    abcd = _mm_sha1rnds4_epu32(abcd, EIN, F); \
+    M3 = _mm_sha1msg1_epu32(M3, M0); \
+    M2 = _mm_xor_si128(M2, M0);
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha1_x86_shani_blocks(uint32_t state[5], const unsigned char * data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+    __m128i e1;
+    __m128i msg0, msg1, msg2, msg3;
+
+    while (blocks > 0) {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+
+        /* rounds 0-15 load the message */
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 0)), byte_swap);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), byte_swap);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), byte_swap);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), byte_swap);
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0) /* 12-15 */
+
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0) /* 16-19 */
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1) /* 20-23 */
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1) /* 24-27 */
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1) /* 28-31 */
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1) /* 32-35 */
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1) /* 36-39 */
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2) /* 40-43 */
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2) /* 44-47 */
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2) /* 48-51 */
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2) /* 52-55 */
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2) /* 56-59 */
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3) /* 60-63 */
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3) /* 64-67 */
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 3) /* 68-71 */
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 3) /* 72-75 */
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3) /* 76-79 */
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        data += 64;
+        blocks--;
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128((__m128i *) state, abcd);
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+/* AVX2, 8 messages at once */
+
+#define SHA1_X8_ROL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+static inline uint32_t sha1_x86_load_be32(const unsigned char * p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+__attribute__((target("avx2")))
+void sha1_x86_avx2_blocks_x8(uint32_t * states[8], const unsigned char * data[8], size_t blocks) {
+    __m256i s[5];
+    for (int i = 0; i < 5; i++) {
+        s[i] = _mm256_setr_epi32((int) states[0][i], (int) states[1][i], (int) states[2][i], (int) states[3][i],
+                                 (int) states[4][i], (int) states[5][i], (int) states[6][i], (int) states[7][i]);
+    }
+
+    const __m256i k0 = _mm256_set1_epi32(0x5A827999);
+    const __m256i k1 = _mm256_set1_epi32(0x6ED9EBA1);
+    const __m256i k2 = _mm256_set1_epi32((int) 0x8F1BBCDC);
+    const __m256i k3 = _mm256_set1_epi32((int) 0xCA62C1D6);
+
+    for (size_t block = 0; block < blocks; block++) {
+        __m256i w[16];
+        size_t offset = block * 64;
+        for (int t = 0; t < 16; t++) {
+            size_t o = offset + (t * 4);
+            w[t] = _mm256_setr_epi32((int) sha1_x86_load_be32(data[0] + o), (int) sha1_x86_load_be32(data[1] + o),
+                                     (int) sha1_x86_load_be32(data[2] + o), (int) sha1_x86_load_be32(data[3] + o),
+                                     (int) sha1_x86_load_be32(data[4] + o), (int) sha1_x86_load_be32(data[5] + o),
+                                     (int) sha1_x86_load_be32(data[6] + o), (int) sha1_x86_load_be32(data[7] + o));
+        }
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+
+        for (int t = 0; t < 80; t++) {
+            if (t >= 16) {
+                __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t + 13) & 15], w[(t + 8) & 15]),
+                                             _mm256_xor_si256(w[(t + 2) & 15], w[t & 15]));
+                w[t & 15] = SHA1_X8_ROL(x, 1);
+            }
+
+            __m256i f, k;
+            if (t < 20) {
+                f = _mm256_xor_si256(_mm256_and_si256(b, _mm256_xor_si256(c, d)), d);
+                k = k0;
+            } else if (t < 40) {
+                f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+                k = k1;
+            } else if (t < 60) {
+                f = _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(b, c), d), _mm256_and_si256(b, c));
+                k = k2;
+            } else {
+                f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+                k = k3;
+            }
+
+            __m256i temp = _mm256_add_epi32(_mm256_add_epi32(SHA1_X8_ROL(a, 5), f),
+                                            _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15]));
+            e = d;
+            d = c;
+            c = SHA1_X8_ROL(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *) lanes, s[i]);
+        for (int lane = 0; lane < 8; lane++) {
+            states[lane][i] = lanes[lane];
+        }
+    }
+}
+
+#endif
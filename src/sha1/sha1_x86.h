@@ -0,0 +1,43 @@
+/**
+ * @file sha1/sha1_x86.h
+ *
+ * @brief x86 SHA-1 block functions used by sha1.c. they're compiled with per function target attributes, so the rest of
+ *        the project doesn't need any special compiler flags. only call them after checking the cpu supports them,
+ *        see sha1_x86_has_shani and sha1_x86_has_avx2.
+ */
+#ifndef SHA1_X86_H
+#define SHA1_X86_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86 1
+
+/**
+ * @brief does the cpu have the SHA extensions (and the SSE4.1 they're used with)?
+ * @return 1 or 0
+ */
+int sha1_x86_has_shani(void);
+
+/**
+ * @brief does the cpu and os support AVX2?
+ * @return 1 or 0
+ */
+int sha1_x86_has_avx2(void);
+
+/**
+ * @brief hash blocks 64 byte blocks of data into state using the SHA extensions
+ */
+void sha1_x86_shani_blocks(uint32_t state[5], const unsigned char * data, size_t blocks);
+
+/**
+ * @brief hash blocks 64 byte blocks of 8 independent messages at once, one per AVX2 lane
+ * @param states the state of each message
+ * @param data the data of each message, each at least blocks * 64 bytes
+ */
+void sha1_x86_avx2_blocks_x8(uint32_t * states[8], const unsigned char * data[8], size_t blocks);
+
+#endif
+
+#endif /* SHA1_X86_H */
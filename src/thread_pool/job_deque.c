@@ -0,0 +1,69 @@
+#include "job_deque.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define JOB_DEQUE_MASK (JOB_DEQUE_SIZE - 1)
+
+void job_deque_init(struct JobDeque * d) {
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    for (int i = 0; i < JOB_DEQUE_SIZE; i++) {
+        atomic_init(&d->jobs[i], NULL);
+    }
+}
+
+int job_deque_push(struct JobDeque * d, struct Job * j) {
+    int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_SIZE) {
+        return EXIT_FAILURE;
+    }
+
+    atomic_store_explicit(&d->jobs[bottom & JOB_DEQUE_MASK], j, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+
+    return EXIT_SUCCESS;
+}
+
+struct Job * job_deque_pop(struct JobDeque * d) {
+    int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // empty
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct Job * j = atomic_load_explicit(&d->jobs[bottom & JOB_DEQUE_MASK], memory_order_relaxed);
+    if (top == bottom) {
+        // the last job, thieves may be after it too
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            j = NULL;
+        }
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return j;
+}
+
+struct Job * job_deque_steal(struct JobDeque * d) {
+    int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    struct Job * j = atomic_load_explicit(&d->jobs[top & JOB_DEQUE_MASK], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return j;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file thread_pool/job_deque.h
+ *
+ * @brief Chase-Lev work stealing deque of jobs. every worker in the thread pool owns one: the owner pushes and pops jobs
+ *        at the bottom, last in first out, while idle workers steal from the top, first in first out. only a steal
+ *        racing the owner for the last job needs a compare and swap.
+ *
+ *        the ring has a fixed size so pushing never mallocs, a full deque makes the pool fall back to it's injection
+ *        queue instead of growing.
+ *
+ * @warning job_deque_push and job_deque_pop may only be called by the owning worker
+ *
+ * @see https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+ */
+#ifndef UVGTORRENT_C_THREAD_POOL_JOB_DEQUE_H
+#define UVGTORRENT_C_THREAD_POOL_JOB_DEQUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define JOB_DEQUE_SIZE 256 // must be a power of 2
+
+struct Job;
+
+struct JobDeque {
+    _Alignas(64) _Atomic int64_t top; // next job to steal
+    _Alignas(64) _Atomic int64_t bottom; // next free slot, owned by the worker
+    _Atomic(struct Job *) jobs[JOB_DEQUE_SIZE];
+};
+
+/**
+ * @brief initialize an empty deque
+ * @param d
+ */
+extern void job_deque_init(struct JobDeque * d);
+
+/**
+ * @brief push a job to the bottom of the deque
+ * @param d
+ * @param j
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the deque is full
+ */
+extern int job_deque_push(struct JobDeque * d, struct Job * j);
+
+/**
+ * @brief pop the newest job from the bottom of the deque
+ * @param d
+ * @return struct Job *, NULL if the deque is empty or a thief took the last job
+ */
+extern struct Job * job_deque_pop(struct JobDeque * d);
+
+/**
+ * @brief steal the oldest job from the top of another workers deque
+ * @param d
+ * @return struct Job *, NULL if the deque is empty or another thread got there first
+ */
+extern struct Job * job_deque_steal(struct JobDeque * d);
+
+#endif // UVGTORRENT_C_THREAD_POOL_JOB_DEQUE_H
@@ -0,0 +1,108 @@
+#include "job_queue.h"
+#include "../log.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct JobQueue * job_queue_new(size_t capacity) {
+    struct JobQueue * q = NULL;
+
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    q = aligned_alloc(_Alignof(struct JobQueue), sizeof(struct JobQueue));
+    if (!q) {
+        throw("job queue failed to malloc");
+    }
+    q->mask = size - 1;
+    q->cells = malloc(sizeof(struct JobQueueCell) * size);
+    if (!q->cells) {
+        throw("job queue cells failed to malloc");
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+        q->cells[i].job = NULL;
+    }
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+
+    return q;
+    error:
+    return job_queue_free(q);
+}
+
+int job_queue_push(struct JobQueue * q, struct Job * j) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    struct JobQueueCell * cell = NULL;
+
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+        if (diff == 0) {
+            // the cell is free for this lap, claim it
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the consumer of the previous lap hasn't taken it yet, the queue is full
+            return EXIT_FAILURE;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->job = j;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    return EXIT_SUCCESS;
+}
+
+struct Job * job_queue_pop(struct JobQueue * q) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    struct JobQueueCell * cell = NULL;
+
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // nothing has been written to the cell yet, the queue is empty
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    struct Job * j = cell->job;
+    // ready for the producer of the next lap
+    atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+
+    return j;
+}
+
+size_t job_queue_get_count(struct JobQueue * q) {
+    size_t dequeue_pos = atomic_load(&q->dequeue_pos);
+    size_t enqueue_pos = atomic_load(&q->enqueue_pos);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+struct JobQueue * job_queue_free(struct JobQueue * q) {
+    if (q) {
+        if (q->cells) {
+            free(q->cells);
+            q->cells = NULL;
+        }
+        free(q);
+        q = NULL;
+    }
+
+    return q;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file thread_pool/job_queue.h
+ *
+ * @brief bounded lock free multi producer multi consumer queue of jobs, the thread pools injection queue. jobs added
+ *        from outside the pool go here and any worker may take them.
+ *
+ *        the queue is a ring of cells allocated up front, so pushing never mallocs. each cell carries a sequence number
+ *        that says whether it's ready to be written or read for the current lap of the ring, producers and consumers
+ *        claim a position with a compare and swap and then only touch their own cell.
+ *
+ * @see http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+#ifndef UVGTORRENT_C_THREAD_POOL_JOB_QUEUE_H
+#define UVGTORRENT_C_THREAD_POOL_JOB_QUEUE_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+struct Job;
+
+struct JobQueueCell {
+    _Atomic size_t sequence;
+    struct Job * job;
+};
+
+struct JobQueue {
+    size_t mask; // capacity - 1, capacity is a power of 2
+    struct JobQueueCell * cells;
+
+    /* producers and consumers each get their own cache line */
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Alignas(64) _Atomic size_t dequeue_pos;
+};
+
+/**
+ * @brief mallocs a new JobQueue
+ * @param capacity most jobs the queue holds, rounded up to a power of 2
+ * @return struct JobQueue * on success, NULL on failure
+ */
+extern struct JobQueue * job_queue_new(size_t capacity);
+
+/**
+ * @brief add a job to the queue
+ * @param q
+ * @param j
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the queue is full
+ */
+extern int job_queue_push(struct JobQueue * q, struct Job * j);
+
+/**
+ * @brief take the oldest job from the queue
+ * @param q
+ * @return struct Job *, NULL if the queue is empty
+ */
+extern struct Job * job_queue_pop(struct JobQueue * q);
+
+/**
+ * @brief number of jobs in the queue
+ * @note only a snapshot while other threads are pushing or popping
+ * @param q
+ * @return
+ */
+extern size_t job_queue_get_count(struct JobQueue * q);
+
+/**
+ * @brief free the given queue. jobs still in it are not freed
+ * @param q
+ * @return q after freeing, NULL on success
+ */
+extern struct JobQueue * job_queue_free(struct JobQueue * q);
+
+#endif // UVGTORRENT_C_THREAD_POOL_JOB_QUEUE_H
@@ -2,6 +2,7 @@
 #include "../log.h"
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
 
 /* PRIVATE FUNCTIONS */
 void queue_lock(struct Queue *q) {
@@ -26,6 +27,7 @@ extern struct Queue *queue_new() {
     q->count = 0;
     q->head = NULL;
     q->tail = NULL;
+    q->wake_fd = -1;
 
     return q;
     error:
@@ -45,17 +47,18 @@ int queue_push(struct Queue *q, void *elem) {
     if (q->head == NULL) {
         q->head = node;
         q->tail = node;
-        q->count += 1;
-
-        queue_unlock(q);
-        return EXIT_SUCCESS;
+    } else {
+        q->tail->next = node;
+        q->tail = node;
     }
-
-    q->tail->next = node;
-    q->tail = node;
     q->count += 1;
+    int wake_fd = q->wake_fd;
 
     queue_unlock(q);
+
+    if (wake_fd != -1) {
+        eventfd_write(wake_fd, 1);
+    }
     return EXIT_SUCCESS;
     error:
     if (node) { free(node); };
@@ -88,6 +91,12 @@ void *queue_pop(struct Queue *q) {
     return elem;
 }
 
+void queue_set_wake_fd(struct Queue *q, int wake_fd) {
+    queue_lock(q);
+    q->wake_fd = wake_fd;
+    queue_unlock(q);
+}
+
 int queue_get_count(struct Queue *q) {
     queue_lock(q);
     int count = q->count;
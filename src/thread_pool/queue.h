@@ -14,6 +14,7 @@ struct Queue {
     volatile int count;
     struct QueueNode *head;
     struct QueueNode *tail;
+    int wake_fd; // eventfd written to on every push, -1 for none
 };
 
 
@@ -65,6 +66,13 @@ extern int queue_push(struct Queue *q, void *elem);
  */
 extern void *queue_pop(struct Queue *q);
 
+/**
+ * @brief have every push to the queue write to an eventfd, so whoever pops from it can sleep until there's something
+ * @param q
+ * @param wake_fd eventfd, -1 to stop
+ */
+extern void queue_set_wake_fd(struct Queue *q, int wake_fd);
+
 /**
  * @brief return the number of elements in the given queue
  * @param q
@@ -1,25 +1,99 @@
 #include "thread_pool.h"
 #include "../log.h"
 #include <stdlib.h>
-#include <semaphore.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// the worker running on this thread, NULL outside of the pool
+static __thread struct ThreadPoolWorker * thread_pool_worker = NULL;
+
+/* PRIVATE FUNCTIONS */
+static void thread_pool_futex_wait(_Atomic uint32_t * addr, uint32_t value) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void thread_pool_futex_wake(_Atomic uint32_t * addr, int count) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * @brief let a parked worker know there's work, unless one is already on it's way
+ */
+static void thread_pool_wake(struct ThreadPool *tp) {
+    atomic_fetch_add(&tp->wake_seq, 1);
+    if (atomic_load(&tp->parked_threads) > 0) {
+        int waking = 0;
+        if (atomic_compare_exchange_strong(&tp->waking, &waking, 1)) {
+            thread_pool_futex_wake(&tp->wake_seq, 1);
+        }
+    }
+}
+
+/**
+ * @brief find the next job for a worker: it's own newest job, then the oldest added from outside the pool, then the
+ *        oldest job of another worker
+ * @return struct Job *, NULL if there's no work anywhere
+ */
+static struct Job * thread_pool_find_job(struct ThreadPool *tp, struct ThreadPoolWorker *w) {
+    struct Job *j = job_deque_pop(&w->deque);
+    if (j) {
+        return j;
+    }
+
+    j = job_queue_pop(tp->job_queue);
+    if (j) {
+        if (job_queue_get_count(tp->job_queue) > 0) {
+            thread_pool_wake(tp);
+        }
+        return j;
+    }
+
+    int thread_count = atomic_load(&tp->thread_count);
+    for (int i = 1; i < thread_count; i++) {
+        j = job_deque_steal(&tp->workers[(w->index + i) % thread_count].deque);
+        if (j) {
+            return j;
+        }
+    }
+
+    return NULL;
+}
 
 /* THREAD POOL */
 void *thread_handle(void *args) {
-    struct ThreadPool *tp = (struct ThreadPool *) args;
-    struct Queue *job_queue = tp->job_queue;
+    struct ThreadPoolWorker *w = (struct ThreadPoolWorker *) args;
+    struct ThreadPool *tp = w->tp;
+    thread_pool_worker = w;
 
     while (tp->cancel_flag != 1) {
-        sem_wait(&tp->job_semaphore);
-        if (queue_get_count(job_queue) > 0) {
-            struct Job *j = (struct Job *) queue_pop(job_queue);
-            if (j) {
-                job_execute(j, (_Atomic int *) &tp->cancel_flag);
-                job_free(j);
+        struct Job *j = thread_pool_find_job(tp, w);
+        if (!j) {
+            // announce we're parking before looking one last time, so a job added in between always wakes us
+            uint32_t wake_seq = atomic_load(&tp->wake_seq);
+            atomic_fetch_add(&tp->parked_threads, 1);
+            j = thread_pool_find_job(tp, w);
+            if (!j && tp->cancel_flag != 1) {
+                thread_pool_futex_wait(&tp->wake_seq, wake_seq);
             }
+            atomic_fetch_sub(&tp->parked_threads, 1);
+            // awake and about to look for work, the next job added may wake someone else
+            atomic_store(&tp->waking, 0);
+        }
+
+        if (j) {
+            tp->working_threads++;
+            job_execute(j, (_Atomic int *) &tp->cancel_flag);
+            job_free(j);
+            tp->working_threads--;
         }
     }
+
+    return NULL;
 }
 
 struct ThreadPool *thread_pool_new(int max_threads) {
@@ -36,15 +110,27 @@ struct ThreadPool *thread_pool_new(int max_threads) {
     tp->working_threads = 0;
     tp->cancel_flag = 0;
     tp->job_queue = NULL;
+    tp->workers = NULL;
+    tp->wake_seq = 0;
+    tp->parked_threads = 0;
+    tp->waking = 0;
+    pthread_mutex_init(&tp->spawn_lock, NULL);
 
-    // initialize a claimed semaphore to prevent worker threads from hogging cpu.
-    // when work becomes available, we will release the semaphore
-    sem_init(&tp->job_semaphore, 0, 0);
-    tp->job_queue = queue_new();
+    tp->job_queue = job_queue_new(THREAD_POOL_QUEUE_SIZE);
     if (!tp->job_queue) {
         throw("ThreadPool job_queue failed to initialize");
     }
 
+    tp->workers = aligned_alloc(_Alignof(struct ThreadPoolWorker), sizeof(struct ThreadPoolWorker) * max_threads);
+    if (!tp->workers && max_threads > 0) {
+        throw("ThreadPool workers failed to malloc");
+    }
+    for (int i = 0; i < max_threads; i++) {
+        job_deque_init(&tp->workers[i].deque);
+        tp->workers[i].tp = tp;
+        tp->workers[i].index = i;
+    }
+
     return tp;
 
     error:
@@ -53,25 +139,38 @@ struct ThreadPool *thread_pool_new(int max_threads) {
 
 struct ThreadPool *thread_pool_free(struct ThreadPool *tp) {
     if (tp) {
+        // once the cancel flag is set under the spawn lock no more threads are started
+        pthread_mutex_lock(&tp->spawn_lock);
         tp->cancel_flag = 1;
-        for (int i = 0; i < tp->thread_count; i++) {
-            // increment the semaphore enough times to allow each thread to exit cleanly
-            // due to the cancel flag we just set
-            sem_post(&tp->job_semaphore);
-        }
-        for (int i = 0; i < tp->thread_count; i++) {
+        int thread_count = tp->thread_count;
+        pthread_mutex_unlock(&tp->spawn_lock);
+
+        // wake every parked thread so it sees the cancel flag
+        atomic_fetch_add(&tp->wake_seq, 1);
+        thread_pool_futex_wake(&tp->wake_seq, INT_MAX);
+
+        for (int i = 0; i < thread_count; i++) {
             pthread_join(tp->threads[i], NULL);
         }
-        if (tp->job_queue) {
-            while (queue_get_count(tp->job_queue) > 0) {
-                struct Job *j = (struct Job *) queue_pop(tp->job_queue);
-                if (j) {
+
+        struct Job *j = NULL;
+        if (tp->workers) {
+            for (int i = 0; i < tp->max_threads; i++) {
+                while ((j = job_deque_steal(&tp->workers[i].deque)) != NULL) {
                     job_free(j);
                 }
             }
-            queue_free(tp->job_queue);
-            tp->job_queue = NULL;
+            free(tp->workers);
+            tp->workers = NULL;
+        }
+        if (tp->job_queue) {
+            while ((j = job_queue_pop(tp->job_queue)) != NULL) {
+                job_free(j);
+            }
+            tp->job_queue = job_queue_free(tp->job_queue);
         }
+
+        pthread_mutex_destroy(&tp->spawn_lock);
         free(tp);
         tp = NULL;
     }
@@ -82,16 +181,30 @@ struct ThreadPool *thread_pool_free(struct ThreadPool *tp) {
 int thread_pool_add_job(struct ThreadPool *tp, struct Job *j) {
     // lazy load threads as work is added
     if (tp->thread_count < tp->max_threads) {
-        if (pthread_create(&tp->threads[tp->thread_count], NULL, &thread_handle, (void *) tp)) {
-            throw("failed to create threads");
+        pthread_mutex_lock(&tp->spawn_lock);
+        int thread_count = tp->thread_count;
+        if (thread_count < tp->max_threads && tp->cancel_flag != 1) {
+            if (pthread_create(&tp->threads[thread_count], NULL, &thread_handle, (void *) &tp->workers[thread_count])) {
+                pthread_mutex_unlock(&tp->spawn_lock);
+                throw("failed to create threads");
+            }
+            tp->thread_count = thread_count + 1;
+        }
+        pthread_mutex_unlock(&tp->spawn_lock);
+    }
+
+    // jobs added by a job running on this pool stay with it's worker until someone steals them
+    struct ThreadPoolWorker *w = thread_pool_worker;
+    if (w == NULL || w->tp != tp || job_deque_push(&w->deque, j) == EXIT_FAILURE) {
+        if (job_queue_push(tp->job_queue, j) == EXIT_FAILURE) {
+            // full, the caller still owns the job and may try again
+            return EXIT_FAILURE;
         }
-        tp->thread_count += 1;
     }
 
-    int result = queue_push(tp->job_queue, (void *) j);
-    sem_post(&tp->job_semaphore); // release the semaphore, work is available.
+    thread_pool_wake(tp);
 
-    return result;
+    return EXIT_SUCCESS;
     error:
     return EXIT_FAILURE;
 }
@@ -1,24 +1,52 @@
+/**
+ * @file thread_pool/thread_pool.h
+ *
+ * @brief work stealing thread pool. threads are started lazily as jobs are added, up to max_threads.
+ *
+ *        - jobs added from outside the pool go to a lock free injection queue, see thread_pool/job_queue.h
+ *        - jobs added by a job running on the pool go to the bottom of that workers own deque, see
+ *          thread_pool/job_deque.h. the worker runs them newest first, and idle workers steal the oldest
+ *        - a worker looks in it's own deque, then the injection queue, then steals from the others
+ *        - workers with nothing to do park on a futex. adding a job only makes a syscall when a worker is parked and
+ *          none is already waking up. a woken worker that finds more jobs waiting wakes the next one
+ *
+ * @note most jobs in uvgTorrent hold their thread for as long as the torrent runs (reactors, verifiers, the http
+ *       server), so max_threads has to cover all of them
+ */
 #ifndef UVGTORRENT_C_THREAD_POOL_H
 #define UVGTORRENT_C_THREAD_POOL_H
 
 #include "job.h"
 #include "queue.h"
+#include "job_queue.h"
+#include "job_deque.h"
 #include <stdlib.h>
-#include <semaphore.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <stdatomic.h>
 
+#define THREAD_POOL_QUEUE_SIZE 1024 // most jobs waiting in the injection queue
+
+struct ThreadPoolWorker {
+    struct JobDeque deque;
+    struct ThreadPool * tp;
+    int index;
+};
 
 struct ThreadPool {
     _Atomic int cancel_flag;
     _Atomic int working_threads;
-    int thread_count;
+    _Atomic int thread_count;
     int max_threads;
 
-    sem_t job_semaphore;
-    struct Queue *job_queue;
+    struct JobQueue * job_queue; // jobs added from outside the pool
+    struct ThreadPoolWorker * workers;
+
+    _Atomic uint32_t wake_seq; // futex word, bumped whenever a job is added
+    _Atomic int parked_threads;
+    _Atomic int waking; // a parked thread has been woken and hasn't looked for work yet
+    pthread_mutex_t spawn_lock; // held while starting a thread
 
-    struct ThreadHandleArgs *thread_handle_args;
     pthread_t threads[];
 };
 
@@ -49,7 +77,8 @@ extern struct ThreadPool *thread_pool_free(struct ThreadPool *tp);
  * @brief add a job to the work queue
  * @param tp
  * @param j
- * @return EXIT_SUCCESS or EXIT_FAILURE
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if a thread couldn't be started or THREAD_POOL_QUEUE_SIZE jobs are already
+ *         waiting. the job isn't freed on failure
  */
 extern int thread_pool_add_job(struct ThreadPool *tp, struct Job *j);
 
@@ -24,6 +24,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdatomic.h>
+#include <sys/sysinfo.h>
 
 #define POLL_ERR         (-1)
 #define POLL_EXPIRE      (0)
@@ -115,10 +116,24 @@ struct Torrent *torrent_new(char *magnet_uri, char *path, int port, char * ipptr
     t->peer_ips = NULL;
     t->peer_count = 0;
     t->assign_upload_slots_deadline = 0;
+    t->rate_peers_deadline = 0;
+
+    memset(t->reactors, 0, sizeof t->reactors);
+    t->reactor_count = 0;
 
     t->torrent_metadata = NULL;
     t->torrent_data = NULL;
 
+    t->resume_path = NULL;
+    t->info = NULL;
+    t->info_len = 0;
+    t->resume_save_deadline = 0;
+    t->resume_saved_pieces = 0;
+
+    t->metadata_cache_dir = NULL;
+    t->cached_info = NULL;
+    t->cached_info_len = 0;
+
     /* set variables */
     t->magnet_uri = strndup(magnet_uri, strlen(magnet_uri));
     if (!t->magnet_uri) {
@@ -141,6 +156,18 @@ struct Torrent *torrent_new(char *magnet_uri, char *path, int port, char * ipptr
         throw("torrent failed to parse magnet_uri");
     }
 
+    t->resume_path = torrent_resume_path(t->path, t->info_hash_hex);
+    if (!t->resume_path) {
+        throw("torrent failed to set resume path");
+    }
+
+    // a torrent we've seen before doesn't need to fetch it's metadata again
+    t->metadata_cache_dir = torrent_metadata_cache_dir();
+    if (t->metadata_cache_dir != NULL &&
+        torrent_metadata_cache_load(t->metadata_cache_dir, t->info_hash_hex, &t->cached_info, &t->cached_info_len) == EXIT_SUCCESS) {
+        log_info("found metadata in cache :: %s", t->metadata_cache_dir);
+    }
+
     log_info("preparing to download torrent :: %s", t->name);
     log_info("torrent info_hash :: %s", t->info_hash);
     log_info("saving torrent to path :: %s", t->path);
@@ -232,74 +259,185 @@ int torrent_run_trackers(struct Torrent *t, struct ThreadPool *tp, struct Queue
     return EXIT_FAILURE;
 }
 
-int torrent_run_peers(struct Torrent *t, struct ThreadPool *tp, struct Queue * metadata_queue, struct Queue * data_queue) {
-    struct PeerIp * peer_ip = t->peer_ips;
-    while(peer_ip != NULL) {
-        struct Peer * p = (struct Peer *) hashmap_get(t->peers, peer_ip->str_ip);
-        hashmap_set(t->peers, p->str_ip, p);
+int torrent_start_reactors(struct Torrent *t, struct ThreadPool *tp, struct MessageRing * metadata_queue, struct MessageRing * data_queue) {
+    struct Job *j = NULL;
+    while (t->reactor_count < TORRENT_REACTOR_COUNT) {
+        struct Reactor * r = reactor_new((int8_t *) t->info_hash_hex, t->torrent_metadata, t->torrent_data, metadata_queue, data_queue);
+        if (!r) {
+            throw("reactor failed to init");
+        }
+        t->reactors[t->reactor_count] = r;
+        t->reactor_count++;
 
-        if (p->running == 0) {
-            p->running = 1;
-            struct JobArg args[6] = {
-                    {
-                            .arg = (void *) p,
-                            .mutex = NULL
-                    },
-                    {
-                            .arg = (void *) &t->info_hash_hex,
-                            .mutex =  NULL
-                    },
-                    {
-                            .arg = (void *) t->torrent_metadata,
-                            .mutex =  NULL
-                    },
-                    {
-                            .arg = (void *) t->torrent_data,
-                            .mutex =  NULL
-                    },
-                    {
-                            .arg = (void *) metadata_queue,
-                            .mutex =  NULL
-                    },
-                    {
-                            .arg = (void *) data_queue,
-                            .mutex =  NULL
-                    }
-            };
-            struct Job * j = job_new(
-                    &peer_run,
-                    sizeof(args) / sizeof(struct JobArg),
-                    args
-            );
-            if (!j) {
-                return EXIT_FAILURE;
-            }
-            if(thread_pool_add_job(tp, j) == EXIT_FAILURE) {
-                return EXIT_FAILURE;
-            }
+        struct JobArg args[1] = {
+                {
+                        .arg = (void *) r,
+                        .mutex = NULL
+                }
+        };
+        j = job_new(
+                &reactor_run,
+                sizeof(args) / sizeof(struct JobArg),
+                args
+        );
+        if (!j) {
+            throw("job failed to init");
+        }
+
+        if(thread_pool_add_job(tp, j) == EXIT_FAILURE) {
+            throw("failed to add job to thread pool");
+        }
+        j = NULL;
+    }
+
+    return EXIT_SUCCESS;
+
+    error:
+    if (j != NULL) {
+        job_free(j);
+    }
+    return EXIT_FAILURE;
+}
+
+int torrent_start_verifiers(struct Torrent *t, struct ThreadPool *tp) {
+    torrent_data_set_verify_pipeline(t->torrent_data, 1);
+
+    for (int i = 0; i < TORRENT_VERIFIER_COUNT; i++) {
+        struct JobArg args[1] = {
+                {
+                        .arg = (void *) t->torrent_data,
+                        .mutex = NULL
+                }
+        };
+        struct Job * j = job_new(
+                &torrent_data_verify_run,
+                sizeof(args) / sizeof(struct JobArg),
+                args
+        );
+        if (!j) {
+            throw("job failed to init");
+        }
+
+        if(thread_pool_add_job(tp, j) == EXIT_FAILURE) {
+            job_free(j);
+            throw("failed to add job to thread pool");
         }
-        peer_ip = peer_ip->next;
     }
 
     return EXIT_SUCCESS;
+
+    error:
+    return EXIT_FAILURE;
+}
+
+void torrent_wake_reactors(struct Torrent *t) {
+    for (int i = 0; i < t->reactor_count; i++) {
+        reactor_wake(t->reactors[i]);
+    }
+}
+
+/**
+ * @brief upload rate of the peer, decayed by how long it's been since it last sent anything
+ * @note the reactor running the peer may have updated it's rate at a later cached time than ours
+ */
+static float torrent_peer_upload_rate(struct Peer * p, int64_t current_time) {
+    if (p->socket == NULL) {
+        return 0;
+    }
+    int64_t elapsed_ms = current_time - (int64_t) p->socket->last_upload_rate_update;
+    return p->socket->upload_rate / (elapsed_ms > 0 ? elapsed_ms : 1);
 }
 
 int peer_compare_upload_speed (const void * a, const void * b) {
     struct Peer * peer_a = *(struct Peer **) a;
     struct Peer * peer_b = *(struct Peer **) b;
 
-    uint64_t now_timestamp = now();
+    // the same time for every comparison in the sort
+    int64_t current_time = now_cached();
+
+    float peer_a_socket_rate = torrent_peer_upload_rate(peer_a, current_time);
+    float peer_b_socket_rate = torrent_peer_upload_rate(peer_b, current_time);
+
+    return (peer_a_socket_rate - peer_b_socket_rate);
+}
+
+int peer_compare_download_rate (const void * a, const void * b) {
+    struct Peer * peer_a = *(struct Peer **) a;
+    struct Peer * peer_b = *(struct Peer **) b;
+
+    if (peer_a->download_rate < peer_b->download_rate) {
+        return 1;
+    } else if (peer_a->download_rate > peer_b->download_rate) {
+        return -1;
+    }
+    return 0;
+}
+
+int torrent_rate_peers(struct Torrent *t) {
+    if (t->rate_peers_deadline > now_cached()) {
+        return EXIT_SUCCESS;
+    }
 
-    float peer_a_socket_rate = 0;
-    if(peer_a->socket != NULL) {
-        peer_a_socket_rate = peer_a->socket->upload_rate / (now_timestamp - peer_a->socket->last_upload_rate_update);
+    int64_t elapsed_ms = TORRENT_RATE_PEERS_INTERVAL_MS;
+    if (t->rate_peers_deadline != 0) {
+        elapsed_ms += now_cached() - t->rate_peers_deadline;
     }
-    float peer_b_socket_rate = 0;
-    if(peer_b->socket != NULL) {
-        peer_b_socket_rate = peer_b->socket->upload_rate / (now_timestamp - peer_b->socket->last_upload_rate_update);
+    t->rate_peers_deadline = now_cached() + TORRENT_RATE_PEERS_INTERVAL_MS;
+
+    if (t->peer_count == 0) {
+        return EXIT_SUCCESS;
     }
 
-    return (peer_a_socket_rate - peer_b_socket_rate);
+    struct Peer *peers[t->peer_count];
+    int connected_peers = 0;
+    float download_rate = 0.00;
+    int total_depth = 0;
+    int max_depth = 0;
+    int total_rtt_ms = 0;
+    int rtt_peers = 0;
+    struct PeerIp *peer_ip = t->peer_ips;
+    while (peer_ip != NULL) {
+        struct Peer *p = (struct Peer *) hashmap_get(t->peers, peer_ip->str_ip);
+        hashmap_set(t->peers, p->str_ip, p);
+
+        // chunks received since the last measurement
+        uint64_t downloaded = atomic_exchange(&p->downloaded, 0);
+        p->download_rate = (float) downloaded / ((float) elapsed_ms / 1000);
+        download_rate += p->download_rate;
+
+        if (p->status == PEER_HANDSHAKE_COMPLETE) {
+            peers[connected_peers] = p;
+            connected_peers++;
+
+            int depth = p->request_depth;
+            total_depth += depth;
+            max_depth = depth > max_depth ? depth : max_depth;
+            int rtt_ms = p->rtt_ms;
+            if (rtt_ms > 0) {
+                total_rtt_ms += rtt_ms;
+                rtt_peers++;
+            }
+        }
+        peer_ip = peer_ip->next;
+    }
+
+    if (connected_peers > 0) {
+        log_info("download rate :: %.1f KiB/s from %i peers :: request depth avg %i max %i :: rtt avg %i ms",
+                 download_rate / 1024, connected_peers, total_depth / connected_peers, max_depth,
+                 rtt_peers > 0 ? total_rtt_ms / rtt_peers : 0);
+    }
+
+    if (t->torrent_data->stream == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    qsort(&peers, connected_peers, sizeof(struct Peer *), peer_compare_download_rate);
+
+    for (int i = 0; i < connected_peers; i++) {
+        peers[i]->fast = i < TORRENT_FAST_PEERS;
+    }
+
+    return EXIT_SUCCESS;
 }
 
 unsigned int randr(unsigned int min, unsigned int max)
@@ -311,13 +449,13 @@ unsigned int randr(unsigned int min, unsigned int max)
 
 
 int torrent_assign_upload_slots(struct Torrent *t) {
-    if(t->assign_upload_slots_deadline > now()) {
+    if((int64_t) t->assign_upload_slots_deadline > now_cached()) {
         return EXIT_SUCCESS;
     }
 
     if (t->peer_count > 0) {
         // sort interested peers by upload speed
-        t->assign_upload_slots_deadline = now() + (10 * 1000);
+        t->assign_upload_slots_deadline = now_cached() + (10 * 1000);
         struct Peer *peers[t->peer_count];
 
         int interested_peers = 0;
@@ -360,6 +498,9 @@ int torrent_assign_upload_slots(struct Torrent *t) {
                 }
             }
         }
+
+        // let peers choke / unchoke right away
+        torrent_wake_reactors(t);
     }
 
     return EXIT_SUCCESS;
@@ -382,6 +523,13 @@ int torrent_add_peer(struct Torrent *t, struct ThreadPool *tp, struct Peer * p)
         (*peer_ip)->str_ip = p->str_ip;
         (*peer_ip)->next = NULL;
 
+        // spread peers over the reactors
+        if (t->reactor_count > 0) {
+            if (reactor_add_peer(t->reactors[t->peer_count % t->reactor_count], p) == EXIT_FAILURE) {
+                throw("failed to hand peer to reactor :: %s:%i", p->str_ip, p->port);
+            }
+        }
+
         t->peer_count++;
 
         return EXIT_SUCCESS;
@@ -474,6 +622,149 @@ error:
     return EXIT_FAILURE;
 }
 
+/**
+ * @brief set up the torrent data from a complete info dict: files, piece size and hashes. then restore what's already
+ *        on disk and let peers start requesting data
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_init_data(struct Torrent * t, uint8_t * info_buffer, size_t info_len) {
+    size_t metadata_read_size = 0;
+    be_node_t * info = be_decode((char *) info_buffer, info_len, &metadata_read_size);
+    if (info == NULL) {
+        be_free(info);
+        // clear completed and claimed bitfields to try downloading again
+        throw("failed to decode metadata");
+    }
+
+    char * name = be_dict_lookup_cstr(info, "name");
+    char * sha1_hashes = be_dict_lookup_cstr(info, "pieces");
+    size_t sha1_hashes_len = (size_t) be_dict_lookup_cstr_len(info, "pieces");
+    uint64_t piece_length = be_dict_lookup_num(info, "piece length");
+
+    torrent_data_set_sha1_hashes(t->torrent_data, sha1_hashes, sha1_hashes_len);
+
+    be_node_t * files = be_dict_lookup(info, "files", NULL);
+    if(files == NULL) {
+        // single file torrent
+        uint64_t file_length = be_dict_lookup_num(info, "length");
+        char file_path[4096]; // 4096 unix max path size
+        memset(&file_path, 0x00, sizeof(file_path));
+
+        strncat((char *) &file_path, "/", 1);
+        strncat((char *) &file_path, name, strlen(name));
+
+        torrent_data_add_file(t->torrent_data, (char *) &file_path, file_length);
+    } else {
+        // multiple files torrent
+        list_t *l, *tmp;
+        list_for_each_safe(l, tmp, &files->x.list_head) {
+            be_node_t *file = list_entry(l, be_node_t, link);
+
+            char file_path[4096]; // 4096 unix max path size
+            memset(&file_path, 0x00, sizeof(file_path));
+            size_t remaining_file_path_buffer = sizeof(file_path);
+            be_node_t * path = be_dict_lookup(file, "path", NULL);
+            list_t *path_l, *path_tmp;
+            list_for_each_safe(path_l, path_tmp, &path->x.list_head) {
+                be_node_t * path = list_entry(path_l, be_node_t, link);
+                if(remaining_file_path_buffer < path->x.str.len) {
+                    be_free(path);
+                    throw("failed to parse filename, too long");
+                }
+                strncat((char *) &file_path, "/", 1);
+                strncat((char *) &file_path, path->x.str.buf, path->x.str.len);
+                remaining_file_path_buffer -= path->x.str.len;
+                be_free(path);
+            }
+
+            uint64_t file_length = be_dict_lookup_num(file, "length");
+            torrent_data_add_file(t->torrent_data, (char *) &file_path, file_length);
+
+            be_free(file);
+        }
+    }
+
+    log_info("name :: %s", name);
+
+    // keep the info dict for the resume file
+    t->info = malloc(info_len);
+    if (t->info == NULL) {
+        be_free(info);
+        throw("failed to malloc info dict");
+    }
+    memcpy(t->info, info_buffer, info_len);
+    t->info_len = info_len;
+
+    // mapped storage creates the files, look for existing data first
+    int has_existing_files = torrent_data_has_existing_files(t->torrent_data);
+
+    torrent_data_set_piece_size(t->torrent_data, (size_t) piece_length);
+    torrent_data_set_chunk_size(t->torrent_data, TORRENT_CHUNK_SIZE);
+    torrent_data_set_data_size(t->torrent_data, t->torrent_data->files_size);
+
+    // pick up where we left off. if the resume file can't be trusted, hash whatever is already on disk
+    if (torrent_resume_load(t->resume_path, t->torrent_data, t->info_hash_hex, t->info, t->info_len) == EXIT_FAILURE &&
+        has_existing_files == 1) {
+        torrent_data_recheck(t->torrent_data, get_nprocs());
+    }
+    t->resume_saved_pieces = t->torrent_data->completed_pieces;
+    log_info("t->torrent_data->files_size %zu", t->torrent_data->files_size);
+    log_info("torrent length :: %zu", t->torrent_data->data_size);
+    log_info("piece size :: %"PRId64, t->torrent_data->piece_size);
+    log_info("chunk size :: %"PRId64, t->torrent_data->chunk_size);
+
+    // a complete torrent still sends it's bitfield, needed only says whether there are chunks left to request
+    t->torrent_data->ready = 1;
+    t->torrent_data->needed = torrent_data_is_complete(t->torrent_data) == 1 ? 0 : 1;
+
+    // peers can start sending bitfields and requesting data
+    torrent_wake_reactors(t);
+
+    be_free(info);
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+int torrent_load_cached_metadata(struct Torrent *t) {
+    if (t->cached_info == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    uint8_t * info = t->cached_info;
+    size_t info_len = t->cached_info_len;
+    t->cached_info = NULL;
+    t->cached_info_len = 0;
+
+    // fill in the metadata as if it came from peers, so we can serve it with ut_metadata
+    torrent_data_set_piece_size(t->torrent_metadata, METADATA_PIECE_SIZE);
+    torrent_data_set_chunk_size(t->torrent_metadata, METADATA_CHUNK_SIZE);
+    torrent_data_add_file(t->torrent_metadata, "/metadata.bencode", info_len);
+    if (torrent_data_set_data_size(t->torrent_metadata, info_len) == EXIT_FAILURE) {
+        throw("failed to init cached metadata");
+    }
+
+    for (int chunk_id = 0; chunk_id < t->torrent_metadata->chunk_count; chunk_id++) {
+        struct ChunkInfo chunk_info;
+        torrent_data_get_chunk_info(t->torrent_metadata, chunk_id, &chunk_info);
+        torrent_data_write_chunk(t->torrent_metadata, chunk_id, info + chunk_info.chunk_offset, chunk_info.chunk_size);
+    }
+    if (torrent_data_is_complete(t->torrent_metadata) == 0) {
+        throw("failed to store cached metadata");
+    }
+
+    if (torrent_init_data(t, info, info_len) == EXIT_FAILURE) {
+        goto error;
+    }
+
+    free(info);
+    return EXIT_SUCCESS;
+    error:
+    free(info);
+    return EXIT_FAILURE;
+}
+
 int torrent_process_metadata_piece(struct Torrent * t, struct PEER_MSG_EXTENSION * metadata_msg) {
     uint32_t msg_length;
     size_t buffer_size;
@@ -492,8 +783,7 @@ int torrent_process_metadata_piece(struct Torrent * t, struct PEER_MSG_EXTENSION
     be_free(msg);
 
     torrent_data_write_chunk(t->torrent_metadata, piece, &metadata_msg->msg[msg_size], extenstion_msg_len - msg_size);
-    if (torrent_data_is_complete(t->torrent_metadata) == 1 && t->torrent_data->needed == 0) {
-        size_t metadata_read_size = 0;
+    if (torrent_data_is_complete(t->torrent_metadata) == 1 && t->info == NULL) {
         uint8_t torrent_metadata_buffer[t->torrent_metadata->data_size];
         memset(&torrent_metadata_buffer, 0x00, t->torrent_metadata->data_size);
 
@@ -501,80 +791,45 @@ int torrent_process_metadata_piece(struct Torrent * t, struct PEER_MSG_EXTENSION
             throw("failed to copy torrent metadata into buffer");
         }
 
-        be_node_t * info = be_decode((char *) &torrent_metadata_buffer, t->torrent_metadata->data_size, &metadata_read_size);
-        if (info == NULL) {
-            be_free(info);
-            // clear completed and claimed bitfields to try downloading again
-            throw("failed to decode metadata");
+        // remember the metadata so the next start can skip fetching it. only metadata that matches the info hash
+        // can be trusted later
+        if (t->metadata_cache_dir != NULL && torrent_metadata_cache_is_valid(t->info_hash_hex, (uint8_t *) &torrent_metadata_buffer,
+                                                                             t->torrent_metadata->data_size) == 1) {
+            torrent_metadata_cache_save(t->metadata_cache_dir, t->info_hash_hex, (uint8_t *) &torrent_metadata_buffer,
+                                        t->torrent_metadata->data_size);
         }
 
-        char * name = be_dict_lookup_cstr(info, "name");
-        char * sha1_hashes = be_dict_lookup_cstr(info, "pieces");
-        size_t sha1_hashes_len = (size_t) be_dict_lookup_cstr_len(info, "pieces");
-        uint64_t piece_length = be_dict_lookup_num(info, "piece length");
-
-        torrent_data_set_sha1_hashes(t->torrent_data, sha1_hashes, sha1_hashes_len);
-
-        be_node_t * files = be_dict_lookup(info, "files", NULL);
-        if(files == NULL) {
-            // single file torrent
-            uint64_t file_length = be_dict_lookup_num(info, "length");
-            char file_path[4096]; // 4096 unix max path size
-            memset(&file_path, 0x00, sizeof(file_path));
-
-            strncat((char *) &file_path, "/", 1);
-            strncat((char *) &file_path, name, strlen(name));
-
-            torrent_data_add_file(t->torrent_data, (char *) &file_path, file_length);
-        } else {
-            // multiple files torrent
-            list_t *l, *tmp;
-            list_for_each_safe(l, tmp, &files->x.list_head) {
-                be_node_t *file = list_entry(l, be_node_t, link);
-
-                char file_path[4096]; // 4096 unix max path size
-                memset(&file_path, 0x00, sizeof(file_path));
-                size_t remaining_file_path_buffer = sizeof(file_path);
-                be_node_t * path = be_dict_lookup(file, "path", NULL);
-                list_t *path_l, *path_tmp;
-                list_for_each_safe(path_l, path_tmp, &path->x.list_head) {
-                    be_node_t * path = list_entry(path_l, be_node_t, link);
-                    if(remaining_file_path_buffer < path->x.str.len) {
-                        be_free(path);
-                        throw("failed to parse filename, too long");
-                    }
-                    strncat((char *) &file_path, "/", 1);
-                    strncat((char *) &file_path, path->x.str.buf, path->x.str.len);
-                    remaining_file_path_buffer -= path->x.str.len;
-                    be_free(path);
-                }
-
-                uint64_t file_length = be_dict_lookup_num(file, "length");
-                torrent_data_add_file(t->torrent_data, (char *) &file_path, file_length);
-
-                be_free(file);
-            }
+        if (torrent_init_data(t, (uint8_t *) &torrent_metadata_buffer, t->torrent_metadata->data_size) == EXIT_FAILURE) {
+            goto error;
         }
-
-        log_info("name :: %s", name);
-
-        torrent_data_set_piece_size(t->torrent_data, (size_t) piece_length);
-        torrent_data_set_chunk_size(t->torrent_data, TORRENT_CHUNK_SIZE);
-        torrent_data_set_data_size(t->torrent_data, t->torrent_data->files_size);
-        log_info("t->torrent_data->files_size %zu", t->torrent_data->files_size);
-        log_info("torrent length :: %zu", t->torrent_data->data_size);
-        log_info("piece size :: %"PRId64, t->torrent_data->piece_size);
-        log_info("chunk size :: %"PRId64, t->torrent_data->chunk_size);
-
-        t->torrent_data->needed = 1;
-
-        be_free(info);
     }
     return EXIT_SUCCESS;
     error:
     return EXIT_FAILURE;
 }
 
+/**
+ * @brief tell every connected peer about a completed piece
+ */
+static void torrent_announce_piece(struct Torrent * t, int piece_id) {
+    log_info("piece finished %i :: %i / %i", piece_id, t->torrent_data->completed_pieces, t->torrent_data->piece_count);
+    struct PeerIp *peer_ip = t->peer_ips;
+    while (peer_ip != NULL) {
+        struct Peer *p = (struct Peer *) hashmap_get(t->peers, peer_ip->str_ip);
+        hashmap_set(t->peers, p->str_ip, p);
+        if(p->status == PEER_HANDSHAKE_COMPLETE) {
+            int * progress_piece_id = malloc(sizeof(int));
+            *progress_piece_id = piece_id;
+            queue_push(p->progress_queue, (void *) progress_piece_id);
+        }
+
+        peer_ip = peer_ip->next;
+    }
+
+    // peers should announce the piece
+    torrent_wake_reactors(t);
+}
+
 int torrent_process_data_chunk(struct Torrent * t, struct PEER_MSG_PIECE * data_msg) {
     uint32_t msg_length;
     size_t buffer_size;
@@ -592,19 +847,7 @@ int torrent_process_data_chunk(struct Torrent * t, struct PEER_MSG_PIECE * data_
     uint32_t chunk_id = chunk_offset / t->torrent_data->chunk_size;
 
     if(torrent_data_write_chunk(t->torrent_data, chunk_id, &data_msg->block, chunk_size) == EXIT_SUCCESS) {
-        log_info("piece finished %i :: %i / %i", (int) piece_id, t->torrent_data->completed_pieces, t->torrent_data->piece_count);
-        struct PeerIp *peer_ip = t->peer_ips;
-        while (peer_ip != NULL) {
-            struct Peer *p = (struct Peer *) hashmap_get(t->peers, peer_ip->str_ip);
-            hashmap_set(t->peers, p->str_ip, p);
-            if(p->status == PEER_HANDSHAKE_COMPLETE) {
-                int * progress_piece_id = malloc(sizeof(int));
-                *progress_piece_id = piece_id;
-                queue_push(p->progress_queue, (void *) progress_piece_id);
-            }
-
-            peer_ip = peer_ip->next;
-        }
+        torrent_announce_piece(t, (int) piece_id);
     }
 
     return EXIT_SUCCESS;
@@ -612,6 +855,61 @@ int torrent_process_data_chunk(struct Torrent * t, struct PEER_MSG_PIECE * data_
     return EXIT_FAILURE;
 }
 
+int torrent_process_verified_pieces(struct Torrent * t) {
+    int piece_id;
+    while (queue_get_count(t->torrent_data->verified_queue) > 0) {
+        if (torrent_data_process_verified_piece(t->torrent_data, &piece_id) == EXIT_SUCCESS) {
+            torrent_announce_piece(t, piece_id);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int torrent_save_resume(struct Torrent * t, int force) {
+    if (t->info == NULL || t->torrent_data->initialized == 0) {
+        return EXIT_SUCCESS;
+    }
+    if (force == 0 && (t->resume_save_deadline > now_cached() || t->torrent_data->completed_pieces == t->resume_saved_pieces)) {
+        return EXIT_SUCCESS;
+    }
+
+    t->resume_save_deadline = now_cached() + TORRENT_RESUME_SAVE_INTERVAL_MS;
+    t->resume_saved_pieces = t->torrent_data->completed_pieces;
+
+    // only block on the data reaching disk when shutting down, periodic saves happen on the main thread
+    return torrent_resume_save(t->resume_path, t->torrent_data, t->info_hash_hex, t->info, t->info_len, force);
+}
+
+/**
+ * @brief keep the earlier of deadline and next, if deadline is still to come
+ */
+static void torrent_min_deadline(int64_t * next, int64_t deadline, int64_t current_time) {
+    if (deadline > current_time && (*next == 0 || deadline < *next)) {
+        *next = deadline;
+    }
+}
+
+int64_t torrent_get_next_deadline(struct Torrent * t) {
+    int64_t current_time = now();
+    int64_t next = 0;
+
+    if (t->peer_count > 0) {
+        torrent_min_deadline(&next, (int64_t) t->assign_upload_slots_deadline, current_time);
+    }
+    torrent_min_deadline(&next, t->rate_peers_deadline, current_time);
+    if (t->info != NULL && t->torrent_data->initialized == 1 && t->torrent_data->completed_pieces != t->resume_saved_pieces) {
+        torrent_min_deadline(&next, t->resume_save_deadline, current_time);
+    }
+    for (int i = 0; i < t->tracker_count; i++) {
+        torrent_min_deadline(&next, tracker_get_deadline(t->trackers[i]), current_time);
+    }
+    torrent_min_deadline(&next, torrent_data_get_claim_deadline(t->torrent_metadata), current_time);
+    torrent_min_deadline(&next, torrent_data_get_claim_deadline(t->torrent_data), current_time);
+
+    return next;
+}
+
 struct Torrent *torrent_free(struct Torrent *t) {
     if (t != NULL) {
         if (t->magnet_uri != NULL) {
@@ -630,6 +928,22 @@ struct Torrent *torrent_free(struct Torrent *t) {
             free(t->info_hash);
             t->info_hash = NULL;
         }
+        if (t->resume_path != NULL) {
+            free(t->resume_path);
+            t->resume_path = NULL;
+        }
+        if (t->info != NULL) {
+            free(t->info);
+            t->info = NULL;
+        }
+        if (t->metadata_cache_dir != NULL) {
+            free(t->metadata_cache_dir);
+            t->metadata_cache_dir = NULL;
+        }
+        if (t->cached_info != NULL) {
+            free(t->cached_info);
+            t->cached_info = NULL;
+        }
 
         for (int i = 0; i < t->tracker_count; i++) {
             struct Tracker *tr = t->trackers[i];
@@ -639,6 +953,12 @@ struct Torrent *torrent_free(struct Torrent *t) {
             }
         }
 
+        // reactors only reference peers, free them first
+        for (int i = 0; i < t->reactor_count; i++) {
+            t->reactors[i] = reactor_free(t->reactors[i]);
+        }
+        t->reactor_count = 0;
+
         if (t->peers != NULL) {
             struct Peer * p = hashmap_empty(t->peers);
             while (p != NULL) {
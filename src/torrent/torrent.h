@@ -9,11 +9,23 @@
  *        - it is responsible for declaring the current state of the torrent and sharing that information
  *        with peers and trackers via the torrent_data struct.
  *
- *        - it is responsible for scheduling jobs with the main thread pool for peers and trackers that advertise
- *        that they currently have work available to perform via tracker_should_run() and peer_should_run()
+ *        - it is responsible for scheduling jobs with the main thread pool for trackers that advertise
+ *        that they currently have work available to perform via tracker_should_run()
  *
- *  @note peers and trackers advertise their running state via peer->running and tracker->running booleans.
- *        don't run trackers or peers that are already running, it keeps things simpler.
+ *        - it is responsible for handing peers to the reactors that run them (see reactor/reactor.h), and for
+ *        waking those reactors when torrent state changes in a way peers should react to.
+ *
+ *        - it is responsible for running the hashers that verify completed pieces and write them to disk, and for
+ *        telling peers about pieces once they've been verified.
+ *
+ *        - it is responsible for caching the metadata once it's complete, and for starting from the cached metadata
+ *        instead of fetching it from peers again. see torrent/torrent_metadata_cache.h
+ *
+ *        - it is responsible for saving the download state to a resume file, and for restoring it (or rechecking the
+ *        data on disk) once the metadata is known. see torrent/torrent_resume.h
+ *
+ *  @note trackers advertise their running state via the tracker->running boolean.
+ *        don't run trackers that are already running, it keeps things simpler.
  *
  *  @see torrent/torrent_data.h
  *  @see peer/peer.h
@@ -27,10 +39,17 @@
 #include "../peer/peer.h"
 #include "../hash_map/hash_map.h"
 #include "../bitfield/bitfield.h"
+#include "../reactor/reactor.h"
 #include "torrent_data.h"
+#include "torrent_resume.h"
+#include "torrent_metadata_cache.h"
 #include <stdatomic.h>
 
 #define MAX_TRACKERS 5
+#define TORRENT_REACTOR_COUNT 2
+#define TORRENT_VERIFIER_COUNT 2
+#define TORRENT_FAST_PEERS 4 // peers given the pieces in the streaming window
+#define TORRENT_RATE_PEERS_INTERVAL_MS (5 * 1000)
 
 struct PeerIp {
     char * str_ip;
@@ -52,9 +71,25 @@ struct Torrent {
     struct PeerIp * peer_ips;
     uint32_t peer_count;
     uint64_t assign_upload_slots_deadline;
+    int64_t rate_peers_deadline;
+
+    struct Reactor * reactors[TORRENT_REACTOR_COUNT];
+    int reactor_count;
 
     struct TorrentData * torrent_metadata;
     struct TorrentData * torrent_data;
+
+    /* FAST RESUME */
+    char * resume_path;
+    uint8_t * info; // the bencoded info dict, once the metadata is complete
+    size_t info_len;
+    int64_t resume_save_deadline;
+    int resume_saved_pieces; // completed pieces at the last save
+
+    /* METADATA CACHE */
+    char * metadata_cache_dir; // NULL if metadata isn't cached
+    uint8_t * cached_info; // info dict found in the cache by torrent_new, until torrent_load_cached_metadata uses it
+    size_t cached_info_len;
 };
 
 /**
@@ -67,6 +102,16 @@ struct Torrent {
  */
 extern struct Torrent *torrent_new(char *magnet_uri, char *path, int port, char * ipptr);
 
+/**
+ * @brief set up the torrent data from metadata torrent_new found in the metadata cache, so peers can be asked for data
+ *        straight after the handshake instead of fetching metadata first
+ * @note call after configuring t->torrent_data (storage, piece memory, ...) and before starting the reactors.
+ *       does nothing if the metadata wasn't cached
+ * @param t
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_load_cached_metadata(struct Torrent *t);
+
 /**
  * @brief add a tracker at url to the given Torrent
  * @param t
@@ -85,10 +130,10 @@ extern int torrent_add_tracker(struct Torrent *t, char *url, char * public_ip);
 extern int torrent_run_trackers(struct Torrent *t, struct ThreadPool *tp, struct Queue * peer_queue);
 
 /**
- * @brief add and run the given peer to the given torrent if we don't already have a peer struct for this peer
- *        added peers are also ran in the given thread pool
+ * @brief add the given peer to the given torrent if we don't already have a peer struct for this peer
+ *        added peers are handed to one of the torrents reactors, which runs them from then on
  * @note if the torrent already has this peer, the peer is free'd.
- *       if not, peer is added to the torrent and peer is ran in tp.
+ *       if not, peer is added to the torrent and handed to a reactor.
  * @param t
  * @param p
  * @param tp
@@ -97,12 +142,30 @@ extern int torrent_run_trackers(struct Torrent *t, struct ThreadPool *tp, struct
 extern int torrent_add_peer(struct Torrent *t, struct ThreadPool *tp, struct Peer * p);
 
 /**
- * @brief run any peers that have work available for them
+ * @brief start the reactors that run this torrents peers. each reactor runs as a long lived job in tp
+ * @note call once, before adding any peers
  * @param t
  * @param tp
- * @return
+ * @param metadata_queue queue for peers to return metadata chunks to the main thread
+ * @param data_queue queue for peers to return data chunks to the main thread
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_start_reactors(struct Torrent *t, struct ThreadPool *tp, struct MessageRing * metadata_queue, struct MessageRing * data_queue);
+
+/**
+ * @brief start the hashers that verify completed pieces of torrent data. each hasher runs as a long lived job in tp
+ * @note call once, before the torrent data size is known
+ * @param t
+ * @param tp
+ * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-extern int torrent_run_peers(struct Torrent *t, struct ThreadPool *tp, struct Queue * metadata_queue, struct Queue * data_queue);
+extern int torrent_start_verifiers(struct Torrent *t, struct ThreadPool *tp);
+
+/**
+ * @brief wake every reactor so all peers run without waiting for the next tick
+ * @param t
+ */
+extern void torrent_wake_reactors(struct Torrent *t);
 
 /**
  * @brief the torrent will assign 4 upload slots, 3 to the fastest available interested peers and 1 slot for optimistic unchoke
@@ -112,6 +175,16 @@ extern int torrent_run_peers(struct Torrent *t, struct ThreadPool *tp, struct Qu
  */
 extern int torrent_assign_upload_slots(struct Torrent *t);
 
+/**
+ * @brief measure how fast each peer is sending us chunks, and mark the TORRENT_FAST_PEERS fastest as fast so they're the
+ *        ones given the pieces in the streaming window. logs the download rate along with the request depth and round
+ *        trip time of the peers, see peer_update_request_depth
+ * @note peers are only marked as fast while streaming. runs every TORRENT_RATE_PEERS_INTERVAL_MS
+ * @param t
+ * @return EXIT_SUCCESS
+ */
+extern int torrent_rate_peers(struct Torrent *t);
+
 /**
  * @brief listen for connecting peers, return peer objects to peer_queue
  * @param cancel_flag
@@ -136,6 +209,33 @@ extern int torrent_process_metadata_piece(struct Torrent * t, struct PEER_MSG_EX
  */
 extern int torrent_process_data_chunk(struct Torrent * t, struct PEER_MSG_PIECE * data_msg);
 
+/**
+ * @brief apply the results of the hashers, telling peers about every piece that was verified
+ * @param t
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_process_verified_pieces(struct Torrent * t);
+
+/**
+ * @brief save the validated pieces to the resume file, at most every TORRENT_RESUME_SAVE_INTERVAL_MS and only if
+ *        pieces were completed since the last save
+ * @note pieces still being downloaded change the files mtimes, so until the final save after peers and hashers have
+ *       stopped a crash means a recheck on the next start
+ * @param t
+ * @param force save now, whether or not anything changed. use it when shutting down
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_save_resume(struct Torrent * t, int force);
+
+/**
+ * @brief when the main loop next has timed work to do: assigning upload slots, rating peers, saving the resume file,
+ *        running a tracker or releasing an expired claim. anything else it does is woken up by a queue
+ * @note deadlines already in the past are left out, the main loop handled them on it's way round
+ * @param t
+ * @return the earliest deadline still to come, 0 if there's none
+ */
+extern int64_t torrent_get_next_deadline(struct Torrent * t);
+
 /**
  * @brief clean up the torrent and all child structs (trackers, peers, etc)
  * @param t
@@ -4,18 +4,39 @@
 #include <stdatomic.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <assert.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <semaphore.h>
 #include "torrent_data.h"
 #include "../log.h"
 #include "../bitfield/bitfield.h"
-#include "../hash_map/hash_map.h"
+#include "../piece_pool/piece_pool.h"
 #include "../deadline/deadline.h"
 #include "../sha1/sha1.h"
+#include "../thread_pool/job.h"
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+int torrent_data_is_chunk_complete(struct TorrentData *td, int chunk_id) {
+    if(td->completed == NULL) {
+        return 0;
+    }
+
+    bitfield_lock(td->completed);
+    int complete = bitfield_get_bit(td->completed, chunk_id);
+    bitfield_unlock(td->completed);
+
+    return complete;
+}
+
+static int torrent_data_is_piece_received(struct TorrentData *td, int piece_id);
 
 struct TorrentData * torrent_data_new(char * root_path) {
     struct TorrentData * td = malloc(sizeof(struct TorrentData));
@@ -24,14 +45,26 @@ struct TorrentData * torrent_data_new(char * root_path) {
     }
 
     td->root_path = root_path;
+    td->storage = TORRENT_DATA_STORAGE_FILE;
     td->needed = ATOMIC_VAR_INIT(0); // are there chunks of this data that peers should be requesting?
     td->initialized = ATOMIC_VAR_INIT(0);
+    td->ready = ATOMIC_VAR_INIT(0);
     td->claimed = NULL; // bitfield indicating whether each chunk is currently claimed by someone else.
+    td->unclaimed_chunks = 0;
+    td->duplicates = NULL;
+    td->duplicating = ATOMIC_VAR_INIT(0);
+    td->cancel_epoch = ATOMIC_VAR_INIT(0);
     td->completed = NULL; // bitfield indicating whether each chunk is completed yet or not
 
     td->files = NULL;
     td->files_size = 0;
 
+    pthread_mutex_init(&td->file_lock, NULL);
+    td->lru_head = NULL;
+    td->lru_tail = NULL;
+    td->open_files = 0;
+    td->max_open_files = TORRENT_DATA_MAX_OPEN_FILES;
+
     td->piece_size = 0; // number of bytes that make up a piece of this data.
     td->chunk_size = 0; // number of bytes that make up a chunk of a piece of this data.
     td->data_size = 0;  // size of data.
@@ -40,22 +73,52 @@ struct TorrentData * torrent_data_new(char * root_path) {
     td->completed_pieces = 0;
     td->chunk_count = 0;
 
-    td->claims = NULL; // linked list of claims to different parts of this data
+    td->claims = NULL; // claim of each chunk, indexed by chunk id
+    td->claim_heap = NULL;
+    td->claim_count = 0;
 
     td->downloaded = ATOMIC_VAR_INIT(0);
     td->left = ATOMIC_VAR_INIT(0);
     td->uploaded = ATOMIC_VAR_INIT(0);
 
-    td->data = NULL;
+    td->pieces = NULL;
+    td->piece_memory = TORRENT_DATA_PIECE_MEMORY;
+    td->spilled = NULL;
+    memset(&td->cache_stats, 0x00, sizeof(td->cache_stats));
     pthread_mutex_init(&td->initializer_lock, NULL);
 
     td->sha1_hashes = NULL;
     td->sha1_hashes_len = 0;
+    td->piece_hashes = NULL;
+
+    td->verified = NULL;
+    td->picker = NULL;
+    td->pick_policy = PIECE_PICKER_SEQUENTIAL;
+    td->pick_window = 0;
+
+    td->stream = 0;
+    td->stream_window = 0;
+    td->stream_piece_ms = TORRENT_DATA_STREAM_PIECE_MS;
+    td->stream_cursor = ATOMIC_VAR_INIT(0);
+    td->stream_begin = 0;
+    td->stream_wanted = NULL;
+    td->stream_deadlines = NULL;
+    memset(&td->stream_stats, 0x00, sizeof(td->stream_stats));
+
+    td->verify_pipeline = 0;
+    td->verify_queue = NULL;
+    td->verified_queue = NULL;
+    sem_init(&td->verify_semaphore, 0, 0);
+    td->verify_queue = queue_new();
+    td->verified_queue = queue_new();
+    if(td->verify_queue == NULL || td->verified_queue == NULL) {
+        throw("torrent_data failed to init verify queues");
+    }
 
     return td;
     error:
 
-    return NULL;
+    return torrent_data_free(td);
 }
 
 /* initialization */
@@ -78,7 +141,11 @@ int torrent_data_add_file(struct TorrentData * td, char * path, uint64_t length)
     if(file == NULL) {
         throw("failed to add file :: %s", path);
     }
-    file->fp = NULL;
+    file->fd = -1;
+    file->pins = 0;
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+    file->map = NULL;
 
     char file_path[4096]; // 4096 unix max path size
     memset(&file_path, 0x00, sizeof(file_path));
@@ -108,21 +175,67 @@ int torrent_data_add_file(struct TorrentData * td, char * path, uint64_t length)
     return EXIT_FAILURE;
 }
 
+void torrent_data_set_max_open_files(struct TorrentData * td, int max_open_files) {
+    pthread_mutex_lock(&td->file_lock);
+    td->max_open_files = max_open_files < 1 ? 1 : max_open_files;
+    pthread_mutex_unlock(&td->file_lock);
+}
+
+void torrent_data_set_storage(struct TorrentData * td, enum TorrentDataStorage storage) {
+    if(td->initialized == 1) {
+        log_error("can't set storage after setting data size");
+        return;
+    }
+    td->storage = storage;
+}
+
+void torrent_data_set_piece_memory(struct TorrentData * td, size_t piece_memory) {
+    if(td->initialized == 1) {
+        log_error("can't set piece memory after setting data size");
+        return;
+    }
+    td->piece_memory = piece_memory;
+}
+
+void torrent_data_set_piece_picker(struct TorrentData * td, enum PiecePickerPolicy policy, int window) {
+    td->pick_policy = policy;
+    td->pick_window = window;
+    if (td->picker != NULL) {
+        piece_picker_set_policy(td->picker, policy, window);
+    }
+}
+
 void torrent_data_set_sha1_hashes(struct TorrentData * td, char * sha1_hashes, size_t sha1_hashes_len) {
     td->sha1_hashes_len = (size_t) sha1_hashes_len;
     td->sha1_hashes = malloc(td->sha1_hashes_len);
     memcpy(td->sha1_hashes, sha1_hashes, td->sha1_hashes_len);
 }
 
+/**
+ * @brief compare a finished hash with the expected hash of a piece
+ * @return EXIT_SUCCESS if they match, EXIT_FAILURE otherwise
+ */
+static int torrent_data_check_piece_hash(struct TorrentData * td, int piece_id, uint8_t hash[20]) {
+    if (piece_id*20 > td->sha1_hashes_len-20) {
+        throw("tried to get sha1 hash from beyond bounds");
+    }
+
+    size_t sha1_offset = piece_id*20;
+    if(memcmp(hash, td->sha1_hashes + sha1_offset, 20) != 0){
+        throw("piece %i validation failed", piece_id);
+    }
+
+    return EXIT_SUCCESS;
+
+    error:
+    return EXIT_FAILURE;
+}
+
 int torrent_data_validate_piece(struct TorrentData * td, struct PieceInfo piece_info, void * piece_data) {
     if(td->sha1_hashes == NULL) {
         return EXIT_SUCCESS;
     }
 
-    if (piece_info.piece_id*20 > td->sha1_hashes_len-20) {
-        throw("tried to get sha1 hash from beyond bounds");
-    }
-
     SHA1_CTX sha;
     uint8_t hash[20] = {0x00};
 
@@ -130,17 +243,307 @@ int torrent_data_validate_piece(struct TorrentData * td, struct PieceInfo piece_
     SHA1Update(&sha, piece_data, piece_info.piece_size);
     SHA1Final(hash, &sha);
 
-    size_t sha1_offset = piece_info.piece_id*20;
-    if(strncmp((char *)&hash, td->sha1_hashes + sha1_offset, 20) != 0){
-        throw("piece validation failed");
+    return torrent_data_check_piece_hash(td, piece_info.piece_id, hash);
+}
+
+/**
+ * @brief feed lengths[i] bytes of data[i] to contexts[i], for up to TORRENT_DATA_VERIFY_BATCH hashes at once.
+ *        hashes with the same length share SIMD lanes, the rest are hashed one at a time
+ */
+static void torrent_data_hash_batch(SHA1_CTX ** contexts, const uint8_t ** data, uint32_t * lengths, int count) {
+    int done[TORRENT_DATA_VERIFY_BATCH] = {0};
+
+    for (int i = 0; i < count; i++) {
+        if (done[i] == 1) {
+            continue;
+        }
+
+        SHA1_CTX * group_contexts[TORRENT_DATA_VERIFY_BATCH];
+        const uint8_t * group_data[TORRENT_DATA_VERIFY_BATCH];
+        int group_count = 0;
+        for (int j = i; j < count; j++) {
+            if (done[j] == 0 && lengths[j] == lengths[i]) {
+                group_contexts[group_count] = contexts[j];
+                group_data[group_count] = data[j];
+                group_count++;
+                done[j] = 1;
+            }
+        }
+
+        SHA1MultiUpdate(group_contexts, group_data, lengths[i], group_count);
     }
+}
 
-    return EXIT_SUCCESS;
+/**
+ * a slice of a torrent_data_validate_pieces batch, hashed by one thread
+ */
+struct TorrentDataValidateSlice {
+    struct TorrentData * td;
+    struct PieceInfo * piece_infos;
+    uint8_t ** pieces;
+    int count;
+    int * valid; // EXIT_SUCCESS or EXIT_FAILURE for each piece
+    int started; // is a thread hashing this slice?
+};
+
+static void * torrent_data_validate_slice(void * arg) {
+    struct TorrentDataValidateSlice * slice = (struct TorrentDataValidateSlice *) arg;
+
+    for (int first = 0; first < slice->count; first += TORRENT_DATA_VERIFY_BATCH) {
+        int count = MIN(TORRENT_DATA_VERIFY_BATCH, slice->count - first);
+
+        SHA1_CTX sha[TORRENT_DATA_VERIFY_BATCH];
+        SHA1_CTX * contexts[TORRENT_DATA_VERIFY_BATCH];
+        const uint8_t * data[TORRENT_DATA_VERIFY_BATCH];
+        uint32_t lengths[TORRENT_DATA_VERIFY_BATCH];
+        for (int i = 0; i < count; i++) {
+            SHA1Init(&sha[i]);
+            contexts[i] = &sha[i];
+            data[i] = slice->pieces[first + i];
+            lengths[i] = (uint32_t) slice->piece_infos[first + i].piece_size;
+        }
+
+        torrent_data_hash_batch(contexts, data, lengths, count);
+
+        for (int i = 0; i < count; i++) {
+            uint8_t hash[20] = {0x00};
+            SHA1Final(hash, &sha[i]);
+            slice->valid[first + i] = torrent_data_check_piece_hash(slice->td, slice->piece_infos[first + i].piece_id, hash);
+        }
+    }
+
+    return NULL;
+}
+
+int torrent_data_validate_pieces(struct TorrentData * td, struct PieceInfo * piece_infos, uint8_t ** pieces, int count,
+                                 int threads, struct Bitfield * results) {
+    int return_value = EXIT_SUCCESS;
+    int * valid = NULL;
+    pthread_t * thread_ids = NULL;
+    struct TorrentDataValidateSlice * slices = NULL;
+
+    if (count <= 0) {
+        return EXIT_SUCCESS;
+    }
 
+    if (td->sha1_hashes == NULL) {
+        for (int i = 0; i < count; i++) {
+            bitfield_set_bit(results, piece_infos[i].piece_id, 1);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // split the batch into whole groups of lanes, one slice per thread
+    int groups = (count + TORRENT_DATA_VERIFY_BATCH - 1) / TORRENT_DATA_VERIFY_BATCH;
+    threads = MAX(1, MIN(threads, groups));
+    int slice_size = ((groups + threads - 1) / threads) * TORRENT_DATA_VERIFY_BATCH;
+
+    valid = malloc(sizeof(int) * count);
+    slices = malloc(sizeof(struct TorrentDataValidateSlice) * threads);
+    thread_ids = malloc(sizeof(pthread_t) * threads);
+    if (valid == NULL || slices == NULL || thread_ids == NULL) {
+        throw("failed to malloc piece batch");
+    }
+
+    for (int i = 0; i < threads; i++) {
+        int first = i * slice_size;
+        slices[i].td = td;
+        slices[i].piece_infos = piece_infos + first;
+        slices[i].pieces = pieces + first;
+        slices[i].count = MAX(0, MIN(slice_size, count - first));
+        slices[i].valid = valid + first;
+        slices[i].started = 0;
+    }
+
+    // the calling thread hashes the first slice itself
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&thread_ids[i], NULL, torrent_data_validate_slice, &slices[i]) != 0) {
+            log_warn("failed to start hasher thread, hashing it's pieces on the calling thread");
+            torrent_data_validate_slice(&slices[i]);
+            continue;
+        }
+        slices[i].started = 1;
+    }
+    torrent_data_validate_slice(&slices[0]);
+
+    for (int i = 1; i < threads; i++) {
+        if (slices[i].started == 1) {
+            pthread_join(thread_ids[i], NULL);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        bitfield_set_bit(results, piece_infos[i].piece_id, valid[i] == EXIT_SUCCESS);
+        if (valid[i] == EXIT_FAILURE) {
+            return_value = EXIT_FAILURE;
+        }
+    }
+
+    free(thread_ids);
+    free(slices);
+    free(valid);
+    return return_value;
+
+    error:
+    if (thread_ids != NULL) {
+        free(thread_ids);
+    }
+    if (slices != NULL) {
+        free(slices);
+    }
+    if (valid != NULL) {
+        free(valid);
+    }
+    return EXIT_FAILURE;
+}
+
+int mkpath(char* file_path, mode_t mode) {
+    assert(file_path && *file_path);
+    for (char* p = strchr(file_path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(file_path, mode) == -1) {
+            if (errno != EEXIST) {
+                *p = '/';
+                return -1;
+            }
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+/* mapped files */
+static void torrent_data_unmap_files(struct TorrentData * td) {
+    struct TorrentDataFileInfo * file = td->files;
+    while(file != NULL) {
+        if(file->map != NULL) {
+            munmap(file->map, file->file_size);
+            file->map = NULL;
+        }
+        file = file->next;
+    }
+}
+
+static int torrent_data_map_files(struct TorrentData * td) {
+    struct TorrentDataFileInfo * file = td->files;
+    while(file != NULL) {
+        if(file->file_size > 0) {
+            mkpath(file->file_path, 0755);
+
+            int fd = open(file->file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if(fd == -1) {
+                throw("failed to open file %s %s", file->file_path, clean_errno());
+            }
+
+            // reserve the space up front, so writing through the mapping can't fail with SIGBUS on a full disk
+            int result = posix_fallocate(fd, 0, (off_t) file->file_size);
+            if(result != 0) {
+                close(fd);
+                errno = result;
+                throw("failed to allocate file %s %s", file->file_path, clean_errno());
+            }
+
+            file->map = mmap(NULL, file->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if(file->map == MAP_FAILED) {
+                file->map = NULL;
+                throw("failed to map file %s %s", file->file_path, clean_errno());
+            }
+
+            madvise(file->map, file->file_size, MADV_SEQUENTIAL);
+        }
+        file = file->next;
+    }
+
+    return EXIT_SUCCESS;
     error:
     return EXIT_FAILURE;
 }
 
+/**
+ * @brief copy length bytes at offset between buff and the mapped files the range covers
+ * @param writing 1 to copy buff into the mapping, 0 to copy from the mapping into buff
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_data_mapped_io(struct TorrentData * td, uint8_t * buff, uint64_t offset, size_t length, int writing) {
+    size_t done = 0;
+    uint64_t end = offset + length;
+
+    struct TorrentDataFileInfo * current_file = td->files;
+    while (current_file != NULL && done != length) {
+        uint64_t file_begin = current_file->file_offset;
+        uint64_t file_end = file_begin + current_file->file_size;
+
+        if (file_end > offset && file_begin < end) {
+            uint64_t segment_begin = MAX(offset, file_begin);
+            uint64_t segment_end = MIN(end, file_end);
+
+            uint8_t * mapped = current_file->map + (segment_begin - file_begin);
+            uint8_t * segment_buff = buff + (segment_begin - offset);
+            if (writing == 1) {
+                memcpy(mapped, segment_buff, segment_end - segment_begin);
+            } else {
+                memcpy(segment_buff, mapped, segment_end - segment_begin);
+            }
+
+            done += segment_end - segment_begin;
+        }
+
+        current_file = current_file->next;
+    }
+
+    if (done != length) {
+        log_error("data at %" PRIu64 " is beyond the end of the torrent", offset);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief get a pointer to length bytes at offset in the mapping
+ * @return uint8_t *. NULL if the range isn't inside a single mapped file
+ */
+static uint8_t * torrent_data_mapped_range(struct TorrentData * td, uint64_t offset, size_t length) {
+    struct TorrentDataFileInfo * current_file = td->files;
+    while (current_file != NULL) {
+        uint64_t file_begin = current_file->file_offset;
+        uint64_t file_end = file_begin + current_file->file_size;
+
+        if (offset >= file_begin && offset + length <= file_end) {
+            return current_file->map == NULL ? NULL : current_file->map + (offset - file_begin);
+        }
+
+        current_file = current_file->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief give the kernel an madvise hint for every mapped file overlapping the given range of data
+ */
+static void torrent_data_advise(struct TorrentData * td, uint64_t offset, size_t length, int advice) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t end = offset + length;
+
+    struct TorrentDataFileInfo * current_file = td->files;
+    while (current_file != NULL) {
+        uint64_t file_begin = current_file->file_offset;
+        uint64_t file_end = file_begin + current_file->file_size;
+
+        if (current_file->map != NULL && file_end > offset && file_begin < end) {
+            // madvise wants a page aligned address
+            uint64_t segment_begin = MAX(offset, file_begin) - file_begin;
+            uint64_t segment_end = MIN(end, file_end) - file_begin;
+            uint64_t aligned_begin = segment_begin - (segment_begin % page_size);
+
+            madvise(current_file->map + aligned_begin, segment_end - aligned_begin, advice);
+        }
+
+        current_file = current_file->next;
+    }
+}
+
 int torrent_data_set_data_size(struct TorrentData * td, size_t data_size) {
     pthread_mutex_lock(&td->initializer_lock);
 
@@ -163,14 +566,66 @@ int torrent_data_set_data_size(struct TorrentData * td, size_t data_size) {
     // initialize bitfields
     td->claimed = bitfield_new((int) td->chunk_count, 0, 0xFF);
     td->completed = bitfield_new((int) td->chunk_count, 0, 0xFF);
+    td->verified = bitfield_new((int) td->piece_count, 0, 0xFF);
+    td->unclaimed_chunks = td->chunk_count;
+
+    td->duplicates = calloc(td->chunk_count, sizeof(uint8_t));
+    if(td->duplicates == NULL) {
+        throw("failed to init chunk duplicates");
+    }
+
+    td->claims = malloc(sizeof(struct TorrentDataClaim) * td->chunk_count);
+    td->claim_heap = malloc(sizeof(int) * td->chunk_count);
+    if(td->claims == NULL || td->claim_heap == NULL) {
+        throw("failed to init chunk claims");
+    }
+    for (int i = 0; i < td->chunk_count; i++) {
+        td->claims[i].deadline = 0;
+        td->claims[i].heap_index = -1;
+    }
+    td->claim_count = 0;
+
+    td->piece_hashes = calloc(td->piece_count, sizeof(struct TorrentDataPieceHash *));
+    if(td->piece_hashes == NULL) {
+        throw("failed to init piece hashes");
+    }
+
+    td->picker = piece_picker_new(td->piece_count, td->pick_policy, td->pick_window);
+    if(td->picker == NULL) {
+        throw("failed to init piece picker");
+    }
+
+    if(td->stream == 1) {
+        td->stream_wanted = calloc(td->piece_count, sizeof(int64_t));
+        td->stream_deadlines = calloc(td->piece_count, sizeof(int64_t));
+        if(td->stream_wanted == NULL || td->stream_deadlines == NULL) {
+            throw("failed to init stream deadlines");
+        }
+    }
 
     // initialize stats
     td->downloaded = ATOMIC_VAR_INIT(0);
     td->left = ATOMIC_VAR_INIT(td->data_size);
     td->uploaded = ATOMIC_VAR_INIT(0);
 
+    if(td->storage == TORRENT_DATA_STORAGE_MMAP && torrent_data_map_files(td) == EXIT_FAILURE) {
+        log_warn("failed to map files, falling back to file storage");
+        torrent_data_unmap_files(td);
+        td->storage = TORRENT_DATA_STORAGE_FILE;
+    }
+
     // initialize data
-    td->data = hashmap_new(1000);
+    if(td->storage == TORRENT_DATA_STORAGE_FILE) {
+        td->pieces = piece_pool_new(td->piece_count, td->piece_size, td->piece_memory);
+        if(td->pieces == NULL) {
+            throw("failed to init piece pool");
+        }
+
+        td->spilled = bitfield_new((int) td->piece_count, 0, 0xFF);
+        if(td->spilled == NULL) {
+            throw("failed to init spilled pieces");
+        }
+    }
 
     td->initialized = 1;
 
@@ -184,6 +639,82 @@ int torrent_data_set_data_size(struct TorrentData * td, size_t data_size) {
 };
 
 /* claiming data */
+
+static void torrent_data_claim_heap_set(struct TorrentData * td, int heap_index, int chunk_id) {
+    td->claim_heap[heap_index] = chunk_id;
+    td->claims[chunk_id].heap_index = heap_index;
+}
+
+/**
+ * @brief move the claim at heap_index up or down the heap until it's deadline is in order
+ * @note call it holding the claimed lock
+ */
+static void torrent_data_claim_heap_fix(struct TorrentData * td, int heap_index) {
+    int chunk_id = td->claim_heap[heap_index];
+    int64_t deadline = td->claims[chunk_id].deadline;
+
+    while (heap_index > 0) {
+        int parent = (heap_index - 1) / 2;
+        if (td->claims[td->claim_heap[parent]].deadline <= deadline) {
+            break;
+        }
+        torrent_data_claim_heap_set(td, heap_index, td->claim_heap[parent]);
+        heap_index = parent;
+    }
+
+    while (1) {
+        int child = (heap_index * 2) + 1;
+        if (child >= td->claim_count) {
+            break;
+        }
+        if (child + 1 < td->claim_count && td->claims[td->claim_heap[child + 1]].deadline < td->claims[td->claim_heap[child]].deadline) {
+            child++;
+        }
+        if (td->claims[td->claim_heap[child]].deadline >= deadline) {
+            break;
+        }
+        torrent_data_claim_heap_set(td, heap_index, td->claim_heap[child]);
+        heap_index = child;
+    }
+
+    torrent_data_claim_heap_set(td, heap_index, chunk_id);
+}
+
+/**
+ * @brief take the claim of a chunk out of the heap
+ * @note call it holding the claimed lock
+ */
+static void torrent_data_claim_heap_remove(struct TorrentData * td, int chunk_id) {
+    int heap_index = td->claims[chunk_id].heap_index;
+    if (heap_index == -1) {
+        return;
+    }
+
+    td->claims[chunk_id].heap_index = -1;
+    td->claim_count--;
+    if (heap_index < td->claim_count) {
+        torrent_data_claim_heap_set(td, heap_index, td->claim_heap[td->claim_count]);
+        torrent_data_claim_heap_fix(td, heap_index);
+    }
+}
+
+/**
+ * @brief claim a chunk until timeout_seconds from now
+ * @note call it holding the claimed lock
+ */
+static void torrent_data_add_claim(struct TorrentData * td, int chunk_id, int timeout_seconds) {
+    bitfield_set_bit(td->claimed, chunk_id, 1);
+    td->unclaimed_chunks--;
+
+    td->claims[chunk_id].deadline = now_cached() + (timeout_seconds * 1000);
+    if (td->claims[chunk_id].heap_index == -1) {
+        td->claims[chunk_id].heap_index = td->claim_count;
+        td->claim_heap[td->claim_count] = chunk_id;
+        td->claim_count++;
+    }
+    torrent_data_claim_heap_fix(td, td->claims[chunk_id].heap_index);
+}
+
 int torrent_data_claim_chunk(struct TorrentData * td, struct Bitfield * interested_chunks, int timeout_seconds, int num_chunks, int * out) {
     int found_a_chunk = 0;
 
@@ -193,17 +724,7 @@ int torrent_data_claim_chunk(struct TorrentData * td, struct Bitfield * interest
             for (int i = 0; i < (td->claimed->bit_count); i++) {
                 if (bitfield_get_bit(td->claimed, i) == 0 && bitfield_get_bit(interested_chunks, i) == 1) {
                     if (timeout_seconds != 0) {
-                        bitfield_set_bit(td->claimed, i, 1);
-
-                        struct TorrentDataClaim *claim = malloc(sizeof(struct TorrentDataClaim));
-                        claim->deadline = now() + (timeout_seconds * 1000);
-                        claim->chunk_id = i;
-                        if (td->claims == NULL) {
-                            claim->next = NULL;
-                        } else {
-                            claim->next = td->claims;
-                        }
-                        td->claims = claim;
+                        torrent_data_add_claim(td, i, timeout_seconds);
                     }
 
                     found_a_chunk = 1;
@@ -224,268 +745,1302 @@ int torrent_data_claim_chunk(struct TorrentData * td, struct Bitfield * interest
     return EXIT_FAILURE;
 }
 
-int torrent_data_release_expired_claims(struct TorrentData * td) {
-    if(td->initialized == 1) {
-        bitfield_lock(td->claimed);
+/**
+ * @brief claim chunks of pieces in the streaming window that are close to their deadline. for fast peers this includes
+ *        a second request for chunks someone else claimed
+ * @note call it holding the claimed lock
+ * @return the number of chunks put in out
+ */
+static int torrent_data_claim_urgent_chunks(struct TorrentData * td, struct Bitfield * peer_pieces, struct Bitfield * peer_requested,
+                                            int fast, int timeout_seconds, int num_chunks, int * out) {
+    int claimed_count = 0;
+    int64_t urgent_deadline = now_cached() + TORRENT_DATA_STREAM_URGENT_MS;
+    int window_end = MIN(td->stream_begin + td->stream_window, td->piece_count);
 
-        if(td->claims != NULL) {
-            struct TorrentDataClaim ** current = &td->claims;
-            struct TorrentDataClaim ** prev = NULL;
-
-            while (*current != NULL) {
-                if((*current)->deadline < now()){
-                    bitfield_lock(td->completed);
-                    if(bitfield_get_bit(td->completed, (*current)->chunk_id) == 0) {
-                        bitfield_set_bit(td->claimed, (*current)->chunk_id, 0);
-                    }
-                    bitfield_unlock(td->completed);
+    bitfield_lock(td->completed);
+    for (int piece_id = td->stream_begin; piece_id < window_end && claimed_count < num_chunks; piece_id++) {
+        if (td->stream_deadlines[piece_id] == 0 || td->stream_deadlines[piece_id] > urgent_deadline) {
+            continue;
+        }
+        if (bitfield_get_bit(td->verified, piece_id) == 1 || piece_id >= peer_pieces->bit_count || bitfield_get_bit(peer_pieces, piece_id) == 0) {
+            continue;
+        }
 
-                    struct TorrentDataClaim * next = (*current)->next;
-                    free((*current));
-                    (*current) = NULL;
+        struct PieceInfo piece_info;
+        torrent_data_get_piece_info(td, piece_id, &piece_info);
+        int first_chunk = piece_info.piece_offset / td->chunk_size;
+        int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
 
-                    if (prev == NULL) {
-                        *current = next;
-                    } else {
-                        (*prev)->next = next;
-                    }
+        for (int i = first_chunk; i <= last_chunk && claimed_count < num_chunks; i++) {
+            if (bitfield_get_bit(td->completed, i) == 1) {
+                continue;
+            }
+            if (peer_requested != NULL && bitfield_get_bit(peer_requested, i) == 1) {
+                continue;
+            }
 
-                    if(next == NULL) {
-                        break;
-                    }
-                } else {
-                    prev = current;
-                    current = &(*current)->next;
-                }
+            if (bitfield_get_bit(td->claimed, i) == 0) {
+                torrent_data_add_claim(td, i, timeout_seconds);
+            } else if (fast == 1 && td->duplicates[i] == 0) {
+                td->duplicates[i]++;
+                td->duplicating = 1;
+                td->stream_stats.duplicates++;
+            } else {
+                continue;
             }
+            out[claimed_count] = i;
+            claimed_count++;
         }
 
-        bitfield_unlock(td->claimed);
-        return EXIT_SUCCESS;
-    }
-}
-
-/* writer */
-int mkpath(char* file_path, mode_t mode) {
-    assert(file_path && *file_path);
-    for (char* p = strchr(file_path + 1, '/'); p; p = strchr(p + 1, '/')) {
-        *p = '\0';
-        if (mkdir(file_path, mode) == -1) {
-            if (errno != EEXIST) {
-                *p = '/';
-                return -1;
+        int unclaimed_left = 0;
+        for (int i = first_chunk; i <= last_chunk; i++) {
+            if (bitfield_get_bit(td->claimed, i) == 0) {
+                unclaimed_left = 1;
+                break;
             }
         }
-        *p = '/';
+        if (unclaimed_left == 0) {
+            piece_picker_set_open(td->picker, piece_id, 0);
+        }
     }
-    return 0;
+    bitfield_unlock(td->completed);
+
+    return claimed_count;
 }
 
+/**
+ * @brief claim chunks other peers claimed but haven't delivered yet, least requested first
+ * @note call it holding the claimed lock
+ * @return the number of chunks put in out
+ */
+static int torrent_data_claim_endgame_chunks(struct TorrentData * td, struct Bitfield * peer_pieces, struct Bitfield * peer_requested,
+                                             int num_chunks, int * out) {
+    int claimed_count = 0;
 
-int torrent_data_write_chunk(struct TorrentData * td, int chunk_id, void * data, size_t data_size) {
-    int return_value = EXIT_FAILURE;
-    // is this chunk already completed?
     bitfield_lock(td->completed);
+    for (int duplicates = 0; duplicates < TORRENT_DATA_ENDGAME_REQUESTS - 1 && claimed_count < num_chunks; duplicates++) {
+        for (int heap_index = 0; heap_index < td->claim_count && claimed_count < num_chunks; heap_index++) {
+            int chunk_id = td->claim_heap[heap_index];
+            int piece_id = (int) (((uint64_t) chunk_id * td->chunk_size) / td->piece_size);
 
-    if (bitfield_get_bit(td->completed, chunk_id) == 1) {
-        // ignore already completed chunks
-        bitfield_unlock(td->completed);
-        return EXIT_FAILURE;
-    }
+            if (td->duplicates[chunk_id] != duplicates || bitfield_get_bit(td->claimed, chunk_id) == 0) {
+                continue;
+            }
+            if (bitfield_get_bit(td->completed, chunk_id) == 1 || bitfield_get_bit(peer_requested, chunk_id) == 1) {
+                continue;
+            }
+            if (piece_id >= peer_pieces->bit_count || bitfield_get_bit(peer_pieces, piece_id) == 0) {
+                continue;
+            }
 
-    // get chunk info
-    struct ChunkInfo chunk_info;
-    torrent_data_get_chunk_info(td, chunk_id, &chunk_info);
+            // a chunk handed out on an earlier pass matches the next one too
+            int already_out = 0;
+            for (int i = 0; i < claimed_count; i++) {
+                if (out[i] == chunk_id) {
+                    already_out = 1;
+                }
+            }
+            if (already_out == 1) {
+                continue;
+            }
 
-    log_debug("got chunk %i / %i", chunk_id, td->chunk_count);
+            if (td->duplicating == 0) {
+                log_info("endgame, %i chunks left unclaimed", td->unclaimed_chunks);
+                td->duplicating = 1;
+            }
+            td->duplicates[chunk_id]++;
+            out[claimed_count] = chunk_id;
+            claimed_count++;
+        }
+    }
+    bitfield_unlock(td->completed);
 
-    // get piece info
-    struct PieceInfo piece_info;
-    torrent_data_get_piece_info(td, chunk_info.piece_id, &piece_info);
+    return claimed_count;
+}
 
-    // validate that we received the expected length
-    if(data_size != chunk_info.chunk_size) {
-        throw("data lengths mismatch %zu %zu", data_size, chunk_info.chunk_size);
+int torrent_data_claim_piece_chunks(struct TorrentData * td, struct Bitfield * peer_pieces, struct Bitfield * peer_requested,
+                                    int fast, int timeout_seconds, int num_chunks, int * out) {
+    if(td->initialized == 0) {
+        return EXIT_FAILURE;
     }
 
-    // try and get
-    char piece_key[10] = {0x00};
-    sprintf(piece_key, "%i", chunk_info.piece_id);
+    int claimed_count = 0;
 
-    void * piece = hashmap_get(td->data, (char *) &piece_key);
-    if (piece == NULL) {
-        piece = malloc(td->piece_size);
-        memset(piece, 0x00, td->piece_size);
+    bitfield_lock(td->claimed);
+    if (td->stream == 1) {
+        claimed_count = torrent_data_claim_urgent_chunks(td, peer_pieces, peer_requested, fast, timeout_seconds, num_chunks, out);
     }
 
-    int relative_chunk_offset = chunk_info.chunk_offset - piece_info.piece_offset;
-    memcpy(piece + relative_chunk_offset, data, chunk_info.chunk_size);
+    // only the fastest peers get the pieces needed soonest
+    int in_window = (td->stream == 0 || fast == 1);
 
-    int piece_already_completed = torrent_data_is_piece_complete(td, piece_info.piece_id);
-    bitfield_set_bit(td->completed, chunk_info.chunk_id, 1);
+    while (claimed_count < num_chunks) {
+        int piece_id = piece_picker_pick(td->picker, peer_pieces, in_window);
+        if (piece_id == -1) {
+            break;
+        }
 
-    // check if entire piece is done
-    if(torrent_data_is_piece_complete(td, piece_info.piece_id) == 1 && piece_already_completed == 0) {
-        if(torrent_data_validate_piece(td, piece_info, piece) == EXIT_SUCCESS) {
-            return_value = EXIT_SUCCESS;
-            // find first file overlapping with the piece
-            struct TorrentDataFileInfo * current_file = td->files;
-            size_t data_written = 0;
-
-            size_t piece_begin = piece_info.piece_offset;
-            size_t piece_end = piece_begin + piece_info.piece_size;
-
-            while(data_written != piece_info.piece_size) {
-                if (current_file == NULL) {
+        struct PieceInfo piece_info;
+        torrent_data_get_piece_info(td, piece_id, &piece_info);
+        int first_chunk = piece_info.piece_offset / td->chunk_size;
+        int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
+
+        int unclaimed_left = 0;
+        for (int i = first_chunk; i <= last_chunk; i++) {
+            if (bitfield_get_bit(td->claimed, i) == 0) {
+                if (claimed_count == num_chunks) {
+                    unclaimed_left = 1;
                     break;
                 }
+                torrent_data_add_claim(td, i, timeout_seconds);
+                out[claimed_count] = i;
+                claimed_count++;
+            }
+        }
 
-                size_t file_begin = current_file->file_offset;
-                size_t file_end = file_begin + current_file->file_size;
-
-                if (file_end >= piece_begin && file_begin <= piece_end) {
-
-                    size_t relative_offset = (piece_begin + data_written) - file_begin;
-                    int bytes_to_write = MIN(current_file->file_size - relative_offset, piece_info.piece_size - data_written);
-
-                    if(current_file->fp == NULL) {
-                        if(access(current_file->file_path, F_OK) == -1) {
-                            // create folders in needed file path
-                            mkpath(current_file->file_path, 0755);
-                            FILE *fp = fopen(current_file->file_path, "wb+");
-                            fclose(fp);
-                        }
-                        current_file->fp = fopen(current_file->file_path, "rb+");
-                        if(current_file->fp == NULL) {
-                            throw("failed to open file %s", current_file->file_path);
-                        }
-                    }
+        if (unclaimed_left == 0) {
+            piece_picker_set_open(td->picker, piece_id, 0);
+        }
+    }
 
-                    fseek(current_file->fp, relative_offset, SEEK_SET);
+    // nothing left for this peer to request on it's own, help with what's still outstanding
+    if (claimed_count < num_chunks && peer_requested != NULL && td->unclaimed_chunks < TORRENT_DATA_ENDGAME_CHUNKS) {
+        claimed_count += torrent_data_claim_endgame_chunks(td, peer_pieces, peer_requested, num_chunks - claimed_count, &out[claimed_count]);
+    }
+    bitfield_unlock(td->claimed);
 
-                    size_t expected_bytes_written = fwrite(piece + data_written, 1, bytes_to_write, current_file->fp);
-                    fflush(current_file->fp);
-                    if (expected_bytes_written != bytes_to_write) {
-                        fclose(current_file->fp);
-                        current_file->fp = NULL;
-                        throw("wrong number of bytes written");
-                    }
+    return claimed_count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int torrent_data_release_expired_claims(struct TorrentData * td) {
+    if(td->initialized == 1) {
+        bitfield_lock(td->claimed);
+
+        int64_t current_time = now_cached();
+        while (td->claim_count > 0 && td->claims[td->claim_heap[0]].deadline < current_time) {
+            int chunk_id = td->claim_heap[0];
+            torrent_data_claim_heap_remove(td, chunk_id);
+
+            bitfield_lock(td->completed);
+            if(bitfield_get_bit(td->completed, chunk_id) == 0 && bitfield_get_bit(td->claimed, chunk_id) == 1) {
+                bitfield_set_bit(td->claimed, chunk_id, 0);
+                td->duplicates[chunk_id] = 0;
+                td->unclaimed_chunks++;
+                piece_picker_set_open(td->picker, ((uint64_t) chunk_id * td->chunk_size) / td->piece_size, 1);
+            }
+            bitfield_unlock(td->completed);
+        }
+
+        bitfield_unlock(td->claimed);
+        return EXIT_SUCCESS;
+    }
+}
+
+int64_t torrent_data_get_claim_deadline(struct TorrentData * td) {
+    if(td->initialized == 0) {
+        return 0;
+    }
+
+    bitfield_lock(td->claimed);
+    int64_t deadline = td->claim_count > 0 ? td->claims[td->claim_heap[0]].deadline : 0;
+    bitfield_unlock(td->claimed);
+
+    return deadline;
+}
+
+/* streaming */
+void torrent_data_set_stream(struct TorrentData * td, int window, int64_t piece_ms) {
+    td->stream = 1;
+    td->stream_window = window > 0 ? window : PIECE_PICKER_WINDOW;
+    td->stream_piece_ms = piece_ms > 0 ? piece_ms : TORRENT_DATA_STREAM_PIECE_MS;
+    torrent_data_set_piece_picker(td, PIECE_PICKER_SEQUENTIAL_WINDOW, td->stream_window);
+}
 
-                    data_written += bytes_to_write;
+void torrent_data_set_stream_position(struct TorrentData * td, uint64_t offset) {
+    if (td->initialized == 0) {
+        return;
+    }
+
+    int cursor = MIN(offset / td->piece_size, td->piece_count - 1);
+    if (td->stream == 0) {
+        // no deadlines, but the sequential policies still start picking from here
+        piece_picker_set_cursor(td->picker, cursor);
+        return;
+    }
+    td->stream_cursor = cursor;
+
+    bitfield_lock(td->claimed);
+    bitfield_lock(td->completed);
+    for (int piece_id = 0; piece_id < td->piece_count; piece_id++) {
+        if (piece_id < cursor || piece_id >= cursor + td->stream_window) {
+            td->stream_wanted[piece_id] = 0;
+            td->stream_deadlines[piece_id] = 0;
+        }
+    }
+    bitfield_unlock(td->completed);
+    bitfield_unlock(td->claimed);
+
+    log_info("streaming from piece %i / %i", cursor, td->piece_count);
+
+    torrent_data_update_stream(td);
+}
+
+void torrent_data_update_stream(struct TorrentData * td) {
+    if (td->stream == 0 || td->initialized == 0) {
+        return;
+    }
+
+    int64_t now_ms = now_cached();
+
+    bitfield_lock(td->claimed);
+    bitfield_lock(td->completed);
+    int window_begin = td->stream_cursor;
+    while (window_begin < td->piece_count && bitfield_get_bit(td->verified, window_begin) == 1) {
+        window_begin++;
+    }
+    td->stream_begin = window_begin;
+
+    int window_end = MIN(window_begin + td->stream_window, td->piece_count);
+    for (int piece_id = window_begin; piece_id < window_end; piece_id++) {
+        if (td->stream_wanted[piece_id] == 0 && bitfield_get_bit(td->verified, piece_id) == 0) {
+            td->stream_wanted[piece_id] = now_ms;
+            td->stream_deadlines[piece_id] = now_ms + ((piece_id - window_begin + 1) * td->stream_piece_ms);
+        }
+    }
+    bitfield_unlock(td->completed);
+    bitfield_unlock(td->claimed);
+
+    if (window_begin < td->piece_count) {
+        piece_picker_set_cursor(td->picker, window_begin);
+    }
+}
+
+void torrent_data_get_stream_stats(struct TorrentData * td, struct TorrentDataStreamStats * stats) {
+    if (td->initialized == 0) {
+        memset(stats, 0x00, sizeof(struct TorrentDataStreamStats));
+        return;
+    }
+
+    bitfield_lock(td->completed);
+    memcpy(stats, &td->stream_stats, sizeof(struct TorrentDataStreamStats));
+    bitfield_unlock(td->completed);
+}
+
+/* piece availability */
+int torrent_data_add_peer_pieces(struct TorrentData * td, struct Bitfield * peer_pieces) {
+    if(td->initialized == 0) {
+        return EXIT_FAILURE;
+    }
+
+    piece_picker_add_peer(td->picker, peer_pieces);
+    return EXIT_SUCCESS;
+}
+
+void torrent_data_remove_peer_pieces(struct TorrentData * td, struct Bitfield * peer_pieces) {
+    if(td->initialized == 1) {
+        piece_picker_remove_peer(td->picker, peer_pieces);
+    }
+}
+
+void torrent_data_add_peer_piece(struct TorrentData * td, int piece_id) {
+    if(td->initialized == 1) {
+        piece_picker_add_piece(td->picker, piece_id);
+    }
+}
+
+/* writer */
+
+/* open files */
+static void torrent_data_lru_remove(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    if (file->lru_prev != NULL) {
+        file->lru_prev->lru_next = file->lru_next;
+    } else {
+        td->lru_head = file->lru_next;
+    }
+    if (file->lru_next != NULL) {
+        file->lru_next->lru_prev = file->lru_prev;
+    } else {
+        td->lru_tail = file->lru_prev;
+    }
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+}
+
+static void torrent_data_lru_push(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    file->lru_prev = NULL;
+    file->lru_next = td->lru_head;
+    if (td->lru_head != NULL) {
+        td->lru_head->lru_prev = file;
+    }
+    td->lru_head = file;
+    if (td->lru_tail == NULL) {
+        td->lru_tail = file;
+    }
+}
+
+static void torrent_data_close_file(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    torrent_data_lru_remove(td, file);
+    close(file->fd);
+    file->fd = -1;
+    td->open_files--;
+}
+
+/**
+ * @brief get an open fd for file and pin it, opening and creating the file if needed
+ * @return fd, -1 on failure
+ */
+static int torrent_data_pin_file(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    pthread_mutex_lock(&td->file_lock);
+
+    if (file->fd != -1) {
+        // most recently used goes to the front
+        torrent_data_lru_remove(td, file);
+        torrent_data_lru_push(td, file);
+        file->pins++;
+
+        pthread_mutex_unlock(&td->file_lock);
+        return file->fd;
+    }
+
+    // make room, least recently used first. pinned files are skipped, so we may go over the limit for a while
+    struct TorrentDataFileInfo * candidate = td->lru_tail;
+    while (td->open_files >= td->max_open_files && candidate != NULL) {
+        struct TorrentDataFileInfo * prev = candidate->lru_prev;
+        if (candidate->pins == 0) {
+            torrent_data_close_file(td, candidate);
+        }
+        candidate = prev;
+    }
+
+    if (access(file->file_path, F_OK) == -1) {
+        // create folders in needed file path
+        mkpath(file->file_path, 0755);
+    }
+
+    file->fd = open(file->file_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file->fd == -1) {
+        throw("failed to open file %s %s", file->file_path, clean_errno());
+    }
+
+    torrent_data_lru_push(td, file);
+    td->open_files++;
+    file->pins++;
+
+    pthread_mutex_unlock(&td->file_lock);
+    return file->fd;
+
+    error:
+    pthread_mutex_unlock(&td->file_lock);
+    return -1;
+}
+
+static void torrent_data_unpin_file(struct TorrentData * td, struct TorrentDataFileInfo * file) {
+    pthread_mutex_lock(&td->file_lock);
+
+    file->pins--;
+    if (file->pins == 0 && td->open_files > td->max_open_files) {
+        torrent_data_close_file(td, file);
+    }
+
+    pthread_mutex_unlock(&td->file_lock);
+}
+
+/**
+ * @brief read or write length bytes at offset, split over whichever files the range covers
+ * @param writing 1 to write buff to disk, 0 to read from disk into buff
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_data_file_io(struct TorrentData * td, uint8_t * buff, uint64_t offset, size_t length, int writing) {
+    size_t done = 0;
+    uint64_t end = offset + length;
+
+    struct TorrentDataFileInfo * current_file = td->files;
+    while (current_file != NULL && done != length) {
+        uint64_t file_begin = current_file->file_offset;
+        uint64_t file_end = file_begin + current_file->file_size;
+
+        if (file_end > offset && file_begin < end) {
+            uint64_t segment_begin = MAX(offset, file_begin);
+            uint64_t segment_end = MIN(end, file_end);
+
+            int fd = torrent_data_pin_file(td, current_file);
+            if (fd == -1) {
+                return EXIT_FAILURE;
+            }
+
+            // positional io, so several threads can share the fd without fighting over the file position
+            size_t segment_done = 0;
+            while (segment_done < segment_end - segment_begin) {
+                uint8_t * segment_buff = buff + (segment_begin - offset) + segment_done;
+                size_t segment_length = (segment_end - segment_begin) - segment_done;
+                off_t file_offset = (off_t) ((segment_begin - file_begin) + segment_done);
+
+                ssize_t result;
+                if (writing == 1) {
+                    result = pwrite(fd, segment_buff, segment_length, file_offset);
+                } else {
+                    result = pread(fd, segment_buff, segment_length, file_offset);
                 }
 
-                current_file = current_file->next;
+                if (result == -1 && errno == EINTR) {
+                    continue;
+                } else if (result <= 0) {
+                    torrent_data_unpin_file(td, current_file);
+                    log_error("failed to %s %s %s", writing == 1 ? "write" : "read", current_file->file_path, clean_errno());
+                    errno = 0;
+                    return EXIT_FAILURE;
+                }
+                segment_done += result;
             }
 
-            if (data_written != piece_info.piece_size) {
-                throw("failed to write piece %i to disk", piece_info.piece_id);
+            torrent_data_unpin_file(td, current_file);
+            done += segment_done;
+        }
+
+        current_file = current_file->next;
+    }
+
+    if (done != length) {
+        log_error("data at %" PRIu64 " is beyond the end of the torrent", offset);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief let peers claim the chunks of a piece that failed validation again
+ * @note takes the claimed lock, call it without holding the completed lock
+ */
+static void torrent_data_release_piece_claims(struct TorrentData * td, struct PieceInfo piece_info) {
+    int first_chunk = piece_info.piece_offset / td->chunk_size;
+    int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
+
+    bitfield_lock(td->claimed);
+    bitfield_lock(td->completed);
+    for (int i = first_chunk; i <= last_chunk; i++) {
+        if (bitfield_get_bit(td->completed, i) == 0 && bitfield_get_bit(td->claimed, i) == 1) {
+            bitfield_set_bit(td->claimed, i, 0);
+            td->duplicates[i] = 0;
+            td->unclaimed_chunks++;
+            torrent_data_claim_heap_remove(td, i);
+        }
+    }
+    piece_picker_set_open(td->picker, piece_info.piece_id, 1);
+    bitfield_unlock(td->completed);
+    bitfield_unlock(td->claimed);
+}
+
+/**
+ * @brief write the completed chunks of an in flight piece to disk and hand it's buffer back to the pool
+ * @note call it holding the completed lock
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_data_spill_piece(struct TorrentData * td, int piece_id) {
+    struct PieceInfo piece_info;
+    torrent_data_get_piece_info(td, piece_id, &piece_info);
+
+    uint8_t * piece = piece_pool_get(td->pieces, piece_id);
+    if (piece == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    int first_chunk = piece_info.piece_offset / td->chunk_size;
+    int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
+    for (int i = first_chunk; i <= last_chunk; i++) {
+        if (bitfield_get_bit(td->completed, i) == 1) {
+            struct ChunkInfo chunk_info;
+            torrent_data_get_chunk_info(td, i, &chunk_info);
+
+            uint8_t * chunk = piece + (chunk_info.chunk_offset - piece_info.piece_offset);
+            if (torrent_data_write_data(td, chunk, chunk_info.chunk_offset, chunk_info.chunk_size) == EXIT_FAILURE) {
+                throw("failed to spill piece %i", piece_id);
             }
+        }
+    }
+
+    piece_pool_release(td->pieces, piece_id);
+    bitfield_set_bit(td->spilled, piece_id, 1);
+    td->cache_stats.spills++;
+    log_debug("spilled piece %i to disk", piece_id);
 
-            free(piece);
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief get the buffer to write a chunk of the given piece into, spilling the least recently used piece if needed
+ * @note call it holding the completed lock
+ * @return the pieces buffer, NULL if the piece is spilled and it's chunks should be written straight to disk
+ */
+static uint8_t * torrent_data_cache_piece(struct TorrentData * td, int piece_id) {
+    if (bitfield_get_bit(td->spilled, piece_id) == 1) {
+        td->cache_stats.misses++;
+        return NULL;
+    }
+
+    if (piece_pool_get(td->pieces, piece_id) != NULL) {
+        td->cache_stats.hits++;
+        return piece_pool_acquire(td->pieces, piece_id);
+    }
+
+    td->cache_stats.misses++;
+    uint8_t * piece = piece_pool_acquire(td->pieces, piece_id);
+    while (piece == NULL) {
+        int victim = piece_pool_least_recently_used(td->pieces);
+        if (victim == -1 || torrent_data_spill_piece(td, victim) == EXIT_FAILURE) {
+            break;
+        }
+        piece = piece_pool_acquire(td->pieces, piece_id);
+    }
+
+    if (piece == NULL) {
+        // the budget is too small for a single piece, or spilling failed. write through to disk
+        bitfield_set_bit(td->spilled, piece_id, 1);
+    }
 
-            td->completed_pieces++;
-            if(torrent_data_is_complete(td) == 1) {
-                td->needed = 0;
+    return piece;
+}
+
+/**
+ * @brief absorb bytes [hashed, end) of a piece into it's hash state
+ * @param piece the pieces buffer. NULL to read mapped pieces from the mapping, and spilled pieces back from disk
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_data_hash_range(struct TorrentData * td, struct TorrentDataPieceHash * piece_hash,
+                                   struct PieceInfo piece_info, uint8_t * piece, size_t end) {
+    uint8_t * chunk = NULL;
+
+    if (piece != NULL) {
+        SHA1Update(&piece_hash->sha, piece + piece_hash->hashed, end - piece_hash->hashed);
+        piece_hash->hashed = end;
+    } else if (td->storage == TORRENT_DATA_STORAGE_MMAP) {
+        // hash straight from the mapping, one file at a time
+        uint64_t begin = piece_info.piece_offset + piece_hash->hashed;
+        uint64_t range_end = piece_info.piece_offset + end;
+        struct TorrentDataFileInfo * current_file = td->files;
+        while (current_file != NULL) {
+            uint64_t file_begin = current_file->file_offset;
+            uint64_t file_end = file_begin + current_file->file_size;
+
+            if (file_end > begin && file_begin < range_end) {
+                uint64_t segment_begin = MAX(begin, file_begin);
+                uint64_t segment_end = MIN(range_end, file_end);
+                SHA1Update(&piece_hash->sha, current_file->map + (segment_begin - file_begin), segment_end - segment_begin);
             }
-        } else {
-            return_value = EXIT_FAILURE;
-            // hold unfinished pieces in memory
-            hashmap_set(td->data, (char *) &piece_key, piece);
+
+            current_file = current_file->next;
         }
+        piece_hash->hashed = end;
     } else {
-        // hold unfinished pieces in memory
-        hashmap_set(td->data, (char *) &piece_key, piece);
+        chunk = malloc(td->chunk_size);
+        if (chunk == NULL) {
+            throw("failed to malloc chunk for hashing");
+        }
+
+        while (piece_hash->hashed < end) {
+            size_t length = MIN(td->chunk_size, end - piece_hash->hashed);
+            if (torrent_data_read_data(td, chunk, piece_info.piece_offset + piece_hash->hashed, length) == EXIT_FAILURE) {
+                throw("failed to reload piece %i", piece_info.piece_id);
+            }
+            SHA1Update(&piece_hash->sha, chunk, length);
+            piece_hash->hashed += length;
+        }
+
+        free(chunk);
+    }
+
+    return EXIT_SUCCESS;
+
+    error:
+    if (chunk != NULL) {
+        free(chunk);
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief get the hash state of a piece, starting it if needed
+ * @return struct TorrentDataPieceHash *. NULL on failure
+ */
+static struct TorrentDataPieceHash * torrent_data_get_piece_hash(struct TorrentData * td, int piece_id) {
+    struct TorrentDataPieceHash * piece_hash = td->piece_hashes[piece_id];
+    if (piece_hash == NULL) {
+        piece_hash = malloc(sizeof(struct TorrentDataPieceHash));
+        if (piece_hash == NULL) {
+            log_error("failed to malloc hash for piece %i", piece_id);
+            return NULL;
+        }
+        SHA1Init(&piece_hash->sha);
+        piece_hash->hashed = 0;
+        td->piece_hashes[piece_id] = piece_hash;
+    }
+    return piece_hash;
+}
+
+static void torrent_data_free_piece_hash(struct TorrentData * td, int piece_id) {
+    if (td->piece_hashes[piece_id] != NULL) {
+        free(td->piece_hashes[piece_id]);
+        td->piece_hashes[piece_id] = NULL;
+    }
+}
+
+/**
+ * @brief hash the chunks of a piece that are completed and contiguous with what's already been hashed
+ * @note call it holding the completed lock. chunks that arrive out of order wait in the piece until the gap is filled.
+ *       spilled pieces aren't hashed until they're complete, so the hot path never reads from disk
+ * @param piece the pieces buffer, NULL for mapped and spilled pieces
+ */
+static void torrent_data_hash_chunks(struct TorrentData * td, struct PieceInfo piece_info, uint8_t * piece) {
+    if (td->sha1_hashes == NULL || (piece == NULL && td->storage != TORRENT_DATA_STORAGE_MMAP)) {
+        return;
+    }
+
+    struct TorrentDataPieceHash * piece_hash = torrent_data_get_piece_hash(td, piece_info.piece_id);
+    if (piece_hash == NULL) {
+        return;
+    }
+
+    size_t end = piece_hash->hashed;
+    while (end < piece_info.piece_size) {
+        int chunk_id = (piece_info.piece_offset + end) / td->chunk_size;
+        if (bitfield_get_bit(td->completed, chunk_id) == 0) {
+            break;
+        }
+        end = MIN(end + td->chunk_size, piece_info.piece_size);
+    }
+
+    if (end > piece_hash->hashed) {
+        torrent_data_hash_range(td, piece_hash, piece_info, piece, end);
+    }
+}
+
+/**
+ * @brief finish hashing a completed piece and compare it with the expected hash
+ * @note call it holding the completed lock. the pieces hash state is freed either way
+ * @param piece the pieces buffer, NULL for mapped and spilled pieces
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int torrent_data_validate_hashed_piece(struct TorrentData * td, struct PieceInfo piece_info, uint8_t * piece) {
+    if (td->sha1_hashes == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    if (piece_info.piece_id*20 > td->sha1_hashes_len-20) {
+        throw("tried to get sha1 hash from beyond bounds");
+    }
+
+    struct TorrentDataPieceHash * piece_hash = torrent_data_get_piece_hash(td, piece_info.piece_id);
+    if (piece_hash == NULL) {
+        goto error;
+    }
+
+    // usually only the last chunk is left, unless chunks arrived out of order or the piece was spilled. with the
+    // verify pipeline this only happens for pieces torrent_data_hash_queued_pieces couldn't hash from memory
+    if (piece_hash->hashed < piece_info.piece_size &&
+        torrent_data_hash_range(td, piece_hash, piece_info, piece, piece_info.piece_size) == EXIT_FAILURE) {
+        goto error;
+    }
+
+    uint8_t hash[20] = {0x00};
+    SHA1Final(hash, &piece_hash->sha);
+    torrent_data_free_piece_hash(td, piece_info.piece_id);
+
+    return torrent_data_check_piece_hash(td, piece_info.piece_id, hash);
+
+    error:
+    torrent_data_free_piece_hash(td, piece_info.piece_id);
+    return EXIT_FAILURE;
+}
+
+int torrent_data_write_data(struct TorrentData * td, void * buff, uint64_t offset, size_t length) {
+    return torrent_data_file_io(td, buff, offset, length, 1);
+}
+
+/**
+ * @brief finish validating a piece that has all of it's chunks, and write it to disk if it's valid
+ * @note safe to call from a hasher thread without holding any locks. nothing else touches the piece while it's being
+ *       verified, it's chunks are all completed and it's buffer is pinned
+ * @return EXIT_SUCCESS if the piece is valid and stored, EXIT_FAILURE otherwise
+ */
+static int torrent_data_verify_piece(struct TorrentData * td, struct PieceInfo piece_info) {
+    uint8_t * piece = NULL;
+    if (td->pieces != NULL) {
+        piece = piece_pool_get(td->pieces, piece_info.piece_id);
+    }
+
+    if (torrent_data_validate_hashed_piece(td, piece_info, piece) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    if (piece != NULL) {
+        if (torrent_data_write_data(td, piece, piece_info.piece_offset, piece_info.piece_size) == EXIT_FAILURE) {
+            throw("failed to write piece %i to disk", piece_info.piece_id);
+        }
+    } else if (td->storage == TORRENT_DATA_STORAGE_MMAP) {
+        // pieces are claimed in order, get the next few ready
+        torrent_data_advise(td, piece_info.piece_offset + piece_info.piece_size,
+                            TORRENT_DATA_MMAP_LOOKAHEAD * td->piece_size, MADV_WILLNEED);
+    }
+
+    return EXIT_SUCCESS;
+    error:
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief mark a verified piece complete, or mark it's chunks incomplete again if it failed so it's downloaded again
+ * @note call it holding the completed lock. if the piece failed call torrent_data_release_piece_claims after unlocking
+ */
+static void torrent_data_finish_piece(struct TorrentData * td, struct PieceInfo piece_info, int valid) {
+    if (td->storage == TORRENT_DATA_STORAGE_FILE) {
+        piece_pool_release(td->pieces, piece_info.piece_id);
+        bitfield_set_bit(td->spilled, piece_info.piece_id, 0);
+    }
+
+    if (valid == EXIT_SUCCESS) {
+        if (td->stream == 1 && td->stream_wanted[piece_info.piece_id] != 0) {
+            int64_t now_ms = now_cached();
+            int64_t available_ms = now_ms - td->stream_wanted[piece_info.piece_id];
+            int late = now_ms > td->stream_deadlines[piece_info.piece_id];
+
+            td->stream_stats.pieces++;
+            td->stream_stats.late += late;
+            td->stream_stats.total_ms += available_ms;
+            td->stream_stats.max_ms = MAX(td->stream_stats.max_ms, available_ms);
+            log_info("piece %i available %" PRId64 " ms after it was wanted%s", piece_info.piece_id, available_ms,
+                     late == 1 ? ", missed it's deadline" : "");
+        }
+
+        bitfield_set_bit(td->verified, piece_info.piece_id, 1);
+        td->completed_pieces++;
+        if(torrent_data_is_complete(td) == 1) {
+            td->needed = 0;
+        }
+    } else {
+        log_warn("piece %i failed validation, downloading it again", piece_info.piece_id);
+
+        int first_chunk = piece_info.piece_offset / td->chunk_size;
+        int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
+        for (int i = first_chunk; i <= last_chunk; i++) {
+            bitfield_set_bit(td->completed, i, 0);
+        }
+        td->downloaded -= piece_info.piece_size;
+        td->left += piece_info.piece_size;
+    }
+}
+
+int torrent_data_write_chunk(struct TorrentData * td, int chunk_id, void * data, size_t data_size) {
+    int return_value = EXIT_FAILURE;
+    // is this chunk already completed?
+    bitfield_lock(td->completed);
+
+    if (bitfield_get_bit(td->completed, chunk_id) == 1) {
+        // ignore already completed chunks
+        bitfield_unlock(td->completed);
+        return EXIT_FAILURE;
+    }
+
+    // get chunk info
+    struct ChunkInfo chunk_info;
+    torrent_data_get_chunk_info(td, chunk_id, &chunk_info);
+
+    log_debug("got chunk %i / %i", chunk_id, td->chunk_count);
+
+    // get piece info
+    struct PieceInfo piece_info;
+    torrent_data_get_piece_info(td, chunk_info.piece_id, &piece_info);
+
+    // validate that we received the expected length
+    if(data_size != chunk_info.chunk_size) {
+        throw("data lengths mismatch %zu %zu", data_size, chunk_info.chunk_size);
+    }
+
+    uint8_t * piece = NULL;
+    if (td->storage == TORRENT_DATA_STORAGE_MMAP) {
+        // mapped chunks go straight to their final location
+        if (torrent_data_mapped_io(td, data, chunk_info.chunk_offset, chunk_info.chunk_size, 1) == EXIT_FAILURE) {
+            throw("failed to write chunk %i", chunk_id);
+        }
+    } else {
+        piece = torrent_data_cache_piece(td, chunk_info.piece_id);
+        if (piece != NULL) {
+            int relative_chunk_offset = chunk_info.chunk_offset - piece_info.piece_offset;
+            memcpy(piece + relative_chunk_offset, data, chunk_info.chunk_size);
+        } else if (torrent_data_write_data(td, data, chunk_info.chunk_offset, chunk_info.chunk_size) == EXIT_FAILURE) {
+            throw("failed to write chunk %i", chunk_id);
+        }
+    }
+
+    int piece_already_received = torrent_data_is_piece_received(td, piece_info.piece_id);
+    bitfield_set_bit(td->completed, chunk_info.chunk_id, 1);
+    if (td->duplicating == 1) {
+        // peers still waiting on this chunk from someone else can cancel their requests
+        td->cancel_epoch++;
     }
 
     td->downloaded += chunk_info.chunk_size;
     td->left -= chunk_info.chunk_size;
 
+    int piece_failed = 0;
+
+    if (td->verify_pipeline == 0) {
+        torrent_data_hash_chunks(td, piece_info, piece);
+    }
+
+    // check if entire piece is done
+    if(torrent_data_is_piece_received(td, piece_info.piece_id) == 1 && piece_already_received == 0) {
+        if (piece == NULL && td->storage == TORRENT_DATA_STORAGE_FILE) {
+            td->cache_stats.reloads++;
+        }
+
+        if (td->verify_pipeline == 1) {
+            // hand the piece to a hasher, the result comes back through torrent_data_process_verified_piece
+            if (piece != NULL) {
+                piece_pool_pin(td->pieces, piece_info.piece_id);
+            }
+
+            int * verify_piece_id = malloc(sizeof(int));
+            if (verify_piece_id == NULL) {
+                throw("failed to malloc piece id for verification");
+            }
+            *verify_piece_id = piece_info.piece_id;
+            queue_push(td->verify_queue, (void *) verify_piece_id);
+            sem_post(&td->verify_semaphore);
+        } else {
+            return_value = torrent_data_verify_piece(td, piece_info);
+            torrent_data_finish_piece(td, piece_info, return_value);
+            piece_failed = return_value == EXIT_FAILURE;
+        }
+    }
+
     bitfield_unlock(td->completed);
+
+    if (piece_failed == 1) {
+        torrent_data_release_piece_claims(td, piece_info);
+    }
+
     return return_value;
     error:
     bitfield_unlock(td->completed);
     return EXIT_FAILURE;
 }
 
-/* reading data */
-int torrent_data_read_data(struct TorrentData * td, void * buff, size_t offset, size_t length) {
-    size_t read_length = 0;
+/**
+ * @brief hash a batch of completed pieces together, so their hashes share SIMD lanes. nothing is hashed while chunks are
+ *        written with the verify pipeline, so these are whole pieces and all but the last piece share a length.
+ *        pieces that aren't in memory are left for torrent_data_verify_piece
+ * @note same rules as torrent_data_verify_piece
+ */
+static void torrent_data_hash_queued_pieces(struct TorrentData * td, struct PieceInfo * piece_infos, int count) {
+    if (td->sha1_hashes == NULL) {
+        return;
+    }
+
+    SHA1_CTX * contexts[TORRENT_DATA_VERIFY_BATCH];
+    const uint8_t * data[TORRENT_DATA_VERIFY_BATCH];
+    uint32_t lengths[TORRENT_DATA_VERIFY_BATCH];
+    struct TorrentDataPieceHash * piece_hashes[TORRENT_DATA_VERIFY_BATCH];
+    int batch_count = 0;
+
+    for (int i = 0; i < count && i < TORRENT_DATA_VERIFY_BATCH; i++) {
+        struct TorrentDataPieceHash * piece_hash = torrent_data_get_piece_hash(td, piece_infos[i].piece_id);
+        if (piece_hash == NULL || piece_hash->hashed >= piece_infos[i].piece_size) {
+            continue;
+        }
+
+        size_t length = piece_infos[i].piece_size - piece_hash->hashed;
+        uint8_t * unhashed = NULL;
+        if (td->pieces != NULL) {
+            uint8_t * piece = piece_pool_get(td->pieces, piece_infos[i].piece_id);
+            unhashed = piece == NULL ? NULL : piece + piece_hash->hashed;
+        } else if (td->storage == TORRENT_DATA_STORAGE_MMAP) {
+            unhashed = torrent_data_mapped_range(td, piece_infos[i].piece_offset + piece_hash->hashed, length);
+        }
+        if (unhashed == NULL) {
+            continue;
+        }
+
+        contexts[batch_count] = &piece_hash->sha;
+        data[batch_count] = unhashed;
+        lengths[batch_count] = (uint32_t) length;
+        piece_hashes[batch_count] = piece_hash;
+        batch_count++;
+    }
+
+    torrent_data_hash_batch(contexts, data, lengths, batch_count);
+
+    for (int i = 0; i < batch_count; i++) {
+        piece_hashes[i]->hashed += lengths[i];
+    }
+}
 
-    uint8_t * piece_buffer = NULL;
+/* verification pipeline */
+void torrent_data_set_verify_pipeline(struct TorrentData * td, int enabled) {
+    if(td->initialized == 1) {
+        log_error("can't change the verify pipeline after setting data size");
+        return;
+    }
+    td->verify_pipeline = enabled;
+}
+
+int torrent_data_verify_run(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
 
-    while(read_length < length) {
-        // for current offset, get piece and relative offset within piece
-        int piece_id = offset / td->piece_size;
+    struct JobArg td_job_arg = va_arg(args, struct JobArg);
+    struct TorrentData * td = (struct TorrentData *) td_job_arg.arg;
+
+    va_end(args);
+
+    while (*cancel_flag != 1) {
+        // wake up regularly to check the cancel flag
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TORRENT_DATA_VERIFY_WAIT_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        if (sem_timedwait(&td->verify_semaphore, &deadline) == -1) {
+            errno = 0;
+            continue;
+        }
+
+        // take whatever else is queued too, so the pieces can be hashed side by side
+        struct PieceInfo piece_infos[TORRENT_DATA_VERIFY_BATCH];
+        int count = 0;
+        do {
+            int * piece_id = (int *) queue_pop(td->verify_queue);
+            if (piece_id == NULL) {
+                break;
+            }
+            torrent_data_get_piece_info(td, *piece_id, &piece_infos[count]);
+            free(piece_id);
+            count++;
+        } while (count < TORRENT_DATA_VERIFY_BATCH && sem_trywait(&td->verify_semaphore) == 0);
+
+        torrent_data_hash_queued_pieces(td, piece_infos, count);
+
+        for (int i = 0; i < count; i++) {
+            struct TorrentDataVerifyResult * result = malloc(sizeof(struct TorrentDataVerifyResult));
+            if (result == NULL) {
+                // put it back for another try
+                int * piece_id = malloc(sizeof(int));
+                if (piece_id != NULL) {
+                    *piece_id = piece_infos[i].piece_id;
+                    queue_push(td->verify_queue, (void *) piece_id);
+                    sem_post(&td->verify_semaphore);
+                }
+                log_error("failed to malloc verify result");
+                continue;
+            }
+
+            result->piece_id = piece_infos[i].piece_id;
+            result->valid = torrent_data_verify_piece(td, piece_infos[i]);
+
+            queue_push(td->verified_queue, (void *) result);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int torrent_data_process_verified_piece(struct TorrentData * td, int * piece_id) {
+    struct TorrentDataVerifyResult * result = NULL;
+    if (queue_get_count(td->verified_queue) > 0) {
+        result = (struct TorrentDataVerifyResult *) queue_pop(td->verified_queue);
+    }
+    if (result == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct PieceInfo piece_info;
+    torrent_data_get_piece_info(td, result->piece_id, &piece_info);
+    int valid = result->valid;
+    free(result);
+
+    bitfield_lock(td->completed);
+    torrent_data_finish_piece(td, piece_info, valid);
+    bitfield_unlock(td->completed);
+
+    if (valid == EXIT_FAILURE) {
+        torrent_data_release_piece_claims(td, piece_info);
+        return EXIT_FAILURE;
+    }
+
+    *piece_id = piece_info.piece_id;
+    return EXIT_SUCCESS;
+}
+
+/* restoring data */
+int torrent_data_restore_pieces(struct TorrentData * td, struct Bitfield * pieces) {
+    int restored = 0;
+
+    bitfield_lock(td->claimed);
+    bitfield_lock(td->completed);
+    for (int piece_id = 0; piece_id < td->piece_count; piece_id++) {
+        if (bitfield_get_bit(pieces, piece_id) == 0 || bitfield_get_bit(td->verified, piece_id) == 1) {
+            continue;
+        }
 
         struct PieceInfo piece_info;
         torrent_data_get_piece_info(td, piece_id, &piece_info);
 
-        // get piece
-        piece_buffer = malloc(piece_info.piece_size + 1);
-        memset(piece_buffer, 0x00, piece_info.piece_size + 1);
+        // the chunks stay claimed, so no one requests them
+        int first_chunk = piece_info.piece_offset / td->chunk_size;
+        int last_chunk = (piece_info.piece_offset + piece_info.piece_size - 1) / td->chunk_size;
+        for (int i = first_chunk; i <= last_chunk; i++) {
+            bitfield_set_bit(td->completed, i, 1);
+            if (bitfield_get_bit(td->claimed, i) == 0) {
+                bitfield_set_bit(td->claimed, i, 1);
+                td->unclaimed_chunks--;
+            }
+        }
 
-        size_t piece_data_read = 0;
+        piece_picker_set_open(td->picker, piece_id, 0);
+        bitfield_set_bit(td->verified, piece_id, 1);
+        td->completed_pieces++;
+        td->left -= piece_info.piece_size;
+        restored++;
+    }
+    if (torrent_data_is_complete(td) == 1) {
+        td->needed = 0;
+    }
+    bitfield_unlock(td->completed);
+    bitfield_unlock(td->claimed);
 
-        size_t piece_begin = piece_info.piece_offset;
-        size_t piece_end = piece_begin + piece_info.piece_size;
+    return restored;
+}
 
-        struct TorrentDataFileInfo * current_file = td->files;
+int torrent_data_has_existing_files(struct TorrentData * td) {
+    struct TorrentDataFileInfo * file = td->files;
+    while (file != NULL) {
+        struct stat file_stat;
+        if (stat(file->file_path, &file_stat) == 0 && file_stat.st_size > 0) {
+            return 1;
+        }
+        file = file->next;
+    }
+    return 0;
+}
 
-        while(piece_data_read != piece_info.piece_size) {
-            if (current_file == NULL) {
-                break;
+/**
+ * @brief is every byte of a piece inside the files as they are on disk?
+ * @param disk_sizes the size on disk of each file, -1 for missing files
+ */
+static int torrent_data_is_piece_on_disk(struct TorrentData * td, struct PieceInfo piece_info, off_t * disk_sizes) {
+    uint64_t end = piece_info.piece_offset + piece_info.piece_size;
+
+    int i = 0;
+    struct TorrentDataFileInfo * file = td->files;
+    while (file != NULL) {
+        uint64_t file_begin = file->file_offset;
+        uint64_t file_end = file_begin + file->file_size;
+
+        if (file_end > piece_info.piece_offset && file_begin < end) {
+            uint64_t needed = MIN(end, file_end) - file_begin;
+            if (disk_sizes[i] < 0 || (uint64_t) disk_sizes[i] < needed) {
+                return 0;
             }
+        }
 
-            size_t file_begin = current_file->file_offset;
-            size_t file_end = file_begin + current_file->file_size;
+        file = file->next;
+        i++;
+    }
+    return 1;
+}
 
-            if (file_end >= piece_begin && file_begin <= piece_end) {
-                size_t relative_offset = (piece_begin + piece_data_read) - file_begin;
-                int bytes_to_read = MIN(current_file->file_size - relative_offset, piece_info.piece_size - piece_data_read);
+int torrent_data_recheck(struct TorrentData * td, int threads) {
+    struct PieceInfo * piece_infos = NULL;
+    uint8_t ** pieces = NULL;
+    uint8_t * buffers = NULL;
+    off_t * disk_sizes = NULL;
+    struct Bitfield * results = NULL;
 
-                FILE *fp = fopen(current_file->file_path, "rb");
-                if(fp == NULL) {
-                    throw("failed to open file %s", current_file->file_path);
-                }
-                fseek(fp, relative_offset, SEEK_SET);
+    if (td->initialized == 0) {
+        throw("can't recheck data before setting data size");
+    }
+
+    // hash as many pieces at once as the threads have lanes. pieces read into buffers count against the piece memory
+    // budget, at least one is always buffered. mapped pieces are hashed in place and only limited by the lanes
+    threads = MAX(1, threads);
+    int batch_size = threads * TORRENT_DATA_VERIFY_BATCH;
+    int buffer_count = MIN(batch_size, MAX(1, (int) (td->piece_memory / td->piece_size)));
+    if (td->storage != TORRENT_DATA_STORAGE_MMAP) {
+        batch_size = buffer_count;
+    }
+
+    int file_count = 0;
+    for (struct TorrentDataFileInfo * file = td->files; file != NULL; file = file->next) {
+        file_count++;
+    }
+
+    piece_infos = malloc(sizeof(struct PieceInfo) * batch_size);
+    pieces = malloc(sizeof(uint8_t *) * batch_size);
+    disk_sizes = malloc(sizeof(off_t) * MAX(1, file_count));
+    results = bitfield_new(td->piece_count, 0, 0x00);
+    if (piece_infos == NULL || pieces == NULL || disk_sizes == NULL || results == NULL) {
+        throw("failed to malloc recheck");
+    }
 
-                size_t expected_bytes_read = fread(piece_buffer + piece_data_read, 1, bytes_to_read, fp);
-                if (expected_bytes_read != bytes_to_read) {
-                    fclose(fp);
-                    throw("wrong number of bytes read %zu %i %s", expected_bytes_read, bytes_to_read, current_file->file_path);
+    int i = 0;
+    for (struct TorrentDataFileInfo * file = td->files; file != NULL; file = file->next) {
+        struct stat file_stat;
+        disk_sizes[i++] = stat(file->file_path, &file_stat) == 0 ? file_stat.st_size : -1;
+    }
+
+    log_info("rechecking existing data on %i threads", threads);
+
+    int count = 0;
+    int buffered = 0;
+    int checked = 0;
+    for (int piece_id = 0; piece_id < td->piece_count; piece_id++) {
+        struct PieceInfo piece_info;
+        torrent_data_get_piece_info(td, piece_id, &piece_info);
+
+        if (bitfield_get_bit(td->verified, piece_id) == 0 && torrent_data_is_piece_on_disk(td, piece_info, disk_sizes) == 1) {
+            // mapped pieces are hashed in place, everything else is read into a buffer first
+            uint8_t * piece = NULL;
+            if (td->storage == TORRENT_DATA_STORAGE_MMAP) {
+                piece = torrent_data_mapped_range(td, piece_info.piece_offset, piece_info.piece_size);
+            }
+            if (piece == NULL) {
+                if (buffers == NULL) {
+                    buffers = malloc(td->piece_size * buffer_count);
+                    if (buffers == NULL) {
+                        throw("failed to malloc recheck buffers");
+                    }
+                }
+                piece = buffers + (buffered * td->piece_size);
+                if (torrent_data_read_data(td, piece, piece_info.piece_offset, piece_info.piece_size) == EXIT_FAILURE) {
+                    piece = NULL;
+                } else {
+                    buffered++;
                 }
-                fclose(fp);
+            }
 
-                piece_data_read += expected_bytes_read;
+            if (piece != NULL) {
+                piece_infos[count] = piece_info;
+                pieces[count] = piece;
+                count++;
             }
+        }
 
-            current_file = current_file->next;
+        if (count == batch_size || buffered == buffer_count || (count > 0 && piece_id == td->piece_count - 1)) {
+            torrent_data_validate_pieces(td, piece_infos, pieces, count, threads, results);
+            checked += count;
+            count = 0;
+            buffered = 0;
         }
+    }
 
-        if (piece_data_read != piece_info.piece_size) {
-            throw("failed to read piece %i from disk", piece_info.piece_id);
+    int restored = torrent_data_restore_pieces(td, results);
+    log_info("recheck found %i valid pieces out of %i checked", restored, checked);
+
+    bitfield_free(results);
+    free(disk_sizes);
+    if (buffers != NULL) {
+        free(buffers);
+    }
+    free(pieces);
+    free(piece_infos);
+    return restored;
+
+    error:
+    if (results != NULL) {
+        bitfield_free(results);
+    }
+    if (disk_sizes != NULL) {
+        free(disk_sizes);
+    }
+    if (buffers != NULL) {
+        free(buffers);
+    }
+    if (pieces != NULL) {
+        free(pieces);
+    }
+    if (piece_infos != NULL) {
+        free(piece_infos);
+    }
+    return -1;
+}
+
+int torrent_data_sync(struct TorrentData * td, int wait) {
+    int result = EXIT_SUCCESS;
+    struct TorrentDataFileInfo * file = td->files;
+    while (file != NULL) {
+        if (file->map != NULL && msync(file->map, file->file_size, wait == 1 ? MS_SYNC : MS_ASYNC) == -1) {
+            log_error("failed to sync %s %s", file->file_path, clean_errno());
+            errno = 0;
+            result = EXIT_FAILURE;
         }
+        file = file->next;
+    }
+    return result;
+}
 
-        // get relative offset and number of bytes we want to copy from this piece
-        int relative_offset = offset - piece_info.piece_offset;
-        int bytes_to_read = MIN(piece_info.piece_size - relative_offset, length - read_length);
+/* reading data */
+int torrent_data_read_data(struct TorrentData * td, void * buff, uint64_t offset, size_t length) {
+    if (td->storage == TORRENT_DATA_STORAGE_MMAP && td->initialized == 1) {
+        return torrent_data_mapped_io(td, buff, offset, length, 0);
+    }
+    return torrent_data_file_io(td, buff, offset, length, 0);
+}
+
+int torrent_data_get_file_segments(struct TorrentData * td, uint64_t offset, size_t length,
+                                   struct TorrentDataFileSegment * segments, int max_segments, int * segment_count) {
+    *segment_count = 0;
+    size_t segment_data = 0;
+    uint64_t end = offset + length;
+
+    struct TorrentDataFileInfo * current_file = td->files;
+    while(current_file != NULL && segment_data != length) {
+        uint64_t file_begin = current_file->file_offset;
+        uint64_t file_end = file_begin + current_file->file_size;
+
+        if (file_end > offset && file_begin < end) {
+            if (*segment_count == max_segments) {
+                throw("data spans more than %i files", max_segments);
+            }
 
-        // copy
-        memcpy(buff + read_length, piece_buffer + relative_offset, bytes_to_read);
+            int fd = torrent_data_pin_file(td, current_file);
+            if (fd == -1) {
+                goto error;
+            }
+
+            uint64_t segment_begin = MAX(offset, file_begin);
+            uint64_t segment_end = MIN(end, file_end);
 
-        // update read_length and read_offset
-        read_length += bytes_to_read;
+            struct TorrentDataFileSegment * segment = &segments[*segment_count];
+            segment->file = current_file;
+            segment->fd = fd;
+            segment->file_offset = segment_begin - file_begin;
+            segment->length = segment_end - segment_begin;
+
+            segment_data += segment->length;
+            (*segment_count)++;
+        }
 
-        free(piece_buffer);
+        current_file = current_file->next;
+    }
+
+    if (segment_data != length) {
+        throw("data at %" PRIu64 " is beyond the end of the torrent", offset);
     }
 
     return EXIT_SUCCESS;
+
     error:
+    torrent_data_release_file_segments(td, segments, *segment_count);
+    *segment_count = 0;
+    return EXIT_FAILURE;
+}
 
-    if(piece_buffer != NULL) {
-        free(piece_buffer);
+void torrent_data_release_file_segments(struct TorrentData * td, struct TorrentDataFileSegment * segments, int segment_count) {
+    for (int i = 0; i < segment_count; i++) {
+        torrent_data_unpin_file(td, segments[i].file);
     }
-    return EXIT_FAILURE;
 }
 
 /* chunk & piece info */
@@ -517,6 +2072,13 @@ int torrent_data_get_piece_info(struct TorrentData * td, int piece_id, struct Pi
 }
 
 int torrent_data_is_piece_complete(struct TorrentData *td, int piece_id) {
+    if(td->verified == NULL) {
+        return 0;
+    }
+    return bitfield_get_bit(td->verified, piece_id);
+}
+
+static int torrent_data_is_piece_received(struct TorrentData *td, int piece_id) {
     // get piece info
     struct PieceInfo piece_info;
     torrent_data_get_piece_info(td, piece_id, &piece_info);
@@ -545,9 +2107,45 @@ int torrent_data_is_complete(struct TorrentData *td) {
     return td->completed_pieces == td->piece_count;
 }
 
+void torrent_data_get_cache_stats(struct TorrentData * td, struct TorrentDataCacheStats * stats) {
+    if (td->initialized == 0) {
+        memset(stats, 0x00, sizeof(struct TorrentDataCacheStats));
+        return;
+    }
+
+    bitfield_lock(td->completed);
+    memcpy(stats, &td->cache_stats, sizeof(struct TorrentDataCacheStats));
+    bitfield_unlock(td->completed);
+}
+
 /* cleanup */
 struct TorrentData * torrent_data_free(struct TorrentData * td) {
     if(td != NULL) {
+        if(td->pieces != NULL) {
+            log_info("piece cache :: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " spills, %" PRIu64 " reloads",
+                     td->cache_stats.hits, td->cache_stats.misses, td->cache_stats.spills, td->cache_stats.reloads);
+        }
+
+        if(td->stream == 1 && td->stream_stats.pieces > 0) {
+            log_info("streaming :: %" PRIu64 " pieces, %" PRIu64 " late, %" PRId64 " ms average / %" PRId64 " ms max to become available, %" PRIu64 " duplicate requests",
+                     td->stream_stats.pieces, td->stream_stats.late, td->stream_stats.total_ms / (int64_t) td->stream_stats.pieces,
+                     td->stream_stats.max_ms, td->stream_stats.duplicates);
+        }
+
+        if(td->stream_wanted != NULL) {
+            free(td->stream_wanted);
+            td->stream_wanted = NULL;
+        }
+
+        if(td->stream_deadlines != NULL) {
+            free(td->stream_deadlines);
+            td->stream_deadlines = NULL;
+        }
+
+        if(td->duplicates != NULL) {
+            free(td->duplicates);
+            td->duplicates = NULL;
+        }
 
         if(td->claimed != NULL) {
             td->claimed = bitfield_free(td->claimed);
@@ -557,17 +2155,50 @@ struct TorrentData * torrent_data_free(struct TorrentData * td) {
             td->completed = bitfield_free(td->completed);
         }
 
+        if(td->verified != NULL) {
+            td->verified = bitfield_free(td->verified);
+        }
+
+        if(td->picker != NULL) {
+            td->picker = piece_picker_free(td->picker);
+        }
+
+        if(td->verify_queue != NULL) {
+            while(queue_get_count(td->verify_queue) > 0) {
+                free(queue_pop(td->verify_queue));
+            }
+            td->verify_queue = queue_free(td->verify_queue);
+        }
+
+        if(td->verified_queue != NULL) {
+            while(queue_get_count(td->verified_queue) > 0) {
+                free(queue_pop(td->verified_queue));
+            }
+            td->verified_queue = queue_free(td->verified_queue);
+        }
+        sem_destroy(&td->verify_semaphore);
+
         if(td->sha1_hashes != NULL) {
             free(td->sha1_hashes);
             td->sha1_hashes = NULL;
         }
 
+        if(td->piece_hashes != NULL) {
+            for(int i = 0; i < td->piece_count; i++) {
+                torrent_data_free_piece_hash(td, i);
+            }
+            free(td->piece_hashes);
+            td->piece_hashes = NULL;
+        }
+
+        torrent_data_unmap_files(td);
+
         if(td->files != NULL) {
             struct TorrentDataFileInfo * file = td->files;
             while (file != NULL) {
                 struct TorrentDataFileInfo * next_file = file->next;
-                if(file->fp != NULL) {
-                    fclose(file->fp);
+                if(file->fd != -1) {
+                    close(file->fd);
                 }
                 free(file->file_path);
                 free(file);
@@ -576,25 +2207,26 @@ struct TorrentData * torrent_data_free(struct TorrentData * td) {
             }
         }
 
-        if (td->data != NULL) {
-            void * piece = hashmap_empty(td->data);
-            while (piece != NULL) {
-                free(piece);
-                piece = hashmap_empty(td->data);
-            }
+        if (td->pieces != NULL) {
+            td->pieces = piece_pool_free(td->pieces);
+        }
 
-            hashmap_free(td->data);
+        if (td->spilled != NULL) {
+            td->spilled = bitfield_free(td->spilled);
+        }
+
+        if(td->claims != NULL) {
+            free(td->claims);
+            td->claims = NULL;
         }
 
-        struct TorrentDataClaim * current = td->claims;
-        while(current != NULL) {
-            struct TorrentDataClaim * next = current->next;
-            free(current);
-            current = NULL;
-            current = next;
+        if(td->claim_heap != NULL) {
+            free(td->claim_heap);
+            td->claim_heap = NULL;
         }
 
         pthread_mutex_destroy(&td->initializer_lock);
+        pthread_mutex_destroy(&td->file_lock);
 
         free(td);
         td = NULL;
@@ -22,6 +22,8 @@
  *
  *        - peer structs can use torrent_data_claim_chunk to lay claim to an uncompleted and unclaimed chunk of the torrent_data, so that
  *          multiple peers aren't requesting the same chunk in parallel.
+ *        - peer structs tell torrent_data which pieces they have with torrent_data_add_peer_pieces, and claim chunks of
+ *          the pieces they have with torrent_data_claim_piece_chunks. the piece_picker decides which piece comes next.
  *        - peer structs can read completed chunks for the purposes of sharing them.
  *
  *        - the torrent struct can use torrent_data_write_chunk to write a chunk received from a peer and declare it complete
@@ -36,6 +38,7 @@
  *       in order to initialized you should:
  *          - call torrent_data_set_chunk_size to set up chunk size
  *          - call torrent_data_set_piece_size to set up piece size
+ *          - optionally call torrent_data_set_storage to pick how data is stored
  *          - call torrent_data_add_file for as many files as are represented by this data,
  *            in the order they appear in the torrent metadata. this will map the pieces of this torrent to files on
  *            the harddrive for reading and writing.
@@ -44,25 +47,138 @@
  *            matter, but if you skipped any of the above steps you will get an error.
  *          - you are now initialized
  *
+ * @note files are read and written with pread / pwrite through a cache of open file descriptors. a file is pinned while
+ *       it's being used so it can't be closed underneath a reader, and the least recently used unpinned files are
+ *       closed once more than max_open_files are open. see torrent_data_set_max_open_files.
+ *
+ * @note with TORRENT_DATA_STORAGE_MMAP every file is preallocated and mapped when the data size is set. chunks are
+ *       copied straight to their final location, pieces are validated by hashing the mapping, and reads come from the
+ *       mapping. the mappings are advised sequential, and the pieces following each completed piece are advised
+ *       WILLNEED, since pieces are claimed in order. if mapping fails the torrent falls back to file storage.
+ *
+ * @note with TORRENT_DATA_STORAGE_FILE pieces are assembled in buffers from a piece_pool, which works as a write-back
+ *       cache with a hard memory budget, see torrent_data_set_piece_memory. piece data never uses more memory than
+ *       that. when a chunk arrives for a new piece while every buffer is in use, the least recently written piece is
+ *       spilled: it's completed chunks are written to their place on disk and it's buffer is reused. the remaining
+ *       chunks of a spilled piece are written straight to disk, and once it's complete the piece is read back from disk
+ *       to be validated. pieces abandoned by slow or departed peers end up spilled instead of holding memory forever.
+ *       see torrent_data_get_cache_stats for hit / miss / spill counters.
+ *
+ * @note without the verify pipeline pieces are hashed incrementally. whenever a chunk is written, the completed chunks
+ *       following the part of the piece that's already been hashed are fed to the pieces SHA1_CTX. pieces arrive mostly
+ *       in order, so completing a piece usually only costs hashing it's last chunk. chunks that arrive out of order wait
+ *       in the piece buffer (or the mapping) until the gap before them is filled. spilled pieces are finished from disk
+ *       once complete.
+ *
+ * @note by default a piece is validated and written out inside the torrent_data_write_chunk call that completes it. with
+ *       torrent_data_set_verify_pipeline nothing is hashed while chunks are written, the main thread only copies them in
+ *       and does the bookkeeping. the completed piece is queued, and hasher jobs (torrent_data_verify_run) hash the
+ *       whole piece and write it to disk. a hasher takes up to TORRENT_DATA_VERIFY_BATCH queued pieces at once and
+ *       hashes them side by side. their results are applied by the main thread with
+ *       torrent_data_process_verified_piece. torrent_data_is_piece_complete only reports pieces once they're validated
+ *       and stored.
+ *
+ * @note torrent_data_claim_piece_chunks asks the piece_picker for a piece, claims as many of it's unclaimed chunks as it
+ *       can, and closes the piece in the picker once every chunk of it is claimed. pieces are opened again when their
+ *       claims expire or they fail validation, so the picker only ever walks pieces that have something left to
+ *       request. see piece_picker/piece_picker.h for the policies, set with torrent_data_set_piece_picker.
+ *
+ * @note with torrent_data_set_stream the pieces just past a read cursor get deadlines. pieces in the window are spaced
+ *       piece_ms apart, starting from when they entered it, the window follows the cursor as it's moved with
+ *       torrent_data_set_stream_position. pieces inside the window are only picked for fast peers, and once a piece
+ *       is within TORRENT_DATA_STREAM_URGENT_MS of it's deadline every peer that has it may claim it's chunks, and fast
+ *       peers may request chunks someone else already claimed a second time. the time it took each piece to become
+ *       available after entering the window is logged and counted, see torrent_data_get_stream_stats.
+ *
+ * @note endgame: once fewer than TORRENT_DATA_ENDGAME_CHUNKS chunks are left unclaimed, a peer that has nothing
+ *       unclaimed left to request is given chunks other peers claimed but haven't delivered, up to
+ *       TORRENT_DATA_ENDGAME_REQUESTS peers per chunk. the last chunks don't wait for the slowest peers claims to
+ *       expire. whenever a chunk completes after chunks were requested more than once cancel_epoch is bumped, telling
+ *       peers to cancel their requests for chunks that already arrived from someone else.
+ *
+ * @note a piece that fails validation has it's chunks marked incomplete and unclaimed again, so it's downloaded again.
+ *       it's buffer goes back to the pool.
+ *
  * @note releasing expired claim deadlines depends on torrent_data_release_expired_claims() being called regularly from
  *       the main loop. it's important that this function is getting called or the first claim on a chunk will never expire
  *       and the swarm will only request it once.
  *
+ * @note claims live in a slab indexed by chunk id, allocated with the rest of the data, and a min heap of the claimed
+ *       chunks ordered by deadline. claiming never mallocs, and releasing expired claims only looks at the ones that
+ *       expired. claiming a chunk that already has a claim moves it's deadline.
+ *
  * @see http://bittorrent.org/bittorrentecon.pdf
  * @see https://wiki.theory.org/index.php/BitTorrentSpecification#Peer_wire_protocol_.28TCP.29
  */
 #ifndef UVGTORRENT_C_TORRENT_DATA_H
 #define UVGTORRENT_C_TORRENT_DATA_H
 
-#include "../hash_map/hash_map.h"
 #include "../bitfield/bitfield.h"
+#include "../piece_picker/piece_picker.h"
+#include "../piece_pool/piece_pool.h"
+#include "../sha1/sha1.h"
+#include "../thread_pool/queue.h"
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <sys/types.h>
+
+#define TORRENT_DATA_MAX_OPEN_FILES 128
+#define TORRENT_DATA_MMAP_LOOKAHEAD 4 // pieces past the last completed one to ask the kernel to prepare
+#define TORRENT_DATA_PIECE_MEMORY (64 * 1024 * 1024) // default budget for buffering in flight pieces
+#define TORRENT_DATA_VERIFY_WAIT_MS 500 // how often idle hashers check if they should exit
+#define TORRENT_DATA_VERIFY_BATCH 8 // pieces hashed side by side, one per SHA1MultiUpdate lane
+#define TORRENT_DATA_STREAM_PIECE_MS 1000 // default time between the deadlines of consecutive pieces in the streaming window
+#define TORRENT_DATA_STREAM_URGENT_MS 2000 // pieces this close to their deadline are requested from any peer, twice if need be
+#define TORRENT_DATA_ENDGAME_CHUNKS 64 // endgame starts once fewer chunks than this are left unclaimed
+#define TORRENT_DATA_ENDGAME_REQUESTS 3 // most peers a chunk is requested from at once in endgame
+
+enum TorrentDataStorage {
+    TORRENT_DATA_STORAGE_FILE, // pieces are assembled in memory and written out with pwrite once they validate
+    TORRENT_DATA_STORAGE_MMAP, // files are preallocated and mapped, chunks are copied straight into place
+};
 
 struct TorrentDataClaim {
     int64_t deadline;
-    int chunk_id;
-    struct TorrentDataClaim * next;
+    int heap_index; // position of the chunk in claim_heap, -1 if it has no claim
+};
+
+/**
+ * the running hash of a piece that's being downloaded
+ */
+struct TorrentDataPieceHash {
+    SHA1_CTX sha;
+    size_t hashed; // bytes from the start of the piece absorbed so far
+};
+
+/**
+ * the outcome of verifying a piece on a hasher thread, handed back to the main thread
+ */
+struct TorrentDataVerifyResult {
+    int piece_id;
+    int valid; // EXIT_SUCCESS if the piece is valid and stored
+};
+
+/**
+ * counters for the piece cache used with TORRENT_DATA_STORAGE_FILE
+ */
+struct TorrentDataCacheStats {
+    uint64_t hits; // chunks written into a piece buffer that was already in memory
+    uint64_t misses; // chunks whose piece had no buffer in memory
+    uint64_t spills; // partially downloaded pieces written out to disk to free their buffer
+    uint64_t reloads; // spilled pieces read back from disk to be validated
+};
+
+/**
+ * how pieces in the streaming window are keeping up with their deadlines
+ */
+struct TorrentDataStreamStats {
+    uint64_t pieces; // pieces that became available while they had a deadline
+    uint64_t late; // pieces that became available after their deadline
+    uint64_t duplicates; // chunks requested a second time because their piece was close to it's deadline
+    int64_t total_ms; // time from entering the window to becoming available, summed over pieces
+    int64_t max_ms;
 };
 
 /**
@@ -70,11 +186,18 @@ struct TorrentDataClaim {
  * for saving and for reading
  */
 struct TorrentDataFileInfo {
-    FILE * fp;
     char * file_path;
     uint64_t file_offset;
     size_t file_size;
     struct TorrentDataFileInfo * next;
+
+    /* open file cache, guarded by the torrent_data file_lock */
+    int fd; // -1 while the file isn't open
+    int pins; // number of users currently reading or writing fd. pinned files are never closed
+    struct TorrentDataFileInfo * lru_prev; // more recently used open file
+    struct TorrentDataFileInfo * lru_next; // less recently used open file
+
+    uint8_t * map; // the whole file, mapped. only used with TORRENT_DATA_STORAGE_MMAP
 };
 
 struct ChunkInfo {
@@ -84,6 +207,16 @@ struct ChunkInfo {
     uint64_t chunk_offset;
 };
 
+/**
+ * a contiguous range of a single file, used to send data straight from disk
+ */
+struct TorrentDataFileSegment {
+    struct TorrentDataFileInfo * file;
+    int fd;
+    uint64_t file_offset; // offset within the file
+    size_t length;
+};
+
 struct PieceInfo {
     int piece_id;
     size_t piece_size;
@@ -94,15 +227,34 @@ struct TorrentData {
     /* STATE */
     _Atomic int needed; // are there chunks of this data that peers should be requesting?
     _Atomic int initialized; // am i usable yet? set to true when data_size is set
-    struct TorrentDataClaim * claims; // linked list of claims to different chunks of this data
+    _Atomic int ready; // are the pieces already on disk accounted for? peers can be told which pieces we have
+    struct TorrentDataClaim * claims; // claim of each chunk, indexed by chunk id. guarded by the claimed lock
+    int * claim_heap; // chunk ids with a claim, min heap by deadline. guarded by the claimed lock
+    int claim_count; // guarded by the claimed lock
     struct Bitfield * claimed; // bitfield indicating whether each chunk is currently claimed by someone else.
     struct Bitfield * completed; // bitfield indicating whether each chunk  &| piece is completed
+    struct Bitfield * verified; // bitfield indicating whether each piece is validated and stored, safe to share
+    struct PiecePicker * picker; // picks which piece to claim chunks of next, pieces are opened / closed under the claimed lock
+    int unclaimed_chunks; // guarded by the claimed lock
+    uint8_t * duplicates; // extra peers each chunk was requested from, guarded by the claimed lock
+    _Atomic int duplicating; // has any chunk been requested from more than one peer?
+    _Atomic int cancel_epoch; // bumped when a chunk completes while duplicating, see peer_send_msg_cancel
+    enum PiecePickerPolicy pick_policy;
+    int pick_window;
 
     /* FILE MAPPING STUFF */
+    enum TorrentDataStorage storage;
     char * root_path;
     struct TorrentDataFileInfo * files;
     size_t files_size;
 
+    /* OPEN FILES */
+    pthread_mutex_t file_lock; // guards the open file cache, files are read and written from several threads
+    struct TorrentDataFileInfo * lru_head; // most recently used open file
+    struct TorrentDataFileInfo * lru_tail; // least recently used open file
+    int open_files;
+    int max_open_files; // unpinned files are closed least recently used first to stay below this
+
     /* CONFIG */
     size_t piece_size; // number of bytes that make up a piece of this data.
     size_t chunk_size; // number of bytes that make up a chunk of a piece of this data.
@@ -115,13 +267,41 @@ struct TorrentData {
     _Atomic int_fast64_t left;           /*	The number of bytes you have left to download until you're finished.                    */
     _Atomic int_fast64_t uploaded;       /*	The number of bytes you have uploaded in this session.                                  */
 
-    struct HashMap * data;
+    struct PiecePool * pieces; // buffers of in flight pieces, only used with TORRENT_DATA_STORAGE_FILE
+    size_t piece_memory; // memory budget for pieces
+    struct Bitfield * spilled; // bitfield indicating whether each in flight piece has been spilled to disk
+    struct TorrentDataCacheStats cache_stats; // guarded by the completed lock
     pthread_mutex_t initializer_lock;
 
     char * sha1_hashes;
     size_t sha1_hashes_len;
+    struct TorrentDataPieceHash ** piece_hashes; // hash state of each in flight piece, guarded by the completed lock
+
+    /* STREAMING */
+    int stream; // do the pieces past the stream cursor have deadlines?
+    int stream_window; // number of pieces past the cursor with a deadline
+    int64_t stream_piece_ms; // time between the deadlines of consecutive pieces in the window
+    _Atomic int stream_cursor; // piece the reader is at
+    int stream_begin; // first incomplete piece from the cursor, the start of the window
+    int64_t * stream_wanted; // when each piece entered the window, 0 if it isn't in it. written holding both locks
+    int64_t * stream_deadlines; // when each piece in the window should be available. written holding both locks
+    struct TorrentDataStreamStats stream_stats; // guarded by the completed lock
+
+    /* VERIFICATION PIPELINE */
+    int verify_pipeline; // are completed pieces verified by hashers instead of inside torrent_data_write_chunk?
+    sem_t verify_semaphore; // posted once for every piece pushed to verify_queue
+    struct Queue * verify_queue; // ids of pieces waiting for a hasher
+    struct Queue * verified_queue; // struct TorrentDataVerifyResult * waiting for the main thread
 };
 
+/**
+ * @brief create the folders leading up to file_path
+ * @param file_path
+ * @param mode
+ * @return 0 or -1 on failure
+ */
+extern int mkpath(char * file_path, mode_t mode);
+
 extern struct TorrentData * torrent_data_new(char * root_path);
 
 /* initialization */
@@ -131,30 +311,260 @@ extern void torrent_data_set_chunk_size(struct TorrentData * td, size_t chunk_si
 
 extern int torrent_data_add_file(struct TorrentData * td, char * path, uint64_t length);
 
+extern void torrent_data_set_max_open_files(struct TorrentData * td, int max_open_files);
+
+extern void torrent_data_set_storage(struct TorrentData * td, enum TorrentDataStorage storage);
+
+extern void torrent_data_set_piece_memory(struct TorrentData * td, size_t piece_memory);
+
+/**
+ * @brief set how torrent_data_claim_piece_chunks picks pieces, see piece_picker/piece_picker.h
+ * @note can be called before or after setting the data size
+ * @param td
+ * @param policy
+ * @param window pieces picked in order with PIECE_PICKER_SEQUENTIAL_WINDOW, 0 for the default
+ */
+extern void torrent_data_set_piece_picker(struct TorrentData * td, enum PiecePickerPolicy policy, int window);
+
 extern void torrent_data_set_sha1_hashes(struct TorrentData * td, char * sha1_hashes, size_t sha1_hashes_len);
 
 extern int torrent_data_validate_piece(struct TorrentData * td, struct PieceInfo piece_info, void * piece_data);
 
+/**
+ * @brief validate a batch of pieces at once. pieces are hashed TORRENT_DATA_VERIFY_BATCH at a time across SIMD lanes,
+ *        and the batch is split over threads
+ * @note for rechecking existing data. the pieces don't need to be in order or the same size, but pieces of the same
+ *       size next to each other hash fastest
+ * @param td
+ * @param piece_infos the pieces to validate
+ * @param pieces the data of each piece
+ * @param count
+ * @param threads how many threads to hash on, counting the calling thread
+ * @param results bitfield indexed by piece id. set to 1 for each valid piece and 0 for each invalid one
+ * @return EXIT_SUCCESS if every piece is valid, EXIT_FAILURE otherwise
+ */
+extern int torrent_data_validate_pieces(struct TorrentData * td, struct PieceInfo * piece_infos, uint8_t ** pieces, int count,
+                                        int threads, struct Bitfield * results);
+
 extern int torrent_data_set_data_size(struct TorrentData * td, size_t data_size);
 
 /* claiming data */
 extern int torrent_data_claim_chunk(struct TorrentData * td, struct Bitfield * interested_chunks, int timeout_seconds, int num_chunks, int * out);
 
+/**
+ * @brief claim chunks of the pieces a peer has, picked by the piece picker
+ * @note while streaming, chunks of pieces close to their deadline come first. for fast peers these may include chunks
+ *       already claimed by another peer, each chunk is requested a second time at most once. in endgame, peers with
+ *       nothing unclaimed left to request are given chunks claimed by other peers, if peer_requested is given
+ * @param td
+ * @param peer_pieces bitfield of the pieces the peer has, indexed by piece id
+ * @param peer_requested bitfield of the chunks already requested from the peer, these are never handed out again. can be NULL
+ * @param fast is the peer one of the fastest? only fast peers are given pieces in the streaming window
+ * @param timeout_seconds how long until the claims expire
+ * @param num_chunks size of out
+ * @param out set to the claimed chunk ids, entries past the last claimed chunk are left alone
+ * @return EXIT_SUCCESS if at least one chunk was claimed, EXIT_FAILURE otherwise
+ */
+extern int torrent_data_claim_piece_chunks(struct TorrentData * td, struct Bitfield * peer_pieces, struct Bitfield * peer_requested,
+                                           int fast, int timeout_seconds, int num_chunks, int * out);
+
 extern int torrent_data_release_expired_claims(struct TorrentData * td);
 
+/**
+ * @brief when the next claim expires, so the main thread knows how long it can sleep before releasing it
+ * @param td
+ * @return deadline of the oldest claim, 0 if nothing is claimed
+ */
+extern int64_t torrent_data_get_claim_deadline(struct TorrentData * td);
+
+/* streaming */
+
+/**
+ * @brief give the pieces past a read cursor deadlines, so they're downloaded in time to be played
+ * @note call before setting the data size. picks pieces with PIECE_PICKER_SEQUENTIAL_WINDOW
+ * @param td
+ * @param window number of pieces past the cursor with a deadline
+ * @param piece_ms time between the deadlines of consecutive pieces, 0 for TORRENT_DATA_STREAM_PIECE_MS
+ */
+extern void torrent_data_set_stream(struct TorrentData * td, int window, int64_t piece_ms);
+
+/**
+ * @brief move the read cursor, pieces that fall out of the window lose their deadlines
+ * @note when not streaming this only moves the piece picker's cursor
+ * @param td
+ * @param offset byte offset in the torrent the reader is at
+ */
+extern void torrent_data_set_stream_position(struct TorrentData * td, uint64_t offset);
+
+/**
+ * @brief move the window past pieces that completed, and give pieces that entered it their deadlines
+ * @note call regularly from the main loop
+ * @param td
+ */
+extern void torrent_data_update_stream(struct TorrentData * td);
+
+/**
+ * @brief copy the streaming counters
+ * @param td
+ * @param stats
+ */
+extern void torrent_data_get_stream_stats(struct TorrentData * td, struct TorrentDataStreamStats * stats);
+
+/* piece availability */
+
+/**
+ * @brief count the pieces of a peer in the piece picker
+ * @note every peer added has to be removed with torrent_data_remove_peer_pieces when it goes away
+ * @param td
+ * @param peer_pieces
+ * @return EXIT_SUCCESS, EXIT_FAILURE if td isn't initialized yet
+ */
+extern int torrent_data_add_peer_pieces(struct TorrentData * td, struct Bitfield * peer_pieces);
+
+/**
+ * @brief stop counting the pieces of a peer in the piece picker
+ * @param td
+ * @param peer_pieces
+ */
+extern void torrent_data_remove_peer_pieces(struct TorrentData * td, struct Bitfield * peer_pieces);
+
+/**
+ * @brief count a piece a peer announced with a have message
+ * @param td
+ * @param piece_id
+ */
+extern void torrent_data_add_peer_piece(struct TorrentData * td, int piece_id);
+
 /* writing data */
+
+/**
+ * @brief write a chunk received from a peer
+ * @param td
+ * @param chunk_id
+ * @param data
+ * @param data_size
+ * @return EXIT_SUCCESS if the chunk completed a piece that's now validated and stored. with the verify pipeline the
+ *         piece is only queued for verification, so this is always EXIT_FAILURE
+ */
 extern int torrent_data_write_chunk(struct TorrentData * td, int chunk_id, void * data, size_t data_size);
 
+extern int torrent_data_write_data(struct TorrentData * td, void * buff, uint64_t offset, size_t length);
+
+/* verification pipeline */
+
+/**
+ * @brief verify completed pieces on hasher threads instead of inside torrent_data_write_chunk
+ * @note call before setting the data size, and run at least one torrent_data_verify_run job
+ * @param td
+ * @param enabled
+ */
+extern void torrent_data_set_verify_pipeline(struct TorrentData * td, int enabled);
+
+/**
+ * @brief hasher main loop. verifies pieces from the verify queue and writes them to disk until cancel_flag is set
+ * @param cancel_flag
+ * @param ... JobArg containing the struct TorrentData *
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_data_verify_run(_Atomic int * cancel_flag, ...);
+
+/**
+ * @brief apply one verify result from the hashers. a valid piece is marked complete, an invalid one is downloaded again
+ * @note call from the main thread
+ * @param td
+ * @param piece_id set to the id of the completed piece
+ * @return EXIT_SUCCESS if a piece was completed, EXIT_FAILURE if there was no result or the piece failed validation
+ */
+extern int torrent_data_process_verified_piece(struct TorrentData * td, int * piece_id);
+
+/* restoring data */
+
+/**
+ * @brief mark pieces that are already on disk as validated and stored, without hashing them
+ * @note call after setting the data size, before peers start claiming chunks
+ * @param td
+ * @param pieces bitfield indexed by piece id, every piece set to 1 is marked complete
+ * @return the number of pieces that were marked complete
+ */
+extern int torrent_data_restore_pieces(struct TorrentData * td, struct Bitfield * pieces);
+
+/**
+ * @brief does any of the files already exist on disk with something in it?
+ * @note call before setting the data size, mapped storage creates every file when the data size is set
+ * @param td
+ * @return 1 or 0
+ */
+extern int torrent_data_has_existing_files(struct TorrentData * td);
+
+/**
+ * @brief hash the data that's already on disk and mark every valid piece complete. pieces are hashed in batches with
+ *        torrent_data_validate_pieces, pieces that don't fit in the files on disk are skipped
+ * @note call after setting the data size, before peers start claiming chunks. blocks until the recheck is done. pieces
+ *       that have to be read into memory first use at most the piece memory budget, or one piece if that's smaller
+ * @param td
+ * @param threads how many threads to hash on
+ * @return the number of valid pieces found, -1 on failure
+ */
+extern int torrent_data_recheck(struct TorrentData * td, int threads);
+
+/**
+ * @brief flush mapped files to disk, so their contents and mtimes are settled
+ * @param td
+ * @param wait 1 to block until everything is written, 0 to only start writing it back. waiting can take as long as it
+ *        takes to write out everything downloaded since the last sync, keep it off the hot path
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_data_sync(struct TorrentData * td, int wait);
+
 /* reading data */
 extern int torrent_data_read_data(struct TorrentData * td, void * buff, uint64_t offset, size_t length);
 
+/**
+ * @brief split length bytes of data at offset into per file segments, and pin an open fd for each file
+ * @note only use this for completed pieces, the files for incomplete pieces might not be fully written yet.
+ *       the fds stay owned by td. release the segments with torrent_data_release_file_segments when you're done
+ *       with the fds, they can't be closed until then
+ * @param td
+ * @param offset offset of the data within the torrent
+ * @param length
+ * @param segments array to fill
+ * @param max_segments size of segments
+ * @param segment_count set to the number of segments filled
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_data_get_file_segments(struct TorrentData * td, uint64_t offset, size_t length,
+                                          struct TorrentDataFileSegment * segments, int max_segments, int * segment_count);
+
+/**
+ * @brief unpin the files of segments returned by torrent_data_get_file_segments
+ * @param td
+ * @param segments
+ * @param segment_count
+ */
+extern void torrent_data_release_file_segments(struct TorrentData * td, struct TorrentDataFileSegment * segments, int segment_count);
+
 /* chunk & piece info */
 extern int torrent_data_get_chunk_info(struct TorrentData * td, int chunk_id, struct ChunkInfo * chunk_info);
 extern int torrent_data_get_piece_info(struct TorrentData * td, int piece_id, struct PieceInfo * piece_info);
 extern int torrent_data_is_piece_complete(struct TorrentData *td, int piece_id);
 
+/**
+ * @brief has the chunk been received? it's piece may not be verified yet
+ * @param td
+ * @param chunk_id
+ * @return 1 or 0
+ */
+extern int torrent_data_is_chunk_complete(struct TorrentData *td, int chunk_id);
+
 extern int torrent_data_is_complete(struct TorrentData *td);
 
+/**
+ * @brief copy the piece cache counters
+ * @param td
+ * @param stats
+ */
+extern void torrent_data_get_cache_stats(struct TorrentData * td, struct TorrentDataCacheStats * stats);
+
 /* cleanup */
 extern struct TorrentData * torrent_data_free(struct TorrentData * td);
 
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "torrent_metadata_cache.h"
+#include "torrent_data.h"
+#include "../log.h"
+#include "../sha1/sha1.h"
+
+/**
+ * @brief build the path of the cache file for a torrent
+ * @param suffix appended to the path, for temporary files
+ * @return char *, free it when you're done. NULL on failure
+ */
+static char * torrent_metadata_cache_path(char * cache_dir, uint8_t info_hash[20], char * suffix) {
+    char info_hash_str[41];
+    for (int i = 0; i < 20; i++) {
+        sprintf(&info_hash_str[i * 2], "%02x", info_hash[i]);
+    }
+
+    size_t path_len = strlen(cache_dir) + sizeof(info_hash_str) + strlen("/.info") + strlen(suffix) + 1;
+    char * path = malloc(path_len);
+    if (path == NULL) {
+        throw("failed to malloc metadata cache path");
+    }
+    snprintf(path, path_len, "%s/%s.info%s", cache_dir, info_hash_str, suffix);
+
+    return path;
+    error:
+    return NULL;
+}
+
+char * torrent_metadata_cache_dir() {
+    char * base = getenv("XDG_CACHE_HOME");
+    char * home = getenv("HOME");
+    char * parent = "";
+
+    if (base == NULL || base[0] == '\0') {
+        if (home == NULL || home[0] == '\0') {
+            return NULL;
+        }
+        base = home;
+        parent = "/.cache";
+    }
+
+    size_t dir_len = strlen(base) + strlen(parent) + strlen(TORRENT_METADATA_CACHE_DIR) + 1;
+    char * dir = malloc(dir_len);
+    if (dir == NULL) {
+        throw("failed to malloc metadata cache dir");
+    }
+    snprintf(dir, dir_len, "%s%s%s", base, parent, TORRENT_METADATA_CACHE_DIR);
+
+    return dir;
+    error:
+    return NULL;
+}
+
+int torrent_metadata_cache_is_valid(uint8_t info_hash[20], uint8_t * info, size_t info_len) {
+    uint8_t hash[20];
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, info, (uint32_t) info_len);
+    SHA1Final(hash, &sha);
+
+    return memcmp(hash, info_hash, 20) == 0;
+}
+
+int torrent_metadata_cache_load(char * cache_dir, uint8_t info_hash[20], uint8_t ** info, size_t * info_len) {
+    uint8_t * buffer = NULL;
+    int fd = -1;
+
+    char * path = torrent_metadata_cache_path(cache_dir, info_hash, "");
+    if (path == NULL) {
+        goto error;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        // not cached
+        errno = 0;
+        goto error;
+    }
+
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) == -1) {
+        throw("failed to stat %s %s", path, clean_errno());
+    }
+    if (cache_stat.st_size <= 0 || cache_stat.st_size > TORRENT_METADATA_CACHE_MAX_SIZE) {
+        throw("cached metadata %s has an invalid size", path);
+    }
+
+    size_t size = (size_t) cache_stat.st_size;
+    buffer = malloc(size);
+    if (buffer == NULL) {
+        throw("failed to malloc cached metadata");
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pread(fd, buffer + done, size - done, (off_t) done);
+        if (result <= 0) {
+            throw("failed to read %s %s", path, clean_errno());
+        }
+        done += (size_t) result;
+    }
+
+    if (torrent_metadata_cache_is_valid(info_hash, buffer, size) == 0) {
+        throw("cached metadata %s doesn't match it's info hash", path);
+    }
+
+    close(fd);
+    free(path);
+
+    *info = buffer;
+    *info_len = size;
+    return EXIT_SUCCESS;
+
+    error:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (buffer != NULL) {
+        free(buffer);
+    }
+    if (path != NULL) {
+        free(path);
+    }
+    return EXIT_FAILURE;
+}
+
+int torrent_metadata_cache_save(char * cache_dir, uint8_t info_hash[20], uint8_t * info, size_t info_len) {
+    char * path = NULL;
+    char * tmp_path = NULL;
+    int fd = -1;
+
+    path = torrent_metadata_cache_path(cache_dir, info_hash, "");
+    tmp_path = torrent_metadata_cache_path(cache_dir, info_hash, ".tmp");
+    if (path == NULL || tmp_path == NULL) {
+        goto error;
+    }
+
+    if (mkpath(tmp_path, 0755) == -1) {
+        throw("failed to create metadata cache dir %s %s", cache_dir, clean_errno());
+    }
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw("failed to open %s %s", tmp_path, clean_errno());
+    }
+
+    size_t done = 0;
+    while (done < info_len) {
+        ssize_t result = pwrite(fd, info + done, info_len - done, (off_t) done);
+        if (result <= 0) {
+            throw("failed to write %s %s", tmp_path, clean_errno());
+        }
+        done += (size_t) result;
+    }
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp_path, path) == -1) {
+        throw("failed to replace %s %s", path, clean_errno());
+    }
+
+    log_info("cached metadata :: %s", path);
+
+    free(tmp_path);
+    free(path);
+    return EXIT_SUCCESS;
+
+    error:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (tmp_path != NULL) {
+        unlink(tmp_path);
+        free(tmp_path);
+    }
+    if (path != NULL) {
+        free(path);
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file torrent/torrent_metadata_cache.h
+ *
+ * @brief a cache of torrent metadata (the bencoded info dict) keyed by info hash, so restarting a torrent doesn't have
+ *        to fetch the metadata from peers with ut_metadata again before it can request any data.
+ *
+ *        every info dict is stored in it's own file, named after the hex info hash, in
+ *        $XDG_CACHE_HOME/uvgtorrent/metadata (or ~/.cache/uvgtorrent/metadata). the info hash is the SHA-1 of the info
+ *        dict, so cached metadata is checked against it when it's loaded and nothing else needs to be stored.
+ *
+ * @see torrent/torrent.h
+ * @see https://www.bittorrent.org/beps/bep_0009.html
+ */
+#ifndef UVGTORRENT_C_TORRENT_METADATA_CACHE_H
+#define UVGTORRENT_C_TORRENT_METADATA_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TORRENT_METADATA_CACHE_DIR "/uvgtorrent/metadata"
+#define TORRENT_METADATA_CACHE_MAX_SIZE (16 * 1024 * 1024) // larger files aren't metadata we wrote
+
+/**
+ * @brief find the metadata cache directory
+ * @return char *, free it when you're done. NULL if there's no home or cache directory to put it in
+ */
+extern char * torrent_metadata_cache_dir();
+
+/**
+ * @brief does an info dict hash to the given info hash?
+ * @param info_hash
+ * @param info
+ * @param info_len
+ * @return 1 or 0
+ */
+extern int torrent_metadata_cache_is_valid(uint8_t info_hash[20], uint8_t * info, size_t info_len);
+
+/**
+ * @brief load the cached info dict of a torrent
+ * @param cache_dir
+ * @param info_hash
+ * @param info set to the info dict, free it when you're done
+ * @param info_len set to the size of the info dict
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the torrent isn't cached or the cached info dict doesn't match the info hash
+ */
+extern int torrent_metadata_cache_load(char * cache_dir, uint8_t info_hash[20], uint8_t ** info, size_t * info_len);
+
+/**
+ * @brief add an info dict to the cache
+ * @note the file is written to a temporary file and renamed into place, so readers never see a partial info dict
+ * @param cache_dir
+ * @param info_hash
+ * @param info
+ * @param info_len
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_metadata_cache_save(char * cache_dir, uint8_t info_hash[20], uint8_t * info, size_t info_len);
+
+#endif //UVGTORRENT_C_TORRENT_METADATA_CACHE_H
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "torrent_resume.h"
+#include "../log.h"
+#include "../bitfield/bitfield.h"
+#include "../sha1/sha1.h"
+
+/**
+ * @brief record the size and mtime of every file, files that don't exist are recorded as all zeros
+ */
+static void torrent_resume_stat_files(struct TorrentData * td, struct TorrentResumeFile * files) {
+    int i = 0;
+    struct TorrentDataFileInfo * file = td->files;
+    while (file != NULL) {
+        struct stat file_stat;
+        memset(&files[i], 0x00, sizeof(struct TorrentResumeFile));
+        if (stat(file->file_path, &file_stat) == 0) {
+            files[i].size = (uint64_t) file_stat.st_size;
+            files[i].mtime_sec = (int64_t) file_stat.st_mtim.tv_sec;
+            files[i].mtime_nsec = (int64_t) file_stat.st_mtim.tv_nsec;
+        }
+        file = file->next;
+        i++;
+    }
+}
+
+static int torrent_resume_file_count(struct TorrentData * td) {
+    int file_count = 0;
+    for (struct TorrentDataFileInfo * file = td->files; file != NULL; file = file->next) {
+        file_count++;
+    }
+    return file_count;
+}
+
+char * torrent_resume_path(char * root_path, uint8_t info_hash[20]) {
+    char info_hash_str[41];
+    for (int i = 0; i < 20; i++) {
+        sprintf(&info_hash_str[i * 2], "%02x", info_hash[i]);
+    }
+
+    size_t path_len = strlen(root_path) + strlen("/.uvgtorrent.resume") + sizeof(info_hash_str) + 1;
+    char * path = malloc(path_len);
+    if (path == NULL) {
+        throw("failed to malloc resume path");
+    }
+    snprintf(path, path_len, "%s/.%s.uvgtorrent.resume", root_path, info_hash_str);
+
+    return path;
+    error:
+    return NULL;
+}
+
+int torrent_resume_save(char * resume_path, struct TorrentData * td, uint8_t info_hash[20], uint8_t * info, size_t info_len,
+                        int wait) {
+    uint8_t * buffer = NULL;
+    char * tmp_path = NULL;
+    int fd = -1;
+
+    if (td->initialized == 0) {
+        throw("can't save resume data before the data size is set");
+    }
+
+    int file_count = torrent_resume_file_count(td);
+    size_t bitfield_len = td->verified->bytes_count;
+    size_t size = sizeof(struct TorrentResumeHeader) + info_len + bitfield_len +
+                  (file_count * sizeof(struct TorrentResumeFile)) + 20;
+
+    buffer = calloc(1, size);
+    if (buffer == NULL) {
+        throw("failed to malloc resume data");
+    }
+
+    struct TorrentResumeHeader * header = (struct TorrentResumeHeader *) buffer;
+    header->magic = TORRENT_RESUME_MAGIC;
+    header->version = TORRENT_RESUME_VERSION;
+    memcpy(header->info_hash, info_hash, 20);
+    header->info_len = info_len;
+    header->piece_count = td->piece_count;
+    header->bitfield_len = bitfield_len;
+    header->file_count = file_count;
+
+    uint8_t * position = buffer + sizeof(struct TorrentResumeHeader);
+    memcpy(position, info, info_len);
+    position += info_len;
+
+    // copy the pieces before looking at the files. a piece stored in between shows up in the files but not the
+    // bitfield, which only costs downloading it again
+    bitfield_lock(td->completed);
+    memcpy(position, td->verified->bytes, bitfield_len);
+    bitfield_unlock(td->completed);
+    position += bitfield_len;
+
+    torrent_data_sync(td, wait);
+    torrent_resume_stat_files(td, (struct TorrentResumeFile *) position);
+    position += file_count * sizeof(struct TorrentResumeFile);
+
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, buffer, (uint32_t) (position - buffer));
+    SHA1Final(position, &sha);
+
+    size_t tmp_path_len = strlen(resume_path) + strlen(".tmp") + 1;
+    tmp_path = malloc(tmp_path_len);
+    if (tmp_path == NULL) {
+        throw("failed to malloc resume path");
+    }
+    snprintf(tmp_path, tmp_path_len, "%s.tmp", resume_path);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw("failed to open %s %s", tmp_path, clean_errno());
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pwrite(fd, buffer + done, size - done, (off_t) done);
+        if (result <= 0) {
+            throw("failed to write %s %s", tmp_path, clean_errno());
+        }
+        done += (size_t) result;
+    }
+
+    if (fsync(fd) == -1) {
+        throw("failed to sync %s %s", tmp_path, clean_errno());
+    }
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp_path, resume_path) == -1) {
+        throw("failed to replace %s %s", resume_path, clean_errno());
+    }
+
+    free(tmp_path);
+    free(buffer);
+    return EXIT_SUCCESS;
+
+    error:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (tmp_path != NULL) {
+        unlink(tmp_path);
+        free(tmp_path);
+    }
+    if (buffer != NULL) {
+        free(buffer);
+    }
+    return EXIT_FAILURE;
+}
+
+int torrent_resume_load(char * resume_path, struct TorrentData * td, uint8_t info_hash[20], uint8_t * info, size_t info_len) {
+    uint8_t * buffer = NULL;
+    struct TorrentResumeFile * files = NULL;
+    struct Bitfield * pieces = NULL;
+    int fd = -1;
+
+    fd = open(resume_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        // nothing to resume
+        errno = 0;
+        return EXIT_FAILURE;
+    }
+
+    struct stat resume_stat;
+    if (fstat(fd, &resume_stat) == -1) {
+        throw("failed to stat %s %s", resume_path, clean_errno());
+    }
+
+    size_t size = (size_t) resume_stat.st_size;
+    if (size < sizeof(struct TorrentResumeHeader) + 20) {
+        throw("resume file %s is truncated", resume_path);
+    }
+
+    buffer = malloc(size);
+    if (buffer == NULL) {
+        throw("failed to malloc resume data");
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pread(fd, buffer + done, size - done, (off_t) done);
+        if (result <= 0) {
+            throw("failed to read %s %s", resume_path, clean_errno());
+        }
+        done += (size_t) result;
+    }
+    close(fd);
+    fd = -1;
+
+    uint8_t checksum[20];
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, buffer, (uint32_t) (size - 20));
+    SHA1Final(checksum, &sha);
+    if (memcmp(checksum, buffer + size - 20, 20) != 0) {
+        throw("resume file %s is corrupt", resume_path);
+    }
+
+    struct TorrentResumeHeader * header = (struct TorrentResumeHeader *) buffer;
+    int file_count = torrent_resume_file_count(td);
+    size_t expected_size = sizeof(struct TorrentResumeHeader) + header->info_len + header->bitfield_len +
+                           (header->file_count * sizeof(struct TorrentResumeFile)) + 20;
+
+    if (header->magic != TORRENT_RESUME_MAGIC || header->version != TORRENT_RESUME_VERSION || size != expected_size) {
+        throw("resume file %s has an unknown format", resume_path);
+    }
+    if (memcmp(header->info_hash, info_hash, 20) != 0 || header->info_len != info_len ||
+        memcmp(buffer + sizeof(struct TorrentResumeHeader), info, info_len) != 0) {
+        throw("resume file %s is for a different torrent", resume_path);
+    }
+    if (header->piece_count != (uint64_t) td->piece_count || header->bitfield_len != td->verified->bytes_count ||
+        header->file_count != (uint64_t) file_count) {
+        throw("resume file %s doesn't match the torrent layout", resume_path);
+    }
+
+    // any file that changed since the resume file was saved makes the saved pieces untrustworthy
+    files = malloc(sizeof(struct TorrentResumeFile) * (file_count > 0 ? file_count : 1));
+    if (files == NULL) {
+        throw("failed to malloc resume files");
+    }
+    torrent_resume_stat_files(td, files);
+
+    uint8_t * saved_pieces = buffer + sizeof(struct TorrentResumeHeader) + info_len;
+    uint8_t * saved_files = saved_pieces + header->bitfield_len;
+    if (memcmp(files, saved_files, file_count * sizeof(struct TorrentResumeFile)) != 0) {
+        throw("files changed since resume file %s was saved", resume_path);
+    }
+
+    pieces = bitfield_new(td->piece_count, 0, 0x00);
+    if (pieces == NULL) {
+        throw("failed to malloc resume pieces");
+    }
+    memcpy(pieces->bytes, saved_pieces, header->bitfield_len);
+
+    int restored = torrent_data_restore_pieces(td, pieces);
+    log_info("resumed %i / %i pieces from %s", restored, td->piece_count, resume_path);
+
+    bitfield_free(pieces);
+    free(files);
+    free(buffer);
+    return EXIT_SUCCESS;
+
+    error:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (files != NULL) {
+        free(files);
+    }
+    if (buffer != NULL) {
+        free(buffer);
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file torrent/torrent_resume.h
+ *
+ * @brief fast resume. the state of a download is saved to a resume file in the download folder, so a restarted client
+ *        picks up where it left off instead of downloading everything that's already on disk again.
+ *
+ *        the resume file holds the info dict, the bitfield of validated pieces, the size and mtime of every file, and
+ *        a SHA-1 checksum of all of it. the pieces in it are only trusted when the checksum, info hash and info dict
+ *        match, and every file still has the size and mtime it had when the resume file was saved. when they don't
+ *        the data on disk is rechecked instead, see torrent_data_recheck.
+ *
+ * @note the resume file is written to a temporary file and renamed into place, so a crash while saving leaves the last
+ *       resume file intact. integers are stored in host byte order, resume files aren't meant to be moved between
+ *       machines.
+ *
+ * @see torrent/torrent_data.h
+ */
+#ifndef UVGTORRENT_C_TORRENT_RESUME_H
+#define UVGTORRENT_C_TORRENT_RESUME_H
+
+#include "torrent_data.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define TORRENT_RESUME_MAGIC 0x52475655 // "UVGR"
+#define TORRENT_RESUME_VERSION 1
+#define TORRENT_RESUME_SAVE_INTERVAL_MS (30 * 1000)
+
+/**
+ * the resume file starts with a header, followed by info_len bytes of info dict, bitfield_len bytes of the validated
+ * pieces bitfield, file_count struct TorrentResumeFile, and the SHA-1 of everything before it
+ */
+struct TorrentResumeHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t info_hash[20];
+    uint64_t info_len;
+    uint64_t piece_count;
+    uint64_t bitfield_len;
+    uint64_t file_count;
+};
+
+/**
+ * what a file looked like on disk when the resume file was saved
+ */
+struct TorrentResumeFile {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+/**
+ * @brief build the path of the resume file for a torrent
+ * @param root_path the folder the torrent is downloaded to
+ * @param info_hash
+ * @return char *, free it when you're done. NULL on failure
+ */
+extern char * torrent_resume_path(char * root_path, uint8_t info_hash[20]);
+
+/**
+ * @brief save the validated pieces of td to the resume file
+ * @note with wait the mapped files are synced first, so the mtimes that are saved are final. without it their write back
+ *       is only started, a crash before it finishes leaves mtimes that don't match and the data is rechecked
+ * @param resume_path
+ * @param td
+ * @param info_hash
+ * @param info the bencoded info dict
+ * @param info_len
+ * @param wait 1 to wait for the mapped files to reach the disk, see torrent_data_sync
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+extern int torrent_resume_save(char * resume_path, struct TorrentData * td, uint8_t info_hash[20], uint8_t * info, size_t info_len,
+                               int wait);
+
+/**
+ * @brief mark the pieces saved in the resume file complete, if the resume file matches the torrent and the files on disk
+ * @note call after setting the data size, before peers start claiming chunks
+ * @param resume_path
+ * @param td
+ * @param info_hash
+ * @param info the bencoded info dict
+ * @param info_len
+ * @return EXIT_SUCCESS if the pieces were restored, EXIT_FAILURE if there's no resume file or it doesn't match
+ */
+extern int torrent_resume_load(char * resume_path, struct TorrentData * td, uint8_t info_hash[20], uint8_t * info, size_t info_len);
+
+#endif //UVGTORRENT_C_TORRENT_RESUME_H
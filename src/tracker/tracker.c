@@ -107,6 +107,13 @@ int tracker_should_run(struct Tracker *tr) {
             tracker_should_scrape(tr)) & tr->running == 0;
 }
 
+int64_t tracker_get_deadline(struct Tracker *tr) {
+    if (tr->running == 1 || tr->status != TRACKER_IDLE || tr->message_attempts >= 5) {
+        return 0;
+    }
+    return tr->announce_deadline < tr->scrape_deadline ? tr->announce_deadline : tr->scrape_deadline;
+}
+
 int tracker_run(_Atomic int *cancel_flag, ...) {
     va_list args;
     va_start(args, cancel_flag);
@@ -308,7 +315,7 @@ int tracker_connect(struct Tracker *tr, _Atomic int *cancel_flag) {
 }
 
 int tracker_should_announce(struct Tracker *tr) {
-    if (tr->status == TRACKER_IDLE && tr->announce_deadline < now() && tr->message_attempts < 5) {
+    if (tr->status == TRACKER_IDLE && tr->announce_deadline < now_cached() && tr->message_attempts < 5) {
         return 1;
     }
     return 0;
@@ -448,7 +455,7 @@ int tracker_announce(struct Tracker *tr, _Atomic int *cancel_flag, _Atomic int_f
 }
 
 int tracker_should_scrape(struct Tracker *tr) {
-    if (tr->status == TRACKER_IDLE && tr->scrape_deadline < now() && tr->message_attempts < 5) {
+    if (tr->status == TRACKER_IDLE && tr->scrape_deadline < now_cached() && tr->message_attempts < 5) {
         return 1;
     }
     return 0;
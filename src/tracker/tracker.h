@@ -67,6 +67,13 @@ extern struct Tracker *tracker_new(char *url, char * public_ip);
  */
 extern int tracker_should_run(struct Tracker *tr);
 
+/**
+ * @brief when this tracker next wants to run, so the main thread knows how long it can sleep
+ * @param tr
+ * @return the earlier of the announce and scrape deadlines, 0 if it's running or has given up
+ */
+extern int64_t tracker_get_deadline(struct Tracker *tr);
+
 /**
  * @brief main tracker loop. handles running the tracker
  * @param cancel_flag
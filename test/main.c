@@ -26,6 +26,18 @@
 #include "test_tracker.c"
 #include "test_hash_map.c"
 #include "test_bitfield.c"
+#include "test_buffered_socket.c"
+#include "test_torrent_data.c"
+#include "test_piece_pool.c"
+#include "test_piece_picker.c"
+#include "test_sha1.c"
+#include "test_torrent_resume.c"
+#include "test_torrent_metadata_cache.c"
+#include "test_http_server.c"
+#include "test_peer.c"
+#include "test_thread_pool.c"
+#include "test_message_ring.c"
+#include "test_timer_wheel.c"
 
 /**
  * Test runner function
@@ -65,6 +77,69 @@ main(void) {
 
             /* Bitfield */
             cmocka_unit_test(test_bitfield_get_and_set),
+
+            /* BufferedSocket */
+            cmocka_unit_test(test_buffered_socket_read_partial),
+            cmocka_unit_test(test_buffered_socket_read_grow),
+            cmocka_unit_test(test_buffered_socket_read_cap),
+            cmocka_unit_test(test_buffered_socket_write_coalesce),
+            cmocka_unit_test(test_buffered_socket_write_partial),
+            cmocka_unit_test(test_buffered_socket_cancel),
+            cmocka_unit_test(test_buffered_socket_cancel_sending),
+            cmocka_unit_test(test_buffered_socket_write_file_short),
+
+            /* TorrentData */
+            cmocka_unit_test(test_torrent_data_get_file_segments),
+            cmocka_unit_test(test_torrent_data_open_file_limit),
+            cmocka_unit_test(test_torrent_data_mmap_storage),
+            cmocka_unit_test(test_torrent_data_incremental_hash),
+            cmocka_unit_test(test_torrent_data_validate_pieces),
+            cmocka_unit_test(test_torrent_data_cache_spill),
+            cmocka_unit_test(test_torrent_data_verify_pipeline),
+            cmocka_unit_test(test_torrent_data_verify_batch),
+            cmocka_unit_test(test_torrent_data_stream_deadlines),
+
+            /* PiecePool */
+            cmocka_unit_test(test_piece_pool_acquire_release),
+
+            /* PiecePicker */
+            cmocka_unit_test(test_piece_picker_policies),
+            cmocka_unit_test(test_torrent_data_claim_piece_chunks),
+            cmocka_unit_test(test_torrent_data_endgame),
+            cmocka_unit_test(test_torrent_data_claim_expiry),
+
+            /* TorrentResume */
+            cmocka_unit_test(test_torrent_resume_save_load),
+            cmocka_unit_test(test_torrent_data_recheck),
+
+            /* TorrentMetadataCache */
+            cmocka_unit_test(test_torrent_metadata_cache_save_load),
+
+            /* HttpServer */
+            cmocka_unit_test(test_http_server_parse_range),
+            cmocka_unit_test(test_http_server_handle_request),
+
+            /* Peer */
+            cmocka_unit_test(test_peer_request_depth),
+            cmocka_unit_test(test_peer_held_message),
+            cmocka_unit_test(test_peer_bitfield_complete),
+
+            /* ThreadPool */
+            cmocka_unit_test(test_job_queue_push_pop),
+            cmocka_unit_test(test_job_deque_pop_steal),
+            cmocka_unit_test(test_thread_pool_run_jobs),
+
+            /* MessageRing */
+            cmocka_unit_test(test_message_ring_push_pop),
+            cmocka_unit_test(test_message_ring_wait),
+            cmocka_unit_test(test_message_ring_wake_fd),
+
+            /* TimerWheel */
+            cmocka_unit_test(test_timer_wheel_schedule),
+            cmocka_unit_test(test_timer_wheel_reschedule),
+
+            /* SHA1 */
+            cmocka_unit_test(test_sha1_implementations),
     };
 
 
@@ -6,6 +6,8 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
 #include "log.h"
 #include "mocked_functions.h"
 
@@ -73,6 +75,29 @@ ssize_t __wrap_write(int fd, const void *buf, size_t count) {
     return WRITE_COUNT;
 }
 
+// writev
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+    struct READ_WRITE_MOCK_VALUED * rw = (struct READ_WRITE_MOCK_VALUED *) mock();
+    if (rw->value != NULL) {
+        // the iovecs only live for the duration of the call, copy them out
+        memcpy(rw->value, iov, sizeof(struct iovec) * iovcnt);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    if (rw->count == 0) {
+        return total;
+    } else if (rw->count == -1) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return rw->count;
+}
+
 // random
 long int __real_random(void);
 long int __wrap_random(void) {
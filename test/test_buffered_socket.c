@@ -0,0 +1,375 @@
+#include "buffered_socket/buffered_socket.h"
+
+static struct BufferedSocket * test_buffered_socket_new() {
+    struct BufferedSocket * s = buffered_socket_new(NULL);
+    s->socket = 100; // never touched, read is mocked
+    return s;
+}
+
+static void test_buffered_socket_free(struct BufferedSocket * s) {
+    s->socket = -1; // don't close the fake fd
+    buffered_socket_free(s);
+}
+
+// test buffered_socket_read only returns data once the full amount has arrived
+static void test_buffered_socket_read_partial(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+
+    uint8_t network_data[6] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+    uint32_t value = 0;
+
+    struct READ_WRITE_MOCK_VALUED r;
+    r.value = &network_data[0];
+    r.count = 3;
+    will_return(__wrap_read, &r);
+    assert_int_equal(buffered_socket_network_read(s), 1);
+
+    // only 3 of 4 bytes available
+    assert_int_equal(buffered_socket_read(s, &value, sizeof(value)), 0);
+    assert_int_equal(s->read_buffer_size, 3);
+
+    struct READ_WRITE_MOCK_VALUED r2;
+    r2.value = &network_data[3];
+    r2.count = 3;
+    will_return(__wrap_read, &r2);
+    assert_int_equal(buffered_socket_network_read(s), 1);
+
+    assert_int_equal(buffered_socket_read(s, &value, sizeof(value)), sizeof(value));
+    assert_memory_equal(&value, &network_data[0], sizeof(value));
+    assert_int_equal(s->read_buffer_size, 2);
+    assert_int_equal(s->read_buffer_offset, 4);
+
+    uint16_t rest = 0;
+    assert_int_equal(buffered_socket_read(s, &rest, sizeof(rest)), sizeof(rest));
+    assert_memory_equal(&rest, &network_data[4], sizeof(rest));
+
+    // fully consumed buffers start from the front again
+    assert_int_equal(s->read_buffer_size, 0);
+    assert_int_equal(s->read_buffer_offset, 0);
+
+    test_buffered_socket_free(s);
+}
+
+// test the read buffer compacts and grows without losing or reordering data
+static void test_buffered_socket_read_grow(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+
+    size_t chunk_size = BUFFERED_SOCKET_READ_MIN_FREE;
+    size_t chunk_count = 3;
+    uint8_t * network_data = malloc(chunk_size * chunk_count);
+    for (size_t i = 0; i < chunk_size * chunk_count; i++) {
+        network_data[i] = (uint8_t) (i * 7);
+    }
+
+    struct READ_WRITE_MOCK_VALUED r[3];
+    for (size_t i = 0; i < chunk_count; i++) {
+        r[i].value = network_data + (i * chunk_size);
+        r[i].count = (int) chunk_size;
+        will_return(__wrap_read, &r[i]);
+        assert_int_equal(buffered_socket_network_read(s), 1);
+    }
+
+    assert_int_equal(s->read_buffer_size, chunk_size * chunk_count);
+    assert_true(s->read_buffer_capacity >= chunk_size * chunk_count);
+
+    // consume one chunk and a bit, then fill the buffer up again
+    uint8_t * out = malloc(chunk_size * chunk_count);
+    size_t consumed = chunk_size + 13;
+    assert_int_equal(buffered_socket_read(s, out, consumed), consumed);
+
+    struct READ_WRITE_MOCK_VALUED r2;
+    r2.value = network_data;
+    r2.count = (int) chunk_size;
+    will_return(__wrap_read, &r2);
+    assert_int_equal(buffered_socket_network_read(s), 1);
+
+    // the next network read has to move the unread data to the front instead of growing
+    size_t capacity = s->read_buffer_capacity;
+    struct READ_WRITE_MOCK_VALUED r3;
+    r3.value = network_data + chunk_size;
+    r3.count = (int) chunk_size;
+    will_return(__wrap_read, &r3);
+    assert_int_equal(buffered_socket_network_read(s), 1);
+    assert_int_equal(s->read_buffer_offset, 0);
+    assert_int_equal(s->read_buffer_capacity, capacity);
+
+    size_t remaining = (chunk_size * chunk_count) - consumed;
+    assert_int_equal(buffered_socket_read(s, out + consumed, remaining), remaining);
+    assert_memory_equal(out, network_data, chunk_size * chunk_count);
+
+    assert_int_equal(buffered_socket_read(s, out, chunk_size * 2), chunk_size * 2);
+    assert_memory_equal(out, network_data, chunk_size * 2);
+    assert_int_equal(s->read_buffer_size, 0);
+
+    free(out);
+    free(network_data);
+    test_buffered_socket_free(s);
+}
+
+// test small writes share a buffer and are flushed with a single writev
+static void test_buffered_socket_write_coalesce(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+
+    uint32_t keepalive = 0;
+    uint8_t have[9] = {0x00, 0x00, 0x00, 0x05, 0x04, 0x00, 0x00, 0x00, 0x01};
+    uint8_t * large = malloc(BUFFERED_SOCKET_COALESCE_SIZE + 1);
+    memset(large, 0xAB, BUFFERED_SOCKET_COALESCE_SIZE + 1);
+
+    assert_int_equal(buffered_socket_write(s, &keepalive, sizeof(keepalive)), sizeof(keepalive));
+    assert_int_equal(buffered_socket_write(s, &have, sizeof(have)), sizeof(have));
+    assert_ptr_equal(s->write_buffer_head, s->write_buffer_tail);
+    assert_int_equal(s->write_buffer_head->data_size, sizeof(keepalive) + sizeof(have));
+
+    // large messages get their own buffer, small messages after it get a new shared one
+    assert_int_equal(buffered_socket_write(s, large, BUFFERED_SOCKET_COALESCE_SIZE + 1), BUFFERED_SOCKET_COALESCE_SIZE + 1);
+    assert_int_equal(buffered_socket_write(s, &keepalive, sizeof(keepalive)), sizeof(keepalive));
+    assert_ptr_not_equal(s->write_buffer_head, s->write_buffer_tail);
+    assert_int_equal(s->write_buffer_tail->data_size, sizeof(keepalive));
+
+    struct iovec iov[BUFFERED_SOCKET_MAX_IOVECS];
+    struct READ_WRITE_MOCK_VALUED w;
+    w.value = &iov;
+    w.count = 0; // everything is sent
+    will_return(__wrap_writev, &w);
+    assert_int_equal(buffered_socket_network_write(s), 1);
+
+    assert_int_equal(iov[0].iov_len, sizeof(keepalive) + sizeof(have));
+    assert_int_equal(iov[1].iov_len, BUFFERED_SOCKET_COALESCE_SIZE + 1);
+    assert_int_equal(iov[2].iov_len, sizeof(keepalive));
+
+    assert_null(s->write_buffer_head);
+    assert_null(s->write_buffer_tail);
+
+    free(large);
+    test_buffered_socket_free(s);
+}
+
+// test partial writes resume from the right place, across buffers
+static void test_buffered_socket_write_partial(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+
+    uint8_t * large = malloc(BUFFERED_SOCKET_COALESCE_SIZE + 1);
+    memset(large, 0xAB, BUFFERED_SOCKET_COALESCE_SIZE + 1);
+    uint32_t keepalive = 0;
+
+    buffered_socket_write(s, &keepalive, sizeof(keepalive));
+    buffered_socket_write(s, large, BUFFERED_SOCKET_COALESCE_SIZE + 1);
+
+    // the first buffer and 10 bytes of the second are sent, then the socket is full
+    struct READ_WRITE_MOCK_VALUED w;
+    w.value = NULL;
+    w.count = sizeof(keepalive) + 10;
+    will_return(__wrap_writev, &w);
+    struct READ_WRITE_MOCK_VALUED w2;
+    w2.value = NULL;
+    w2.count = -1;
+    will_return(__wrap_writev, &w2);
+    s->writable = 1;
+    assert_int_equal(buffered_socket_network_write(s), 1);
+
+    assert_int_equal(s->writable, 0);
+    assert_ptr_equal(s->write_buffer_head, s->write_buffer_tail);
+    assert_int_equal(s->write_buffer_head->data_sent, 10);
+
+    // writing more while a buffer is half sent must keep it queued
+    buffered_socket_write(s, &keepalive, sizeof(keepalive));
+    assert_int_equal(s->write_buffer_head->data_sent, 10);
+    assert_ptr_not_equal(s->write_buffer_head, s->write_buffer_tail);
+
+    struct iovec iov[BUFFERED_SOCKET_MAX_IOVECS];
+    struct READ_WRITE_MOCK_VALUED w3;
+    w3.value = &iov;
+    w3.count = 0;
+    will_return(__wrap_writev, &w3);
+    assert_int_equal(buffered_socket_network_write(s), 1);
+
+    assert_int_equal(iov[0].iov_len, BUFFERED_SOCKET_COALESCE_SIZE + 1 - 10);
+    assert_int_equal(iov[1].iov_len, sizeof(keepalive));
+    assert_null(s->write_buffer_head);
+
+    free(large);
+    test_buffered_socket_free(s);
+}
+
+// test a tagged message is dropped whole by a cancel, unless it started going out
+static void test_buffered_socket_cancel(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+
+    uint32_t keepalive = 0;
+    uint8_t header[13];
+    memset(header, 0xCD, sizeof(header));
+
+    buffered_socket_write(s, &keepalive, sizeof(keepalive));
+    assert_int_equal(buffered_socket_write_tagged(s, header, sizeof(header), 1), sizeof(header));
+    assert_int_equal(buffered_socket_write_tagged(s, header, sizeof(header), 2), sizeof(header));
+
+    // small messages aren't appended to tagged buffers
+    buffered_socket_write(s, &keepalive, sizeof(keepalive));
+    assert_int_equal(s->write_buffer_tail->tag, 0);
+    assert_int_equal(s->write_buffer_tail->data_size, sizeof(keepalive));
+
+    assert_int_equal(buffered_socket_cancel(s, 1), sizeof(header));
+    assert_int_equal(buffered_socket_cancel(s, 1), 0);
+
+    // the keepalive and 5 bytes of message 2 are sent, it's too late to cancel it
+    struct READ_WRITE_MOCK_VALUED w;
+    w.value = NULL;
+    w.count = sizeof(keepalive) + 5;
+    will_return(__wrap_writev, &w);
+    struct READ_WRITE_MOCK_VALUED w2;
+    w2.value = NULL;
+    w2.count = -1;
+    will_return(__wrap_writev, &w2);
+    assert_int_equal(buffered_socket_network_write(s), 1);
+    assert_int_equal(buffered_socket_cancel(s, 2), 0);
+
+    struct iovec iov[BUFFERED_SOCKET_MAX_IOVECS];
+    struct READ_WRITE_MOCK_VALUED w3;
+    w3.value = &iov;
+    w3.count = 0;
+    will_return(__wrap_writev, &w3);
+    assert_int_equal(buffered_socket_network_write(s), 1);
+    assert_int_equal(iov[0].iov_len, sizeof(header) - 5);
+    assert_int_equal(iov[1].iov_len, sizeof(keepalive));
+    assert_null(s->write_buffer_head);
+
+    // cancelling the last buffer moves the tail back
+    buffered_socket_write(s, &keepalive, sizeof(keepalive));
+    buffered_socket_write_tagged(s, header, sizeof(header), 3);
+    assert_int_equal(buffered_socket_cancel(s, 3), sizeof(header));
+    assert_ptr_equal(s->write_buffer_head, s->write_buffer_tail);
+    assert_int_equal(s->write_buffer_tail->tag, 0);
+
+    test_buffered_socket_free(s);
+}
+
+// test a file shorter than it's queued range fails the write instead of leaving the buffer queued forever
+static void test_buffered_socket_write_file_short(void **state) {
+    (void) state;
+
+    int fds[2];
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    struct BufferedSocket * s = test_buffered_socket_new();
+    s->socket = fds[0];
+
+    FILE * fp = fopen("/tmp/uvgtorrent_test_short", "wb");
+    uint8_t data[100];
+    memset(data, 0xEF, sizeof(data));
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+
+    // 50 of the 100 queued bytes are in the file
+    int fd = open("/tmp/uvgtorrent_test_short", O_RDONLY);
+    assert_int_equal(buffered_socket_write_file(s, fd, 50, 100, 0), 100);
+    close(fd);
+
+    s->writable = 1;
+    assert_int_equal(buffered_socket_network_write(s), -1);
+    assert_int_equal(s->write_buffer_head->data_sent, 50);
+
+    test_buffered_socket_free(s);
+    close(fds[0]);
+    close(fds[1]);
+    unlink("/tmp/uvgtorrent_test_short");
+}
+
+// test the read buffer stops growing at it's cap, and reading stops with readable still set once it's full
+static void test_buffered_socket_read_cap(void **state) {
+    (void) state;
+
+    struct BufferedSocket * s = test_buffered_socket_new();
+    s->readable = 1;
+
+    size_t chunk_size = BUFFERED_SOCKET_READ_MIN_FREE;
+    uint8_t * network_data = malloc(chunk_size);
+    memset(network_data, 0x5A, chunk_size);
+
+    struct READ_WRITE_MOCK_VALUED r;
+    r.value = network_data;
+    r.count = (int) chunk_size;
+    for (size_t i = 0; i < BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY / chunk_size; i++) {
+        will_return(__wrap_read, &r);
+        assert_int_equal(buffered_socket_network_read(s), 1);
+    }
+    assert_int_equal(s->read_buffer_capacity, BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY);
+
+    // full, read isn't called again until some of it is consumed
+    assert_int_equal(buffered_socket_network_read(s), 0);
+    assert_int_equal(s->readable, 1);
+    assert_int_equal(s->hungup, 0);
+
+    assert_int_equal(buffered_socket_read(s, network_data, chunk_size), chunk_size);
+    will_return(__wrap_read, &r);
+    assert_int_equal(buffered_socket_network_read(s), 1);
+    assert_int_equal(s->read_buffer_capacity, BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY);
+    assert_int_equal(s->read_buffer_size, BUFFERED_SOCKET_READ_BUFFER_MAX_CAPACITY);
+
+    free(network_data);
+    test_buffered_socket_free(s);
+}
+
+// test a message can't be cancelled once it's header went out, even though the header's buffer was already freed
+static void test_buffered_socket_cancel_sending(void **state) {
+    (void) state;
+
+    // a real socket with a full send buffer, so sendfile gets EAGAIN
+    int fds[2];
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    struct BufferedSocket * s = test_buffered_socket_new();
+    assert_int_equal(buffered_socket_set_socket_fd(s, fds[0]), EXIT_SUCCESS);
+    uint8_t filler[4096];
+    memset(filler, 0x00, sizeof(filler));
+    while (send(fds[0], filler, sizeof(filler), MSG_DONTWAIT) > 0);
+
+    FILE * fp = fopen("/tmp/uvgtorrent_test_cancel", "wb");
+    uint8_t block[16384];
+    memset(block, 0xEF, sizeof(block));
+    fwrite(block, 1, sizeof(block), fp);
+    fclose(fp);
+
+    // a PIECE message: the header from memory, the block from the file, both tagged
+    uint8_t header[13];
+    memset(header, 0xCD, sizeof(header));
+    int fd = open("/tmp/uvgtorrent_test_cancel", O_RDONLY);
+    buffered_socket_write_tagged(s, header, sizeof(header), 7);
+    assert_int_equal(buffered_socket_write_file(s, fd, 0, sizeof(block), 7), sizeof(block));
+    close(fd);
+
+    // the header is written whole, then the socket is full
+    struct READ_WRITE_MOCK_VALUED w;
+    w.value = NULL;
+    w.count = 0;
+    will_return(__wrap_writev, &w);
+    s->writable = 1;
+    assert_int_equal(buffered_socket_network_write(s), 1);
+    assert_int_equal(s->writable, 0);
+    assert_int_equal(s->write_buffer_head->fd != -1, 1);
+    assert_int_equal(s->write_buffer_head->data_sent, 0);
+
+    // dropping the block now would leave the header without it
+    assert_int_equal(buffered_socket_cancel(s, 7), 0);
+    assert_non_null(s->write_buffer_head);
+
+    // once the block went out too, the tag can be used again
+    uint8_t sink[4096];
+    while (recv(fds[1], sink, sizeof(sink), MSG_DONTWAIT) > 0);
+    s->writable = 1;
+    assert_int_equal(buffered_socket_network_write(s), 1);
+    assert_null(s->write_buffer_head);
+    assert_int_equal(s->sending_tag, 0);
+
+    test_buffered_socket_free(s);
+    close(fds[0]);
+    close(fds[1]);
+    unlink("/tmp/uvgtorrent_test_cancel");
+}
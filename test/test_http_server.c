@@ -0,0 +1,98 @@
+#include "http_server/http_server.h"
+#include "torrent/torrent_data.h"
+
+// test single byte ranges are resolved against the file size, and ones that can't be served are refused
+static void test_http_server_parse_range(void **state) {
+    (void) state;
+
+    uint64_t begin = 0;
+    uint64_t end = 0;
+
+    assert_int_equal(http_server_parse_range(" bytes=0-499", 1000, &begin, &end), EXIT_SUCCESS);
+    assert_int_equal(begin, 0);
+    assert_int_equal(end, 500);
+
+    assert_int_equal(http_server_parse_range("bytes=500-\r\nHost: localhost\r\n", 1000, &begin, &end), EXIT_SUCCESS);
+    assert_int_equal(begin, 500);
+    assert_int_equal(end, 1000);
+
+    // the last n bytes, and ranges running past the end of the file are cut short
+    assert_int_equal(http_server_parse_range("bytes=-100", 1000, &begin, &end), EXIT_SUCCESS);
+    assert_int_equal(begin, 900);
+    assert_int_equal(end, 1000);
+    assert_int_equal(http_server_parse_range("bytes=900-5000", 1000, &begin, &end), EXIT_SUCCESS);
+    assert_int_equal(end, 1000);
+
+    assert_int_equal(http_server_parse_range("bytes=1000-", 1000, &begin, &end), EXIT_FAILURE);
+    assert_int_equal(http_server_parse_range("bytes=5-1", 1000, &begin, &end), EXIT_FAILURE);
+    assert_int_equal(http_server_parse_range("bytes=0-1,5-6", 1000, &begin, &end), EXIT_FAILURE);
+    assert_int_equal(http_server_parse_range("lines=0-1", 1000, &begin, &end), EXIT_FAILURE);
+}
+
+// test requests are answered with the right status, and file ranges map to the right torrent data
+static void test_http_server_handle_request(void **state) {
+    (void) state;
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_http_a", piece_size);
+    torrent_data_add_file(td, "uvgtorrent_test_http_b", piece_size * 2);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+
+    struct HttpServer s = {
+            .port = 0,
+            .sockfd = -1,
+            .epoll_fd = -1,
+            .torrent_data = td,
+            .client_count = 0
+    };
+    struct HttpClient c;
+    memset(&c, 0x00, sizeof(c));
+    c.fd = -1;
+
+    // nothing to serve until we have the metadata
+    strcpy(c.request, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 503", 12);
+
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 3), EXIT_SUCCESS);
+
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 200", 12);
+    assert_non_null(strstr(c.response, "<a href=\"/1/uvgtorrent_test_http_b\">"));
+    assert_int_equal(c.keep_alive, 1);
+
+    // the second file starts after the first one
+    strcpy(c.request, "GET /1/uvgtorrent_test_http_b HTTP/1.1\r\nRange: bytes=10-19\r\nConnection: close\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 206", 12);
+    assert_non_null(strstr(c.response, "Content-Length: 10\r\n"));
+    assert_non_null(strstr(c.response, "Content-Range: bytes 10-19/262144\r\n"));
+    assert_int_equal(c.offset, piece_size + 10);
+    assert_int_equal(c.end, piece_size + 20);
+    assert_int_equal(c.keep_alive, 0);
+
+    // a head request has no body
+    strcpy(c.request, "HEAD /0 HTTP/1.1\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_non_null(strstr(c.response, "Content-Length: 131072\r\n"));
+    assert_int_equal(c.offset, c.end);
+
+    strcpy(c.request, "GET /0 HTTP/1.1\r\nRange: bytes=131072-\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 416", 12);
+
+    strcpy(c.request, "GET /2 HTTP/1.1\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 404", 12);
+
+    strcpy(c.request, "POST /0 HTTP/1.1\r\n\r\n");
+    assert_int_equal(http_server_handle_request(&s, &c), EXIT_SUCCESS);
+    assert_memory_equal(c.response, "HTTP/1.1 405", 12);
+
+    free(c.response);
+    torrent_data_free(td);
+}
@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "message_ring/message_ring.h"
+
+// test messages come out in order and in batches, and a full ring refuses more
+static void test_message_ring_push_pop(void **state) {
+    (void) state;
+
+    struct MessageRing * r = message_ring_new(8);
+    assert_non_null(r);
+    assert_null(message_ring_pop(r));
+
+    int values[8];
+    void * messages[8];
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(message_ring_is_congested(r), i >= 6);
+        assert_int_equal(message_ring_push(r, &values[i]), EXIT_SUCCESS);
+    }
+    assert_int_equal(message_ring_get_count(r), 8);
+    assert_int_equal(message_ring_is_congested(r), 1);
+
+    // the producer is turned away straight away, and the ring remembers until it's caught up
+    assert_int_equal(message_ring_push(r, &values[0]), EXIT_FAILURE);
+    assert_int_equal(message_ring_prepare_wait(r), 1);
+    assert_int_equal(message_ring_reset_full(r), 0);
+
+    assert_ptr_equal(message_ring_pop(r), &values[0]);
+    assert_int_equal(message_ring_pop_batch(r, messages, 3), 3);
+    assert_ptr_equal(messages[0], &values[1]);
+    assert_ptr_equal(messages[2], &values[3]);
+    assert_int_equal(message_ring_reset_full(r), 1);
+    assert_int_equal(message_ring_reset_full(r), 0);
+
+    // the ring wraps around
+    assert_int_equal(message_ring_push(r, &values[0]), EXIT_SUCCESS);
+    assert_int_equal(message_ring_pop_batch(r, messages, 8), 5);
+    assert_ptr_equal(messages[3], &values[7]);
+    assert_ptr_equal(messages[4], &values[0]);
+    assert_int_equal(message_ring_get_count(r), 0);
+    assert_int_equal(message_ring_wait(r, 1), 0);
+
+    message_ring_free(r);
+}
+
+static void * test_message_ring_producer(void * arg) {
+    struct MessageRing * r = (struct MessageRing *) arg;
+    static int values[1000];
+    for (int i = 0; i < 1000; i++) {
+        values[i] = i;
+        while (message_ring_push(r, &values[i]) == EXIT_FAILURE) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// test the consumer is woken as messages arrive, and producers retrying a full ring don't lose messages
+static void test_message_ring_wait(void **state) {
+    (void) state;
+
+    struct MessageRing * r = message_ring_new(16);
+    pthread_t producer;
+    pthread_create(&producer, NULL, &test_message_ring_producer, r);
+
+    int received = 0;
+    int in_order = 1;
+    void * messages[4];
+    while (received < 1000 && message_ring_wait(r, 5000) == 1) {
+        size_t count = message_ring_pop_batch(r, messages, 4);
+        for (size_t i = 0; i < count; i++) {
+            in_order &= *(int *) messages[i] == received;
+            received++;
+        }
+    }
+    pthread_join(producer, NULL);
+
+    assert_int_equal(received, 1000);
+    assert_int_equal(in_order, 1);
+
+    message_ring_free(r);
+}
+
+// test with a wake eventfd set, only the first push after the consumer prepares to wait writes to it
+static void test_message_ring_wake_fd(void **state) {
+    (void) state;
+
+    struct MessageRing * r = message_ring_new(8);
+    int wake_fd = eventfd(0, EFD_NONBLOCK);
+    message_ring_set_wake_fd(r, wake_fd);
+
+    int values[3];
+    eventfd_t wakeups = 0;
+    assert_int_equal(message_ring_push(r, &values[0]), EXIT_SUCCESS);
+    assert_int_equal(eventfd_read(wake_fd, &wakeups), -1);
+
+    // there's already a message, so there's no need to wait
+    assert_int_equal(message_ring_prepare_wait(r), 1);
+    message_ring_pop(r);
+
+    assert_int_equal(message_ring_prepare_wait(r), 0);
+    assert_int_equal(message_ring_push(r, &values[1]), EXIT_SUCCESS);
+    assert_int_equal(message_ring_push(r, &values[2]), EXIT_SUCCESS);
+    assert_int_equal(eventfd_read(wake_fd, &wakeups), 0);
+    assert_int_equal(wakeups, 1);
+
+    close(wake_fd);
+    message_ring_free(r);
+}
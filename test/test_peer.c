@@ -0,0 +1,78 @@
+#include "peer/peer.h"
+#include "peer/peer_messages.h"
+
+// test the request depth covers a round trip plus the queue time of data, within the bounds
+static void test_peer_request_depth(void **state) {
+    (void) state;
+
+    size_t chunk_size = 16384;
+
+    // nothing known about the peer yet
+    assert_int_equal(peer_request_depth(0.00, 0, chunk_size), PEER_REQUEST_DEPTH_MIN);
+
+    // 1 MiB/s over 100ms is 1.1 MiB in flight, 70.4 chunks
+    assert_int_equal(peer_request_depth(1024 * 1024, 100, chunk_size), 71);
+
+    // a longer round trip needs more requests outstanding for the same rate
+    assert_true(peer_request_depth(1024 * 1024, 300, chunk_size) > peer_request_depth(1024 * 1024, 100, chunk_size));
+
+    // very fast peers are capped
+    assert_int_equal(peer_request_depth(100 * 1024 * 1024, 200, chunk_size), PEER_REQUEST_DEPTH_MAX);
+}
+
+// test a message the main thread has no room for is held instead of dropped, and reading stops until it's handed over
+static void test_peer_held_message(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    struct Peer * p = peer_new(2130706433, 5000);
+    struct MessageRing * r = message_ring_new(2);
+
+    void * messages[3];
+    for (int i = 0; i < 3; i++) {
+        messages[i] = malloc(8);
+        peer_queue_message(p, r, messages[i]);
+    }
+    assert_ptr_equal(p->held_message, messages[2]);
+    assert_int_equal(peer_should_push_held_message(p), 1);
+    assert_int_equal(peer_should_read_message(p), 0);
+    assert_int_equal(peer_push_held_message(p), EXIT_FAILURE);
+
+    // once there's room it goes in after the others
+    assert_ptr_equal(message_ring_pop(r), messages[0]);
+    assert_int_equal(peer_push_held_message(p), EXIT_SUCCESS);
+    assert_null(p->held_message);
+    assert_ptr_equal(message_ring_pop(r), messages[1]);
+    assert_ptr_equal(message_ring_pop(r), messages[2]);
+
+    for (int i = 0; i < 3; i++) {
+        free(messages[i]);
+    }
+    message_ring_free(r);
+    peer_free(p);
+}
+
+// test a complete torrent still sends it's bitfield, so it keeps seeding after a restart
+static void test_peer_bitfield_complete(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    struct Peer * p = peer_new(2130706433, 5000);
+    p->status = PEER_HANDSHAKE_COMPLETE;
+    struct TorrentData * td = torrent_data_new("/tmp/");
+
+    // not until the pieces on disk are accounted for
+    assert_int_equal(peer_should_send_msg_bitfield(p, td), 0);
+
+    td->ready = 1;
+    td->needed = 0;
+    assert_int_equal(peer_should_send_msg_bitfield(p, td), 1);
+
+    p->msg_bitfield_sent = 1;
+    assert_int_equal(peer_should_send_msg_bitfield(p, td), 0);
+
+    torrent_data_free(td);
+    peer_free(p);
+}
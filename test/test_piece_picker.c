@@ -0,0 +1,231 @@
+#include "piece_picker/piece_picker.h"
+#include "torrent/torrent_data.h"
+
+// test availability is counted per piece, and each policy picks the piece it should
+static void test_piece_picker_policies(void **state) {
+    (void) state;
+
+    struct PiecePicker * pp = piece_picker_new(8, PIECE_PICKER_SEQUENTIAL, 2);
+    assert_non_null(pp);
+
+    struct Bitfield * seeder = bitfield_new(8, 1, 0x00);
+    struct Bitfield * partial = bitfield_new(8, 0, 0x00);
+    bitfield_set_bit(partial, 3, 1);
+    bitfield_set_bit(partial, 5, 1);
+    bitfield_set_bit(partial, 6, 1);
+
+    piece_picker_add_peer(pp, seeder);
+    piece_picker_add_peer(pp, partial);
+    piece_picker_add_piece(pp, 6);
+    assert_int_equal(piece_picker_get_availability(pp, 0), 1);
+    assert_int_equal(piece_picker_get_availability(pp, 5), 2);
+    assert_int_equal(piece_picker_get_availability(pp, 6), 3);
+
+    // sequential picks the first open piece the peer has
+    assert_int_equal(piece_picker_pick(pp, seeder, 1), 0);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 3);
+    piece_picker_set_open(pp, 0, 0);
+    assert_int_equal(piece_picker_pick(pp, seeder, 1), 1);
+
+    // from the cursor onwards, wrapping around to the start
+    piece_picker_set_cursor(pp, 7);
+    assert_int_equal(piece_picker_pick(pp, seeder, 1), 7);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 3);
+
+    // rarest first prefers pieces the fewest peers have
+    piece_picker_set_policy(pp, PIECE_PICKER_RAREST_FIRST, 0);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 3);
+    piece_picker_set_open(pp, 3, 0);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 5);
+    piece_picker_set_open(pp, 5, 0);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 6);
+    piece_picker_set_open(pp, 6, 0);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), -1);
+
+    // a reopened piece can be picked again
+    piece_picker_set_open(pp, 5, 1);
+    assert_int_equal(piece_picker_pick(pp, partial, 1), 5);
+
+    // inside the window pieces go in order, past it the rarest goes first
+    piece_picker_set_policy(pp, PIECE_PICKER_SEQUENTIAL_WINDOW, 2);
+    piece_picker_set_cursor(pp, 0);
+    piece_picker_add_piece(pp, 1);
+    piece_picker_add_piece(pp, 1);
+    assert_int_equal(piece_picker_pick(pp, seeder, 1), 1);
+    piece_picker_set_open(pp, 1, 0);
+    assert_int_equal(piece_picker_pick(pp, seeder, 1), 2);
+    piece_picker_set_open(pp, 2, 0);
+
+    struct Bitfield * sparse = bitfield_new(8, 0, 0x00);
+    bitfield_set_bit(sparse, 5, 1);
+    bitfield_set_bit(sparse, 7, 1);
+    assert_int_equal(piece_picker_pick(pp, sparse, 1), 5);
+    piece_picker_set_policy(pp, PIECE_PICKER_SEQUENTIAL_WINDOW, 1);
+    assert_int_equal(piece_picker_pick(pp, sparse, 1), 7);
+    bitfield_free(sparse);
+
+    // peers going away take their pieces with them
+    piece_picker_remove_peer(pp, partial);
+    piece_picker_remove_peer(pp, seeder);
+    assert_int_equal(piece_picker_get_availability(pp, 5), 0);
+    assert_int_equal(piece_picker_get_availability(pp, 6), 1);
+
+    bitfield_free(seeder);
+    bitfield_free(partial);
+    piece_picker_free(pp);
+}
+
+// test chunks are claimed from the picked pieces, and pieces come back once their claims are released
+static void test_torrent_data_claim_piece_chunks(void **state) {
+    (void) state;
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_picker", piece_size * 4);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_piece_picker(td, PIECE_PICKER_RAREST_FIRST, 0);
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 4), EXIT_SUCCESS);
+
+    struct Bitfield * seeder = bitfield_new(4, 1, 0x00);
+    struct Bitfield * partial = bitfield_new(4, 0, 0x00);
+    bitfield_set_bit(partial, 2, 1);
+    assert_int_equal(torrent_data_add_peer_pieces(td, seeder), EXIT_SUCCESS);
+    assert_int_equal(torrent_data_add_peer_pieces(td, partial), EXIT_SUCCESS);
+
+    // piece 2 is the only one with more than one peer, so it goes last
+    int chunks[12];
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, NULL, 1, 10, 12, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 0);
+    assert_int_equal(chunks[7], 7);
+    assert_int_equal(chunks[8], 8);
+    assert_int_equal(chunks[11], 11);
+
+    // all the partial peer has is piece 2
+    assert_int_equal(torrent_data_claim_piece_chunks(td, partial, NULL, 1, 10, 12, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 16);
+    assert_int_equal(chunks[7], 23);
+    assert_int_equal(torrent_data_claim_piece_chunks(td, partial, NULL, 1, 10, 12, &chunks[0]), EXIT_FAILURE);
+
+    // the rest of piece 1 is handed out before moving on
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, NULL, 1, 10, 12, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 12);
+    assert_int_equal(chunks[4], 24);
+
+    // expired claims open their pieces again
+    for (int i = 0; i < td->claim_count; i++) {
+        td->claims[td->claim_heap[i]].deadline = 0;
+    }
+    torrent_data_release_expired_claims(td);
+    assert_int_equal(torrent_data_claim_piece_chunks(td, partial, NULL, 1, 10, 1, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 16);
+
+    torrent_data_remove_peer_pieces(td, seeder);
+    torrent_data_remove_peer_pieces(td, partial);
+    assert_int_equal(piece_picker_get_availability(td->picker, 2), 0);
+
+    bitfield_free(seeder);
+    bitfield_free(partial);
+    torrent_data_free(td);
+}
+
+// test once everything is claimed, peers are given chunks claimed by others, and completing one bumps the cancel epoch
+static void test_torrent_data_endgame(void **state) {
+    (void) state;
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_endgame", piece_size * 2);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 2), EXIT_SUCCESS);
+    assert_int_equal(td->unclaimed_chunks, 16);
+
+    struct Bitfield * seeder = bitfield_new(2, 1, 0x00);
+    struct Bitfield * requested[4];
+    for (int i = 0; i < 4; i++) {
+        requested[i] = bitfield_new(16, 0, 0x00);
+    }
+
+    // the first peer claims everything
+    int chunks[16];
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested[0], 1, 10, 16, &chunks[0]), EXIT_SUCCESS);
+    for (int i = 0; i < 16; i++) {
+        bitfield_set_bit(requested[0], chunks[i], 1);
+    }
+    assert_int_equal(td->unclaimed_chunks, 0);
+    assert_int_equal(td->duplicating, 0);
+
+    // it isn't given what it already requested, the others get the same chunks until enough peers have them
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested[0], 1, 10, 16, &chunks[0]), EXIT_FAILURE);
+    for (int peer = 1; peer < TORRENT_DATA_ENDGAME_REQUESTS; peer++) {
+        memset(chunks, 0xFF, sizeof(chunks));
+        assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested[peer], 1, 10, 16, &chunks[0]), EXIT_SUCCESS);
+        for (int i = 0; i < 16; i++) {
+            assert_int_not_equal(chunks[i], -1);
+            bitfield_set_bit(requested[peer], chunks[i], 1);
+        }
+    }
+    assert_int_equal(td->duplicating, 1);
+    assert_int_equal(td->duplicates[5], TORRENT_DATA_ENDGAME_REQUESTS - 1);
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested[3], 1, 10, 16, &chunks[0]), EXIT_FAILURE);
+
+    // the first copy of a chunk to arrive tells the other peers to cancel
+    int cancel_epoch = td->cancel_epoch;
+    uint8_t * data = malloc(chunk_size);
+    memset(data, 0x00, chunk_size);
+    torrent_data_write_chunk(td, 5, data, chunk_size);
+    assert_int_not_equal(td->cancel_epoch, cancel_epoch);
+    assert_int_equal(torrent_data_is_chunk_complete(td, 5), 1);
+    assert_int_equal(torrent_data_is_chunk_complete(td, 6), 0);
+    free(data);
+
+    // expired claims are requested from one peer again
+    for (int i = 0; i < td->claim_count; i++) {
+        td->claims[td->claim_heap[i]].deadline = 0;
+    }
+    torrent_data_release_expired_claims(td);
+    assert_int_equal(td->unclaimed_chunks, 15);
+    assert_int_equal(td->duplicates[6], 0);
+
+    for (int i = 0; i < 4; i++) {
+        bitfield_free(requested[i]);
+    }
+    bitfield_free(seeder);
+    torrent_data_free(td);
+}
+
+// test claims expire in deadline order, and only the expired ones are released
+static void test_torrent_data_claim_expiry(void **state) {
+    (void) state;
+
+    size_t chunk_size = 16384;
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_claim_expiry", chunk_size * 8);
+    torrent_data_set_piece_size(td, chunk_size * 8);
+    torrent_data_set_chunk_size(td, chunk_size);
+    assert_int_equal(torrent_data_set_data_size(td, chunk_size * 8), EXIT_SUCCESS);
+
+    struct Bitfield * interested = bitfield_new(8, 1, 0x00);
+    int chunks[8];
+    assert_int_equal(torrent_data_claim_chunk(td, interested, 60, 3, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(torrent_data_claim_chunk(td, interested, -10, 2, &chunks[3]), EXIT_SUCCESS);
+    assert_int_equal(torrent_data_claim_chunk(td, interested, -20, 1, &chunks[5]), EXIT_SUCCESS);
+    assert_int_equal(td->claim_count, 6);
+    assert_int_equal(td->claim_heap[0], chunks[5]);
+
+    torrent_data_release_expired_claims(td);
+    assert_int_equal(td->claim_count, 3);
+    assert_int_equal(td->unclaimed_chunks, 5);
+    assert_int_equal(bitfield_get_bit(td->claimed, chunks[0]), 1);
+    assert_int_equal(bitfield_get_bit(td->claimed, chunks[3]), 0);
+    assert_int_equal(td->claims[chunks[5]].heap_index, -1);
+
+    bitfield_free(interested);
+    torrent_data_free(td);
+}
@@ -0,0 +1,51 @@
+#include "piece_pool/piece_pool.h"
+
+// test buffers are looked up by piece id, limited by the budget, and reused once released
+static void test_piece_pool_acquire_release(void **state) {
+    (void) state;
+
+    struct PiecePool * pp = piece_pool_new(10, 1024, 2048);
+    assert_non_null(pp);
+    assert_int_equal(pp->buffer_count, 2);
+
+    assert_null(piece_pool_get(pp, 3));
+
+    uint8_t * a = piece_pool_acquire(pp, 3);
+    uint8_t * b = piece_pool_acquire(pp, 7);
+    assert_non_null(a);
+    assert_non_null(b);
+    assert_ptr_not_equal(a, b);
+    assert_int_equal(pp->in_flight, 2);
+
+    // pieces in flight get their own buffer back
+    assert_ptr_equal(piece_pool_acquire(pp, 3), a);
+    assert_ptr_equal(piece_pool_get(pp, 7), b);
+
+    // the budget is used up
+    assert_null(piece_pool_acquire(pp, 5));
+    assert_null(piece_pool_acquire(pp, 10));
+
+    // 3 was acquired last, so 7 is the least recently used
+    assert_int_equal(piece_pool_least_recently_used(pp), 7);
+    piece_pool_acquire(pp, 7);
+    assert_int_equal(piece_pool_least_recently_used(pp), 3);
+
+    piece_pool_release(pp, 3);
+    assert_null(piece_pool_get(pp, 3));
+    assert_int_equal(piece_pool_least_recently_used(pp), 7);
+    assert_ptr_equal(piece_pool_acquire(pp, 5), a);
+    assert_int_equal(pp->allocated_count, 2);
+
+    piece_pool_release(pp, 5);
+    piece_pool_release(pp, 7);
+    assert_int_equal(piece_pool_least_recently_used(pp), -1);
+
+    piece_pool_free(pp);
+
+    // the budget is a hard limit, a budget smaller than a piece gets no buffers
+    pp = piece_pool_new(10, 1024, 1000);
+    assert_int_equal(pp->buffer_count, 0);
+    assert_null(piece_pool_acquire(pp, 0));
+    assert_int_equal(piece_pool_least_recently_used(pp), -1);
+    piece_pool_free(pp);
+}
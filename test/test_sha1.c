@@ -0,0 +1,60 @@
+#include "sha1/sha1.h"
+
+static const char * test_sha1_message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static const unsigned char test_sha1_digest[20] = {
+        0x84, 0x98, 0x3E, 0x44, 0x1C, 0x3B, 0xD2, 0x6E, 0xBA, 0xAE,
+        0x4A, 0xA1, 0xF9, 0x51, 0x29, 0xE5, 0xE5, 0x46, 0x70, 0xF1
+};
+static const unsigned char test_sha1_million_a_digest[20] = {
+        0x34, 0xAA, 0x97, 0x3C, 0xD4, 0xC4, 0xDA, 0xA4, 0xF6, 0x1E,
+        0xEB, 0x2B, 0xDB, 0xAD, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6F
+};
+
+/* every implementation the cpu supports has to give the FIPS 180-1 digests, and the same digests from the
+   single stream and multi buffer paths */
+static void test_sha1_implementations(void **state) {
+    size_t size = 1000000;
+    unsigned char * a = malloc(size);
+    memset(a, 'a', size);
+
+    for (int impl = SHA1_IMPL_AUTO; impl <= SHA1_IMPL_AVX2; impl++) {
+        if (SHA1UseImplementation(impl) == EXIT_FAILURE) {
+            continue;
+        }
+
+        SHA1_CTX ctx;
+        unsigned char digest[20];
+
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, (const unsigned char *) test_sha1_message, strlen(test_sha1_message));
+        SHA1Final(digest, &ctx);
+        assert_memory_equal(digest, test_sha1_digest, 20);
+
+        /* odd sized updates so blocks straddle the buffered tail */
+        SHA1Init(&ctx);
+        for (size_t i = 0; i < size; i += 999) {
+            SHA1Update(&ctx, a + i, (uint32_t) (size - i < 999 ? size - i : 999));
+        }
+        SHA1Final(digest, &ctx);
+        assert_memory_equal(digest, test_sha1_million_a_digest, 20);
+
+        /* 9 messages, so one group of 8 lanes plus a straggler */
+        SHA1_CTX contexts[9];
+        SHA1_CTX * context_ptrs[9];
+        const unsigned char * data[9];
+        for (int i = 0; i < 9; i++) {
+            SHA1Init(&contexts[i]);
+            context_ptrs[i] = &contexts[i];
+            data[i] = a;
+        }
+        SHA1MultiUpdate(context_ptrs, data, 500000, 9);
+        SHA1MultiUpdate(context_ptrs, data, 500000, 9);
+        for (int i = 0; i < 9; i++) {
+            SHA1Final(digest, &contexts[i]);
+            assert_memory_equal(digest, test_sha1_million_a_digest, 20);
+        }
+    }
+
+    free(a);
+    SHA1UseImplementation(SHA1_IMPL_AUTO);
+}
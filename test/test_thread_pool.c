@@ -0,0 +1,106 @@
+#include <unistd.h>
+#include "thread_pool/thread_pool.h"
+
+// test the injection queue is first in first out and refuses jobs once it's full
+static void test_job_queue_push_pop(void **state) {
+    (void) state;
+
+    struct JobQueue * q = job_queue_new(3);
+    assert_non_null(q);
+    assert_null(job_queue_pop(q));
+
+    struct Job * jobs[4] = {(struct Job *) 0x10, (struct Job *) 0x20, (struct Job *) 0x30, (struct Job *) 0x40};
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(job_queue_push(q, jobs[i]), EXIT_SUCCESS);
+    }
+    assert_int_equal(job_queue_push(q, jobs[0]), EXIT_FAILURE);
+
+    // the ring wraps around
+    assert_ptr_equal(job_queue_pop(q), jobs[0]);
+    assert_int_equal(job_queue_push(q, jobs[0]), EXIT_SUCCESS);
+    assert_ptr_equal(job_queue_pop(q), jobs[1]);
+    assert_ptr_equal(job_queue_pop(q), jobs[2]);
+    assert_ptr_equal(job_queue_pop(q), jobs[3]);
+    assert_ptr_equal(job_queue_pop(q), jobs[0]);
+    assert_null(job_queue_pop(q));
+
+    job_queue_free(q);
+}
+
+// test the owner pops the newest job while thieves take the oldest
+static void test_job_deque_pop_steal(void **state) {
+    (void) state;
+
+    struct JobDeque * d = aligned_alloc(_Alignof(struct JobDeque), sizeof(struct JobDeque));
+    job_deque_init(d);
+    assert_null(job_deque_pop(d));
+    assert_null(job_deque_steal(d));
+
+    for (intptr_t i = 1; i <= JOB_DEQUE_SIZE; i++) {
+        assert_int_equal(job_deque_push(d, (struct Job *) i), EXIT_SUCCESS);
+    }
+    assert_int_equal(job_deque_push(d, (struct Job *) 1), EXIT_FAILURE);
+
+    assert_ptr_equal(job_deque_pop(d), (struct Job *) JOB_DEQUE_SIZE);
+    assert_ptr_equal(job_deque_steal(d), (struct Job *) 1);
+    assert_ptr_equal(job_deque_steal(d), (struct Job *) 2);
+    assert_ptr_equal(job_deque_pop(d), (struct Job *) (JOB_DEQUE_SIZE - 1));
+
+    for (int i = 0; i < JOB_DEQUE_SIZE - 4; i++) {
+        assert_non_null(job_deque_pop(d));
+    }
+    assert_null(job_deque_pop(d));
+    assert_null(job_deque_steal(d));
+
+    free(d);
+}
+
+static int test_thread_pool_count(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+    struct JobArg counter_arg = va_arg(args, struct JobArg);
+    va_end(args);
+
+    atomic_fetch_add((_Atomic int *) counter_arg.arg, 1);
+    return EXIT_SUCCESS;
+}
+
+static int test_thread_pool_spawn(_Atomic int * cancel_flag, ...) {
+    va_list args;
+    va_start(args, cancel_flag);
+    struct JobArg pool_arg = va_arg(args, struct JobArg);
+    struct JobArg counter_arg = va_arg(args, struct JobArg);
+    va_end(args);
+
+    for (int i = 0; i < 100; i++) {
+        struct Job * j = job_new(&test_thread_pool_count, 1, &counter_arg);
+        thread_pool_add_job((struct ThreadPool *) pool_arg.arg, j);
+    }
+    return EXIT_SUCCESS;
+}
+
+// test every job runs, whether it's added from outside the pool or by another job
+static void test_thread_pool_run_jobs(void **state) {
+    (void) state;
+
+    _Atomic int counter = 0;
+    struct ThreadPool * tp = thread_pool_new(4);
+    assert_non_null(tp);
+
+    struct JobArg args[2] = {
+            {.arg = (void *) tp, .mutex = NULL},
+            {.arg = (void *) &counter, .mutex = NULL}
+    };
+    for (int i = 0; i < 10; i++) {
+        assert_int_equal(thread_pool_add_job(tp, job_new(&test_thread_pool_spawn, 2, args)), EXIT_SUCCESS);
+        assert_int_equal(thread_pool_add_job(tp, job_new(&test_thread_pool_count, 1, &args[1])), EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < 5000 && counter < 1010; i++) {
+        usleep(1000);
+    }
+    assert_int_equal(counter, 1010);
+    assert_int_equal(tp->thread_count, 4);
+
+    thread_pool_free(tp);
+}
@@ -0,0 +1,109 @@
+#include "deadline/timer_wheel.h"
+
+struct TestTimer {
+    struct Timer timer;
+    int64_t fired_at; // time the wheel was advanced to when the timer fired, -1 until it does
+    struct TimerWheel * wheel;
+};
+
+static void test_timer_wheel_fire(void * arg, void * context) {
+    struct TestTimer * t = (struct TestTimer *) arg;
+    t->fired_at = *(int64_t *) context;
+}
+
+static void test_timer_wheel_init(struct TestTimer * t) {
+    timer_init(&t->timer, &test_timer_wheel_fire, (void *) t);
+    t->fired_at = -1;
+}
+
+/**
+ * @brief advance the wheel a tick at a time up to until, so fired_at is the first tick at or after the deadline
+ */
+static int test_timer_wheel_advance(struct TimerWheel * w, int64_t * current_time, int64_t until) {
+    int fired = 0;
+    while (*current_time < until) {
+        *current_time += TIMER_WHEEL_TICK_MS;
+        fired += timer_wheel_advance(w, *current_time, (void *) current_time);
+    }
+    return fired;
+}
+
+// test timers at every level fire on their deadline and not before, and cancelled timers don't fire
+static void test_timer_wheel_schedule(void **state) {
+    (void) state;
+
+    int64_t current_time = 1000;
+    struct TimerWheel * w = timer_wheel_new(current_time);
+    assert_non_null(w);
+    assert_int_equal(timer_wheel_next_deadline(w), 0);
+
+    // first level, second level, third level, and past the top level
+    int64_t deadlines[5] = {1000 + 50, 1000 + 120 * 1000, 1000 + 5 * 60 * 1000, 1000 + 50 * 60 * 60 * 1000, 1000 + 30 * 1000};
+    struct TestTimer timers[5];
+    for (int i = 0; i < 5; i++) {
+        test_timer_wheel_init(&timers[i]);
+        timer_wheel_schedule(w, &timers[i].timer, deadlines[i]);
+        assert_int_equal(timer_is_scheduled(&timers[i].timer), 1);
+    }
+    assert_int_equal(timer_wheel_next_deadline(w), deadlines[0]);
+
+    // cancelling takes it out, moving it changes when it fires
+    timer_wheel_cancel(w, &timers[4].timer);
+    assert_int_equal(timer_is_scheduled(&timers[4].timer), 0);
+    timer_wheel_schedule(w, &timers[1].timer, 1000 + 125 * 1000);
+    deadlines[1] = 1000 + 125 * 1000;
+
+    assert_int_equal(test_timer_wheel_advance(w, &current_time, deadlines[0] - 10), 0);
+    assert_int_equal(test_timer_wheel_advance(w, &current_time, deadlines[0]), 1);
+    assert_int_equal(timers[0].fired_at, deadlines[0]);
+
+    // timers that still have to be cascaded down count too
+    assert_int_equal(timer_wheel_next_deadline(w), deadlines[1]);
+
+    assert_int_equal(test_timer_wheel_advance(w, &current_time, deadlines[2]), 2);
+
+    // it's a long way to the last one, skip most of it
+    current_time = deadlines[3] - 10 * TIMER_WHEEL_TICK_MS;
+    assert_int_equal(timer_wheel_advance(w, current_time, (void *) &current_time), 0);
+    assert_int_equal(test_timer_wheel_advance(w, &current_time, deadlines[3]), 1);
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(timers[i].fired_at, deadlines[i]);
+        assert_int_equal(timer_is_scheduled(&timers[i].timer), 0);
+    }
+    assert_int_equal(timers[4].fired_at, -1);
+    assert_int_equal(timer_wheel_next_deadline(w), 0);
+
+    // deadlines in the past fire on the next advance, a long gap is caught up on in one go
+    timer_wheel_schedule(w, &timers[0].timer, 0);
+    current_time += 60 * 1000;
+    assert_int_equal(timer_wheel_advance(w, current_time, (void *) &current_time), 1);
+
+    timer_wheel_free(w);
+}
+
+static void test_timer_wheel_reschedule_fire(void * arg, void * context) {
+    struct TestTimer * t = (struct TestTimer *) arg;
+    t->fired_at = *(int64_t *) context;
+    timer_wheel_schedule(t->wheel, &t->timer, t->fired_at + 100);
+}
+
+// test a timer can schedule itself again from it's callback
+static void test_timer_wheel_reschedule(void **state) {
+    (void) state;
+
+    int64_t current_time = 0;
+    struct TimerWheel * w = timer_wheel_new(current_time);
+
+    struct TestTimer t;
+    timer_init(&t.timer, &test_timer_wheel_reschedule_fire, (void *) &t);
+    t.fired_at = -1;
+    t.wheel = w;
+    timer_wheel_schedule(w, &t.timer, 100);
+
+    assert_int_equal(test_timer_wheel_advance(w, &current_time, 1000), 10);
+    assert_int_equal(t.fired_at, 1000);
+    assert_int_equal(timer_is_scheduled(&t.timer), 1);
+    assert_int_equal(timer_wheel_next_deadline(w), 1100);
+
+    timer_wheel_free(w);
+}
@@ -52,7 +52,7 @@ static void test_run_trackers_success(void **state) {
     torrent_run_trackers(t, tp, NULL);
 
     /* check that 4 tracker run jobs were added to thread pool */
-    assert_int_equal(queue_get_count(tp->job_queue), 5);
+    assert_int_equal(job_queue_get_count(tp->job_queue), 5);
 
     thread_pool_free(tp);
     torrent_free(t);
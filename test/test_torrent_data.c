@@ -0,0 +1,631 @@
+#include "torrent/torrent_data.h"
+#include "sha1/sha1.h"
+#include "thread_pool/thread_pool.h"
+#include "deadline/deadline.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static void test_torrent_data_create_file(char * path, size_t size) {
+    FILE * fp = fopen(path, "wb");
+    for (size_t i = 0; i < size; i++) {
+        fputc((int) i, fp);
+    }
+    fclose(fp);
+}
+
+// test data is split into the right per file segments
+static void test_torrent_data_get_file_segments(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_a", 10);
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_b", 5);
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_c", 20);
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", 10);
+    torrent_data_add_file(td, "uvgtorrent_test_b", 5);
+    torrent_data_add_file(td, "uvgtorrent_test_c", 20);
+
+    struct TorrentDataFileSegment segments[4];
+    int segment_count = 0;
+
+    // spans all three files
+    assert_int_equal(torrent_data_get_file_segments(td, 8, 10, segments, 4, &segment_count), EXIT_SUCCESS);
+    assert_int_equal(segment_count, 3);
+    assert_int_equal(segments[0].file_offset, 8);
+    assert_int_equal(segments[0].length, 2);
+    assert_int_equal(segments[1].file_offset, 0);
+    assert_int_equal(segments[1].length, 5);
+    assert_int_equal(segments[2].file_offset, 0);
+    assert_int_equal(segments[2].length, 3);
+    assert_int_not_equal(segments[0].fd, segments[1].fd);
+    torrent_data_release_file_segments(td, segments, segment_count);
+
+    // ends exactly on a file boundary
+    assert_int_equal(torrent_data_get_file_segments(td, 10, 5, segments, 4, &segment_count), EXIT_SUCCESS);
+    assert_int_equal(segment_count, 1);
+    assert_int_equal(segments[0].file_offset, 0);
+    assert_int_equal(segments[0].length, 5);
+
+    uint8_t byte = 0;
+    assert_int_equal(pread(segments[0].fd, &byte, 1, 4), 1);
+    assert_int_equal(byte, 4);
+    torrent_data_release_file_segments(td, segments, segment_count);
+
+    // too many segments, and beyond the end of the data
+    assert_int_equal(torrent_data_get_file_segments(td, 8, 10, segments, 2, &segment_count), EXIT_FAILURE);
+    assert_int_equal(torrent_data_get_file_segments(td, 30, 10, segments, 4, &segment_count), EXIT_FAILURE);
+
+    assert_int_equal(td->open_files, 3);
+    for (struct TorrentDataFileInfo * file = td->files; file != NULL; file = file->next) {
+        assert_int_equal(file->pins, 0);
+    }
+
+    torrent_data_free(td);
+
+    unlink("/tmp/uvgtorrent_test_a");
+    unlink("/tmp/uvgtorrent_test_b");
+    unlink("/tmp/uvgtorrent_test_c");
+}
+
+// test reads across files stay below the open file limit, and leave nothing pinned
+static void test_torrent_data_open_file_limit(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_a", 10);
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_b", 5);
+    test_torrent_data_create_file("/tmp/uvgtorrent_test_c", 20);
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", 10);
+    torrent_data_add_file(td, "uvgtorrent_test_b", 5);
+    torrent_data_add_file(td, "uvgtorrent_test_c", 20);
+    torrent_data_set_max_open_files(td, 2);
+
+    uint8_t buff[35];
+    assert_int_equal(torrent_data_read_data(td, &buff, 0, sizeof(buff)), EXIT_SUCCESS);
+    assert_int_equal(buff[9], 9);
+    assert_int_equal(buff[10], 0);
+    assert_int_equal(buff[14], 4);
+    assert_int_equal(buff[34], 19);
+    assert_true(td->open_files <= 2);
+
+    // the least recently used file was closed
+    assert_int_equal(td->files->fd, -1);
+    assert_ptr_equal(td->lru_head, td->files->next->next);
+
+    // writes land in the right file
+    uint8_t write_buff[4] = {0xAA, 0xBB, 0xCC, 0xDD};
+    assert_int_equal(torrent_data_write_data(td, &write_buff, 8, sizeof(write_buff)), EXIT_SUCCESS);
+    assert_int_equal(torrent_data_read_data(td, &buff, 0, sizeof(buff)), EXIT_SUCCESS);
+    assert_int_equal(buff[8], 0xAA);
+    assert_int_equal(buff[10], 0xCC);
+    assert_int_equal(buff[11], 0xDD);
+    assert_int_equal(buff[12], 2);
+    assert_true(td->open_files <= 2);
+
+    torrent_data_free(td);
+
+    unlink("/tmp/uvgtorrent_test_a");
+    unlink("/tmp/uvgtorrent_test_b");
+    unlink("/tmp/uvgtorrent_test_c");
+}
+
+// test mapped storage writes chunks in place, and a piece failing validation is downloaded again
+static void test_torrent_data_mmap_storage(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_a");
+    unlink("/tmp/uvgtorrent_test_b");
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    uint8_t * data = malloc(piece_size);
+    for (size_t i = 0; i < piece_size; i++) {
+        data[i] = (uint8_t) (i * 31);
+    }
+
+    char hash[20];
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, data, piece_size);
+    SHA1Final((unsigned char *) &hash, &sha);
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_set_storage(td, TORRENT_DATA_STORAGE_MMAP);
+    torrent_data_add_file(td, "uvgtorrent_test_a", 50000);
+    torrent_data_add_file(td, "uvgtorrent_test_b", piece_size - 50000);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hash, sizeof(hash));
+    assert_int_equal(torrent_data_set_data_size(td, piece_size), EXIT_SUCCESS);
+    assert_int_equal(td->storage, TORRENT_DATA_STORAGE_MMAP);
+
+    // first attempt has a corrupted chunk
+    uint8_t * bad_chunk = malloc(chunk_size);
+    memcpy(bad_chunk, data, chunk_size);
+    bad_chunk[0] ^= 0xFF;
+    assert_int_equal(torrent_data_write_chunk(td, 0, bad_chunk, chunk_size), EXIT_FAILURE);
+    for (int i = 1; i < 8; i++) {
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), EXIT_FAILURE);
+    }
+
+    // the piece is up for grabs again
+    assert_int_equal(td->completed_pieces, 0);
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(bitfield_get_bit(td->completed, i), 0);
+        assert_int_equal(bitfield_get_bit(td->claimed, i), 0);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        int expected = i == 7 ? EXIT_SUCCESS : EXIT_FAILURE;
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), expected);
+    }
+    assert_int_equal(td->completed_pieces, 1);
+    assert_int_equal(td->left, 0);
+
+    // no piece buffer was held in memory, the data is already in the files
+    assert_null(td->pieces);
+
+    uint8_t * read_back = malloc(piece_size);
+    assert_int_equal(torrent_data_read_data(td, read_back, 0, piece_size), EXIT_SUCCESS);
+    assert_memory_equal(read_back, data, piece_size);
+
+    torrent_data_free(td);
+
+    FILE * fp = fopen("/tmp/uvgtorrent_test_b", "rb");
+    assert_int_equal(fread(read_back, 1, piece_size - 50000, fp), piece_size - 50000);
+    assert_memory_equal(read_back, data + 50000, piece_size - 50000);
+    fclose(fp);
+
+    free(read_back);
+    free(bad_chunk);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_a");
+    unlink("/tmp/uvgtorrent_test_b");
+}
+
+// test pieces are hashed as contiguous chunks arrive, and out of order chunks wait for the gap to be filled
+static void test_torrent_data_incremental_hash(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_a");
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    uint8_t * data = malloc(piece_size);
+    for (size_t i = 0; i < piece_size; i++) {
+        data[i] = (uint8_t) (i * 13);
+    }
+
+    char hash[20];
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, data, piece_size);
+    SHA1Final((unsigned char *) &hash, &sha);
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", piece_size);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hash, sizeof(hash));
+    assert_int_equal(torrent_data_set_data_size(td, piece_size), EXIT_SUCCESS);
+
+    int order[8] = {0, 1, 3, 2, 6, 4, 5, 7};
+    size_t hashed[8] = {1, 2, 2, 4, 4, 5, 7, 0};
+    for (int i = 0; i < 8; i++) {
+        int chunk = order[i];
+        int expected = i == 7 ? EXIT_SUCCESS : EXIT_FAILURE;
+        assert_int_equal(torrent_data_write_chunk(td, chunk, data + (chunk * chunk_size), chunk_size), expected);
+
+        if (i < 7) {
+            assert_non_null(td->piece_hashes[0]);
+            assert_int_equal(td->piece_hashes[0]->hashed, hashed[i] * chunk_size);
+        }
+    }
+
+    // the hash state is dropped once the piece is validated
+    assert_null(td->piece_hashes[0]);
+    assert_int_equal(td->completed_pieces, 1);
+
+    torrent_data_free(td);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_a");
+}
+
+// test a batch of pieces is validated across lanes and threads, including a short last piece and a corrupt piece
+static void test_torrent_data_validate_pieces(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    int piece_count = 19;
+    size_t piece_size = 4096;
+    size_t data_size = (piece_size * (piece_count - 1)) + 1000;
+    uint8_t * data = malloc(data_size);
+    for (size_t i = 0; i < data_size; i++) {
+        data[i] = (uint8_t) (i * 7);
+    }
+
+    char * hashes = malloc(20 * piece_count);
+    struct PieceInfo piece_infos[19];
+    uint8_t * pieces[19];
+    for (int i = 0; i < piece_count; i++) {
+        piece_infos[i].piece_id = i;
+        piece_infos[i].piece_offset = i * piece_size;
+        piece_infos[i].piece_size = i == piece_count - 1 ? 1000 : piece_size;
+        pieces[i] = data + piece_infos[i].piece_offset;
+
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, pieces[i], piece_infos[i].piece_size);
+        SHA1Final((unsigned char *) hashes + (i * 20), &sha);
+    }
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_set_sha1_hashes(td, hashes, 20 * piece_count);
+
+    struct Bitfield * results = bitfield_new(piece_count, 0, 0x00);
+    assert_int_equal(torrent_data_validate_pieces(td, piece_infos, pieces, piece_count, 3, results), EXIT_SUCCESS);
+    for (int i = 0; i < piece_count; i++) {
+        assert_int_equal(bitfield_get_bit(results, i), 1);
+    }
+
+    data[(9 * piece_size) + 5] ^= 0xFF;
+    assert_int_equal(torrent_data_validate_pieces(td, piece_infos, pieces, piece_count, 2, results), EXIT_FAILURE);
+    for (int i = 0; i < piece_count; i++) {
+        assert_int_equal(bitfield_get_bit(results, i), i != 9);
+    }
+
+    bitfield_free(results);
+    torrent_data_free(td);
+    free(hashes);
+    free(data);
+}
+
+// test the least recently written piece is spilled to disk once the piece memory is used up, and reloaded for hashing
+static void test_torrent_data_cache_spill(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_a");
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    uint8_t * data = malloc(piece_size * 2);
+    for (size_t i = 0; i < piece_size * 2; i++) {
+        data[i] = (uint8_t) (i * 7);
+    }
+
+    char hashes[40];
+    for (int i = 0; i < 2; i++) {
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, data + (i * piece_size), piece_size);
+        SHA1Final((unsigned char *) &hashes[i * 20], &sha);
+    }
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", piece_size * 2);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_piece_memory(td, piece_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hashes, sizeof(hashes));
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 2), EXIT_SUCCESS);
+    assert_int_equal(td->pieces->buffer_count, 1);
+
+    // peers aren't held back while the only buffer is in use
+    struct Bitfield * interested = bitfield_new(td->chunk_count, 1, 0x00);
+    int chunks[16];
+    assert_int_equal(torrent_data_claim_chunk(td, interested, 10, 16, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[15], 15);
+    bitfield_free(interested);
+
+    // half of piece 0 arrives, then piece 1 starts and takes it's buffer
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), EXIT_FAILURE);
+    }
+    assert_int_equal(torrent_data_write_chunk(td, 8, data + (8 * chunk_size), chunk_size), EXIT_FAILURE);
+    assert_int_equal(bitfield_get_bit(td->spilled, 0), 1);
+    assert_null(piece_pool_get(td->pieces, 0));
+    assert_non_null(piece_pool_get(td->pieces, 1));
+
+    // the rest of piece 0 goes straight to disk, and it's read back to be validated
+    for (int i = 4; i < 8; i++) {
+        int expected = i == 7 ? EXIT_SUCCESS : EXIT_FAILURE;
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), expected);
+    }
+    assert_int_equal(bitfield_get_bit(td->spilled, 0), 0);
+
+    for (int i = 9; i < 16; i++) {
+        int expected = i == 15 ? EXIT_SUCCESS : EXIT_FAILURE;
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), expected);
+    }
+    assert_int_equal(td->completed_pieces, 2);
+    assert_int_equal(td->pieces->in_flight, 0);
+
+    struct TorrentDataCacheStats stats;
+    torrent_data_get_cache_stats(td, &stats);
+    assert_int_equal(stats.hits, 3 + 7);
+    assert_int_equal(stats.misses, 1 + 1 + 4);
+    assert_int_equal(stats.spills, 1);
+    assert_int_equal(stats.reloads, 1);
+
+    uint8_t * read_back = malloc(piece_size * 2);
+    assert_int_equal(torrent_data_read_data(td, read_back, 0, piece_size * 2), EXIT_SUCCESS);
+    assert_memory_equal(read_back, data, piece_size * 2);
+
+    torrent_data_free(td);
+    free(read_back);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_a");
+}
+
+static int test_torrent_data_wait_verified(struct TorrentData * td) {
+    for (int i = 0; i < 500 && queue_get_count(td->verified_queue) == 0; i++) {
+        usleep(10000);
+    }
+    return queue_get_count(td->verified_queue);
+}
+
+// test completed pieces are verified by a hasher and only reported complete once the main thread applies the result
+static void test_torrent_data_verify_pipeline(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_a");
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    uint8_t * data = malloc(piece_size * 2);
+    for (size_t i = 0; i < piece_size * 2; i++) {
+        data[i] = (uint8_t) (i * 3);
+    }
+
+    char hashes[40];
+    for (int i = 0; i < 2; i++) {
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, data + (i * piece_size), piece_size);
+        SHA1Final((unsigned char *) &hashes[i * 20], &sha);
+    }
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", piece_size * 2);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hashes, sizeof(hashes));
+    torrent_data_set_verify_pipeline(td, 1);
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 2), EXIT_SUCCESS);
+
+    struct ThreadPool * tp = thread_pool_new(1);
+    struct JobArg args[1] = {
+            {
+                    .arg = (void *) td,
+                    .mutex = NULL
+            }
+    };
+    thread_pool_add_job(tp, job_new(&torrent_data_verify_run, 1, args));
+
+    // piece 0 is queued, not completed by the write
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), EXIT_FAILURE);
+    }
+    assert_int_equal(test_torrent_data_wait_verified(td), 1);
+    assert_int_equal(torrent_data_is_piece_complete(td, 0), 0);
+    assert_int_equal(td->completed_pieces, 0);
+
+    int piece_id = -1;
+    assert_int_equal(torrent_data_process_verified_piece(td, &piece_id), EXIT_SUCCESS);
+    assert_int_equal(piece_id, 0);
+    assert_int_equal(torrent_data_is_piece_complete(td, 0), 1);
+    assert_int_equal(td->completed_pieces, 1);
+    assert_null(piece_pool_get(td->pieces, 0));
+
+    // a corrupted piece 1 is handed back to be downloaded again
+    uint8_t * bad_chunk = malloc(chunk_size);
+    memcpy(bad_chunk, data + (8 * chunk_size), chunk_size);
+    bad_chunk[0] ^= 0xFF;
+    assert_int_equal(torrent_data_write_chunk(td, 8, bad_chunk, chunk_size), EXIT_FAILURE);
+    for (int i = 9; i < 16; i++) {
+        // the main thread leaves all of the hashing to the hasher
+        assert_null(td->piece_hashes[1]);
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), EXIT_FAILURE);
+    }
+    assert_int_equal(test_torrent_data_wait_verified(td), 1);
+    assert_int_equal(torrent_data_process_verified_piece(td, &piece_id), EXIT_FAILURE);
+    assert_int_equal(torrent_data_is_piece_complete(td, 1), 0);
+    for (int i = 8; i < 16; i++) {
+        assert_int_equal(bitfield_get_bit(td->completed, i), 0);
+    }
+    assert_int_equal(td->left, piece_size);
+
+    // nothing left to process
+    assert_int_equal(torrent_data_process_verified_piece(td, &piece_id), EXIT_FAILURE);
+
+    thread_pool_free(tp);
+
+    uint8_t * read_back = malloc(piece_size);
+    assert_int_equal(torrent_data_read_data(td, read_back, 0, piece_size), EXIT_SUCCESS);
+    assert_memory_equal(read_back, data, piece_size);
+
+    torrent_data_free(td);
+    free(read_back);
+    free(bad_chunk);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_a");
+}
+
+// test pieces queued together are hashed whole in one batch, and each result lands on the right piece
+static void test_torrent_data_verify_batch(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_a");
+
+    // four full pieces and a last one with a short last chunk, piece 2 is corrupted
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    size_t data_size = piece_size * 5 - 1000;
+    int chunk_count = piece_size * 5 / chunk_size;
+    uint8_t * data = malloc(data_size);
+    for (size_t i = 0; i < data_size; i++) {
+        data[i] = (uint8_t) (i * 7);
+    }
+
+    char hashes[100];
+    for (int i = 0; i < 5; i++) {
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, data + (i * piece_size), i < 4 ? piece_size : piece_size - 1000);
+        SHA1Final((unsigned char *) &hashes[i * 20], &sha);
+    }
+    data[piece_size * 2] ^= 0xFF;
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_a", data_size);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hashes, sizeof(hashes));
+    torrent_data_set_verify_pipeline(td, 1);
+    assert_int_equal(torrent_data_set_data_size(td, data_size), EXIT_SUCCESS);
+
+    // every piece is queued before the hasher starts, so it takes them all at once
+    for (int i = 0; i < chunk_count; i++) {
+        size_t length = i < chunk_count - 1 ? chunk_size : chunk_size - 1000;
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), length), EXIT_FAILURE);
+    }
+    for (int i = 0; i < 5; i++) {
+        assert_null(td->piece_hashes[i]);
+    }
+
+    struct ThreadPool * tp = thread_pool_new(1);
+    struct JobArg args[1] = {
+            {
+                    .arg = (void *) td,
+                    .mutex = NULL
+            }
+    };
+    thread_pool_add_job(tp, job_new(&torrent_data_verify_run, 1, args));
+
+    for (int i = 0; i < 500 && queue_get_count(td->verified_queue) < 5; i++) {
+        usleep(10000);
+    }
+    assert_int_equal(queue_get_count(td->verified_queue), 5);
+
+    int valid = 0;
+    int piece_id = -1;
+    for (int i = 0; i < 5; i++) {
+        valid += torrent_data_process_verified_piece(td, &piece_id) == EXIT_SUCCESS;
+    }
+    assert_int_equal(valid, 4);
+    for (int i = 0; i < 5; i++) {
+        assert_int_equal(torrent_data_is_piece_complete(td, i), i != 2);
+    }
+    assert_int_equal(td->left, piece_size);
+
+    thread_pool_free(tp);
+    torrent_data_free(td);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_a");
+}
+
+// test pieces in the streaming window go to fast peers, and are requested twice once they're close to their deadline
+static void test_torrent_data_stream_deadlines(void **state) {
+    (void) state;
+
+    unlink("/tmp/uvgtorrent_test_stream");
+
+    size_t chunk_size = 16384;
+    size_t piece_size = chunk_size * 8;
+    uint8_t * data = malloc(piece_size * 4);
+    for (size_t i = 0; i < piece_size * 4; i++) {
+        data[i] = (uint8_t) (i * 3);
+    }
+
+    char hashes[80];
+    for (int i = 0; i < 4; i++) {
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, data + (i * piece_size), piece_size);
+        SHA1Final((unsigned char *) &hashes[i * 20], &sha);
+    }
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_stream", piece_size * 4);
+    torrent_data_set_piece_size(td, piece_size);
+    torrent_data_set_chunk_size(td, chunk_size);
+    torrent_data_set_sha1_hashes(td, (char *) &hashes, sizeof(hashes));
+    torrent_data_set_stream(td, 2, 10000);
+    assert_int_equal(torrent_data_set_data_size(td, piece_size * 4), EXIT_SUCCESS);
+
+    struct Bitfield * seeder = bitfield_new(4, 1, 0x00);
+    struct Bitfield * requested = bitfield_new(td->chunk_count, 0, 0x00);
+    torrent_data_add_peer_pieces(td, seeder);
+    torrent_data_update_stream(td);
+    assert_true(td->stream_deadlines[0] > 0);
+    assert_true(td->stream_deadlines[1] > td->stream_deadlines[0]);
+    assert_int_equal(td->stream_deadlines[2], 0);
+
+    // slow peers are kept out of the window, fast ones get it in order
+    int chunks[8];
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, NULL, 0, 10, 8, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 16);
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested, 1, 10, 8, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 0);
+    for (int i = 0; i < 8; i++) {
+        bitfield_set_bit(requested, chunks[i], 1);
+    }
+
+    // once piece 0 is about due, another fast peer requests it's chunks again
+    td->stream_deadlines[0] = now() - 1;
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, NULL, 1, 10, 4, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 0);
+    assert_int_equal(chunks[3], 3);
+
+    // but never from the peer that has them already, and slow peers don't duplicate
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, requested, 1, 10, 1, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 8);
+    assert_int_equal(torrent_data_claim_piece_chunks(td, seeder, NULL, 0, 10, 1, &chunks[0]), EXIT_SUCCESS);
+    assert_int_equal(chunks[0], 24);
+
+    // the time it took piece 0 to arrive is counted
+    for (int i = 0; i < 8; i++) {
+        int expected = i == 7 ? EXIT_SUCCESS : EXIT_FAILURE;
+        assert_int_equal(torrent_data_write_chunk(td, i, data + (i * chunk_size), chunk_size), expected);
+    }
+    struct TorrentDataStreamStats stats;
+    torrent_data_get_stream_stats(td, &stats);
+    assert_int_equal(stats.pieces, 1);
+    assert_int_equal(stats.late, 1);
+    assert_int_equal(stats.duplicates, 4);
+
+    // seeking moves the window, pieces left behind lose their deadlines
+    torrent_data_set_stream_position(td, piece_size * 3);
+    assert_int_equal(td->stream_begin, 3);
+    assert_int_equal(td->stream_deadlines[1], 0);
+    assert_true(td->stream_deadlines[3] > 0);
+
+    bitfield_free(seeder);
+    bitfield_free(requested);
+    torrent_data_free(td);
+    free(data);
+
+    unlink("/tmp/uvgtorrent_test_stream");
+}
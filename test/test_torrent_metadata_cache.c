@@ -0,0 +1,57 @@
+#include "torrent/torrent_metadata_cache.h"
+#include "sha1/sha1.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// test info dicts are cached by info hash, and only come back out if they still match it
+static void test_torrent_metadata_cache_save_load(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    setenv("XDG_CACHE_HOME", "/tmp/uvgtorrent_test_cache", 1);
+    char * cache_dir = torrent_metadata_cache_dir();
+    assert_string_equal(cache_dir, "/tmp/uvgtorrent_test_cache/uvgtorrent/metadata");
+
+    uint8_t info[] = "d6:lengthi1024e4:name4:test12:piece lengthi16384e6:pieces20:aaaaaaaaaaaaaaaaaaaae";
+    size_t info_len = sizeof(info) - 1;
+    uint8_t info_hash[20];
+    SHA1_CTX sha;
+    SHA1Init(&sha);
+    SHA1Update(&sha, info, info_len);
+    SHA1Final(info_hash, &sha);
+
+    uint8_t * cached_info = NULL;
+    size_t cached_info_len = 0;
+    assert_int_equal(torrent_metadata_cache_load(cache_dir, info_hash, &cached_info, &cached_info_len), EXIT_FAILURE);
+
+    // metadata that doesn't hash to the info hash is rejected
+    uint8_t other_hash[20] = {0x00};
+    assert_int_equal(torrent_metadata_cache_is_valid(other_hash, info, info_len), 0);
+    assert_int_equal(torrent_metadata_cache_is_valid(info_hash, info, info_len), 1);
+
+    assert_int_equal(torrent_metadata_cache_save(cache_dir, info_hash, info, info_len), EXIT_SUCCESS);
+    assert_int_equal(torrent_metadata_cache_load(cache_dir, info_hash, &cached_info, &cached_info_len), EXIT_SUCCESS);
+    assert_int_equal(cached_info_len, info_len);
+    assert_memory_equal(cached_info, info, info_len);
+    free(cached_info);
+
+    // a cache file that was tampered with is ignored
+    char path[256];
+    snprintf(path, sizeof(path), "%s/", cache_dir);
+    for (int i = 0; i < 20; i++) {
+        sprintf(path + strlen(path), "%02x", info_hash[i]);
+    }
+    strcat(path, ".info");
+    FILE * fp = fopen(path, "r+b");
+    fputc('x', fp);
+    fclose(fp);
+    cached_info = NULL;
+    assert_int_equal(torrent_metadata_cache_load(cache_dir, info_hash, &cached_info, &cached_info_len), EXIT_FAILURE);
+    assert_null(cached_info);
+
+    unlink(path);
+    free(cache_dir);
+    unsetenv("XDG_CACHE_HOME");
+}
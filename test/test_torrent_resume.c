@@ -0,0 +1,150 @@
+#include "torrent/torrent_data.h"
+#include "torrent/torrent_resume.h"
+#include "sha1/sha1.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_RESUME_CHUNK_SIZE 16384
+#define TEST_RESUME_PIECE_SIZE (TEST_RESUME_CHUNK_SIZE * 8)
+#define TEST_RESUME_PIECE_COUNT 4
+
+static uint8_t test_resume_info_hash[20] = {0x01, 0x02, 0x03};
+static uint8_t test_resume_info[] = "d4:name4:test12:piece lengthi131072ee";
+
+/**
+ * @brief fill data with the contents of the test torrent and hashes with the hash of each piece
+ */
+static void test_resume_make_data(uint8_t * data, char * hashes) {
+    for (size_t i = 0; i < TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT; i++) {
+        data[i] = (uint8_t) (i * 11);
+    }
+    for (int i = 0; i < TEST_RESUME_PIECE_COUNT; i++) {
+        SHA1_CTX sha;
+        SHA1Init(&sha);
+        SHA1Update(&sha, data + (i * TEST_RESUME_PIECE_SIZE), TEST_RESUME_PIECE_SIZE);
+        SHA1Final((unsigned char *) hashes + (i * 20), &sha);
+    }
+}
+
+static struct TorrentData * test_resume_new_data(char * hashes) {
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_resume", TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    torrent_data_set_piece_size(td, TEST_RESUME_PIECE_SIZE);
+    torrent_data_set_chunk_size(td, TEST_RESUME_CHUNK_SIZE);
+    torrent_data_set_sha1_hashes(td, hashes, 20 * TEST_RESUME_PIECE_COUNT);
+    torrent_data_set_data_size(td, TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    return td;
+}
+
+// test validated pieces survive a restart, and aren't trusted once the files change
+static void test_torrent_resume_save_load(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    unlink("/tmp/uvgtorrent_test_resume");
+    char * resume_path = torrent_resume_path("/tmp", test_resume_info_hash);
+    assert_non_null(resume_path);
+    unlink(resume_path);
+
+    uint8_t * data = malloc(TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    char hashes[20 * TEST_RESUME_PIECE_COUNT];
+    test_resume_make_data(data, hashes);
+
+    // download pieces 0 and 2
+    struct TorrentData * td = test_resume_new_data(hashes);
+    for (int piece = 0; piece < TEST_RESUME_PIECE_COUNT; piece += 2) {
+        for (int chunk = piece * 8; chunk < (piece + 1) * 8; chunk++) {
+            torrent_data_write_chunk(td, chunk, data + (chunk * TEST_RESUME_CHUNK_SIZE), TEST_RESUME_CHUNK_SIZE);
+        }
+    }
+    assert_int_equal(td->completed_pieces, 2);
+    // a periodic save, that doesn't wait for the data to reach the disk
+    assert_int_equal(torrent_resume_save(resume_path, td, test_resume_info_hash, test_resume_info, sizeof(test_resume_info), 0), EXIT_SUCCESS);
+    torrent_data_free(td);
+
+    // a restart picks them up without downloading them again
+    td = test_resume_new_data(hashes);
+    assert_int_equal(torrent_resume_load(resume_path, td, test_resume_info_hash, test_resume_info, sizeof(test_resume_info)), EXIT_SUCCESS);
+    assert_int_equal(td->completed_pieces, 2);
+    assert_int_equal(torrent_data_is_piece_complete(td, 0), 1);
+    assert_int_equal(torrent_data_is_piece_complete(td, 1), 0);
+    assert_int_equal(torrent_data_is_piece_complete(td, 2), 1);
+    assert_int_equal(bitfield_get_bit(td->completed, 16), 1);
+    assert_int_equal(bitfield_get_bit(td->claimed, 16), 1);
+    assert_int_equal(bitfield_get_bit(td->claimed, 8), 0);
+    assert_int_equal(td->left, TEST_RESUME_PIECE_SIZE * 2);
+    torrent_data_free(td);
+
+    // a different info dict doesn't match
+    td = test_resume_new_data(hashes);
+    assert_int_equal(torrent_resume_load(resume_path, td, test_resume_info_hash, (uint8_t *) "d4:name5:otheree", 17), EXIT_FAILURE);
+    assert_int_equal(td->completed_pieces, 0);
+    torrent_data_free(td);
+
+    // neither does a file that was modified after saving
+    struct timespec times[2] = {{.tv_sec = 1, .tv_nsec = 0}, {.tv_sec = 1, .tv_nsec = 0}};
+    assert_int_equal(utimensat(AT_FDCWD, "/tmp/uvgtorrent_test_resume", times, 0), 0);
+    td = test_resume_new_data(hashes);
+    assert_int_equal(torrent_resume_load(resume_path, td, test_resume_info_hash, test_resume_info, sizeof(test_resume_info)), EXIT_FAILURE);
+    assert_int_equal(td->completed_pieces, 0);
+
+    // but a recheck finds the valid pieces
+    assert_int_equal(torrent_data_recheck(td, 2), 2);
+    assert_int_equal(torrent_data_is_piece_complete(td, 0), 1);
+    assert_int_equal(torrent_data_is_piece_complete(td, 1), 0);
+    assert_int_equal(torrent_data_is_piece_complete(td, 2), 1);
+    assert_int_equal(torrent_data_is_piece_complete(td, 3), 0);
+    torrent_data_free(td);
+
+    unlink(resume_path);
+    unlink("/tmp/uvgtorrent_test_resume");
+    free(resume_path);
+    free(data);
+}
+
+// test a recheck of a fully downloaded file with a corrupt piece
+static void test_torrent_data_recheck(void **state) {
+    (void) state;
+
+    RESET_MOCKS();
+
+    uint8_t * data = malloc(TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    char hashes[20 * TEST_RESUME_PIECE_COUNT];
+    test_resume_make_data(data, hashes);
+    data[TEST_RESUME_PIECE_SIZE + 100] ^= 0xFF;
+
+    FILE * fp = fopen("/tmp/uvgtorrent_test_resume", "wb");
+    fwrite(data, 1, TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT, fp);
+    fclose(fp);
+
+    struct TorrentData * td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_resume", TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    assert_int_equal(torrent_data_has_existing_files(td), 1);
+    torrent_data_free(td);
+
+    td = test_resume_new_data(hashes);
+    assert_int_equal(torrent_data_recheck(td, 3), 3);
+    assert_int_equal(td->completed_pieces, 3);
+    assert_int_equal(torrent_data_is_piece_complete(td, 1), 0);
+    assert_int_equal(bitfield_get_bit(td->claimed, 8), 0);
+    assert_int_equal(bitfield_get_bit(td->claimed, 0), 1);
+    torrent_data_free(td);
+
+    // a budget of less than one piece still rechecks, one piece at a time
+    td = torrent_data_new("/tmp/");
+    torrent_data_add_file(td, "uvgtorrent_test_resume", TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    torrent_data_set_piece_size(td, TEST_RESUME_PIECE_SIZE);
+    torrent_data_set_chunk_size(td, TEST_RESUME_CHUNK_SIZE);
+    torrent_data_set_sha1_hashes(td, hashes, 20 * TEST_RESUME_PIECE_COUNT);
+    torrent_data_set_piece_memory(td, TEST_RESUME_PIECE_SIZE / 2);
+    torrent_data_set_data_size(td, TEST_RESUME_PIECE_SIZE * TEST_RESUME_PIECE_COUNT);
+    assert_int_equal(torrent_data_recheck(td, 3), 3);
+    assert_int_equal(torrent_data_is_piece_complete(td, 1), 0);
+    torrent_data_free(td);
+
+    unlink("/tmp/uvgtorrent_test_resume");
+    free(data);
+}